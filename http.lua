@@ -7,6 +7,9 @@ local BUFFER_SIZE = 4096
 
 local http = {}
 
+-- Idle connections of http.request(), reused for further requests to the same host
+http.pool = multisocket.pool()
+
 local CRLF = '\r\n'
 
 local obj = {}
@@ -89,12 +92,20 @@ http.codes = {
 }
 
 
-local function export(fields)
-    local str = ""
+local function export(fields, parts)
     for index,data in pairs(fields) do
-        str = str..tostring(index)..": "..tostring(data)..CRLF
+        parts[#parts + 1] = tostring(index)..": "..tostring(data)..CRLF
+    end
+    parts[#parts + 1] = CRLF
+    return parts
+end
+
+local function size(parts)
+    local len = 0
+    for _,str in ipairs(parts) do
+        len = len + #str
     end
-    return str
+    return len
 end
 
 local function urlEncode(str)
@@ -181,25 +192,19 @@ function req:request(method, path, body)
     cookie = cookie:sub(1,-3)
     self:setField("Cookie", cookie)
 
-    local str = self.req.method.." "..self.req.path.." HTTP/"..self.req.version..CRLF..export(self.req.fields)..CRLF
-    local sent, err = self:send(str)
-    if sent ~= #str then
+    local parts = export(self.req.fields, {self.req.method.." "..self.req.path.." HTTP/"..self.req.version..CRLF})
+    if type(body) == "string" then
+        parts[#parts + 1] = body
+    end
+    local sent, err = self:send(parts)
+    if sent ~= size(parts) then
         return nil, err
     end
 
-    if type(body) == "string" then
-        local sent, err = self:send(body)
-        if not sent then
-             return nil, err
-        end
-    elseif type(body) == "userdata" then
-        while true do
-            local sent, err = self:send(body:read(4096))
-            if not sent then
-                return nil, err
-            elseif sent == 0 then
-                break
-            end
+    if type(body) == "userdata" then
+        local sent, err = self.socket:sendFile(body, 0, len)
+        if sent ~= len then
+            return nil, err or "file ended before Content-Length"
         end
     end
 
@@ -256,7 +261,16 @@ function req:request(method, path, body)
                 return nil, err
             end
             len = tonumber(len,16)
-            if not len or len == 0 then
+            if not len then
+                break
+            elseif len == 0 then
+                -- The last chunk is followed by optional trailer fields and an empty line
+                repeat
+                    local line, err = self:receiveLine()
+                    if not line then
+                        return nil, err
+                    end
+                until line == ""
                 break
             end
             local buffer, err = self:receive(len)
@@ -346,25 +360,29 @@ function res:respond(statuscode, body, statustext, length)
     local isFile = false
     local sent = 0
     local isPart = false
-    local range = self.req.fields["Range"] or "" -- TODO FIX
-    local startb, endb
-    --print(range,range:match("^bytes="))
-    if range:match("^bytes=") then
-        startb, endb = range:match("^bytes=(%d+)-(%d+)?")
-        startb = tonumber(startb)
-        endb = tonumber(endb)
-        --print(startb,endb)
-        if startb then
-            isPart = true
-        end
-    end
+    local count
+    local range = self.req.fields["Range"] or ""
+    local startb, endb = range:match("^bytes=(%d+)-(%d*)$")
+    startb = tonumber(startb)
+    endb = tonumber(endb)
     if type(body) == "userdata" then
-        self.res.fields["Transfer-Encoding"] = "chunked"
         isFile = true
-        len = body:seek("end",0)
-        self.res.fields["Content-Range"] = "bytes "..(startb or 0).."-"..(endb or len - 1).."/"..len
-        body:seek("set",startb or 0)
-        len = endb and (endb - startb + 1) or len
+        local filesize = body:seek("end", 0)
+        if startb and statuscode == 200 then
+            if startb >= filesize or (endb and endb < startb) then
+                self.res.fields["Content-Range"] = "bytes */"..filesize
+                statuscode = 416
+                body = ""
+                isFile = false
+            else
+                isPart = true
+                endb = math.min(endb or filesize - 1, filesize - 1)
+                self.res.fields["Content-Range"] = "bytes "..startb.."-"..endb.."/"..filesize
+            end
+        end
+        startb = isPart and startb or 0
+        count = isFile and (isPart and endb - startb + 1 or filesize) or 0
+        len = count
     elseif body then
         body = tostring(body)
         len = #body
@@ -379,38 +397,29 @@ function res:respond(statuscode, body, statustext, length)
         len = nil
     end
 
-    self.res.statuscode = statuscode == 200 and isPart and 206 or statuscode
-    self.res.statustext = statustext or http.codes[statuscode].name
+    self.res.statuscode = isPart and 206 or statuscode
+    self.res.statustext = statustext or http.codes[self.res.statuscode].name
     self.res.version = "1.1"
     self.res.fields["Content-Length"] = len
     self.res.fields["Accept-Ranges"] = "bytes"
 
-    local str = "HTTP/"..self.res.version.." "..self.res.statuscode.." "..self.res.statustext..CRLF..export(self.res.fields)..CRLF
-    local s, err = self:send(str)
-    if s ~= #str then
+    local parts = export(self.res.fields, {"HTTP/"..self.res.version.." "..self.res.statuscode.." "..self.res.statustext..CRLF})
+    if not isFile then
+        parts[#parts + 1] = body
+    end
+    local s, err = self:send(parts)
+    if s ~= size(parts) then
         return nil, err
     end
 
     if not isFile then
-        local s, err = self:send(body)
-        if s ~= #body then
-            return nil, err
-        end
         sent = #body
     else
-        --self.socket:setTimeout(0)
-        while true do
-            local buffer = body:read(BUFFER_SIZE) -- body:read(sent+BUFFER_SIZE < len and BUFFER_SIZE or len-sent)
-            if not buffer or #buffer == 0 then
-                self:send("0\r\n\r\n")
-                break
-            end
-            sent = sent + #buffer
-            local success, err = self:send(string.format("%X\r\n%s\r\n", #buffer, buffer))
-            if not success then
-                return nil, err
-            end
+        local s, err = self.socket:sendFile(body, startb, count)
+        if s ~= count then
+            return nil, err or "file ended before Content-Length"
         end
+        sent = s
     end
 
     return self
@@ -573,11 +582,15 @@ function http.request(method, url, fields, body)
         return nil, "scheme not supported"
     end
 
-    local sock, err = multisocket.open(host, (scheme == "https" and 443 or 80), (scheme == "https"))
+    -- Only idempotent requests without a body go as TLS 1.3 early data, those can be replayed safely
+    local earlyData = scheme == "https" and (method == "GET" or method == "HEAD") and body == nil
+    local sock, err = http.pool:get(host, (scheme == "https" and 443 or 80), (scheme == "https"), true, nil, earlyData)
     if not sock then
         return nil, err
     end
     sock:setTimeout(4)
+    -- Requests are written at once, Nagle would only delay them
+    sock:setOption("noDelay", true)
     local sock, err = http.wrap(sock, {fields = fields, host = host})
     if fields then
         sock.req.cookies = fields.cookies or sock.req.cookies
@@ -592,7 +605,14 @@ function http.request(method, url, fields, body)
     local sockport = sock.socket:getSocketPort()
     local peeraddr = sock.socket:getPeerAddress()
     local sockaddr = sock.socket:getSocketAddress()
-    sock:close()
+    -- Only a completely received response leaves the connection ready for the next request
+    local fields = sock.res.fields
+    if succ and sock.res.version == "1.1" and tostring(fields.connection or ""):lower() ~= "close"
+            and (fields.contentlength or fields.transferencoding == "chunked") then
+        http.pool:put(sock.socket)
+    else
+        sock:close()
+    end
     sock.socket = nil
     sock.peerPort = peerport
     sock.socketPort = sockport
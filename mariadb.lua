@@ -253,7 +253,7 @@ end
 function connection:sendPacket(data)
     while true do
         local len = math.min(#data, 0xFFFFF)
-        local succ, err = self.socket:send(num2str(len, 3) .. num2str(self.seq, 1) .. data:sub(1, len))
+        local succ, err = self.socket:send(num2str(len, 3), num2str(self.seq, 1), len == #data and data or data:sub(1, len))
         if not succ then
             return nil, err
         end
@@ -662,6 +662,8 @@ function mariadb.connect(address, port, schema, username, password)
     end
 
     socket:setTimeout(10)
+    -- Every query is a single small packet waiting for its response
+    socket:setOption("noDelay", true)
     local conn = setmetatable({
         socket = socket,
         flags = {},
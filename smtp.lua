@@ -13,8 +13,8 @@ end
 
 local mtConnection = {
     __index = {
-        send = function(self, str)
-            return self.socket:send(str)
+        send = function(self, ...)
+            return self.socket:send(...)
         end,
         receive = function(self)
             local respond = {}
@@ -36,7 +36,7 @@ local mtConnection = {
             return respond
         end,
         command = function(self, str)
-            local succ, err = self:send(str.."\r\n")
+            local succ, err = self:send(str, "\r\n")
             if not succ then
                 return nil, err
             end
@@ -0,0 +1,131 @@
+/**
+ * Reserve space for at least size bytes behind the buffered data
+ * Moves the buffered data to the front or grows the buffer if necessary
+ * @param sock the socket
+ * @param size number of bytes which have to fit into the buffer
+ * @return 0 = success, -1 = out of memory
+ */
+static int multi_buffer_reserve(Multisocket *sock, size_t size) {
+    if (sock->rbufCap - sock->rbufPos - sock->rbufLen >= size) {
+        return 0;
+    }
+
+    if (sock->rbufCap - sock->rbufLen >= size) {
+        memmove(sock->rbuf, sock->rbuf + sock->rbufPos, sock->rbufLen);
+        sock->rbufPos = 0;
+        return 0;
+    }
+
+    size_t cap = (sock->rbufCap == 0) ? MULTISOCKET_READ_BUFFER_SIZE : sock->rbufCap * 2;
+    while (cap < sock->rbufLen + size) {
+        cap *= 2;
+    }
+    char *buf = (char *) malloc(cap);
+    if (buf == NULL) {
+        return -1;
+    }
+    if (sock->rbuf != NULL) {
+        memcpy(buf, sock->rbuf + sock->rbufPos, sock->rbufLen);
+        free(sock->rbuf);
+    }
+    sock->rbuf = buf;
+    sock->rbufCap = cap;
+    sock->rbufPos = 0;
+    return 0;
+}
+
+/**
+ * Remove bytes from the front of the buffer
+ * The rest of the data has not been tried by a read yet and counts as pending.
+ * A buffer which has grown beyond its default size is released as soon as it is empty
+ * @param sock the socket
+ * @param size number of bytes to remove
+ */
+static void multi_buffer_consume(Multisocket *sock, size_t size) {
+    sock->rbufPos += size;
+    sock->rbufLen -= size;
+    sock->rbufNew = 1;
+    if (sock->rbufLen == 0) {
+        sock->rbufPos = 0;
+        if (sock->rbufCap > MULTISOCKET_READ_BUFFER_SIZE) {
+            free(sock->rbuf);
+            sock->rbuf = NULL;
+            sock->rbufCap = 0;
+        }
+    }
+}
+
+/**
+ * Release the buffer of the socket
+ * @param sock the socket
+ */
+static void multi_buffer_free(Multisocket *sock) {
+    free(sock->rbuf);
+    sock->rbuf = NULL;
+    sock->rbufCap = 0;
+    sock->rbufPos = 0;
+    sock->rbufLen = 0;
+}
+
+/**
+ * Read as many bytes as possible with a single recv() or SSL_read() into the buffer
+ * @param sock the socket
+ * @param size number of bytes the caller waits for, at most MULTISOCKET_READ_RESERVE_MAX of them are reserved
+ * @return number of bytes read, 0 = connection closed, < 0 = error (see multi_buffer_error())
+ */
+static long multi_buffer_fill(Multisocket *sock, size_t size) {
+    // A large or peer-supplied length is not allocated up front, the next fill grows the buffer if it is full
+    if (size < MULTISOCKET_READ_BUFFER_SIZE) {
+        size = MULTISOCKET_READ_BUFFER_SIZE;
+    } else if (size > MULTISOCKET_READ_RESERVE_MAX) {
+        size = MULTISOCKET_READ_RESERVE_MAX;
+    }
+    if (multi_buffer_reserve(sock, size) != 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    char *end = sock->rbuf + sock->rbufPos + sock->rbufLen;
+    size_t space = sock->rbufCap - sock->rbufPos - sock->rbufLen;
+
+    long ret;
+    if (sock->enc) {
+        ret = multi_tls_read(sock, end, (space > 0x7FFFFFFF) ? 0x7FFFFFFF : (int) space);
+    } else {
+        ret = recv(sock->socket, end, space, 0);
+    }
+
+    if (ret > 0) {
+        sock->rbufLen += ret;
+        sock->rbufNew = 1;
+        sock->recB += ret;
+        multi_metrics_count(MULTISOCKET_METRIC_RECEIVED, ret);
+        sock->lastT = multi_clock_now();
+    } else {
+        // The buffered data did not satisfy the read, it is pending again as soon as more data arrives
+        sock->rbufNew = 0;
+    }
+    return ret;
+}
+
+/**
+ * Push the error of a failed multi_buffer_fill() onto the Lua stack
+ * @param L the Lua state
+ * @param sock the socket
+ * @param ret the return value of multi_buffer_fill()
+ */
+static void multi_buffer_error(lua_State *L, Multisocket *sock, long ret) {
+    if (ret == 0) {
+        lua_pushstring(L, "closed");
+    } else if (errno == ETIMEDOUT) {
+        lua_pushstring(L, "timeout");
+    } else if (sock->enc && errno != ENOMEM) {
+        lua_pushstring(L, multi_ssl_get_error(sock->ssl, (int) ret));
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        lua_pushstring(L, "timeout");
+    } else if (errno == ECONNRESET) {
+        lua_pushstring(L, "closed");
+    } else {
+        lua_pushstring(L, strerror(errno));
+    }
+}
@@ -0,0 +1,77 @@
+/**
+ * Clocks of the library, all times are in nanoseconds
+ * Internal times (connection signals, deadlines, timers, cache expiry) are CLOCK_MONOTONIC,
+ * so durations never go negative when the wall clock is stepped. Only times passed to Lua are UNIX-times.
+ */
+
+#ifndef CLOCK_MONOTONIC_COARSE
+#define CLOCK_MONOTONIC_COARSE CLOCK_MONOTONIC
+#endif
+
+/**
+ * Time cached by the loop which is running in this thread, 0 = no loop is running
+ */
+static __thread long multi_clock_cached = 0;
+
+/**
+ * Read a clock
+ * @param clock the clock id
+ * @return the time in nanoseconds
+ */
+static long multi_clock_read(clockid_t clock) {
+    struct timespec tv;
+    clock_gettime(clock, &tv);
+    return tv.tv_sec * 1000000000L + tv.tv_nsec;
+}
+
+/**
+ * Returns the exact monotonic time, for measurements and deadlines
+ * @return monotonic time in nanoseconds
+ */
+static long multi_clock_monotonic() {
+    return multi_clock_read(CLOCK_MONOTONIC);
+}
+
+/**
+ * Returns the monotonic time for bookkeeping on the hot path (e.g. the last connection signal)
+ * Inside a scheduler step this is the time cached by the step, otherwise the coarse clock,
+ * which is only updated every tick of the kernel but does not need to read the clock source.
+ * It is never later than multi_clock_monotonic().
+ * @return monotonic time in nanoseconds
+ */
+static long multi_clock_now() {
+    return (multi_clock_cached != 0) ? multi_clock_cached : multi_clock_read(CLOCK_MONOTONIC_COARSE);
+}
+
+/**
+ * Cache the current time for the running loop iteration
+ * @return the cached monotonic time in nanoseconds
+ */
+static long multi_clock_update() {
+    multi_clock_cached = multi_clock_monotonic();
+    return multi_clock_cached;
+}
+
+/**
+ * Stop using the cached time, e.g. at the end of a loop iteration
+ */
+static void multi_clock_reset() {
+    multi_clock_cached = 0;
+}
+
+/**
+ * Returns the current UNIX-time
+ * @return UNIX-time in nanoseconds
+ */
+static long multi_clock_realtime() {
+    return multi_clock_read(CLOCK_REALTIME);
+}
+
+/**
+ * Convert a monotonic time into a UNIX-time
+ * @param time monotonic time in nanoseconds
+ * @return UNIX-time in nanoseconds
+ */
+static long multi_clock_to_unix(long time) {
+    return time + multi_clock_realtime() - multi_clock_monotonic();
+}
@@ -0,0 +1,243 @@
+/**
+ * Crypto threads: the TLS handshakes of contexts created with offload = true run in a fixed pool of threads
+ * A scheduler task queues every step of the handshake of its non-blocking socket and yields the job and "r",
+ * the scheduler waits for the eventfd of the job meanwhile and keeps running the established connections.
+ * When OpenSSL has to wait for the peer, the task waits for the socket in its own thread as before,
+ * so a crypto thread never blocks and the socket is handed back to its task after every step.
+ */
+typedef struct MultiCryptoJob {
+    struct MultiCryptoJob *next;
+    Multisocket *sock;
+
+    /**
+     * eventfd which becomes readable as soon as the step has run
+     */
+    int fd;
+    int refs;
+    int done;
+    long queuedT;
+
+    /**
+     * Result of multi_tls_handshake(), and the error message read in the crypto thread (NULL = none)
+     */
+    int ret;
+    const char *message;
+} MultiCryptoJob;
+
+/**
+ * The crypto threads of the process and their queue, shared by all Lua states and server workers
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    MultiCryptoJob *queue;
+    MultiCryptoJob *queueTail;
+    int threads;
+} multi_crypto = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+
+static const char* multi_ssl_get_error(SSL* ssl, int ret);
+
+/**
+ * Release a job, the last reference frees it
+ * The lock has to be held.
+ * @param job the job
+ */
+static void multi_crypto_unref(MultiCryptoJob *job) {
+    if (--job->refs == 0) {
+        close(job->fd);
+        free(job);
+    }
+}
+
+/**
+ * A crypto thread, runs handshake steps from the queue until the process ends
+ */
+static void *multi_crypto_thread(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&multi_crypto.lock);
+    while (1) {
+        while (multi_crypto.queue == NULL) {
+            pthread_cond_wait(&multi_crypto.cond, &multi_crypto.lock);
+        }
+        MultiCryptoJob *job = multi_crypto.queue;
+        multi_crypto.queue = job->next;
+        if (multi_crypto.queue == NULL) {
+            multi_crypto.queueTail = NULL;
+        }
+        pthread_mutex_unlock(&multi_crypto.lock);
+
+        multi_metrics_count(MULTISOCKET_METRIC_DEQUEUED, 1);
+        multi_metrics_latency(MULTISOCKET_METRIC_OFFLOAD, job->queuedT);
+
+        // The error queue of OpenSSL belongs to the thread, so the message has to be read here
+        int ret = multi_tls_handshake(job->sock);
+        const char *message = NULL;
+        if (ret != 1) {
+            int error = SSL_get_error(job->sock->ssl, ret);
+            if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) {
+                message = multi_ssl_get_error(job->sock->ssl, ret);
+            }
+        }
+        ERR_clear_error();
+
+        pthread_mutex_lock(&multi_crypto.lock);
+        job->ret = ret;
+        job->message = message;
+        job->done = 1;
+        uint64_t one = 1;
+        write(job->fd, &one, sizeof(one));
+        multi_crypto_unref(job);
+    }
+    return NULL;
+}
+
+/**
+ * Start the crypto threads, the first call starts all of them
+ * The lock has to be held.
+ * @return number of running threads
+ */
+static int multi_crypto_threads() {
+    if (multi_crypto.threads > 0) {
+        return multi_crypto.threads;
+    }
+    // The threads never end, so the library has to stay loaded after the Lua state has been closed
+    Dl_info info;
+    if (dladdr((void *) multi_crypto_thread, &info) != 0 && info.dli_fname != NULL) {
+        dlopen(info.dli_fname, RTLD_NOW | RTLD_NODELETE);
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (int i = 0; i < MULTISOCKET_CRYPTO_THREADS; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, multi_crypto_thread, NULL) == 0) {
+            multi_crypto.threads++;
+        }
+    }
+    pthread_attr_destroy(&attr);
+    return multi_crypto.threads;
+}
+
+/**
+ * Do the handshakes of the socket run in the crypto threads?
+ * Only steps of non-blocking sockets in a coroutine are offloaded, everything else runs in the calling thread.
+ * @param L the Lua state
+ * @param sock the socket
+ * @return 1 = offload, 0 = run in the calling thread
+ */
+static int multi_crypto_offloaded(lua_State *L, Multisocket *sock) {
+    return sock->nonblock && lua_isyieldable(L) && SSL_CTX_get_ex_data(sock->ctx, multi_tls_offload_index) != NULL;
+}
+
+/**
+ * Queue the next step of the handshake of a socket
+ * The socket must not be used until the step has run, see multi_crypto_finish().
+ * @param sock the socket
+ * @return the job, has to be released / NULL = error, the step has to run in the calling thread
+ */
+static MultiCryptoJob *multi_crypto_start(Multisocket *sock) {
+    MultiCryptoJob *job = calloc(1, sizeof(MultiCryptoJob));
+    if (job == NULL) {
+        return NULL;
+    } else if ((job->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1) {
+        free(job);
+        return NULL;
+    }
+    job->sock = sock;
+    job->refs = 2;
+    job->queuedT = multi_clock_monotonic();
+
+    pthread_mutex_lock(&multi_crypto.lock);
+    if (multi_crypto_threads() == 0) {
+        pthread_mutex_unlock(&multi_crypto.lock);
+        close(job->fd);
+        free(job);
+        return NULL;
+    }
+    if (multi_crypto.queueTail != NULL) {
+        multi_crypto.queueTail->next = job;
+    } else {
+        multi_crypto.queue = job;
+    }
+    multi_crypto.queueTail = job;
+    sock->job = job;
+    multi_metrics_count(MULTISOCKET_METRIC_OFFLOADED, 1);
+    pthread_cond_signal(&multi_crypto.cond);
+    pthread_mutex_unlock(&multi_crypto.lock);
+    return job;
+}
+
+/**
+ * Wait until the step of a job has run, the socket belongs to the calling thread again afterwards
+ * @param job the job
+ */
+static void multi_crypto_finish(MultiCryptoJob *job) {
+    struct pollfd fd = {job->fd, POLLIN, 0};
+    pthread_mutex_lock(&multi_crypto.lock);
+    while (!job->done) {
+        pthread_mutex_unlock(&multi_crypto.lock);
+        poll(&fd, 1, -1);
+        pthread_mutex_lock(&multi_crypto.lock);
+    }
+    job->sock->job = NULL;
+    pthread_mutex_unlock(&multi_crypto.lock);
+}
+
+/**
+ * Wait for the running step of a socket before it is closed, the crypto thread still uses its SSL object
+ * @param sock the socket
+ */
+static void multi_crypto_wait(Multisocket *sock) {
+    if (sock->job != NULL) {
+        multi_crypto_finish(sock->job);
+    }
+}
+
+/**
+ * Yield the running coroutine until the step of a job has run
+ * The coroutine yields the job and "r", the scheduler waits for the eventfd of the job.
+ * Has to be used as return expression of a Lua function.
+ * @param L the Lua state
+ * @param job the job, is pushed on the stack, the userdata owns the reference of the caller
+ * @param sock stack index of the socket, the userdata keeps it alive as its uservalue
+ * @param ctx the context passed to the continuation
+ * @param k the continuation
+ */
+static int multi_crypto_yield(lua_State *L, MultiCryptoJob *job, int sock, lua_KContext ctx, lua_KFunction k) {
+    MultiCryptoJob **ud = (MultiCryptoJob **) lua_newuserdata(L, sizeof(MultiCryptoJob *));
+    *ud = job;
+    luaL_setmetatable(L, "multisocket_crypto_job");
+    lua_pushvalue(L, sock);
+    lua_setuservalue(L, -2);
+    lua_pushvalue(L, -1);
+    lua_pushstring(L, "r");
+    return lua_yieldk(L, 2, ctx, k); // Yield [CryptoJob] job, [String] events
+}
+
+/**
+ * Release the job of a userdata, the step has to be finished
+ * @param ud the userdata
+ */
+static void multi_crypto_release(MultiCryptoJob **ud) {
+    if (*ud != NULL) {
+        pthread_mutex_lock(&multi_crypto.lock);
+        multi_crypto_unref(*ud);
+        pthread_mutex_unlock(&multi_crypto.lock);
+        *ud = NULL;
+    }
+}
+
+/**
+ * Lua Method
+ * __gc of a job whose task has been dropped
+ * The crypto thread may still use the socket, which the job keeps alive until then, so the step is waited for.
+ * @param0 [CryptoJob] job
+ */
+static int multi_crypto_gc(lua_State *L) {
+    MultiCryptoJob **ud = (MultiCryptoJob **) luaL_checkudata(L, 1, "multisocket_crypto_job");
+    if (*ud != NULL) {
+        multi_crypto_finish(*ud);
+    }
+    multi_crypto_release(ud);
+    return 0;
+}
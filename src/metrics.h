@@ -0,0 +1,359 @@
+/**
+ * Counters of the metrics registry
+ */
+#define MULTISOCKET_METRIC_OPENED 0
+#define MULTISOCKET_METRIC_ACCEPTED 1
+#define MULTISOCKET_METRIC_CONNECTED 2
+#define MULTISOCKET_METRIC_CLOSED 3
+#define MULTISOCKET_METRIC_RECEIVED 4
+#define MULTISOCKET_METRIC_SENT 5
+#define MULTISOCKET_METRIC_HANDSHAKES 6
+#define MULTISOCKET_METRIC_RESUMED 7
+#define MULTISOCKET_METRIC_OFFLOADED 8
+#define MULTISOCKET_METRIC_DEQUEUED 9
+#define MULTISOCKET_METRIC_COUNTERS 10
+
+/**
+ * Operations with a latency histogram
+ */
+#define MULTISOCKET_METRIC_ACCEPT 0
+#define MULTISOCKET_METRIC_CONNECT 1
+#define MULTISOCKET_METRIC_HANDSHAKE 2
+#define MULTISOCKET_METRIC_RECEIVE 3
+#define MULTISOCKET_METRIC_SEND 4
+#define MULTISOCKET_METRIC_OFFLOAD 5
+#define MULTISOCKET_METRIC_OPERATIONS 6
+
+/**
+ * Classes of the counted errors
+ */
+#define MULTISOCKET_METRIC_TIMEOUT 0
+#define MULTISOCKET_METRIC_CLOSE 1
+#define MULTISOCKET_METRIC_TLS 2
+#define MULTISOCKET_METRIC_OTHER 3
+#define MULTISOCKET_METRIC_ERRORS 4
+
+static const char *multi_metrics_counters[] = {"opened", "accepted", "connected", "closed", "received", "sent", "handshakes", "resumed",
+                                               "offloaded", "dequeued"};
+static const char *multi_metrics_operations[] = {"accept", "connect", "handshake", "receive", "send", "offload"};
+static const char *multi_metrics_errors[] = {"timeout", "closed", "tls", "other"};
+
+/**
+ * The metrics of one thread
+ * Only the owning thread writes to its shard, so the counters are updated without locks or atomic read-modify-write,
+ * readers sum up the shards of all threads.
+ */
+typedef struct MultiMetricsShard {
+    struct MultiMetricsShard *next;
+    long counters[MULTISOCKET_METRIC_COUNTERS];
+    long errors[MULTISOCKET_METRIC_ERRORS];
+
+    /**
+     * Latency histograms, bucket n counts the operations which took less than 2^n microseconds
+     * (the last bucket counts the rest), and the sum of the latencies in nanoseconds
+     */
+    long buckets[MULTISOCKET_METRIC_OPERATIONS][MULTISOCKET_METRICS_BUCKETS];
+    long sum[MULTISOCKET_METRIC_OPERATIONS];
+} MultiMetricsShard;
+
+/**
+ * The process-wide registry, the lock only protects the list of shards
+ * Shards are kept when their thread ends, so the counts of finished workers are not lost.
+ */
+static struct {
+    pthread_mutex_t lock;
+    MultiMetricsShard *shards;
+} multi_metrics = {PTHREAD_MUTEX_INITIALIZER, NULL};
+
+static __thread MultiMetricsShard *multi_metrics_shard = NULL;
+
+/**
+ * Get the shard of the calling thread, it is created by the first call
+ * @return the shard, NULL = out of memory
+ */
+static MultiMetricsShard *multi_metrics_local() {
+    if (multi_metrics_shard == NULL) {
+        MultiMetricsShard *shard = (MultiMetricsShard *) calloc(1, sizeof(MultiMetricsShard));
+        if (shard == NULL) {
+            return NULL;
+        }
+        pthread_mutex_lock(&multi_metrics.lock);
+        shard->next = multi_metrics.shards;
+        multi_metrics.shards = shard;
+        pthread_mutex_unlock(&multi_metrics.lock);
+        multi_metrics_shard = shard;
+    }
+    return multi_metrics_shard;
+}
+
+/**
+ * Add a value to a counter of a shard, the store is atomic so readers never see a torn value
+ */
+static void multi_metrics_add_to(long *counter, long value) {
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Add a value to a counter of the registry
+ * @param counter MULTISOCKET_METRIC_OPENED ... MULTISOCKET_METRIC_DEQUEUED
+ * @param value the value
+ */
+static void multi_metrics_count(int counter, long value) {
+    MultiMetricsShard *shard = multi_metrics_local();
+    if (shard != NULL) {
+        multi_metrics_add_to(&shard->counters[counter], value);
+    }
+}
+
+/**
+ * Count an error
+ * @param error MULTISOCKET_METRIC_TIMEOUT ... MULTISOCKET_METRIC_OTHER
+ */
+static void multi_metrics_error(int error) {
+    MultiMetricsShard *shard = multi_metrics_local();
+    if (shard != NULL) {
+        multi_metrics_add_to(&shard->errors[error], 1);
+    }
+}
+
+/**
+ * Record the latency of an operation
+ * @param op MULTISOCKET_METRIC_ACCEPT ... MULTISOCKET_METRIC_OFFLOAD
+ * @param start start time of the operation (multi_clock_monotonic())
+ */
+static void multi_metrics_latency(int op, long start) {
+    MultiMetricsShard *shard = multi_metrics_local();
+    if (shard == NULL) {
+        return;
+    }
+    long time = multi_clock_monotonic() - start;
+    long us = (time > 0) ? time / 1000 : 0;
+    int bucket = (us == 0) ? 0 : 64 - __builtin_clzl((unsigned long) us);
+    if (bucket >= MULTISOCKET_METRICS_BUCKETS) {
+        bucket = MULTISOCKET_METRICS_BUCKETS - 1;
+    }
+    multi_metrics_add_to(&shard->buckets[op][bucket], 1);
+    multi_metrics_add_to(&shard->sum[op], time);
+}
+
+/**
+ * Record a finished operation from its Lua results
+ * The latency is recorded unless the non-blocking socket would have to wait outside of a coroutine,
+ * a nil result counts as error of the class of the message.
+ * Has to be used as return expression of a Lua function, after the operation has returned.
+ * @param L the Lua state with the results on the top of the stack
+ * @param sock the socket
+ * @param op MULTISOCKET_METRIC_ACCEPT ... MULTISOCKET_METRIC_SEND
+ * @param start start time of the operation (multi_clock_monotonic())
+ * @param nres number of results
+ * @return nres
+ */
+static int multi_metrics_finish(lua_State *L, Multisocket *sock, int op, long start, int nres) {
+    if (nres >= 2 && lua_isnil(L, -nres) && lua_type(L, -nres + 1) == LUA_TSTRING) {
+        const char *error = lua_tostring(L, -nres + 1);
+        if (strncmp(error, "want_", 5) == 0) {
+            return nres;
+        } else if (strcmp(error, "timeout") == 0) {
+            multi_metrics_error(MULTISOCKET_METRIC_TIMEOUT);
+        } else if (strcmp(error, "closed") == 0) {
+            multi_metrics_error(MULTISOCKET_METRIC_CLOSE);
+        } else {
+            multi_metrics_error(sock->enc ? MULTISOCKET_METRIC_TLS : MULTISOCKET_METRIC_OTHER);
+        }
+    }
+    multi_metrics_latency(op, start);
+    return nres;
+}
+
+/**
+ * Sum up the shards of all threads
+ * @param total returns the sums
+ */
+static void multi_metrics_collect(MultiMetricsShard *total) {
+    bzero(total, sizeof(MultiMetricsShard));
+    pthread_mutex_lock(&multi_metrics.lock);
+    for (MultiMetricsShard *shard = multi_metrics.shards; shard != NULL; shard = shard->next) {
+        for (int i = 0; i < MULTISOCKET_METRIC_COUNTERS; i++) {
+            total->counters[i] += __atomic_load_n(&shard->counters[i], __ATOMIC_RELAXED);
+        }
+        for (int i = 0; i < MULTISOCKET_METRIC_ERRORS; i++) {
+            total->errors[i] += __atomic_load_n(&shard->errors[i], __ATOMIC_RELAXED);
+        }
+        for (int op = 0; op < MULTISOCKET_METRIC_OPERATIONS; op++) {
+            for (int i = 0; i < MULTISOCKET_METRICS_BUCKETS; i++) {
+                total->buckets[op][i] += __atomic_load_n(&shard->buckets[op][i], __ATOMIC_RELAXED);
+            }
+            total->sum[op] += __atomic_load_n(&shard->sum[op], __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&multi_metrics.lock);
+}
+
+/**
+ * Lua Function
+ * Get a snapshot of the metrics of all threads
+ * @return1 [Table] metrics
+ *          connections = [Table] opened, accepted, connected, closed, open
+ *          bytes = [Table] received, sent
+ *          tls = [Table] handshakes, resumed (completed handshakes and the ones which resumed a session),
+ *                offloaded, queued (handshake steps run by the crypto threads and the ones waiting for a thread)
+ *          errors = [Table] timeout, closed, tls, other
+ *          latency = [Table] accept, connect, handshake, receive, send, offload (wait for a crypto thread)
+ *                    = [Table] count, sum (seconds),
+ *                    buckets = [Table<Integer, Integer>] counts per bucket
+ *          bounds = [Table<Integer, Number>] upper bounds of the buckets in seconds (the last one is math.huge)
+ */
+static int multi_get_metrics(lua_State *L) {
+    MultiMetricsShard total;
+    multi_metrics_collect(&total);
+
+    lua_createtable(L, 0, 6);
+
+    lua_createtable(L, 0, 5);
+    for (int i = MULTISOCKET_METRIC_OPENED; i <= MULTISOCKET_METRIC_CLOSED; i++) {
+        lua_pushinteger(L, total.counters[i]);
+        lua_setfield(L, -2, multi_metrics_counters[i]);
+    }
+    lua_pushinteger(L, total.counters[MULTISOCKET_METRIC_OPENED] + total.counters[MULTISOCKET_METRIC_ACCEPTED] -
+                       total.counters[MULTISOCKET_METRIC_CLOSED]);
+    lua_setfield(L, -2, "open");
+    lua_setfield(L, -2, "connections");
+
+    lua_createtable(L, 0, 2);
+    lua_pushinteger(L, total.counters[MULTISOCKET_METRIC_RECEIVED]);
+    lua_setfield(L, -2, "received");
+    lua_pushinteger(L, total.counters[MULTISOCKET_METRIC_SENT]);
+    lua_setfield(L, -2, "sent");
+    lua_setfield(L, -2, "bytes");
+
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, total.counters[MULTISOCKET_METRIC_HANDSHAKES]);
+    lua_setfield(L, -2, "handshakes");
+    lua_pushinteger(L, total.counters[MULTISOCKET_METRIC_RESUMED]);
+    lua_setfield(L, -2, "resumed");
+    lua_pushinteger(L, total.counters[MULTISOCKET_METRIC_OFFLOADED]);
+    lua_setfield(L, -2, "offloaded");
+    lua_pushinteger(L, total.counters[MULTISOCKET_METRIC_OFFLOADED] - total.counters[MULTISOCKET_METRIC_DEQUEUED]);
+    lua_setfield(L, -2, "queued");
+    lua_setfield(L, -2, "tls");
+
+    lua_createtable(L, 0, MULTISOCKET_METRIC_ERRORS);
+    for (int i = 0; i < MULTISOCKET_METRIC_ERRORS; i++) {
+        lua_pushinteger(L, total.errors[i]);
+        lua_setfield(L, -2, multi_metrics_errors[i]);
+    }
+    lua_setfield(L, -2, "errors");
+
+    lua_createtable(L, 0, MULTISOCKET_METRIC_OPERATIONS);
+    for (int op = 0; op < MULTISOCKET_METRIC_OPERATIONS; op++) {
+        long count = 0;
+        lua_createtable(L, 0, 3);
+        lua_createtable(L, MULTISOCKET_METRICS_BUCKETS, 0);
+        for (int i = 0; i < MULTISOCKET_METRICS_BUCKETS; i++) {
+            count += total.buckets[op][i];
+            lua_pushinteger(L, total.buckets[op][i]);
+            lua_rawseti(L, -2, i + 1);
+        }
+        lua_setfield(L, -2, "buckets");
+        lua_pushinteger(L, count);
+        lua_setfield(L, -2, "count");
+        lua_pushnumber(L, (double) total.sum[op] / 1000000000.0);
+        lua_setfield(L, -2, "sum");
+        lua_setfield(L, -2, multi_metrics_operations[op]);
+    }
+    lua_setfield(L, -2, "latency");
+
+    lua_createtable(L, MULTISOCKET_METRICS_BUCKETS, 0);
+    for (int i = 0; i < MULTISOCKET_METRICS_BUCKETS; i++) {
+        lua_pushnumber(L, (i < MULTISOCKET_METRICS_BUCKETS - 1) ? (double) (1L << i) / 1000000.0 : HUGE_VAL);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_setfield(L, -2, "bounds");
+
+    return 1; // Return [Table] metrics
+}
+
+/**
+ * Lua Function
+ * Get the metrics of all threads in the Prometheus text exposition format
+ * @return1 [String] metrics
+ */
+static int multi_get_metrics_text(lua_State *L) {
+    MultiMetricsShard total;
+    multi_metrics_collect(&total);
+
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    char line[256];
+
+    luaL_addstring(&b, "# HELP multisocket_connections_total Connections by event.\n"
+                       "# TYPE multisocket_connections_total counter\n");
+    for (int i = MULTISOCKET_METRIC_OPENED; i <= MULTISOCKET_METRIC_CLOSED; i++) {
+        snprintf(line, sizeof(line), "multisocket_connections_total{event=\"%s\"} %ld\n",
+                 multi_metrics_counters[i], total.counters[i]);
+        luaL_addstring(&b, line);
+    }
+
+    snprintf(line, sizeof(line), "# HELP multisocket_connections Sockets which are open.\n"
+                                 "# TYPE multisocket_connections gauge\n"
+                                 "multisocket_connections %ld\n",
+             total.counters[MULTISOCKET_METRIC_OPENED] + total.counters[MULTISOCKET_METRIC_ACCEPTED] -
+             total.counters[MULTISOCKET_METRIC_CLOSED]);
+    luaL_addstring(&b, line);
+
+    snprintf(line, sizeof(line), "# HELP multisocket_bytes_total Bytes received and sent.\n"
+                                 "# TYPE multisocket_bytes_total counter\n"
+                                 "multisocket_bytes_total{direction=\"received\"} %ld\n"
+                                 "multisocket_bytes_total{direction=\"sent\"} %ld\n",
+             total.counters[MULTISOCKET_METRIC_RECEIVED], total.counters[MULTISOCKET_METRIC_SENT]);
+    luaL_addstring(&b, line);
+
+    snprintf(line, sizeof(line), "# HELP multisocket_tls_handshakes_total Completed TLS handshakes.\n"
+                                 "# TYPE multisocket_tls_handshakes_total counter\n"
+                                 "multisocket_tls_handshakes_total %ld\n", total.counters[MULTISOCKET_METRIC_HANDSHAKES]);
+    luaL_addstring(&b, line);
+    snprintf(line, sizeof(line), "# HELP multisocket_tls_resumed_total TLS handshakes which resumed a session.\n"
+                                 "# TYPE multisocket_tls_resumed_total counter\n"
+                                 "multisocket_tls_resumed_total %ld\n", total.counters[MULTISOCKET_METRIC_RESUMED]);
+    luaL_addstring(&b, line);
+    snprintf(line, sizeof(line), "# HELP multisocket_tls_offloaded_total TLS handshake steps run by the crypto threads.\n"
+                                 "# TYPE multisocket_tls_offloaded_total counter\n"
+                                 "multisocket_tls_offloaded_total %ld\n", total.counters[MULTISOCKET_METRIC_OFFLOADED]);
+    luaL_addstring(&b, line);
+    snprintf(line, sizeof(line), "# HELP multisocket_tls_handshake_queue TLS handshake steps waiting for a crypto thread.\n"
+                                 "# TYPE multisocket_tls_handshake_queue gauge\n"
+                                 "multisocket_tls_handshake_queue %ld\n",
+             total.counters[MULTISOCKET_METRIC_OFFLOADED] - total.counters[MULTISOCKET_METRIC_DEQUEUED]);
+    luaL_addstring(&b, line);
+
+    luaL_addstring(&b, "# HELP multisocket_errors_total Failed operations by class.\n"
+                       "# TYPE multisocket_errors_total counter\n");
+    for (int i = 0; i < MULTISOCKET_METRIC_ERRORS; i++) {
+        snprintf(line, sizeof(line), "multisocket_errors_total{class=\"%s\"} %ld\n", multi_metrics_errors[i], total.errors[i]);
+        luaL_addstring(&b, line);
+    }
+
+    luaL_addstring(&b, "# HELP multisocket_latency_seconds Latency of the operations.\n"
+                       "# TYPE multisocket_latency_seconds histogram\n");
+    for (int op = 0; op < MULTISOCKET_METRIC_OPERATIONS; op++) {
+        long count = 0;
+        for (int i = 0; i < MULTISOCKET_METRICS_BUCKETS; i++) {
+            count += total.buckets[op][i];
+            if (i < MULTISOCKET_METRICS_BUCKETS - 1) {
+                snprintf(line, sizeof(line), "multisocket_latency_seconds_bucket{op=\"%s\",le=\"%.9g\"} %ld\n",
+                         multi_metrics_operations[op], (double) (1L << i) / 1000000.0, count);
+            } else {
+                snprintf(line, sizeof(line), "multisocket_latency_seconds_bucket{op=\"%s\",le=\"+Inf\"} %ld\n",
+                         multi_metrics_operations[op], count);
+            }
+            luaL_addstring(&b, line);
+        }
+        snprintf(line, sizeof(line), "multisocket_latency_seconds_sum{op=\"%s\"} %.9f\n"
+                                     "multisocket_latency_seconds_count{op=\"%s\"} %ld\n",
+                 multi_metrics_operations[op], (double) total.sum[op] / 1000000000.0, multi_metrics_operations[op], count);
+        luaL_addstring(&b, line);
+    }
+
+    luaL_pushresult(&b);
+    return 1; // Return [String] metrics
+}
@@ -1,6 +1,8 @@
 
 
 
+#define _GNU_SOURCE
+
 #include <sys/socket.h>
 #include <memory.h>
 #include <errno.h>
@@ -8,9 +10,27 @@
 #include <arpa/inet.h>
 #include <zconf.h>
 #include <time.h>
+#include <math.h>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <stdlib.h>
 #include <netdb.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+#include <netinet/udp.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <arpa/nameser.h>
+#include <resolv.h>
+#include <dlfcn.h>
 
 #include <lua5.3/lua.h>
 #include <lua5.3/lualib.h>
@@ -20,6 +40,8 @@
 #include <openssl/bio.h>
 #include <openssl/err.h>
 #include <openssl/x509.h>
+#include <openssl/rand.h>
+#include <openssl/core_names.h>
 
 
 
@@ -28,6 +50,98 @@
  */
 #define MULTISOCKET_BUFFER_SIZE 6000 // Ethernetframe size = 1500, TLS/SSL size = 16384
 
+/**
+ * Maximum payload of a TLS record, small pieces of data are packed into records of this size
+ */
+#define MULTISOCKET_TLS_RECORD_SIZE 16384
+
+/**
+ * Maximum number of pieces sent by a single writev() call
+ */
+#define MULTISOCKET_IOV_MAX 256
+
+/**
+ * Size of the buffer used by sendFile() on encrypted sockets
+ */
+#define MULTISOCKET_SENDFILE_BUFFER_SIZE 65536
+
+/**
+ * Default size of the per-socket read-ahead buffer, large enough for one TLS record
+ */
+#define MULTISOCKET_READ_BUFFER_SIZE 16384
+
+/**
+ * Largest number of bytes reserved at once for receive(numBytes), the buffer grows with the data which arrives
+ */
+#define MULTISOCKET_READ_RESERVE_MAX 262144
+
+/**
+ * Cipher list and protocol versions of new TLS contexts
+ */
+#define MULTISOCKET_TLS_CIPHERS "HIGH:!aNULL:!kRSA:!PSK:!SRP:!MD5:!RC4"
+#define MULTISOCKET_TLS_MIN_VERSION TLS1_2_VERSION
+#define MULTISOCKET_TLS_MAX_VERSION TLS1_3_VERSION
+
+/**
+ * Number of client sessions cached by every TLS context
+ */
+#define MULTISOCKET_TLS_SESSIONS 256
+
+/**
+ * Lifetime of TLS sessions in seconds, the keys of session tickets are rotated as often
+ */
+#define MULTISOCKET_TLS_TICKET_LIFETIME 3600
+
+/**
+ * Number of crypto threads which run the TLS handshakes of contexts created with offload = true
+ */
+#define MULTISOCKET_CRYPTO_THREADS 4
+
+/**
+ * Maximum number of addresses open() races, and the delay between two attempts in nanoseconds (RFC 8305)
+ */
+#define MULTISOCKET_OPEN_ADDRESSES 16
+#define MULTISOCKET_OPEN_DELAY 250000000L
+
+/**
+ * Resolver: number of lookup threads, addresses kept per answer and size of the cache
+ */
+#define MULTISOCKET_RESOLVER_THREADS 4
+#define MULTISOCKET_RESOLVER_ADDRESSES 16
+#define MULTISOCKET_RESOLVER_BUCKETS 256
+#define MULTISOCKET_RESOLVER_ENTRIES 4096
+#define MULTISOCKET_RESOLVER_PACKET_SIZE 4096
+
+/**
+ * Resolver: TTLs in seconds for answers without one (e.g. from /etc/hosts) and the upper limit for all answers
+ */
+#define MULTISOCKET_RESOLVER_TTL 60
+#define MULTISOCKET_RESOLVER_NEGATIVE_TTL 5
+#define MULTISOCKET_RESOLVER_MAX_TTL 3600
+
+/**
+ * Default maximum number of idle connections per key of a pool, and the default idle timeout in seconds
+ */
+#define MULTISOCKET_POOL_MAX_IDLE 8
+#define MULTISOCKET_POOL_IDLE_TIMEOUT 60
+
+/**
+ * Number of levels of the timer wheel of a scheduler and the length of a tick in nanoseconds
+ * 4 levels of 64 slots cover 2^24 ticks (4.6 hours), later timers are cascaded down once they are in range
+ */
+#define MULTISOCKET_TIMER_LEVELS 4
+#define MULTISOCKET_TIMER_TICK 1000000L
+
+/**
+ * Number of buckets of the latency histograms of the metrics, bucket n counts latencies below 2^n microseconds
+ * The last bucket counts the rest, so 24 buckets cover up to 4.2 seconds.
+ */
+#define MULTISOCKET_METRICS_BUCKETS 24
+
+struct MultiPoller;
+struct MultiTlsEarly;
+struct MultiCryptoJob;
+
 /**
  * Primary socket identifier: multisocket
  */
@@ -45,15 +159,69 @@ typedef struct {
     SSL_CTX *ctx;
 
     /**
-     * Creation-time of the socket in nanoseconds
+     * Early data of a client whose TLS handshake is deferred to the first send(), NULL = none
+     */
+    struct MultiTlsEarly *early;
+
+    /**
+     * Handshake step which a crypto thread is running for the socket, NULL = none
+     */
+    struct MultiCryptoJob *job;
+
+    /**
+     * Read-ahead buffer, received data is rbuf[rbufPos] to rbuf[rbufPos + rbufLen - 1]
+     */
+    char *rbuf;
+    size_t rbufCap;
+    size_t rbufPos;
+    size_t rbufLen;
+
+    /**
+     * The poller the socket is registered in, or NULL
+     */
+    struct MultiPoller *poller;
+
+    /**
+     * Interest set of the socket in its poller (MULTISOCKET_POLL_*)
+     */
+    unsigned char pevents;
+
+    /**
+     * Creation-time of the socket in nanoseconds (CLOCK_MONOTONIC)
      */
     long startT;
 
     /**
-     * Time of the last connection signal in nanoseconds
+     * Time of the last connection signal in nanoseconds (CLOCK_MONOTONIC)
      */
     long lastT;
 
+    /**
+     * Start times of the pending read (receive, accept) and write (send, connect) operations for the metrics
+     */
+    long readT;
+    long writeT;
+
+    /**
+     * Start time of the pending TLS handshake for the metrics
+     */
+    long handshakeT;
+
+    /**
+     * Maximum time a scheduler task waits for the socket in nanoseconds, 0 = unlimited
+     */
+    long timeout;
+
+    /**
+     * Maximum time since the last connection signal in nanoseconds, 0 = unlimited
+     */
+    long idleTimeout;
+
+    /**
+     * Timer of the scheduler task waiting for the socket (index + 1), 0 = none
+     */
+    int timer;
+
     /**
      * Number of bytes received by the socket
      */
@@ -89,6 +257,11 @@ typedef struct {
      */
     unsigned char enc:1;
 
+    /**
+     * State of the TLS handshake, 0 = complete or none, MULTISOCKET_TLS_HANDSHAKE / MULTISOCKET_TLS_EARLY_DATA = pending
+     */
+    unsigned char handshake:2;
+
     /**
      * Is the socket a TCP socket?
      */
@@ -109,6 +282,37 @@ typedef struct {
      */
     unsigned char ipv4:1;
 
+    /**
+     * Is the socket on the pending list of its poller?
+     */
+    unsigned char pend:1;
+
+    /**
+     * Has the read-ahead buffer changed since a read found its data insufficient?
+     * Only then the buffered data counts as pending, a partial line does not wake up the reader again.
+     */
+    unsigned char rbufNew:1;
+
+    /**
+     * Is the socket in non-blocking mode?
+     */
+    unsigned char nonblock:1;
+
+    /**
+     * Does the kernel coalesce received datagrams (UDP_GRO)?
+     */
+    unsigned char gro:1;
+
+    /**
+     * Has the timer of the waiting task expired? The next operation which would wait reports "timeout"
+     */
+    unsigned char expired:1;
+
+    /**
+     * Connections accepted by the io_uring of a scheduler, NULL = none
+     */
+    struct MultiUringAccept *accepted;
+
 } Multisocket;
 
 typedef struct {
@@ -116,20 +320,36 @@ typedef struct {
 } Certificate;
 
 /**
- * Returns the current UNIX-time in nanoseconds.
- * @return UNIX-time in nanoseconds
+ * Is the value a Multisocket, either TCP or UDP?
+ * @param L the Lua state
+ * @param index stack index of the value
+ * @return 1 = socket, 0 = something else
  */
-static long getcurrenttime() {
-    struct timespec tv;
-    clockid_t clock = 0;
-    clock_gettime(clock, &tv);
-    return tv.tv_sec * 1000000000 + tv.tv_nsec;
+static int multi_is_socket(lua_State *L, int index) {
+    return lua_isuserdata(L, index) &&
+           (luaL_testudata(L, index, "multisocket_tcp") != NULL || luaL_testudata(L, index, "multisocket_udp") != NULL);
 }
 
 
+#include "clock.h"
+#include "metrics.h"
+#include "tls.h"
+#include "crypto.h"
 #include "ssl.h"
+#include "search.h"
+#include "buffer.h"
+#include "poller.h"
+#include "uring.h"
+#include "options.h"
+#include "resolver.h"
 #include "tcp.h"
+#include "udp.h"
+#include "timer.h"
+#include "scheduler.h"
+#include "relay.h"
+#include "server.h"
 #include "support.h"
+#include "pool.h"
 
 #include "base64.h"
 
@@ -141,6 +361,7 @@ static long getcurrenttime() {
 int luaopen_multisocket(lua_State *L) {
 
     multi_ssl_init();
+    multi_search_init();
     signal(SIGPIPE, SIG_IGN);
 
     /**
@@ -149,12 +370,15 @@ int luaopen_multisocket(lua_State *L) {
     static const luaL_Reg mt_tcp[] = {
             {"bind",                multi_tcp_bind},
             {"encrypt",             multi_tcp_encrypt},
+            {"handshake",           multi_tcp_handshake},
             {"listen",              multi_tcp_listen},
             {"accept",              multi_tcp_accept},
+            {"acceptMany",          multi_tcp_accept_many},
             {"connect",             multi_tcp_connect},
             {"receive",             multi_tcp_receive},
             {"receiveLine",         multi_tcp_receive_line},
             {"send",                multi_tcp_send},
+            {"sendFile",            multi_tcp_send_file},
             {"close",               multi_tcp_close},
             {"pointer",             multi_getpointer},
             {"getSocketAddress",    multi_tcp_get_sockaddr},
@@ -164,6 +388,11 @@ int luaopen_multisocket(lua_State *L) {
             {"getPeerPort",         multi_tcp_get_peerport},
             {"getPeerName",         multi_tcp_get_peername},
             {"setTimeout",          multi_tcp_set_timeout},
+            {"setIdleTimeout",      multi_tcp_set_idle_timeout},
+            {"setBlocking",         multi_tcp_set_blocking},
+            {"isBlocking",          multi_tcp_is_blocking},
+            {"setOption",           multi_set_option},
+            {"getOption",           multi_get_option},
             {"getDuration",         multi_get_duration},
             {"getStartTime",        multi_get_starttime},
             {"getLastSignalTime",   multi_get_lasttime},
@@ -172,6 +401,12 @@ int luaopen_multisocket(lua_State *L) {
             {"isServerSide",        multi_tcp_is_server_side},
             {"isClientSide",        multi_tcp_is_client_side},
             {"isEncrypted",         multi_tcp_is_encrypted},
+            {"isSessionReused",     multi_tcp_is_session_reused},
+            {"isEarlyDataAccepted", multi_tcp_is_early_data_accepted},
+            {"getAlpnProtocol",     multi_tcp_get_alpn_protocol},
+            {"getTlsVersion",       multi_tcp_get_tls_version},
+            {"isKernelTls",         multi_tcp_is_kernel_tls},
+            {"isFastOpen",          multi_tcp_is_fast_open},
             {"isIpv6",              multi_is_ipv6},
             {"isIpv4",              multi_is_ipv4},
             {NULL, NULL}
@@ -186,10 +421,211 @@ int luaopen_multisocket(lua_State *L) {
     luaL_newlib(L, mt_tcp);
     lua_settable(L, -3);
 
+    lua_pushstring(L, "__gc");
+    lua_pushcfunction(L, multi_tcp_gc);
+    lua_settable(L, -3);
+
+    /**
+     * The Metatable for UDP Sockets, IPv6 and IPv4
+     */
+    static const luaL_Reg mt_udp[] = {
+            {"bind",                multi_tcp_bind},
+            {"connect",             multi_tcp_connect},
+            {"receive",             multi_udp_receive},
+            {"receiveMany",         multi_udp_receive_many},
+            {"send",                multi_udp_send},
+            {"sendMany",            multi_udp_send_many},
+            {"sendSegments",        multi_udp_send_segments},
+            {"setGro",              multi_udp_set_gro},
+            {"close",               multi_tcp_close},
+            {"pointer",             multi_getpointer},
+            {"getSocketAddress",    multi_tcp_get_sockaddr},
+            {"getSocketPort",       multi_tcp_get_sockport},
+            {"getSocketName",       multi_tcp_get_sockname},
+            {"getPeerAddress",      multi_tcp_get_peeraddr},
+            {"getPeerPort",         multi_tcp_get_peerport},
+            {"getPeerName",         multi_tcp_get_peername},
+            {"setTimeout",          multi_tcp_set_timeout},
+            {"setIdleTimeout",      multi_tcp_set_idle_timeout},
+            {"setBlocking",         multi_tcp_set_blocking},
+            {"isBlocking",          multi_tcp_is_blocking},
+            {"setOption",           multi_set_option},
+            {"getOption",           multi_get_option},
+            {"getDuration",         multi_get_duration},
+            {"getStartTime",        multi_get_starttime},
+            {"getLastSignalTime",   multi_get_lasttime},
+            {"getSentBytes",        multi_get_sent},
+            {"getReceivedBytes",    multi_get_received},
+            {"isIpv6",              multi_is_ipv6},
+            {"isIpv4",              multi_is_ipv4},
+            {NULL, NULL}
+    };
+
+    luaL_newmetatable(L, "multisocket_udp");
+    lua_pushstring(L, "__metatable");
+    lua_pushvalue(L, -2);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "__index");
+    luaL_newlib(L, mt_udp);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "__gc");
+    lua_pushcfunction(L, multi_tcp_gc);
+    lua_settable(L, -3);
+
+    /**
+     * The Metatable for Pollers
+     */
+    static const luaL_Reg mt_poller[] = {
+            {"add",                 multi_poller_add},
+            {"modify",              multi_poller_modify},
+            {"remove",              multi_poller_remove},
+            {"wait",                multi_poller_wait},
+            {"count",               multi_poller_count},
+            {"close",               multi_poller_close},
+            {NULL, NULL}
+    };
+
+    luaL_newmetatable(L, "multisocket_poller");
+    lua_pushstring(L, "__metatable");
+    lua_pushvalue(L, -2);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "__index");
+    luaL_newlib(L, mt_poller);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "__gc");
+    lua_pushcfunction(L, multi_poller_close);
+    lua_settable(L, -3);
+
+    /**
+     * The Metatable for Schedulers
+     */
+    static const luaL_Reg mt_scheduler[] = {
+            {"spawn",               multi_scheduler_spawn},
+            {"step",                multi_scheduler_step_lua},
+            {"run",                 multi_scheduler_run},
+            {"sleep",               multi_scheduler_sleep},
+            {"after",               multi_scheduler_after},
+            {"cancel",              multi_scheduler_cancel},
+            {"count",               multi_scheduler_count},
+            {"getBackend",          multi_scheduler_get_backend},
+            {"close",               multi_scheduler_close},
+            {NULL, NULL}
+    };
+
+    luaL_newmetatable(L, "multisocket_scheduler");
+    lua_pushstring(L, "__metatable");
+    lua_pushvalue(L, -2);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "__index");
+    luaL_newlib(L, mt_scheduler);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "__gc");
+    lua_pushcfunction(L, multi_scheduler_close);
+    lua_settable(L, -3);
+
+    /**
+     * The Metatable for Servers
+     */
+    static const luaL_Reg mt_server[] = {
+            {"getSocketPort",       multi_server_get_port},
+            {"getThreadCount",      multi_server_get_threads},
+            {"wait",                multi_server_wait},
+            {"close",               multi_server_close},
+            {NULL, NULL}
+    };
+
+    luaL_newmetatable(L, "multisocket_server");
+    lua_pushstring(L, "__metatable");
+    lua_pushvalue(L, -2);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "__index");
+    luaL_newlib(L, mt_server);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "__gc");
+    lua_pushcfunction(L, multi_server_close);
+    lua_settable(L, -3);
+
+    /**
+     * The Metatable for Connection Pools
+     */
+    static const luaL_Reg mt_pool[] = {
+            {"get",                 multi_pool_get},
+            {"put",                 multi_pool_put},
+            {"getStatistics",       multi_pool_get_statistics},
+            {"close",               multi_pool_close},
+            {NULL, NULL}
+    };
+
+    luaL_newmetatable(L, "multisocket_pool");
+    lua_pushstring(L, "__metatable");
+    lua_pushvalue(L, -2);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "__index");
+    luaL_newlib(L, mt_pool);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "__gc");
+    lua_pushcfunction(L, multi_pool_close);
+    lua_settable(L, -3);
+
+    /**
+     * The Metatable for TLS Contexts
+     */
+    static const luaL_Reg mt_tls_context[] = {
+            {"close",               multi_tls_context_close},
+            {NULL, NULL}
+    };
+
+    luaL_newmetatable(L, "multisocket_tls_context");
+    lua_pushstring(L, "__metatable");
+    lua_pushvalue(L, -2);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "__index");
+    luaL_newlib(L, mt_tls_context);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "__gc");
+    lua_pushcfunction(L, multi_tls_context_close);
+    lua_settable(L, -3);
+
+    /**
+     * The Metatable for Lookups of the Resolver
+     */
+    luaL_newmetatable(L, "multisocket_lookup");
+    lua_pushstring(L, "__metatable");
+    lua_pushvalue(L, -2);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "__gc");
+    lua_pushcfunction(L, multi_resolver_gc);
+    lua_settable(L, -3);
+
     //lua_pushstring(L, "__tostring");
     //lua_pushcfunction(L, multi_tostring);
     //lua_settable(L, -3);
 
+    /**
+     * The Metatable for handshake steps running in a crypto thread
+     */
+    luaL_newmetatable(L, "multisocket_crypto_job");
+    lua_pushstring(L, "__metatable");
+    lua_pushvalue(L, -2);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "__gc");
+    lua_pushcfunction(L, multi_crypto_gc);
+    lua_settable(L, -3);
+
 
     /**
      * The main Library Table
@@ -197,13 +633,37 @@ int luaopen_multisocket(lua_State *L) {
     static const luaL_Reg lib_functions[] = {
             {"tcp6",    multi_tcp6},        // Create new IPv6 Socket
             {"tcp4",    multi_tcp4},        // Create new IPv4 Socket
+            {"udp6",    multi_udp6},        // Create new IPv6 UDP Socket
+            {"udp4",    multi_udp4},        // Create new IPv4 UDP Socket
             {"pointer", multi_pointer},     // Create new Socket from Pointer
             {"select",  multi_select},      // Wait until a Socket State has changed
+            {"poller",  multi_poller_new},  // Create new epoll based Poller
+            {"scheduler", multi_scheduler_new}, // Create new Scheduler for Coroutines
+            {"relay",   multi_relay},       // Relay data between two Sockets
+            {"server",  multi_server_new},  // Create new Server with Worker Threads
             {"open",    multi_open},        // Create and connects an IPv6/IPv4 Socket
+            {"pool",    multi_pool_new},    // Create new Pool for Client Connections
+            {"resolve", multi_resolve},     // Resolve a Host Name using the Resolver Cache
+            {"getResolverStatistics", multi_get_resolver_statistics}, // Get the Counters of the Resolver
+            {"clearResolverCache", multi_clear_resolver_cache}, // Remove all cached Answers
+            {"setDefaultOption", multi_set_default_option}, // Set a Socket Option for new TCP Sockets
+            {"getDefaultOption", multi_get_default_option}, // Get a Socket Option for new TCP Sockets
+            {"getMetrics", multi_get_metrics}, // Get a Snapshot of the Metrics of all Threads
+            {"getMetricsText", multi_get_metrics_text}, // Get the Metrics in the Prometheus Text Format
             {"time",    multi_time},        // Get the current UNIX-Time
             {NULL, NULL}
     };
     luaL_newlib(L, lib_functions);  // Create a new Table and put it on the Stack
+
+    /**
+     * The TLS Table of the Library
+     */
+    static const luaL_Reg lib_tls[] = {
+            {"context", multi_tls_context_new}, // Create new shared TLS Context
+            {NULL, NULL}
+    };
+    luaL_newlib(L, lib_tls);
+    lua_setfield(L, -2, "tls");
     return 1;  // Return the last Item on the Stack
 }
 
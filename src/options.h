@@ -0,0 +1,298 @@
+/**
+ * Value types of socket options
+ */
+#define MULTISOCKET_OPTION_BOOLEAN 1
+#define MULTISOCKET_OPTION_INTEGER 2
+
+/**
+ * A socket option which can be set from Lua
+ */
+typedef struct {
+    const char *name;
+    int level;
+    int option;
+    int type;
+
+    /**
+     * Does the option only exist for TCP sockets?
+     */
+    int tcp;
+} MultiOption;
+
+/**
+ * The socket options known by setOption(), getOption() and setDefaultOption()
+ */
+static const MultiOption multi_options[] = {
+        {"noDelay",         IPPROTO_TCP, TCP_NODELAY,          MULTISOCKET_OPTION_BOOLEAN, 1},
+        {"cork",            IPPROTO_TCP, TCP_CORK,             MULTISOCKET_OPTION_BOOLEAN, 1},
+        {"quickAck",        IPPROTO_TCP, TCP_QUICKACK,         MULTISOCKET_OPTION_BOOLEAN, 1},
+        {"notSentLowat",    IPPROTO_TCP, TCP_NOTSENT_LOWAT,    MULTISOCKET_OPTION_INTEGER, 1},
+        {"keepAlive",       SOL_SOCKET,  SO_KEEPALIVE,         MULTISOCKET_OPTION_BOOLEAN, 1},
+        {"keepIdle",        IPPROTO_TCP, TCP_KEEPIDLE,         MULTISOCKET_OPTION_INTEGER, 1},
+        {"keepInterval",    IPPROTO_TCP, TCP_KEEPINTVL,        MULTISOCKET_OPTION_INTEGER, 1},
+        {"keepCount",       IPPROTO_TCP, TCP_KEEPCNT,          MULTISOCKET_OPTION_INTEGER, 1},
+        {"sendBuffer",      SOL_SOCKET,  SO_SNDBUF,            MULTISOCKET_OPTION_INTEGER, 0},
+        {"receiveBuffer",   SOL_SOCKET,  SO_RCVBUF,            MULTISOCKET_OPTION_INTEGER, 0},
+        {"busyPoll",        SOL_SOCKET,  SO_BUSY_POLL,         MULTISOCKET_OPTION_INTEGER, 0},
+        {"fastOpen",        IPPROTO_TCP, TCP_FASTOPEN,         MULTISOCKET_OPTION_INTEGER, 1},
+        {"fastOpenConnect", IPPROTO_TCP, TCP_FASTOPEN_CONNECT, MULTISOCKET_OPTION_BOOLEAN, 1},
+};
+
+#define MULTISOCKET_OPTIONS ((int) (sizeof(multi_options) / sizeof(MultiOption)))
+
+/**
+ * Default values of the options for new TCP sockets, shared by all Lua states of the process
+ * They are only read by the worker threads of a server, so set them before the server is started.
+ */
+static int multi_option_defaults[MULTISOCKET_OPTIONS];
+static unsigned char multi_option_defaultSet[MULTISOCKET_OPTIONS];
+
+/**
+ * Find a socket option by its name
+ * @param name the name
+ * @return index in multi_options, -1 = unknown option
+ */
+static int multi_option_find(const char *name) {
+    for (int i = 0; i < MULTISOCKET_OPTIONS; i++) {
+        if (strcmp(multi_options[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Read the value of a socket option from the Lua stack
+ * @param L the Lua state
+ * @param index stack index of the value
+ * @param opt the option
+ * @param value the value
+ * @return 0 = success, -1 = wrong type
+ */
+static int multi_option_value(lua_State *L, int index, const MultiOption *opt, int *value) {
+    if (opt->type == MULTISOCKET_OPTION_BOOLEAN && lua_isboolean(L, index)) {
+        *value = lua_toboolean(L, index);
+        return 0;
+    } else if (opt->type == MULTISOCKET_OPTION_INTEGER && lua_isinteger(L, index) &&
+               lua_tointeger(L, index) >= 0 && lua_tointeger(L, index) <= 0x7FFFFFFF) {
+        *value = (int) lua_tointeger(L, index);
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * Push a value of a socket option
+ * @param L the Lua state
+ * @param opt the option
+ * @param value the value
+ */
+static void multi_option_push(lua_State *L, const MultiOption *opt, int value) {
+    if (opt->type == MULTISOCKET_OPTION_BOOLEAN) {
+        lua_pushboolean(L, value != 0);
+    } else {
+        lua_pushinteger(L, value);
+    }
+}
+
+/**
+ * Apply the default options to a new TCP socket
+ * Defaults the kernel refuses are skipped, setOption() reports the error.
+ * @param sock the socket
+ */
+static void multi_option_apply_defaults(Multisocket *sock) {
+    for (int i = 0; i < MULTISOCKET_OPTIONS; i++) {
+        if (multi_option_defaultSet[i] && (!multi_options[i].tcp || sock->tcp)) {
+            setsockopt(sock->socket, multi_options[i].level, multi_options[i].option,
+                       &multi_option_defaults[i], sizeof(int));
+        }
+    }
+}
+
+/**
+ * Lua Method
+ * Set a socket option
+ * Boolean options: noDelay, cork, quickAck, keepAlive,
+ *                  fastOpenConnect (connect() returns at once, the first send() goes with the SYN)
+ * Integer options: notSentLowat (bytes), keepIdle, keepInterval (seconds), keepCount,
+ *                  sendBuffer, receiveBuffer (bytes), busyPoll (microseconds),
+ *                  fastOpen (queue length of a listener for Fast Open connections, set before listen())
+ * Only sendBuffer, receiveBuffer and busyPoll exist for UDP sockets.
+ * The kernel resets quickAck on its own, it has to be set again after receiving.
+ * @param0 [Multisocket] socket
+ * @param1 [String] name
+ * @param2 [Boolean] value / [Integer] value
+ * @return1 [Boolean] success / nil
+ * @return2 nil / [String] error
+ */
+static int multi_set_option(lua_State *L) {
+    // Check if there are three parameters and if they have valid values
+    if (lua_gettop(L) != 3) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!multi_is_socket(L, 1)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
+        return 2; // Return nil, [String] error
+    } else if (lua_type(L, 2) != LUA_TSTRING) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [String] name");
+        return 2; // Return nil, [String] error
+    }
+
+    // Cast userdata to Multisocket
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+
+    int index = multi_option_find(lua_tostring(L, 2));
+    if (index == -1 || (multi_options[index].tcp && !sock->tcp)) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "Unknown option %s", lua_tostring(L, 2));
+        return 2; // Return nil, [String] error
+    }
+    const MultiOption *opt = &multi_options[index];
+
+    int value = 0;
+    if (multi_option_value(L, 3, opt, &value) != 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, (opt->type == MULTISOCKET_OPTION_BOOLEAN) ? "Argument #2 has to be [Boolean] value" :
+                          "Argument #2 has to be [Integer] value (0-2147483647)");
+        return 2; // Return nil, [String] error
+    }
+
+    if (setsockopt(sock->socket, opt->level, opt->option, &value, sizeof(value)) == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2; // Return nil, [String] error
+    }
+
+    lua_pushboolean(L, 1);
+    return 1; // Return [Boolean] success (true)
+}
+
+/**
+ * Lua Method
+ * Get a socket option
+ * The kernel reports sendBuffer and receiveBuffer doubled, including its bookkeeping overhead.
+ * @param0 [Multisocket] socket
+ * @param1 [String] name
+ * @return1 [Boolean] value / [Integer] value / nil
+ * @return2 nil / [String] error
+ */
+static int multi_get_option(lua_State *L) {
+    // Check if there are two parameters and if they have valid values
+    if (lua_gettop(L) != 2) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!multi_is_socket(L, 1)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
+        return 2; // Return nil, [String] error
+    } else if (lua_type(L, 2) != LUA_TSTRING) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [String] name");
+        return 2; // Return nil, [String] error
+    }
+
+    // Cast userdata to Multisocket
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+
+    int index = multi_option_find(lua_tostring(L, 2));
+    if (index == -1 || (multi_options[index].tcp && !sock->tcp)) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "Unknown option %s", lua_tostring(L, 2));
+        return 2; // Return nil, [String] error
+    }
+    const MultiOption *opt = &multi_options[index];
+
+    int value = 0;
+    socklen_t len = sizeof(value);
+    if (getsockopt(sock->socket, opt->level, opt->option, &value, &len) == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2; // Return nil, [String] error
+    }
+
+    multi_option_push(L, opt, value);
+    return 1; // Return [Boolean] value / [Integer] value
+}
+
+/**
+ * Lua Function
+ * Set the default value of a socket option for new TCP sockets
+ * The defaults are applied to sockets created by tcp4(), tcp6() and open(), and to accepted connections.
+ * @param1 [String] name (see setOption())
+ * @param2 [Boolean] value / [Integer] value / nil (remove the default)
+ * @return1 [Boolean] success / nil
+ * @return2 nil / [String] error
+ */
+static int multi_set_default_option(lua_State *L) {
+    // Check if there are two parameters and if they have valid values
+    if (lua_gettop(L) != 2) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (lua_type(L, 1) != LUA_TSTRING) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [String] name");
+        return 2; // Return nil, [String] error
+    }
+
+    int index = multi_option_find(lua_tostring(L, 1));
+    if (index == -1) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "Unknown option %s", lua_tostring(L, 1));
+        return 2; // Return nil, [String] error
+    }
+    const MultiOption *opt = &multi_options[index];
+
+    int value = 0;
+    if (lua_isnil(L, 2)) {
+        multi_option_defaultSet[index] = 0;
+    } else if (multi_option_value(L, 2, opt, &value) != 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, (opt->type == MULTISOCKET_OPTION_BOOLEAN) ? "Argument #2 has to be [Boolean] value / nil" :
+                          "Argument #2 has to be [Integer] value (0-2147483647) / nil");
+        return 2; // Return nil, [String] error
+    } else {
+        multi_option_defaults[index] = value;
+        multi_option_defaultSet[index] = 1;
+    }
+
+    lua_pushboolean(L, 1);
+    return 1; // Return [Boolean] success (true)
+}
+
+/**
+ * Lua Function
+ * Get the default value of a socket option for new TCP sockets
+ * @param1 [String] name (see setOption())
+ * @return1 [Boolean] value / [Integer] value / nil (no default)
+ * @return2 nil / [String] error
+ */
+static int multi_get_default_option(lua_State *L) {
+    // Check if there is one parameter and if it has a valid value
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (lua_type(L, 1) != LUA_TSTRING) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [String] name");
+        return 2; // Return nil, [String] error
+    }
+
+    int index = multi_option_find(lua_tostring(L, 1));
+    if (index == -1) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "Unknown option %s", lua_tostring(L, 1));
+        return 2; // Return nil, [String] error
+    } else if (!multi_option_defaultSet[index]) {
+        lua_pushnil(L);
+        return 1; // Return nil
+    }
+
+    multi_option_push(L, &multi_options[index], multi_option_defaults[index]);
+    return 1; // Return [Boolean] value / [Integer] value
+}
@@ -0,0 +1,524 @@
+/**
+ * Maximum number of events fetched by a single epoll_wait() call
+ */
+#define MULTISOCKET_POLLER_EVENTS 256
+
+/**
+ * Interest flags of a socket registered in a poller
+ */
+#define MULTISOCKET_POLL_READ  1
+#define MULTISOCKET_POLL_WRITE 2
+
+/**
+ * Poller identifier: multisocket_poller
+ * Sockets are registered once with their interest set,
+ * wait() only returns the sockets which are ready.
+ */
+typedef struct MultiPoller {
+    /**
+     * Filedescriptor of the epoll instance
+     */
+    int epfd;
+
+    /**
+     * Registry reference to the table [Multisocket] -> [Multisocket]
+     * Keeps the registered sockets alive and maps the epoll data back to the userdata
+     */
+    int ref;
+
+    /**
+     * Number of registered sockets
+     */
+    int count;
+
+    /**
+     * Registered sockets which have already buffered or decrypted data pending
+     */
+    Multisocket **pend;
+    int pendLen;
+    int pendCap;
+} MultiPoller;
+
+/**
+ * Does the socket hold received data which is not visible to epoll?
+ * Buffered data which a read has already found insufficient only counts again after more data has arrived.
+ * @param sock the socket
+ * @return 1 = data pending, 0 = no data pending
+ */
+static int multi_socket_pending(Multisocket *sock) {
+    return (sock->rbufLen > 0 && sock->rbufNew) || (sock->enc && sock->ssl != NULL && SSL_pending(sock->ssl) > 0);
+}
+
+/**
+ * Put the socket on the pending list of its poller, if it has data pending
+ * Has to be called after every read from a socket
+ * @param sock the socket
+ */
+static void multi_poller_mark(Multisocket *sock) {
+    MultiPoller *poller = sock->poller;
+    if (poller == NULL || sock->pend || !(sock->pevents & MULTISOCKET_POLL_READ) || !multi_socket_pending(sock)) {
+        return;
+    }
+    if (poller->pendLen == poller->pendCap) {
+        int cap = (poller->pendCap == 0) ? 16 : poller->pendCap * 2;
+        Multisocket **pend = realloc(poller->pend, cap * sizeof(Multisocket *));
+        if (pend == NULL) {
+            return; // The socket will be reported by epoll as soon as new data arrives
+        }
+        poller->pend = pend;
+        poller->pendCap = cap;
+    }
+    poller->pend[poller->pendLen++] = sock;
+    sock->pend = 1;
+}
+
+/**
+ * Remove the socket from the pending list of its poller
+ * @param sock the socket
+ */
+static void multi_poller_unmark(Multisocket *sock) {
+    MultiPoller *poller = sock->poller;
+    if (poller == NULL || !sock->pend) {
+        return;
+    }
+    for (int i = 0; i < poller->pendLen; i++) {
+        if (poller->pend[i] == sock) {
+            poller->pend[i] = poller->pend[--poller->pendLen];
+            break;
+        }
+    }
+    sock->pend = 0;
+}
+
+/**
+ * Convert an interest set to epoll events
+ * @param events MULTISOCKET_POLL_* flags
+ * @return epoll events
+ */
+static uint32_t multi_poller_epoll_events(int events) {
+    uint32_t ev = 0;
+    if (events & MULTISOCKET_POLL_READ) {
+        ev |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (events & MULTISOCKET_POLL_WRITE) {
+        ev |= EPOLLOUT;
+    }
+    return ev;
+}
+
+/**
+ * Parse an interest set string ("r", "w" or "rw")
+ * @param str the string
+ * @return MULTISOCKET_POLL_* flags, 0 = invalid
+ */
+static int multi_poller_parse_events(const char *str) {
+    int events = 0;
+    for (; *str != 0; str++) {
+        if (*str == 'r') {
+            events |= MULTISOCKET_POLL_READ;
+        } else if (*str == 'w') {
+            events |= MULTISOCKET_POLL_WRITE;
+        } else {
+            return 0;
+        }
+    }
+    return events;
+}
+
+/**
+ * Remove a socket from its poller, e.g. before it gets closed
+ * @param L the Lua state
+ * @param sock the socket
+ */
+static void multi_poller_forget(lua_State *L, Multisocket *sock) {
+    MultiPoller *poller = sock->poller;
+    if (poller == NULL) {
+        return;
+    }
+    multi_poller_unmark(sock);
+    epoll_ctl(poller->epfd, EPOLL_CTL_DEL, sock->socket, NULL);
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, poller->ref);
+    lua_pushnil(L);
+    lua_rawsetp(L, -2, sock);
+    lua_pop(L, 1);
+
+    poller->count--;
+    sock->poller = NULL;
+    sock->pevents = 0;
+}
+
+/**
+ * Lua Function
+ * Create a new epoll based poller
+ * @return1 [Poller] poller / nil
+ * @return2 nil / [String] error
+ */
+static int multi_poller_new(lua_State *L) {
+    if (lua_gettop(L) != 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    }
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2; // Return nil, [String] error
+    }
+
+    MultiPoller *poller = (MultiPoller *) lua_newuserdata(L, sizeof(MultiPoller));
+    poller->epfd = epfd;
+    poller->count = 0;
+    poller->pend = NULL;
+    poller->pendLen = 0;
+    poller->pendCap = 0;
+
+    lua_newtable(L);
+    poller->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    luaL_getmetatable(L, "multisocket_poller");
+    lua_setmetatable(L, -2);
+
+    return 1; // Return [Poller] poller
+}
+
+/**
+ * Lua Method
+ * Register a socket in the poller
+ * @param0 [Poller] poller
+ * @param1 [Multisocket] socket
+ * @param2 [String] events ("r", "w" or "rw")
+ * @return1 [Boolean] success / nil
+ * @return2 nil / [String] error
+ */
+static int multi_poller_add(lua_State *L) {
+    if (lua_gettop(L) != 3) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_poller")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Poller] poller");
+        return 2; // Return nil, [String] error
+    } else if (!multi_is_socket(L, 2)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [Multisocket] socket");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isstring(L, 3) || multi_poller_parse_events(lua_tostring(L, 3)) == 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #2 has to be [String] events (\"r\", \"w\" or \"rw\")");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiPoller *poller = (MultiPoller *) lua_touserdata(L, 1);
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 2);
+    int events = multi_poller_parse_events(lua_tostring(L, 3));
+
+    if (poller->epfd == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Poller is closed");
+        return 2; // Return nil, [String] error
+    } else if (sock->poller != NULL) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Socket is already registered in a poller");
+        return 2; // Return nil, [String] error
+    }
+
+    struct epoll_event ev;
+    bzero(&ev, sizeof(ev));
+    ev.events = multi_poller_epoll_events(events);
+    ev.data.ptr = sock;
+    if (epoll_ctl(poller->epfd, EPOLL_CTL_ADD, sock->socket, &ev) == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2; // Return nil, [String] error
+    }
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, poller->ref);
+    lua_pushvalue(L, 2);
+    lua_rawsetp(L, -2, sock);
+    lua_pop(L, 1);
+
+    poller->count++;
+    sock->poller = poller;
+    sock->pevents = events;
+    sock->pend = 0;
+    multi_poller_mark(sock);
+
+    lua_pushboolean(L, 1);
+    return 1; // Return [Boolean] success (true)
+}
+
+/**
+ * Lua Method
+ * Change the interest set of a registered socket
+ * @param0 [Poller] poller
+ * @param1 [Multisocket] socket
+ * @param2 [String] events ("r", "w" or "rw")
+ * @return1 [Boolean] success / nil
+ * @return2 nil / [String] error
+ */
+static int multi_poller_modify(lua_State *L) {
+    if (lua_gettop(L) != 3) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_poller")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Poller] poller");
+        return 2; // Return nil, [String] error
+    } else if (!multi_is_socket(L, 2)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [Multisocket] socket");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isstring(L, 3) || multi_poller_parse_events(lua_tostring(L, 3)) == 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #2 has to be [String] events (\"r\", \"w\" or \"rw\")");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiPoller *poller = (MultiPoller *) lua_touserdata(L, 1);
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 2);
+    int events = multi_poller_parse_events(lua_tostring(L, 3));
+
+    if (sock->poller != poller) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Socket is not registered in this poller");
+        return 2; // Return nil, [String] error
+    }
+
+    struct epoll_event ev;
+    bzero(&ev, sizeof(ev));
+    ev.events = multi_poller_epoll_events(events);
+    ev.data.ptr = sock;
+    if (epoll_ctl(poller->epfd, EPOLL_CTL_MOD, sock->socket, &ev) == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2; // Return nil, [String] error
+    }
+
+    multi_poller_unmark(sock);
+    sock->pevents = events;
+    multi_poller_mark(sock);
+
+    lua_pushboolean(L, 1);
+    return 1; // Return [Boolean] success (true)
+}
+
+/**
+ * Lua Method
+ * Remove a socket from the poller
+ * @param0 [Poller] poller
+ * @param1 [Multisocket] socket
+ * @return1 [Boolean] success / nil
+ * @return2 nil / [String] error
+ */
+static int multi_poller_remove(lua_State *L) {
+    if (lua_gettop(L) != 2) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_poller")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Poller] poller");
+        return 2; // Return nil, [String] error
+    } else if (!multi_is_socket(L, 2)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [Multisocket] socket");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiPoller *poller = (MultiPoller *) lua_touserdata(L, 1);
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 2);
+
+    if (sock->poller != poller) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Socket is not registered in this poller");
+        return 2; // Return nil, [String] error
+    }
+
+    multi_poller_forget(L, sock);
+
+    lua_pushboolean(L, 1);
+    return 1; // Return [Boolean] success (true)
+}
+
+/**
+ * Lua Method
+ * Wait until at least one registered socket is ready or the timeout has run out
+ * Sockets with already decrypted data pending are reported as readable immediately.
+ * Errors and hangups are reported as readable, so the next receive() returns the error.
+ * @param0 [Poller] poller
+ * @param1 nil / [Number] timeout (seconds)
+ * @param2 nil / [Integer] maxEvents (1-MULTISOCKET_POLLER_EVENTS)
+ * @return1 [Table<Integer, Multisocket>] readable / nil
+ * @return2 [Table<Integer, Multisocket>] writable / [String] error
+ */
+static int multi_poller_wait(lua_State *L) {
+    if (lua_gettop(L) < 1 || lua_gettop(L) > 3) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_poller")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Poller] poller");
+        return 2; // Return nil, [String] error
+    } else if (lua_gettop(L) >= 2 && !lua_isnil(L, 2) && (!lua_isnumber(L, 2) || lua_tonumber(L, 2) < 0)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [Number] timeout (seconds)");
+        return 2; // Return nil, [String] error
+    } else if (lua_gettop(L) == 3 && !lua_isnil(L, 3) && (!lua_isinteger(L, 3) || lua_tointeger(L, 3) < 1 || lua_tointeger(L, 3) > MULTISOCKET_POLLER_EVENTS)) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "Argument #2 has to be [Integer] maxEvents (1-%d)", MULTISOCKET_POLLER_EVENTS);
+        return 2; // Return nil, [String] error
+    }
+
+    MultiPoller *poller = (MultiPoller *) lua_touserdata(L, 1);
+
+    if (poller->epfd == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Poller is closed");
+        return 2; // Return nil, [String] error
+    }
+
+    // A timeout of -1 blocks until a socket is ready
+    int timeout = -1;
+    if (lua_gettop(L) >= 2 && !lua_isnil(L, 2)) {
+        timeout = (int) (lua_tonumber(L, 2) * 1000);
+    }
+    int maxEvents = MULTISOCKET_POLLER_EVENTS;
+    if (lua_gettop(L) == 3 && !lua_isnil(L, 3)) {
+        maxEvents = (int) lua_tointeger(L, 3);
+    }
+
+    // Drop the sockets which have been drained, or whose buffered data a read has found insufficient
+    for (int i = 0; i < poller->pendLen;) {
+        Multisocket *sock = poller->pend[i];
+        if (!multi_socket_pending(sock)) {
+            poller->pend[i] = poller->pend[--poller->pendLen];
+            sock->pend = 0;
+            continue;
+        }
+        i++;
+    }
+
+    // Sockets with pending data are ready right now, so don't block
+    if (poller->pendLen > 0) {
+        timeout = 0;
+    }
+
+    struct epoll_event events[MULTISOCKET_POLLER_EVENTS];
+    int num = epoll_wait(poller->epfd, events, maxEvents, timeout);
+    if (num == -1) {
+        if (errno != EINTR) {
+            lua_pushnil(L);
+            lua_pushstring(L, strerror(errno));
+            return 2; // Return nil, [String] error
+        }
+        num = 0;
+    }
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, poller->ref);
+    int sockets = lua_gettop(L);
+    lua_createtable(L, num + poller->pendLen, 0);
+    int readable = lua_gettop(L);
+    lua_createtable(L, num, 0);
+    int writable = lua_gettop(L);
+    lua_Integer numRead = 0;
+    lua_Integer numWrite = 0;
+
+    // Report the sockets with pending data
+    for (int i = 0; i < poller->pendLen; i++) {
+        lua_rawgetp(L, sockets, poller->pend[i]);
+        lua_rawseti(L, readable, ++numRead);
+    }
+
+    for (int i = 0; i < num; i++) {
+        Multisocket *sock = (Multisocket *) events[i].data.ptr;
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+            if (!sock->pend) { // Already reported as pending
+                lua_rawgetp(L, sockets, sock);
+                lua_rawseti(L, readable, ++numRead);
+            }
+        }
+        if (events[i].events & EPOLLOUT) {
+            lua_rawgetp(L, sockets, sock);
+            lua_rawseti(L, writable, ++numWrite);
+        }
+    }
+
+    return 2; // Return [Table<Integer, Multisocket>] readable, [Table<Integer, Multisocket>] writable
+}
+
+/**
+ * Lua Method
+ * Get the number of registered sockets
+ * @param0 [Poller] poller
+ * @return1 [Integer] count
+ */
+static int multi_poller_count(lua_State *L) {
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_poller")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Poller] poller");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiPoller *poller = (MultiPoller *) lua_touserdata(L, 1);
+
+    lua_pushinteger(L, poller->count);
+    return 1; // Return [Integer] count
+}
+
+/**
+ * Lua Method
+ * Close the poller and unregister all sockets
+ * Also called by the garbage collector
+ * @param0 [Poller] poller
+ * @return1 [Boolean] success
+ */
+static int multi_poller_close(lua_State *L) {
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_poller")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Poller] poller");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiPoller *poller = (MultiPoller *) lua_touserdata(L, 1);
+
+    if (poller->epfd != -1) {
+        // Detach all sockets, they must not point to a freed poller
+        lua_rawgeti(L, LUA_REGISTRYINDEX, poller->ref);
+        lua_pushnil(L);
+        while (lua_next(L, -2)) {
+            Multisocket *sock = (Multisocket *) lua_touserdata(L, -1);
+            sock->poller = NULL;
+            sock->pevents = 0;
+            sock->pend = 0;
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+
+        luaL_unref(L, LUA_REGISTRYINDEX, poller->ref);
+        close(poller->epfd);
+        free(poller->pend);
+        poller->epfd = -1;
+        poller->ref = LUA_NOREF;
+        poller->pend = NULL;
+        poller->pendLen = 0;
+        poller->pendCap = 0;
+        poller->count = 0;
+    }
+
+    lua_pushboolean(L, 1);
+    return 1; // Return [Boolean] success (true)
+}
@@ -0,0 +1,396 @@
+/**
+ * Pool identifier: multisocket_pool
+ * Keeps idle client connections for reuse, keyed by host, port and encryption.
+ * The uservalue is a table: [1] = key -> list of idle sockets (oldest first), [2] = socket -> key (weak keys)
+ */
+typedef struct {
+    /**
+     * Maximum number of idle sockets per key
+     */
+    int maxIdle;
+
+    /**
+     * Time in nanoseconds after which an idle socket is closed
+     */
+    long idleTimeout;
+
+    /**
+     * Number of idle sockets of all keys
+     */
+    int idle;
+
+    long hits;
+    long misses;
+    long discarded;
+    unsigned char closed:1;
+} MultiPool;
+
+/**
+ * Check cheaply whether an idle socket can be reused
+ * One poll() without timeout: a plain connection must neither be closed nor have unsolicited data,
+ * an encrypted one may receive data (e.g. TLS session tickets), but must not be closed.
+ * @param sock the socket
+ * @param valid set to 0 if the socket has been closed already
+ * @return 1 = alive, 0 = has to be discarded
+ */
+static int multi_pool_alive(Multisocket *sock, int *valid) {
+    struct pollfd fd = {sock->socket, POLLIN | POLLRDHUP, 0};
+    *valid = (sock->socket != -1);
+    if (!*valid || poll(&fd, 1, 0) == -1) {
+        return 0;
+    } else if (fd.revents & POLLNVAL) {
+        *valid = 0;
+        return 0;
+    } else if (sock->rbufLen > 0 || (fd.revents & (POLLRDHUP | POLLHUP | POLLERR))) {
+        return 0;
+    }
+    return !(fd.revents & POLLIN) || sock->enc;
+}
+
+/**
+ * Close a socket which is not reused, unless it has been closed by its user already
+ * @param L the Lua state
+ * @param pool the pool
+ * @param index stack index of the socket
+ */
+static void multi_pool_discard(lua_State *L, MultiPool *pool, int index) {
+    if (((Multisocket *) lua_touserdata(L, index))->socket != -1) {
+        lua_pushcfunction(L, multi_tcp_close);
+        lua_pushvalue(L, index);
+        lua_call(L, 1, 0);
+    }
+    pool->discarded++;
+}
+
+/**
+ * Push the pool key of a connection
+ * @param L the Lua state
+ * @param host stack index of the host
+ * @param port stack index of the port
+ * @param encrypt stack index of the encryption flag
+ */
+static void multi_pool_push_key(lua_State *L, int host, int port, int encrypt) {
+    lua_pushfstring(L, "%s:%d:%d", lua_tostring(L, host), (int) lua_tointeger(L, port), lua_toboolean(L, encrypt));
+}
+
+/**
+ * Lua Function
+ * Create a pool of client connections
+ * @param1 [Table] options (optional)
+ *         maxIdle = [Integer] maximum number of idle connections per host, port and encryption (default = 8)
+ *         idleTimeout = [Number] seconds after which an idle connection is closed (default = 60)
+ * @return1 [Pool] pool / nil
+ * @return2 nil / [String] error
+ */
+static int multi_pool_new(lua_State *L) {
+    // Check if there is at most one parameter and if it has a valid value
+    if (lua_gettop(L) > 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isnoneornil(L, 1) && !lua_istable(L, 1)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [Table] options");
+        return 2; // Return nil, [String] error
+    }
+
+    if (lua_isnoneornil(L, 1)) {
+        lua_settop(L, 0);
+        lua_newtable(L);
+    }
+    lua_getfield(L, 1, "maxIdle");
+    lua_getfield(L, 1, "idleTimeout");
+    if (!lua_isnil(L, 2) && (!lua_isinteger(L, 2) || lua_tointeger(L, 2) < 0 || lua_tointeger(L, 2) > 0x7FFFFFFF)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Option maxIdle has to be [Integer] maxIdle (0-2147483647)");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isnil(L, 3) && (!lua_isnumber(L, 3) || lua_tonumber(L, 3) < 0)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Option idleTimeout has to be [Number] idleTimeout (seconds)");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiPool *pool = (MultiPool *) lua_newuserdata(L, sizeof(MultiPool));
+    bzero(pool, sizeof(MultiPool));
+    pool->maxIdle = lua_isnil(L, 2) ? MULTISOCKET_POOL_MAX_IDLE : (int) lua_tointeger(L, 2);
+    pool->idleTimeout = lua_isnil(L, 3) ? MULTISOCKET_POOL_IDLE_TIMEOUT * 1000000000L :
+                        (long) (lua_tonumber(L, 3) * 1000000000.0);
+    luaL_setmetatable(L, "multisocket_pool");
+
+    lua_createtable(L, 2, 0);
+    lua_newtable(L);
+    lua_rawseti(L, -2, 1);
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_pushstring(L, "k");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    lua_rawseti(L, -2, 2);
+    lua_setuservalue(L, -2);
+    return 1; // Return [Pool] pool
+}
+
+/**
+ * Lua Method
+ * Get a connection to the host, an idle one is reused if it is still alive, otherwise a new one is opened
+ * @param0 [Pool] pool
+ * @param1 [String] address (address or domain)
+ * @param2 [Integer] port (0-65535)
+ * @param3 [Boolean] encrypt (optional, default = false)
+ * @param4 [Boolean] fastOpen (optional, only used for new connections)
+ * @param5 [Number] timeout (seconds, optional, only used for new connections)
+ * @param6 [Boolean] earlyData (optional, only used for new connections, see multisocket.open())
+ * @return1 [Multisocket] socket / nil
+ * @return2 nil / [String] error
+ */
+static int multi_pool_get(lua_State *L) {
+    // Check if there are three to seven parameters and if they have valid values
+    if (lua_gettop(L) < 3 || lua_gettop(L) > 7) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_pool")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Pool] pool");
+        return 2; // Return nil, [String] error
+    } else if (lua_type(L, 2) != LUA_TSTRING) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [String] address (address or domain)");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isinteger(L, 3) || lua_tointeger(L, 3) > 0xFFFF || lua_tointeger(L, 3) < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #2 has to be [Integer] port (0-65535)");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiPool *pool = (MultiPool *) lua_touserdata(L, 1);
+    if (pool->closed) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Pool is closed");
+        return 2; // Return nil, [String] error
+    }
+    lua_settop(L, 7);
+    lua_getuservalue(L, 1);
+    lua_rawgeti(L, 8, 1);
+    multi_pool_push_key(L, 2, 3, 4);
+    lua_pushvalue(L, 10);
+    lua_rawget(L, 9);
+
+    // The most recently used connection is taken first, older ones are more likely to be closed by the peer
+    if (lua_istable(L, 11)) {
+        long now = multi_clock_now();
+        for (int n = (int) lua_rawlen(L, 11); n > 0; n--) {
+            lua_rawgeti(L, 11, n);
+            lua_pushnil(L);
+            lua_rawseti(L, 11, n);
+            pool->idle--;
+            Multisocket *sock = (Multisocket *) lua_touserdata(L, 12);
+
+            int valid;
+            if (now - sock->lastT > pool->idleTimeout) {
+                // All older connections have expired as well
+                multi_pool_discard(L, pool, 12);
+                lua_pop(L, 1);
+                for (n--; n > 0; n--) {
+                    lua_rawgeti(L, 11, n);
+                    lua_pushnil(L);
+                    lua_rawseti(L, 11, n);
+                    pool->idle--;
+                    multi_pool_discard(L, pool, 12);
+                    lua_pop(L, 1);
+                }
+                break;
+            } else if (multi_pool_alive(sock, &valid)) {
+                pool->hits++;
+                return 1; // Return [Multisocket] socket
+            } else if (valid) {
+                multi_pool_discard(L, pool, 12);
+            } else {
+                pool->discarded++;
+            }
+            lua_pop(L, 1);
+        }
+    }
+    lua_settop(L, 10);
+
+    // Open a new connection and remember its key for put()
+    pool->misses++;
+    lua_pushcfunction(L, multi_open);
+    for (int i = 2; i <= 7; i++) {
+        lua_pushvalue(L, i);
+    }
+    lua_call(L, 6, 2);
+    if (lua_isnil(L, 11)) {
+        return 2; // Return nil, [String] error
+    }
+    lua_rawgeti(L, 8, 2);
+    lua_pushvalue(L, 11);
+    lua_pushvalue(L, 10);
+    lua_rawset(L, -3);
+    lua_pop(L, 2);
+    return 1; // Return [Multisocket] socket
+}
+
+/**
+ * Lua Method
+ * Give a connection back to the pool after the exchange has been completed
+ * The connection is closed instead if the pool has enough idle connections to the host already,
+ * or if it has unread data or is not connected. Closed sockets are rejected.
+ * @param0 [Pool] pool
+ * @param1 [Multisocket] socket (TCP, from get())
+ * @return1 [Boolean] pooled (true = kept for reuse, false = closed) / nil
+ * @return2 nil / [String] error
+ */
+static int multi_pool_put(lua_State *L) {
+    // Check if there are two parameters and if they have valid values
+    if (lua_gettop(L) != 2) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_pool")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Pool] pool");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 2) || !luaL_testudata(L, 2, "multisocket_tcp")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [Multisocket] socket (TCP)");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiPool *pool = (MultiPool *) lua_touserdata(L, 1);
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 2);
+    if (sock->socket == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Socket is closed");
+        return 2; // Return nil, [String] error
+    }
+    lua_getuservalue(L, 1);
+    lua_rawgeti(L, 3, 2);
+    lua_pushvalue(L, 2);
+    lua_rawget(L, 4);
+    if (lua_isnil(L, 5)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Socket does not belong to the pool");
+        return 2; // Return nil, [String] error
+    }
+
+    lua_rawgeti(L, 3, 1);
+    lua_pushvalue(L, 5);
+    lua_rawget(L, 6);
+    if (lua_isnil(L, 7)) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, 5);
+        lua_pushvalue(L, 7);
+        lua_rawset(L, 6);
+    }
+
+    // Expired connections are at the front of the list
+    long now = multi_clock_now();
+    int len = (int) lua_rawlen(L, 7);
+    int expired = 0;
+    while (expired < len) {
+        lua_rawgeti(L, 7, expired + 1);
+        Multisocket *idle = (Multisocket *) lua_touserdata(L, -1);
+        if (now - idle->lastT <= pool->idleTimeout) {
+            lua_pop(L, 1);
+            break;
+        }
+        multi_pool_discard(L, pool, lua_gettop(L));
+        lua_pop(L, 1);
+        expired++;
+    }
+    if (expired > 0) {
+        for (int i = 1; i <= len; i++) {
+            lua_rawgeti(L, 7, i + expired);
+            lua_rawseti(L, 7, i);
+        }
+        len -= expired;
+        pool->idle -= expired;
+    }
+
+    if (pool->closed || len >= pool->maxIdle || sock->rbufLen > 0 || sock->listen || !sock->conn) {
+        multi_pool_discard(L, pool, 2);
+        lua_pushboolean(L, 0);
+        return 1; // Return [Boolean] pooled (false)
+    }
+    lua_pushvalue(L, 2);
+    lua_rawseti(L, 7, len + 1);
+    pool->idle++;
+
+    lua_pushboolean(L, 1);
+    return 1; // Return [Boolean] pooled (true)
+}
+
+/**
+ * Lua Method
+ * Get the counters of the pool
+ * @param0 [Pool] pool
+ * @return1 [Table] statistics (idle, hits, misses, discarded)
+ */
+static int multi_pool_get_statistics(lua_State *L) {
+    // Check if there is one parameter and if it has a valid value
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_pool")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Pool] pool");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiPool *pool = (MultiPool *) lua_touserdata(L, 1);
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, pool->idle);
+    lua_setfield(L, -2, "idle");
+    lua_pushinteger(L, pool->hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushinteger(L, pool->misses);
+    lua_setfield(L, -2, "misses");
+    lua_pushinteger(L, pool->discarded);
+    lua_setfield(L, -2, "discarded");
+    return 1; // Return [Table] statistics
+}
+
+/**
+ * Lua Method
+ * Close all idle connections of the pool, sockets given back later are closed as well
+ * @param0 [Pool] pool
+ * @return1 [Boolean] success (true) / nil
+ * @return2 nil / [String] error
+ */
+static int multi_pool_close(lua_State *L) {
+    // Check if there is one parameter and if it has a valid value
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_pool")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Pool] pool");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiPool *pool = (MultiPool *) lua_touserdata(L, 1);
+    pool->closed = 1;
+    lua_getuservalue(L, 1);
+    if (lua_istable(L, 2)) {
+        lua_rawgeti(L, 2, 1);
+        lua_pushnil(L);
+        while (lua_next(L, 3) != 0) {
+            for (int i = 1; i <= (int) lua_rawlen(L, 5); i++) {
+                lua_rawgeti(L, 5, i);
+                multi_pool_discard(L, pool, 6);
+                lua_pop(L, 1);
+            }
+            lua_pop(L, 1);
+        }
+        lua_newtable(L);
+        lua_rawseti(L, 2, 1);
+    }
+    pool->idle = 0;
+
+    lua_pushboolean(L, 1);
+    return 1; // Return [Boolean] success (true)
+}
@@ -0,0 +1,377 @@
+/**
+ * One direction of a relay between two sockets
+ * Plain sockets move the data through a pipe with splice(), it never leaves the kernel,
+ * also to an encrypted destination if the kernel encrypts the connection (kTLS).
+ * Encrypted sockets and data which is already buffered by the source are copied through its read buffer.
+ */
+typedef struct {
+    Multisocket *src;
+    Multisocket *dst;
+
+    /**
+     * Pipe used by splice(), -1 if it could not be created
+     */
+    int pipe[2];
+    size_t pipeCap;
+    size_t piped;
+
+    /**
+     * Number of bytes written to the destination
+     */
+    long bytes;
+
+    /**
+     * Poll events requested by the last SSL operation on the source and the destination
+     */
+    short srcWant;
+    short dstWant;
+
+    unsigned char eof:1, done:1;
+} MultiRelay;
+
+/**
+ * Initialize a direction of a relay
+ * @param dir the direction
+ * @param src the socket to read from
+ * @param dst the socket to write to
+ * @param pipeSize requested size of the pipe, 0 = default
+ */
+static void multi_relay_init(MultiRelay *dir, Multisocket *src, Multisocket *dst, int pipeSize) {
+    bzero(dir, sizeof(MultiRelay));
+    dir->src = src;
+    dir->dst = dst;
+    dir->pipe[0] = -1;
+    dir->pipe[1] = -1;
+    // The kernel encrypts what is spliced into a socket with kernel TLS, the source has to be plain though,
+    // splice() can not pass the control records of a TLS connection
+    if (!src->enc && (!dst->enc || multi_tls_ktls_send(dst)) && pipe2(dir->pipe, O_NONBLOCK | O_CLOEXEC) == 0) {
+        if (pipeSize > 0) {
+            fcntl(dir->pipe[1], F_SETPIPE_SZ, pipeSize);
+        }
+        int cap = fcntl(dir->pipe[1], F_GETPIPE_SZ);
+        dir->pipeCap = (cap > 0) ? (size_t) cap : 65536;
+    }
+}
+
+/**
+ * Release the pipe of a direction
+ * @param dir the direction
+ */
+static void multi_relay_free(MultiRelay *dir) {
+    if (dir->pipe[0] != -1) {
+        close(dir->pipe[0]);
+        close(dir->pipe[1]);
+    }
+}
+
+/**
+ * Check if a direction can be spliced
+ * Data which was buffered by receive() before the relay started has to be copied first.
+ * @param dir the direction
+ */
+static int multi_relay_spliced(MultiRelay *dir) {
+    return dir->pipe[0] != -1 && dir->src->rbufLen == 0;
+}
+
+/**
+ * Poll events a direction waits for on its source and destination
+ * @param dir the direction
+ * @param srcEvents events for the source
+ * @param dstEvents events for the destination
+ * @return 1 = the source has decrypted data pending and has to be read without waiting
+ */
+static int multi_relay_events(MultiRelay *dir, short *srcEvents, short *dstEvents) {
+    if (dir->done) {
+        return 0;
+    }
+    int ready = 0;
+    if (!dir->eof) {
+        if (multi_relay_spliced(dir)) {
+            if (dir->piped < dir->pipeCap) {
+                *srcEvents |= POLLIN;
+            }
+        } else if (dir->src->rbufLen == 0) {
+            *srcEvents |= dir->srcWant ? dir->srcWant : POLLIN;
+            ready = dir->src->enc && SSL_pending(dir->src->ssl) > 0;
+        }
+    }
+    if (dir->piped > 0 || dir->src->rbufLen > 0) {
+        *dstEvents |= dir->dstWant ? dir->dstWant : POLLOUT;
+    }
+    return ready;
+}
+
+/**
+ * Store the poll events an SSL operation waits for
+ * @param sock the socket
+ * @param ret the return value of the SSL operation
+ * @param want the events to store
+ * @return 0 = the operation can be retried, -1 = error
+ */
+static int multi_relay_ssl_want(Multisocket *sock, long ret, short *want) {
+    switch (SSL_get_error(sock->ssl, (int) ret)) {
+        case SSL_ERROR_WANT_READ: *want = POLLIN; return 0;
+        case SSL_ERROR_WANT_WRITE: *want = POLLOUT; return 0;
+        default: return -1;
+    }
+}
+
+/**
+ * Read from the source of a direction into its pipe or buffer
+ * @param dir the direction
+ * @param ret the return value of the failed operation
+ * @return > 0 = bytes read, 0 = nothing to read, -1 = error (ret holds the failed return value)
+ */
+static long multi_relay_read(MultiRelay *dir, long *ret) {
+    Multisocket *src = dir->src;
+    long trans;
+    if (multi_relay_spliced(dir)) {
+        // splice() of 0 bytes returns 0 as well, which must not be taken for the end of the stream
+        if (dir->piped >= dir->pipeCap) {
+            return 0;
+        }
+        trans = splice(src->socket, NULL, dir->pipe[1], NULL, dir->pipeCap - dir->piped,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (trans > 0) {
+            dir->piped += trans;
+            src->recB += trans;
+            multi_metrics_count(MULTISOCKET_METRIC_RECEIVED, trans);
+            src->lastT = multi_clock_now();
+        }
+    } else {
+        trans = multi_buffer_fill(src, 0);
+    }
+
+    if (trans > 0) {
+        dir->srcWant = 0;
+        return trans;
+    } else if (trans == 0) {
+        dir->eof = 1;
+        return 0;
+    } else if (src->enc && errno != ENOMEM) {
+        if (multi_relay_ssl_want(src, trans, &dir->srcWant) == 0) {
+            return 0;
+        }
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return 0;
+    }
+    *ret = trans;
+    return -1;
+}
+
+/**
+ * Write from the pipe or buffer of a direction to its destination
+ * Shuts down the writing side of the destination as soon as the source is closed and everything is written.
+ * @param dir the direction
+ * @param ret the return value of the failed operation
+ * @return >= 0 = bytes written, -1 = error (ret holds the failed return value)
+ */
+static long multi_relay_write(MultiRelay *dir, long *ret) {
+    Multisocket *dst = dir->dst;
+    long trans = 0;
+    if (dir->piped > 0) {
+        trans = splice(dir->pipe[0], NULL, dst->socket, NULL, dir->piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (trans > 0) {
+            dir->piped -= trans;
+        }
+    } else if (dir->src->rbufLen > 0) {
+        Multisocket *src = dir->src;
+        size_t size = src->rbufLen;
+        if (dst->enc) {
+            trans = multi_tls_write(dst, src->rbuf + src->rbufPos, (size > 0x7FFFFFFF) ? 0x7FFFFFFF : (int) size);
+        } else {
+            trans = send(dst->socket, src->rbuf + src->rbufPos, size, MSG_NOSIGNAL);
+        }
+        if (trans > 0) {
+            multi_buffer_consume(src, (size_t) trans);
+        }
+    }
+
+    if (trans > 0) {
+        dir->bytes += trans;
+        dst->sndB += trans;
+        multi_metrics_count(MULTISOCKET_METRIC_SENT, trans);
+        dst->lastT = multi_clock_now();
+        dir->dstWant = 0;
+    } else if (trans < 0 || (dst->enc && dir->src->rbufLen > 0)) {
+        if (dst->enc && dir->piped == 0) {
+            if (multi_relay_ssl_want(dst, trans, &dir->dstWant) == 0) {
+                return 0;
+            }
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        *ret = trans;
+        return -1;
+    }
+
+    if (dir->eof && dir->piped == 0 && dir->src->rbufLen == 0 && !dir->done) {
+        dir->done = 1;
+        if (dst->enc) {
+            SSL_shutdown(dst->ssl);
+        }
+        shutdown(dst->socket, SHUT_WR);
+    }
+    return (trans > 0) ? trans : 0;
+}
+
+/**
+ * Lua Function
+ * Relay data between two sockets in both directions until both of them are closed
+ * Plain TCP sockets are relayed with splice(), also into sockets with kernel TLS, encrypted sockets are copied through a buffer.
+ * Blocks the calling thread, non-blocking sockets are switched back to non-blocking mode afterwards.
+ * @param1 [Multisocket] a (TCP)
+ * @param2 [Multisocket] b (TCP)
+ * @param3 [Table] options (optional)
+ *         timeout = [Number] idle timeout in seconds (default = unlimited)
+ *         pipeSize = [Integer] size of the pipes in bytes (default = system default)
+ * @return1 [Integer] bytes a -> b / nil
+ * @return2 [Integer] bytes b -> a / [String] error
+ * @return3 nil / [Integer] bytes a -> b
+ * @return4 nil / [Integer] bytes b -> a
+ */
+static int multi_relay(lua_State *L) {
+    // Check if there are two or three parameters and if they have valid values
+    if (lua_gettop(L) != 2 && lua_gettop(L) != 3) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_testudata(L, 1, "multisocket_tcp")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [Multisocket] a (TCP)");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 2) || !luaL_testudata(L, 2, "multisocket_tcp") ||
+               lua_touserdata(L, 1) == lua_touserdata(L, 2)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #2 has to be [Multisocket] b (TCP)");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isnoneornil(L, 3) && !lua_istable(L, 3)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #3 has to be [Table] options");
+        return 2; // Return nil, [String] error
+    }
+
+    Multisocket *a = (Multisocket *) lua_touserdata(L, 1);
+    Multisocket *b = (Multisocket *) lua_touserdata(L, 2);
+    if (!a->conn || !b->conn) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Both sockets have to be connected");
+        return 2; // Return nil, [String] error
+    }
+
+    int timeout = -1;
+    int pipeSize = 0;
+    if (lua_istable(L, 3)) {
+        if (lua_getfield(L, 3, "timeout") != LUA_TNIL) {
+            if (!lua_isnumber(L, -1) || lua_tonumber(L, -1) < 0) {
+                lua_pushnil(L);
+                lua_pushstring(L, "Option timeout has to be [Number] timeout");
+                return 2; // Return nil, [String] error
+            }
+            timeout = (int) (lua_tonumber(L, -1) * 1000);
+        }
+        if (lua_getfield(L, 3, "pipeSize") != LUA_TNIL) {
+            if (!lua_isinteger(L, -1) || lua_tointeger(L, -1) <= 0) {
+                lua_pushnil(L);
+                lua_pushstring(L, "Option pipeSize has to be [Integer] pipeSize");
+                return 2; // Return nil, [String] error
+            }
+            pipeSize = (int) lua_tointeger(L, -1);
+        }
+        lua_pop(L, 2);
+    }
+
+    // Both sockets are switched to non-blocking mode while relaying
+    int flagsA = fcntl(a->socket, F_GETFL, 0);
+    int flagsB = fcntl(b->socket, F_GETFL, 0);
+    fcntl(a->socket, F_SETFL, flagsA | O_NONBLOCK);
+    fcntl(b->socket, F_SETFL, flagsB | O_NONBLOCK);
+
+    MultiRelay dirs[2];
+    multi_relay_init(&dirs[0], a, b, pipeSize);
+    multi_relay_init(&dirs[1], b, a, pipeSize);
+
+    const char *error = NULL;
+    Multisocket *errSock = NULL;
+    long errRet = 0;
+    int errNo = 0;
+    while (!dirs[0].done || !dirs[1].done) {
+        struct pollfd ufds[2];
+        ufds[0].fd = a->socket;
+        ufds[1].fd = b->socket;
+        // The events of a socket are shared by both directions, each one only reads if it polled the source itself
+        short srcEvents[2] = {0, 0};
+        short dstEvents[2] = {0, 0};
+        int ready = multi_relay_events(&dirs[0], &srcEvents[0], &dstEvents[0]);
+        ready |= multi_relay_events(&dirs[1], &srcEvents[1], &dstEvents[1]);
+        ufds[0].events = srcEvents[0] | dstEvents[1];
+        ufds[1].events = srcEvents[1] | dstEvents[0];
+
+        int num = poll(ufds, 2, ready ? 0 : timeout);
+        if (num == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            errNo = errno;
+            break;
+        } else if (num == 0 && !ready) {
+            error = "timeout";
+            break;
+        }
+
+        for (int i = 0; i < 2 && errNo == 0 && errSock == NULL; i++) {
+            MultiRelay *dir = &dirs[i];
+            short srcRevents = ufds[i].revents & (srcEvents[i] | POLLHUP | POLLERR);
+            short dstRevents = ufds[1 - i].revents & (dstEvents[i] | POLLHUP | POLLERR);
+            long ret = 0;
+            if (!dir->done && !dir->eof && srcEvents[i] != 0 &&
+                (srcRevents || (dir->src->enc && SSL_pending(dir->src->ssl) > 0))) {
+                if (multi_relay_read(dir, &ret) < 0) {
+                    errSock = dir->src;
+                    errRet = ret;
+                    errNo = errno;
+                    break;
+                }
+            }
+            if (!dir->done && (dstRevents || dir->eof)) {
+                if (multi_relay_write(dir, &ret) < 0) {
+                    errSock = dir->dst;
+                    errRet = ret;
+                    errNo = errno;
+                    break;
+                }
+            }
+        }
+        if (errNo != 0 || errSock != NULL) {
+            break;
+        }
+    }
+
+    multi_relay_free(&dirs[0]);
+    multi_relay_free(&dirs[1]);
+    fcntl(a->socket, F_SETFL, flagsA);
+    fcntl(b->socket, F_SETFL, flagsB);
+
+    if (error != NULL || errNo != 0 || errSock != NULL) {
+        lua_pushnil(L);
+        if (error != NULL) {
+            lua_pushstring(L, error);
+        } else if (errSock != NULL) {
+            errno = errNo;
+            if (errno == EPIPE) {
+                lua_pushstring(L, "closed");
+            } else {
+                multi_buffer_error(L, errSock, errRet);
+            }
+        } else {
+            lua_pushstring(L, strerror(errNo));
+        }
+        lua_pushinteger(L, dirs[0].bytes);
+        lua_pushinteger(L, dirs[1].bytes);
+        return 4; // Return nil, [String] error, [Integer] bytes a -> b, [Integer] bytes b -> a
+    }
+
+    lua_pushinteger(L, dirs[0].bytes);
+    lua_pushinteger(L, dirs[1].bytes);
+    return 2; // Return [Integer] bytes a -> b, [Integer] bytes b -> a
+}
@@ -0,0 +1,801 @@
+/**
+ * Result of a lookup, either cached or fresh from a resolver thread
+ */
+typedef struct {
+    /**
+     * 0 = the name was resolved, EAI_* error code otherwise
+     */
+    int error;
+    int count;
+    struct sockaddr_in6 addresses[MULTISOCKET_RESOLVER_ADDRESSES];
+} MultiResolverResult;
+
+/**
+ * A cached positive or negative answer
+ */
+typedef struct MultiResolverEntry {
+    struct MultiResolverEntry *next;
+    char *host;
+    int family;
+    long expires;
+    MultiResolverResult result;
+} MultiResolverEntry;
+
+/**
+ * A lookup running in a resolver thread
+ * It is shared by the thread and the caller, the last one to release it frees it.
+ */
+typedef struct MultiLookup {
+    struct MultiLookup *next;
+
+    /**
+     * Lookups of the same name started in the meantime, they get the same result
+     */
+    struct MultiLookup *followers;
+    char *host;
+    int family;
+
+    /**
+     * eventfd which becomes readable as soon as the lookup has finished
+     */
+    int fd;
+    int refs;
+    int done;
+    long startT;
+    MultiResolverResult result;
+} MultiLookup;
+
+/**
+ * The resolver of the process: cache, queue of pending lookups, threads and counters
+ * It is shared by all Lua states and server workers, everything is protected by the lock.
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    MultiResolverEntry *buckets[MULTISOCKET_RESOLVER_BUCKETS];
+    int entries;
+    MultiLookup *queue;
+    MultiLookup *queueTail;
+    MultiLookup *running;
+    int pending;
+    int threads;
+    int idle;
+
+    /**
+     * Names listed in /etc/hosts and the modification time of the file when they were read
+     */
+    char *hosts;
+    struct timespec hostsT;
+
+    long hits;
+    long negativeHits;
+    long misses;
+    long lookups;
+    long failures;
+    long latency;
+    long maxLatency;
+} multi_resolver = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+
+/**
+ * Hash of a host name and an address family
+ */
+static unsigned multi_resolver_hash(const char *host, int family) {
+    unsigned hash = 2166136261u ^ (unsigned) family;
+    for (; *host != 0; host++) {
+        hash = (hash ^ (unsigned char) (*host | 0x20)) * 16777619u;
+    }
+    return hash % MULTISOCKET_RESOLVER_BUCKETS;
+}
+
+/**
+ * Parse a numeric address, they are neither cached nor sent to a resolver thread
+ * @param host the address
+ * @param family AF_INET6, AF_INET or AF_UNSPEC
+ * @param result the result
+ * @return 1 = numeric address, 0 = host name
+ */
+static int multi_resolver_numeric(const char *host, int family, MultiResolverResult *result) {
+    bzero(result, sizeof(MultiResolverResult));
+    if (family != AF_INET && inet_pton(AF_INET6, host, &result->addresses[0].sin6_addr) == 1) {
+        result->addresses[0].sin6_family = AF_INET6;
+    } else if (family != AF_INET6 && inet_pton(AF_INET, host, &((struct sockaddr_in *) result->addresses)->sin_addr) == 1) {
+        result->addresses[0].sin6_family = AF_INET;
+    } else {
+        return 0;
+    }
+    result->count = 1;
+    return 1;
+}
+
+/**
+ * Look a host name up in the cache, expired entries are removed on the way
+ * The lock has to be held.
+ * @param host the host name
+ * @param family AF_INET6, AF_INET or AF_UNSPEC
+ * @param result the cached result
+ * @return 1 = cached, 0 = not cached
+ */
+static int multi_resolver_cache_get(const char *host, int family, MultiResolverResult *result) {
+    long now = multi_clock_now();
+    MultiResolverEntry **prev = &multi_resolver.buckets[multi_resolver_hash(host, family)];
+    while (*prev != NULL) {
+        MultiResolverEntry *entry = *prev;
+        if (entry->expires <= now) {
+            *prev = entry->next;
+            multi_resolver.entries--;
+            free(entry->host);
+            free(entry);
+            continue;
+        } else if (entry->family == family && strcasecmp(entry->host, host) == 0) {
+            memcpy(result, &entry->result, sizeof(MultiResolverResult));
+            return 1;
+        }
+        prev = &entry->next;
+    }
+    return 0;
+}
+
+/**
+ * Store a result in the cache
+ * If the cache is full, the bucket of the host name is emptied first.
+ * The lock has to be held.
+ * @param host the host name
+ * @param family AF_INET6, AF_INET or AF_UNSPEC
+ * @param result the result
+ * @param ttl time to live in seconds, 0 = do not cache
+ */
+static void multi_resolver_cache_put(const char *host, int family, MultiResolverResult *result, int ttl) {
+    MultiResolverResult old;
+    if (ttl <= 0 || multi_resolver_cache_get(host, family, &old)) {
+        return;
+    }
+    MultiResolverEntry **bucket = &multi_resolver.buckets[multi_resolver_hash(host, family)];
+    while (multi_resolver.entries >= MULTISOCKET_RESOLVER_ENTRIES && *bucket != NULL) {
+        MultiResolverEntry *entry = *bucket;
+        *bucket = entry->next;
+        multi_resolver.entries--;
+        free(entry->host);
+        free(entry);
+    }
+
+    MultiResolverEntry *entry = malloc(sizeof(MultiResolverEntry));
+    if (entry == NULL || (entry->host = strdup(host)) == NULL) {
+        free(entry);
+        return;
+    }
+    entry->family = family;
+    entry->expires = multi_clock_now() + ttl * 1000000000L;
+    memcpy(&entry->result, result, sizeof(MultiResolverResult));
+    entry->next = *bucket;
+    *bucket = entry;
+    multi_resolver.entries++;
+}
+
+/**
+ * Read the names listed in /etc/hosts, they are kept separated and surrounded by spaces
+ * The lock has to be held.
+ */
+static void multi_resolver_hosts_load() {
+    free(multi_resolver.hosts);
+    multi_resolver.hosts = NULL;
+    FILE *file = fopen("/etc/hosts", "re");
+    if (file == NULL) {
+        return;
+    }
+    size_t len = 1;
+    size_t cap = 1024;
+    char *hosts = malloc(cap);
+    if (hosts == NULL) {
+        fclose(file);
+        return;
+    }
+    hosts[0] = ' ';
+
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char *save = NULL;
+        line[strcspn(line, "#")] = 0;
+        char *token = strtok_r(line, " \t\r\n", &save);
+        while (token != NULL && (token = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+            size_t tokenLen = strlen(token);
+            if (len + tokenLen + 2 > cap) {
+                cap = (len + tokenLen + 2) * 2;
+                char *grown = realloc(hosts, cap);
+                if (grown == NULL) {
+                    free(hosts);
+                    fclose(file);
+                    return;
+                }
+                hosts = grown;
+            }
+            memcpy(hosts + len, token, tokenLen);
+            len += tokenLen;
+            hosts[len++] = ' ';
+        }
+    }
+    hosts[len] = 0;
+    fclose(file);
+    multi_resolver.hosts = hosts;
+}
+
+/**
+ * Is the host name listed in /etc/hosts? Such names are left to getaddrinfo().
+ * The file is only read again after it has changed.
+ * @param host the host name
+ * @return 1 = listed, 0 = not listed
+ */
+static int multi_resolver_hosts(const char *host) {
+    struct stat st;
+    if (stat("/etc/hosts", &st) == -1) {
+        return 0;
+    }
+    pthread_mutex_lock(&multi_resolver.lock);
+    if (multi_resolver.hosts == NULL || st.st_mtim.tv_sec != multi_resolver.hostsT.tv_sec
+        || st.st_mtim.tv_nsec != multi_resolver.hostsT.tv_nsec) {
+        multi_resolver_hosts_load();
+        multi_resolver.hostsT = st.st_mtim;
+    }
+    char name[NS_MAXDNAME + 2];
+    snprintf(name, sizeof(name), " %s ", host);
+    int found = multi_resolver.hosts != NULL && strcasestr(multi_resolver.hosts, name) != NULL;
+    pthread_mutex_unlock(&multi_resolver.lock);
+    return found;
+}
+
+/**
+ * Resolve a host name with getaddrinfo(), its answers do not tell their TTL
+ * @param host the host name
+ * @param family AF_INET6, AF_INET or AF_UNSPEC
+ * @param result the result
+ * @return TTL of the result in seconds, 0 = do not cache
+ */
+static int multi_resolver_getaddrinfo(const char *host, int family, MultiResolverResult *result) {
+    struct addrinfo *info, *next;
+    struct addrinfo hint;
+    bzero(&hint, sizeof(hint));
+    hint.ai_family = family;
+    hint.ai_socktype = SOCK_STREAM;
+
+    bzero(result, sizeof(MultiResolverResult));
+    result->error = getaddrinfo(host, NULL, &hint, &info);
+    if (result->error == 0) {
+        for (next = info; next != NULL && result->count < MULTISOCKET_RESOLVER_ADDRESSES; next = next->ai_next) {
+            if (next->ai_family == AF_INET6 || next->ai_family == AF_INET) {
+                memcpy(&result->addresses[result->count++], next->ai_addr, next->ai_addrlen);
+            }
+        }
+        freeaddrinfo(info);
+        return MULTISOCKET_RESOLVER_TTL;
+    }
+    // Temporary failures are not cached, the next lookup should try again
+    return (result->error == EAI_NONAME || result->error == EAI_NODATA) ? MULTISOCKET_RESOLVER_NEGATIVE_TTL : 0;
+}
+
+/**
+ * Ask the DNS for the addresses of one family, their TTL comes from the same answer
+ * Positive answers live as long as their shortest record, negative ones as long as the SOA of the zone
+ * says (RFC 2308).
+ * @param res the resolver state of the calling thread
+ * @param host the host name
+ * @param type ns_t_a / ns_t_aaaa
+ * @param result the addresses of the answer are appended
+ * @param ttl TTL of the answer in seconds, -1 = unknown
+ * @return 0 = answer (with or without addresses), EAI_NONAME = the name does not exist, EAI_AGAIN = no answer
+ */
+static int multi_resolver_dns(res_state res, const char *host, ns_type type, MultiResolverResult *result, int *ttl) {
+    unsigned char query[NS_PACKETSZ];
+    unsigned char answer[MULTISOCKET_RESOLVER_PACKET_SIZE];
+    ns_msg msg;
+    ns_rr rr;
+    *ttl = -1;
+    int len = res_nmkquery(res, ns_o_query, host, ns_c_in, type, NULL, 0, NULL, query, sizeof(query));
+    if (len < 0 || (len = res_nsend(res, query, len, answer, sizeof(answer))) < 0 || ns_initparse(answer, len, &msg) < 0) {
+        return EAI_AGAIN;
+    }
+    int rcode = ns_msg_getflag(msg, ns_f_rcode);
+    if (rcode != ns_r_noerror && rcode != ns_r_nxdomain) {
+        return EAI_AGAIN;
+    }
+
+    long min = -1;
+    int found = 0;
+    for (int i = 0; rcode == ns_r_noerror && i < ns_msg_count(msg, ns_s_an); i++) {
+        if (ns_parserr(&msg, ns_s_an, i, &rr) < 0) {
+            break;
+        } else if (ns_rr_type(rr) == ns_t_a && type == ns_t_a && ns_rr_rdlen(rr) == NS_INADDRSZ) {
+            if (result->count < MULTISOCKET_RESOLVER_ADDRESSES) {
+                struct sockaddr_in *address = (struct sockaddr_in *) &result->addresses[result->count++];
+                address->sin_family = AF_INET;
+                memcpy(&address->sin_addr, ns_rr_rdata(rr), NS_INADDRSZ);
+            }
+            found = 1;
+        } else if (ns_rr_type(rr) == ns_t_aaaa && type == ns_t_aaaa && ns_rr_rdlen(rr) == NS_IN6ADDRSZ) {
+            if (result->count < MULTISOCKET_RESOLVER_ADDRESSES) {
+                struct sockaddr_in6 *address = &result->addresses[result->count++];
+                address->sin6_family = AF_INET6;
+                memcpy(&address->sin6_addr, ns_rr_rdata(rr), NS_IN6ADDRSZ);
+            }
+            found = 1;
+        } else if (ns_rr_type(rr) != ns_t_cname) {
+            continue;
+        }
+        min = (min == -1 || ns_rr_ttl(rr) < min) ? ns_rr_ttl(rr) : min;
+    }
+    if (found) {
+        *ttl = (int) min;
+        return 0;
+    }
+
+    for (int i = 0; i < ns_msg_count(msg, ns_s_ns); i++) {
+        if (ns_parserr(&msg, ns_s_ns, i, &rr) < 0) {
+            break;
+        } else if (ns_rr_type(rr) != ns_t_soa) {
+            continue;
+        }
+        // Skip MNAME and RNAME, MINIMUM is the last of the five numbers following them
+        char name[NS_MAXDNAME];
+        const unsigned char *data = ns_rr_rdata(rr);
+        for (int n = 0; n < 2 && data != NULL; n++) {
+            int skip = dn_expand(ns_msg_base(msg), ns_msg_end(msg), data, name, sizeof(name));
+            data = (skip < 0) ? NULL : data + skip;
+        }
+        if (data != NULL && data + 5 * NS_INT32SZ <= ns_rr_rdata(rr) + ns_rr_rdlen(rr)) {
+            long minimum = ns_get32(data + 4 * NS_INT32SZ);
+            *ttl = (int) ((minimum < ns_rr_ttl(rr)) ? minimum : ns_rr_ttl(rr));
+        }
+        break;
+    }
+    return (rcode == ns_r_nxdomain) ? EAI_NONAME : 0;
+}
+
+/**
+ * Resolve a host name, called by the resolver threads
+ * The DNS is asked once per address family, names from /etc/hosts, names completed by the search domains
+ * and addresses are left to getaddrinfo().
+ * @param res the resolver state of the calling thread
+ * @param host the host name
+ * @param family AF_INET6, AF_INET or AF_UNSPEC
+ * @param result the result
+ * @return TTL of the result in seconds, 0 = do not cache
+ */
+static int multi_resolver_query(res_state res, const char *host, int family, MultiResolverResult *result) {
+    int dots = 0;
+    for (const char *next = host; *next != 0; next++) {
+        dots += (*next == '.');
+    }
+    // An address of the other family is no name the DNS knows
+    if (dots < res->ndots || strlen(host) >= NS_MAXDNAME || multi_resolver_numeric(host, AF_UNSPEC, result)
+        || multi_resolver_hosts(host)) {
+        return multi_resolver_getaddrinfo(host, family, result);
+    }
+
+    bzero(result, sizeof(MultiResolverResult));
+    ns_type types[2] = {(family == AF_INET) ? ns_t_a : ns_t_aaaa, (family == AF_UNSPEC) ? ns_t_a : ns_t_invalid};
+    int ttl = -1;
+    int again = 0;
+    int missing = 0;
+    for (int i = 0; i < 2 && types[i] != ns_t_invalid && !missing; i++) {
+        int answerTtl;
+        int error = multi_resolver_dns(res, host, types[i], result, &answerTtl);
+        again |= (error == EAI_AGAIN);
+        missing = (error == EAI_NONAME);
+        ttl = (answerTtl != -1 && (ttl == -1 || answerTtl < ttl)) ? answerTtl : ttl;
+    }
+    if (result->count == 0) {
+        result->error = again ? EAI_AGAIN : missing ? EAI_NONAME : EAI_NODATA;
+    }
+
+    // Temporary failures are not cached, the next lookup should try again
+    if (again) {
+        return 0;
+    } else if (ttl == -1) {
+        ttl = (result->count == 0) ? MULTISOCKET_RESOLVER_NEGATIVE_TTL : MULTISOCKET_RESOLVER_TTL;
+    }
+    return (ttl > MULTISOCKET_RESOLVER_MAX_TTL) ? MULTISOCKET_RESOLVER_MAX_TTL : ttl;
+}
+
+/**
+ * Release a lookup, the last reference frees it
+ * The lock has to be held.
+ * @param lookup the lookup
+ */
+static void multi_resolver_unref(MultiLookup *lookup) {
+    if (--lookup->refs == 0) {
+        close(lookup->fd);
+        free(lookup->host);
+        free(lookup);
+    }
+}
+
+/**
+ * Release a lookup, the last reference frees it
+ * @param lookup the lookup
+ */
+static void multi_resolver_release(MultiLookup *lookup) {
+    pthread_mutex_lock(&multi_resolver.lock);
+    multi_resolver_unref(lookup);
+    pthread_mutex_unlock(&multi_resolver.lock);
+}
+
+/**
+ * Find a queued or running lookup of a name
+ * The lock has to be held.
+ * @param host the host name
+ * @param family AF_INET6, AF_INET or AF_UNSPEC
+ * @return the lookup / NULL = none
+ */
+static MultiLookup *multi_resolver_find(const char *host, int family) {
+    for (int i = 0; i < 2; i++) {
+        MultiLookup *lookup = (i == 0) ? multi_resolver.running : multi_resolver.queue;
+        for (; lookup != NULL; lookup = lookup->next) {
+            if (lookup->family == family && strcasecmp(lookup->host, host) == 0) {
+                return lookup;
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Hand the result to a lookup, update the counters and wake up the caller
+ * The lock has to be held.
+ * @param lookup the lookup
+ * @param result the result
+ */
+static void multi_resolver_complete(MultiLookup *lookup, MultiResolverResult *result) {
+    long latency = multi_clock_monotonic() - lookup->startT;
+    multi_resolver.lookups++;
+    multi_resolver.latency += latency;
+    multi_resolver.maxLatency = (latency > multi_resolver.maxLatency) ? latency : multi_resolver.maxLatency;
+    multi_resolver.failures += (result->error != 0);
+    memcpy(&lookup->result, result, sizeof(MultiResolverResult));
+    lookup->done = 1;
+
+    uint64_t one = 1;
+    write(lookup->fd, &one, sizeof(one));
+    multi_resolver_unref(lookup);
+}
+
+/**
+ * A resolver thread, takes lookups from the queue until the process ends
+ */
+static void *multi_resolver_thread(void *arg) {
+    (void) arg;
+    struct __res_state res;
+    bzero(&res, sizeof(res));
+    res_ninit(&res);
+
+    pthread_mutex_lock(&multi_resolver.lock);
+    while (1) {
+        while (multi_resolver.queue == NULL) {
+            multi_resolver.idle++;
+            pthread_cond_wait(&multi_resolver.cond, &multi_resolver.lock);
+            multi_resolver.idle--;
+        }
+        MultiLookup *lookup = multi_resolver.queue;
+        multi_resolver.queue = lookup->next;
+        multi_resolver.pending--;
+        if (multi_resolver.queue == NULL) {
+            multi_resolver.queueTail = NULL;
+        }
+        lookup->next = multi_resolver.running;
+        multi_resolver.running = lookup;
+
+        // An earlier lookup of the same name might have finished in the meantime
+        MultiResolverResult result;
+        if (!multi_resolver_cache_get(lookup->host, lookup->family, &result)) {
+            pthread_mutex_unlock(&multi_resolver.lock);
+            int ttl = multi_resolver_query(&res, lookup->host, lookup->family, &result);
+            pthread_mutex_lock(&multi_resolver.lock);
+            multi_resolver_cache_put(lookup->host, lookup->family, &result, ttl);
+        }
+
+        MultiLookup **prev = &multi_resolver.running;
+        while (*prev != lookup) {
+            prev = &(*prev)->next;
+        }
+        *prev = lookup->next;
+
+        MultiLookup *follower = lookup->followers;
+        multi_resolver_complete(lookup, &result);
+        while (follower != NULL) {
+            MultiLookup *next = follower->next;
+            multi_resolver_complete(follower, &result);
+            follower = next;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Look a host name up in the cache and count hits
+ * Numeric addresses are always found.
+ * @param host the host name
+ * @param family AF_INET6, AF_INET or AF_UNSPEC
+ * @param result the result
+ * @return 1 = found, 0 = a lookup has to be started
+ */
+static int multi_resolver_get(const char *host, int family, MultiResolverResult *result) {
+    if (multi_resolver_numeric(host, family, result)) {
+        return 1;
+    }
+    pthread_mutex_lock(&multi_resolver.lock);
+    int found = multi_resolver_cache_get(host, family, result);
+    if (found) {
+        multi_resolver.hits += (result->error == 0);
+        multi_resolver.negativeHits += (result->error != 0);
+    }
+    pthread_mutex_unlock(&multi_resolver.lock);
+    return found;
+}
+
+/**
+ * Start a lookup in a resolver thread, the threads are started on demand
+ * @param host the host name
+ * @param family AF_INET6, AF_INET or AF_UNSPEC
+ * @return the lookup, has to be released / NULL = error, see errno
+ */
+static MultiLookup *multi_resolver_start(const char *host, int family) {
+    MultiLookup *lookup = calloc(1, sizeof(MultiLookup));
+    if (lookup == NULL || (lookup->host = strdup(host)) == NULL) {
+        free(lookup);
+        errno = ENOMEM;
+        return NULL;
+    } else if ((lookup->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1) {
+        free(lookup->host);
+        free(lookup);
+        return NULL;
+    }
+    lookup->family = family;
+    lookup->refs = 2;
+    lookup->startT = multi_clock_monotonic();
+
+    pthread_mutex_lock(&multi_resolver.lock);
+    MultiLookup *same = multi_resolver_find(host, family);
+    if (same != NULL) {
+        // Follow the lookup of the same name instead of asking the DNS twice
+        lookup->next = same->followers;
+        same->followers = lookup;
+        multi_resolver.misses++;
+        pthread_mutex_unlock(&multi_resolver.lock);
+        return lookup;
+    } else if (multi_resolver.threads == 0) {
+        // The threads never end, so the library has to stay loaded after the Lua state has been closed
+        Dl_info info;
+        if (dladdr((void *) multi_resolver_thread, &info) != 0 && info.dli_fname != NULL) {
+            dlopen(info.dli_fname, RTLD_NOW | RTLD_NODELETE);
+        }
+    }
+    if (multi_resolver.pending >= multi_resolver.idle && multi_resolver.threads < MULTISOCKET_RESOLVER_THREADS) {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, multi_resolver_thread, NULL) == 0) {
+            multi_resolver.threads++;
+        }
+        pthread_attr_destroy(&attr);
+    }
+    if (multi_resolver.threads == 0) {
+        pthread_mutex_unlock(&multi_resolver.lock);
+        close(lookup->fd);
+        free(lookup->host);
+        free(lookup);
+        errno = EAGAIN;
+        return NULL;
+    }
+    if (multi_resolver.queueTail != NULL) {
+        multi_resolver.queueTail->next = lookup;
+    } else {
+        multi_resolver.queue = lookup;
+    }
+    multi_resolver.queueTail = lookup;
+    multi_resolver.pending++;
+    multi_resolver.misses++;
+    pthread_cond_signal(&multi_resolver.cond);
+    pthread_mutex_unlock(&multi_resolver.lock);
+    return lookup;
+}
+
+/**
+ * Get the result of a lookup, blocks until the lookup has finished
+ * @param lookup the lookup
+ * @param result the result
+ */
+static void multi_resolver_finish(MultiLookup *lookup, MultiResolverResult *result) {
+    struct pollfd fd = {lookup->fd, POLLIN, 0};
+    pthread_mutex_lock(&multi_resolver.lock);
+    while (!lookup->done) {
+        pthread_mutex_unlock(&multi_resolver.lock);
+        poll(&fd, 1, -1);
+        pthread_mutex_lock(&multi_resolver.lock);
+    }
+    memcpy(result, &lookup->result, sizeof(MultiResolverResult));
+    pthread_mutex_unlock(&multi_resolver.lock);
+}
+
+/**
+ * Push a lookup as Lua userdata, the userdata owns the reference of the caller
+ * @param L the Lua state
+ * @param lookup the lookup
+ */
+static void multi_resolver_push(lua_State *L, MultiLookup *lookup) {
+    MultiLookup **ud = (MultiLookup **) lua_newuserdata(L, sizeof(MultiLookup *));
+    *ud = lookup;
+    luaL_setmetatable(L, "multisocket_lookup");
+}
+
+/**
+ * Yield the running coroutine until a lookup has finished
+ * The coroutine yields the lookup and "r", the scheduler waits for the eventfd of the lookup.
+ * Has to be used as return expression of a Lua function.
+ * @param L the Lua state
+ * @param lookup the lookup, is pushed on the stack
+ * @param ctx the context passed to the continuation
+ * @param k the continuation
+ */
+static int multi_resolver_yield(lua_State *L, MultiLookup *lookup, lua_KContext ctx, lua_KFunction k) {
+    multi_resolver_push(L, lookup);
+    lua_pushvalue(L, -1);
+    lua_pushstring(L, "r");
+    return lua_yieldk(L, 2, ctx, k); // Yield [Lookup] lookup, [String] events
+}
+
+/**
+ * Lua Method
+ * __gc of a lookup
+ * @param0 [Lookup] lookup
+ */
+static int multi_resolver_gc(lua_State *L) {
+    MultiLookup **ud = (MultiLookup **) luaL_checkudata(L, 1, "multisocket_lookup");
+    if (*ud != NULL) {
+        multi_resolver_release(*ud);
+        *ud = NULL;
+    }
+    return 0;
+}
+
+/**
+ * Push a result as table of addresses or nil and the error
+ * @param L the Lua state
+ * @param result the result
+ * @return number of pushed values
+ */
+static int multi_resolver_push_result(lua_State *L, MultiResolverResult *result) {
+    if (result->error != 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, gai_strerror(result->error));
+        return 2; // Return nil, [String] error
+    }
+    char buffer[INET6_ADDRSTRLEN];
+    lua_createtable(L, result->count, 0);
+    for (int i = 0; i < result->count; i++) {
+        struct sockaddr_in6 *address = &result->addresses[i];
+        if (address->sin6_family == AF_INET6) {
+            inet_ntop(AF_INET6, &address->sin6_addr, buffer, sizeof(buffer));
+        } else {
+            inet_ntop(AF_INET, &((struct sockaddr_in *) address)->sin_addr, buffer, sizeof(buffer));
+        }
+        lua_pushstring(L, buffer);
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 1; // Return [Table] addresses
+}
+
+/**
+ * Lua Function
+ * Resolve a host name to its addresses
+ * Answers are cached as long as their TTL allows. On a cache miss a resolver thread does the lookup,
+ * a task of a scheduler yields the lookup and "r" meanwhile, so the scheduler keeps running other tasks.
+ * Everything else, including other coroutines, waits for the lookup.
+ * @param1 [String] host
+ * @param2 [Integer] version (6 / 4, optional, default = both)
+ * @return1 [Table] addresses / nil
+ * @return2 nil / [String] error
+ */
+static int multi_resolve_k(lua_State *L, int status, lua_KContext ctx);
+static int multi_scheduler_in_task(lua_State *L);
+
+static int multi_resolve(lua_State *L) {
+    // Check if there are one or two parameters and if they have valid values
+    if (lua_gettop(L) != 1 && lua_gettop(L) != 2) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (lua_type(L, 1) != LUA_TSTRING || lua_rawlen(L, 1) == 0 || lua_rawlen(L, 1) >= NS_MAXDNAME) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [String] host");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isnoneornil(L, 2) && (!lua_isinteger(L, 2) || (lua_tointeger(L, 2) != 6 && lua_tointeger(L, 2) != 4))) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #2 has to be [Integer] version (6 / 4)");
+        return 2; // Return nil, [String] error
+    }
+
+    const char *host = lua_tostring(L, 1);
+    int family = lua_isnoneornil(L, 2) ? AF_UNSPEC : (lua_tointeger(L, 2) == 6) ? AF_INET6 : AF_INET;
+
+    MultiResolverResult result;
+    if (!multi_resolver_get(host, family, &result)) {
+        MultiLookup *lookup = multi_resolver_start(host, family);
+        if (lookup == NULL) {
+            lua_pushnil(L);
+            lua_pushstring(L, strerror(errno));
+            return 2; // Return nil, [String] error
+        } else if (multi_scheduler_in_task(L)) {
+            lua_settop(L, 2);
+            return multi_resolver_yield(L, lookup, 0, multi_resolve_k);
+        }
+        multi_resolver_finish(lookup, &result);
+        multi_resolver_release(lookup);
+    }
+    return multi_resolver_push_result(L, &result);
+}
+
+/**
+ * Continuation of multi_resolve() after the lookup has finished
+ */
+static int multi_resolve_k(lua_State *L, int status, lua_KContext ctx) {
+    (void) status;
+    (void) ctx;
+    MultiLookup **ud = (MultiLookup **) lua_touserdata(L, 3);
+    MultiResolverResult result;
+    multi_resolver_finish(*ud, &result);
+    lua_settop(L, 2);
+    return multi_resolver_push_result(L, &result);
+}
+
+/**
+ * Lua Function
+ * Get the counters of the resolver
+ * @return1 [Table] statistics (hits, negativeHits, misses, lookups, failures, entries, threads, latency and maxLatency in seconds)
+ */
+static int multi_get_resolver_statistics(lua_State *L) {
+    pthread_mutex_lock(&multi_resolver.lock);
+    long hits = multi_resolver.hits, negativeHits = multi_resolver.negativeHits, misses = multi_resolver.misses;
+    long lookups = multi_resolver.lookups;
+    long failures = multi_resolver.failures, latency = multi_resolver.latency, maxLatency = multi_resolver.maxLatency;
+    int entries = multi_resolver.entries, threads = multi_resolver.threads;
+    pthread_mutex_unlock(&multi_resolver.lock);
+
+    lua_createtable(L, 0, 9);
+    lua_pushinteger(L, hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushinteger(L, negativeHits);
+    lua_setfield(L, -2, "negativeHits");
+    lua_pushinteger(L, misses);
+    lua_setfield(L, -2, "misses");
+    lua_pushinteger(L, lookups);
+    lua_setfield(L, -2, "lookups");
+    lua_pushinteger(L, failures);
+    lua_setfield(L, -2, "failures");
+    lua_pushinteger(L, entries);
+    lua_setfield(L, -2, "entries");
+    lua_pushinteger(L, threads);
+    lua_setfield(L, -2, "threads");
+    lua_pushnumber(L, (lookups > 0) ? (double) latency / (double) lookups / 1000000000.0 : 0.0);
+    lua_setfield(L, -2, "latency");
+    lua_pushnumber(L, (double) maxLatency / 1000000000.0);
+    lua_setfield(L, -2, "maxLatency");
+    return 1; // Return [Table] statistics
+}
+
+/**
+ * Lua Function
+ * Remove all entries from the resolver cache
+ */
+static int multi_clear_resolver_cache(lua_State *L) {
+    (void) L;
+    pthread_mutex_lock(&multi_resolver.lock);
+    for (int i = 0; i < MULTISOCKET_RESOLVER_BUCKETS; i++) {
+        while (multi_resolver.buckets[i] != NULL) {
+            MultiResolverEntry *entry = multi_resolver.buckets[i];
+            multi_resolver.buckets[i] = entry->next;
+            free(entry->host);
+            free(entry);
+        }
+    }
+    multi_resolver.entries = 0;
+    pthread_mutex_unlock(&multi_resolver.lock);
+    return 0;
+}
@@ -0,0 +1,1243 @@
+/**
+ * A task of the scheduler which is ready to be resumed
+ */
+typedef struct {
+    /**
+     * Id of the task, key of the coroutine in the task table
+     */
+    lua_Integer id;
+
+    /**
+     * Number of values on the coroutine stack passed to lua_resume()
+     */
+    int nargs;
+} MultiTask;
+
+/**
+ * The tasks waiting for a filedescriptor in the epoll instance of a scheduler, 0 = none
+ */
+typedef struct {
+    lua_Integer reader;
+    lua_Integer writer;
+} MultiWatch;
+
+/**
+ * Scheduler identifier: multisocket_scheduler
+ * Runs coroutines and resumes them as soon as the socket they yielded on is ready.
+ * A coroutine waiting on a non-blocking socket yields the socket and "r" or "w",
+ * a running lookup of the resolver yields itself and "r",
+ * any other yield puts the coroutine back into the ready queue.
+ * Deadlines of the waits, sleep() and after() are timers of a timer wheel, so they cost nothing until they expire.
+ */
+typedef struct {
+    /**
+     * Filedescriptor of the epoll instance or of the io_uring, -1 = closed
+     */
+    int epfd;
+
+    /**
+     * The io_uring, NULL = the scheduler uses epoll
+     */
+    MultiUring *ring;
+
+    /**
+     * Registry reference to the table [Integer] id -> [Thread] coroutine
+     */
+    int ref;
+
+    /**
+     * Id of the next spawned task
+     */
+    lua_Integer nextId;
+
+    /**
+     * Number of tasks which have not finished yet
+     */
+    int count;
+
+    /**
+     * Number of tasks waiting for a socket
+     */
+    int waiting;
+
+    /**
+     * Waiting tasks of the epoll instance, indexed by filedescriptor
+     * A reader and a writer can wait for the same socket, it is registered with the union of their events.
+     */
+    MultiWatch *watches;
+    int watchesCap;
+
+    /**
+     * Queue of tasks which are ready to be resumed
+     */
+    MultiTask *ready;
+    int readyLen;
+    int readyCap;
+
+    /**
+     * Timers of the waits with a deadline, of sleeping tasks and of tasks started by after()
+     */
+    MultiTimerWheel wheel;
+
+    /**
+     * Registry reference to the table [Integer] id -> [Multisocket] socket (a wait with a deadline)
+     * / [Integer] timer (a task started by after())
+     */
+    int waitsRef;
+
+    /**
+     * Number of entries of the waits table
+     */
+    int deadlines;
+} MultiScheduler;
+
+/**
+ * Append a task to the ready queue
+ * @param sched the scheduler
+ * @param id id of the task
+ * @param nargs number of values on the coroutine stack
+ * @return 0 = success, -1 = out of memory
+ */
+static int multi_scheduler_push(MultiScheduler *sched, lua_Integer id, int nargs) {
+    if (sched->readyLen == sched->readyCap) {
+        int cap = (sched->readyCap == 0) ? 64 : sched->readyCap * 2;
+        MultiTask *ready = realloc(sched->ready, cap * sizeof(MultiTask));
+        if (ready == NULL) {
+            return -1;
+        }
+        sched->ready = ready;
+        sched->readyCap = cap;
+    }
+    sched->ready[sched->readyLen].id = id;
+    sched->ready[sched->readyLen].nargs = nargs;
+    sched->readyLen++;
+    return 0;
+}
+
+/**
+ * Register a filedescriptor with the events of the tasks waiting for it
+ * The registration is one-shot, so it is disabled as soon as it has fired once.
+ * @param sched the scheduler
+ * @param fd the filedescriptor
+ * @return 0 = success, -1 = error
+ */
+static int multi_scheduler_rearm(MultiScheduler *sched, int fd) {
+    MultiWatch *watch = &sched->watches[fd];
+    struct epoll_event ev;
+    bzero(&ev, sizeof(ev));
+    ev.events = EPOLLONESHOT;
+    ev.events |= (watch->reader != 0) ? EPOLLIN | EPOLLRDHUP : 0;
+    ev.events |= (watch->writer != 0) ? EPOLLOUT : 0;
+    ev.data.u64 = (uint64_t) fd;
+
+    // The filedescriptor stays registered (but disabled) after it has fired once
+    if (epoll_ctl(sched->epfd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+        if (errno != ENOENT || epoll_ctl(sched->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Wait for a socket in the epoll instance of the scheduler
+ * A task which already waits in the same direction is displaced, it has to be woken up by the caller
+ * and retries its operation.
+ * @param sched the scheduler
+ * @param fd the filedescriptor of the socket
+ * @param events MULTISOCKET_POLL_READ / MULTISOCKET_POLL_WRITE
+ * @param id id of the waiting task
+ * @param displaced returns the id of the displaced task, 0 = none
+ * @return 0 = success, -1 = error
+ */
+static int multi_scheduler_watch(MultiScheduler *sched, int fd, int events, lua_Integer id, lua_Integer *displaced) {
+    *displaced = 0;
+    if (fd >= sched->watchesCap) {
+        int cap = (sched->watchesCap == 0) ? 64 : sched->watchesCap;
+        while (cap <= fd) {
+            cap *= 2;
+        }
+        MultiWatch *watches = realloc(sched->watches, cap * sizeof(MultiWatch));
+        if (watches == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        bzero(watches + sched->watchesCap, (cap - sched->watchesCap) * sizeof(MultiWatch));
+        sched->watches = watches;
+        sched->watchesCap = cap;
+    }
+
+    lua_Integer *slot = (events & MULTISOCKET_POLL_WRITE) ? &sched->watches[fd].writer : &sched->watches[fd].reader;
+    lua_Integer previous = *slot;
+    *slot = id;
+    if (multi_scheduler_rearm(sched, fd) != 0) {
+        *slot = previous;
+        return -1;
+    }
+    *displaced = (previous != id) ? previous : 0;
+    return 0;
+}
+
+/**
+ * Stop waiting for a socket in the epoll instance, the other task waiting for it keeps waiting
+ * @param sched the scheduler
+ * @param fd the filedescriptor of the socket
+ * @param id id of the task
+ * @return 1 = the task has waited for the socket, 0 = it has not
+ */
+static int multi_scheduler_unwatch(MultiScheduler *sched, int fd, lua_Integer id) {
+    if (fd < 0 || fd >= sched->watchesCap) {
+        return 0;
+    }
+    MultiWatch *watch = &sched->watches[fd];
+    if (watch->reader == id) {
+        watch->reader = 0;
+    } else if (watch->writer == id) {
+        watch->writer = 0;
+    } else {
+        return 0;
+    }
+    if (watch->reader == 0 && watch->writer == 0) {
+        epoll_ctl(sched->epfd, EPOLL_CTL_DEL, fd, NULL);
+    } else {
+        multi_scheduler_rearm(sched, fd);
+    }
+    return 1;
+}
+
+/**
+ * Wait for a socket with the io_uring of the scheduler
+ * Listeners are served by a multishot accept, plain TCP sockets receive into a provided buffer,
+ * everything else waits with a one-shot poll. The entries are submitted with the next wait.
+ * @param sched the scheduler
+ * @param sock the socket, NULL = a filedescriptor without socket (e.g. a lookup of the resolver)
+ * @param fd the filedescriptor
+ * @param events MULTISOCKET_POLL_READ / MULTISOCKET_POLL_WRITE
+ * @param id id of the waiting task
+ * @param op returns the slot of the operation, -1 = the task waits in the accept queue of the listener
+ * @return 0 = success, 1 = the task is ready already, -1 = error
+ */
+static int multi_scheduler_watch_uring(MultiScheduler *sched, Multisocket *sock, int fd, int events, lua_Integer id, int *op) {
+    MultiUring *ring = sched->ring;
+    *op = -1;
+
+    if (sock != NULL && sock->listen && (events & MULTISOCKET_POLL_READ)) {
+        MultiUringAccept *acc = multi_uring_accept_queue(ring, sock);
+        if (acc == NULL) {
+            errno = ENOMEM;
+            return -1;
+        } else if (acc->fdsLen > 0) {
+            return (multi_scheduler_push(sched, id, 0) == 0) ? 1 : -1;
+        }
+        if (acc->waitersLen == acc->waitersCap) {
+            int cap = (acc->waitersCap == 0) ? 4 : acc->waitersCap * 2;
+            lua_Integer *waiters = realloc(acc->waiters, cap * sizeof(lua_Integer));
+            if (waiters == NULL) {
+                errno = ENOMEM;
+                return -1;
+            }
+            acc->waiters = waiters;
+            acc->waitersCap = cap;
+        }
+        if (!acc->armed) {
+            struct io_uring_sqe *sqe = multi_uring_sqe(ring);
+            if (sqe == NULL) {
+                return -1;
+            }
+            acc->flags = SOCK_CLOEXEC | (sock->nonblock ? SOCK_NONBLOCK : 0);
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = sock->socket;
+            sqe->accept_flags = (unsigned) acc->flags;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->user_data = (unsigned long) acc | 1;
+            acc->armed = 1;
+        }
+        acc->waiters[acc->waitersLen++] = id;
+        return 0;
+    }
+
+    int type = ((events & MULTISOCKET_POLL_READ) && sock != NULL && sock->tcp && !sock->enc && ring->bufRing != NULL) ?
+               MULTISOCKET_URING_RECV : MULTISOCKET_URING_POLL;
+    int slot = multi_uring_op(ring, id, sock, type);
+    if (slot == -1) {
+        errno = ENOMEM;
+        return -1;
+    }
+    struct io_uring_sqe *sqe = multi_uring_sqe(ring);
+    if (sqe == NULL) {
+        ring->ops[slot].next = ring->opsFree;
+        ring->opsFree = slot;
+        return -1;
+    }
+
+    *op = slot;
+    sqe->fd = fd;
+    sqe->user_data = ((unsigned long) slot + 1) << 1;
+    if (type == MULTISOCKET_URING_RECV) {
+        // A waiting connection does not need its own buffer, the kernel picks one as soon as data arrives
+        if (sock->rbufLen == 0) {
+            multi_buffer_free(sock);
+        }
+        sqe->opcode = IORING_OP_RECV;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+    } else {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = (events & MULTISOCKET_POLL_WRITE) ? POLLOUT : POLLIN | POLLRDHUP;
+    }
+    return 0;
+}
+
+/**
+ * Wake up all tasks waiting for a connection of an accept queue
+ * @param sched the scheduler
+ * @param acc the accept queue
+ * @return 0 = success, -1 = out of memory
+ */
+static int multi_scheduler_wake_accept(MultiScheduler *sched, MultiUringAccept *acc) {
+    for (int i = 0; i < acc->waitersLen; i++) {
+        if (multi_scheduler_push(sched, acc->waiters[i], 0) != 0) {
+            return -1;
+        }
+        sched->waiting--;
+    }
+    acc->waitersLen = 0;
+    return 0;
+}
+
+/**
+ * Submit the queued entries of the io_uring and reap the completions
+ * @param sched the scheduler
+ * @param timeout maximum time to wait in milliseconds, -1 = unlimited, 0 = do not wait
+ * @return 0 = success, -1 = error (see errno)
+ */
+static int multi_scheduler_wait_uring(MultiScheduler *sched, int timeout) {
+    MultiUring *ring = sched->ring;
+    if (multi_uring_enter(ring, timeout) != 0) {
+        return -1;
+    }
+
+    int ret = 0;
+    unsigned head = *ring->cqHead;
+    unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail && ret == 0; head++) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cqMask];
+        unsigned long data = (unsigned long) cqe->user_data;
+        if (data == 0) {
+            continue; // Cancellation
+        }
+
+        if (data & 1) {
+            MultiUringAccept *acc = (MultiUringAccept *) (data & ~1UL);
+            if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                acc->armed = 0;
+            }
+            if (cqe->res >= 0 && acc->sock == NULL) {
+                close(cqe->res);
+            } else if (cqe->res >= 0) {
+                if (acc->fdsLen == acc->fdsCap) {
+                    int cap = (acc->fdsCap == 0) ? 16 : acc->fdsCap * 2;
+                    int *fds = realloc(acc->fds, cap * sizeof(int));
+                    if (fds == NULL) {
+                        close(cqe->res);
+                        errno = ENOMEM;
+                        ret = -1;
+                        continue;
+                    }
+                    acc->fds = fds;
+                    acc->fdsCap = cap;
+                }
+                acc->fds[acc->fdsLen++] = cqe->res;
+            }
+            // Failed accepts wake the waiters too, accept() reports the error of the listener
+            if (multi_scheduler_wake_accept(sched, acc) != 0) {
+                errno = ENOMEM;
+                ret = -1;
+            }
+            continue;
+        }
+
+        int slot = (int) (data >> 1) - 1;
+        MultiUringOp op = ring->ops[slot];
+        ring->ops[slot].next = ring->opsFree;
+        ring->opsFree = slot;
+
+        if (op.type == MULTISOCKET_URING_RECV && (cqe->flags & IORING_CQE_F_BUFFER)) {
+            unsigned short bid = (unsigned short) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            if (cqe->res > 0) {
+                Multisocket *sock = op.sock;
+                if (multi_buffer_reserve(sock, (size_t) cqe->res) == 0) {
+                    memcpy(sock->rbuf + sock->rbufPos + sock->rbufLen,
+                           ring->bufs + (size_t) bid * MULTISOCKET_URING_BUFFER_SIZE, (size_t) cqe->res);
+                    sock->rbufLen += cqe->res;
+                    sock->rbufNew = 1;
+                    sock->recB += cqe->res;
+                    multi_metrics_count(MULTISOCKET_METRIC_RECEIVED, cqe->res);
+                    sock->lastT = multi_clock_now();
+                    multi_poller_mark(sock);
+                } else {
+                    errno = ENOMEM;
+                    ret = -1;
+                }
+            }
+            multi_uring_recycle(ring, bid);
+        }
+        // The receive is retried by the task, so end of file and errors are reported there
+        if (multi_scheduler_push(sched, op.id, 0) != 0) {
+            errno = ENOMEM;
+            ret = -1;
+        }
+        sched->waiting--;
+    }
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    return ret;
+}
+
+/**
+ * Arm the timer of a task which waits for a socket
+ * The deadline is the timeout of the socket, or the idle timeout counted from the last connection signal
+ * if it ends earlier. Listeners wait for connections, so their idle timeout is only passed on to the connections.
+ * Expects the socket on the top of the stack and pops it
+ * @param L the Lua state
+ * @param sched the scheduler
+ * @param waits stack index of the waits table
+ * @param sock the socket
+ * @param op the io_uring operation of the wait, -1 = none
+ * @param id id of the waiting task
+ * @return 0 = success, -1 = out of memory
+ */
+static int multi_scheduler_arm(lua_State *L, MultiScheduler *sched, int waits, Multisocket *sock, int op, lua_Integer id) {
+    long idle = sock->listen ? 0 : sock->idleTimeout;
+    if ((sock->timeout == 0 && idle == 0) || sock->timer != 0) {
+        lua_pop(L, 1);
+        return 0;
+    }
+
+    long deadline = multi_clock_now() + sock->timeout;
+    if (idle > 0 && (sock->timeout == 0 || sock->lastT + idle < deadline)) {
+        deadline = sock->lastT + idle;
+    }
+    int index = multi_timer_add(&sched->wheel, deadline, id, sock);
+    if (index == -1) {
+        lua_pop(L, 1);
+        errno = ENOMEM;
+        return -1;
+    }
+    sched->wheel.timers[index].slot = op;
+    sock->timer = index + 1;
+
+    // The waits table keeps the socket alive until the task has been resumed
+    lua_rawseti(L, waits, id);
+    sched->deadlines++;
+    return 0;
+}
+
+/**
+ * Cancel the timer of a task which has been woken up by its socket
+ * @param L the Lua state
+ * @param sched the scheduler
+ * @param waits stack index of the waits table
+ * @param id id of the task
+ */
+static void multi_scheduler_disarm_task(lua_State *L, MultiScheduler *sched, int waits, lua_Integer id) {
+    if (lua_rawgeti(L, waits, id) == LUA_TUSERDATA) {
+        Multisocket *sock = (Multisocket *) lua_touserdata(L, -1);
+        if (sock->timer != 0) {
+            multi_timer_cancel(&sched->wheel, sock->timer - 1);
+            sock->timer = 0;
+        }
+    }
+    lua_pop(L, 1);
+}
+
+/**
+ * Cancel the timers of the tasks which have been woken up by their sockets
+ * @param L the Lua state
+ * @param sched the scheduler
+ * @param waits stack index of the waits table
+ * @param from index of the first woken task in the ready queue
+ */
+static void multi_scheduler_disarm(lua_State *L, MultiScheduler *sched, int waits, int from) {
+    if (sched->deadlines == 0) {
+        return;
+    }
+    for (int i = from; i < sched->readyLen; i++) {
+        multi_scheduler_disarm_task(L, sched, waits, sched->ready[i].id);
+    }
+}
+
+/**
+ * Wake up the tasks whose timers have expired
+ * A task waiting for a socket stops waiting and the operation it waited for reports "timeout".
+ * With io_uring the pending operation is cancelled, its completion wakes up the task.
+ * @param L the Lua state
+ * @param sched the scheduler
+ * @param waits stack index of the waits table
+ * @return 0 = success, -1 = error (see errno)
+ */
+static int multi_scheduler_expire(lua_State *L, MultiScheduler *sched, int waits) {
+    if (sched->wheel.count == 0) {
+        return 0;
+    }
+    multi_timer_advance(&sched->wheel, multi_clock_now());
+
+    int index;
+    while ((index = multi_timer_pop(&sched->wheel)) != -1) {
+        MultiTimer timer = sched->wheel.timers[index];
+        multi_timer_cancel(&sched->wheel, index);
+
+        Multisocket *sock = timer.sock;
+        if (sock == NULL) {
+            // A sleeping task or a task started by after()
+            if (sched->deadlines > 0) {
+                if (lua_rawgeti(L, waits, timer.id) == LUA_TNUMBER) {
+                    lua_pushnil(L);
+                    lua_rawseti(L, waits, timer.id);
+                    sched->deadlines--;
+                }
+                lua_pop(L, 1);
+            }
+            if (multi_scheduler_push(sched, timer.id, timer.nargs) != 0) {
+                errno = ENOMEM;
+                return -1;
+            }
+            continue;
+        }
+
+        sock->timer = 0;
+        sock->expired = 1;
+        if (sched->ring == NULL) {
+            // Without its registration the socket cannot wake up the task anymore
+            if (!multi_scheduler_unwatch(sched, sock->socket, timer.id)) {
+                continue;
+            }
+        } else if (timer.slot == -1) {
+            MultiUringAccept *acc = sock->accepted;
+            int i = 0;
+            while (acc != NULL && acc->ring == sched->ring && i < acc->waitersLen && acc->waiters[i] != timer.id) {
+                i++;
+            }
+            if (acc == NULL || acc->ring != sched->ring || i == acc->waitersLen) {
+                continue;
+            }
+            memmove(acc->waiters + i, acc->waiters + i + 1, (acc->waitersLen - i - 1) * sizeof(lua_Integer));
+            acc->waitersLen--;
+        } else {
+            struct io_uring_sqe *sqe = multi_uring_sqe(sched->ring);
+            if (sqe == NULL) {
+                return -1;
+            }
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = ((unsigned long) timer.slot + 1) << 1;
+            continue;
+        }
+        if (multi_scheduler_push(sched, timer.id, 0) != 0) {
+            errno = ENOMEM;
+            return -1;
+        }
+        sched->waiting--;
+    }
+    return 0;
+}
+
+/**
+ * Lua Function
+ * Create a new scheduler for coroutines using non-blocking sockets
+ * @param1 [String] backend (optional, "epoll" (default) / "io_uring")
+ * @return1 [Scheduler] scheduler / nil
+ * @return2 nil / [String] error
+ */
+static int multi_scheduler_new(lua_State *L) {
+    if (lua_gettop(L) > 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (lua_gettop(L) == 1 && !lua_isnil(L, 1) && (lua_type(L, 1) != LUA_TSTRING ||
+               (strcmp(lua_tostring(L, 1), "epoll") != 0 && strcmp(lua_tostring(L, 1), "io_uring") != 0))) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [String] backend (\"epoll\" / \"io_uring\")");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiUring *ring = NULL;
+    int epfd;
+    if (lua_type(L, 1) == LUA_TSTRING && strcmp(lua_tostring(L, 1), "io_uring") == 0) {
+        ring = multi_uring_new();
+        if (ring == NULL) {
+            lua_pushnil(L);
+            lua_pushstring(L, strerror(errno));
+            return 2; // Return nil, [String] error
+        }
+        epfd = ring->fd;
+    } else if ((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2; // Return nil, [String] error
+    }
+
+    MultiScheduler *sched = (MultiScheduler *) lua_newuserdata(L, sizeof(MultiScheduler));
+    sched->epfd = epfd;
+    sched->ring = ring;
+    sched->nextId = 1;
+    sched->count = 0;
+    sched->waiting = 0;
+    sched->watches = NULL;
+    sched->watchesCap = 0;
+    sched->ready = NULL;
+    sched->readyLen = 0;
+    sched->readyCap = 0;
+    sched->deadlines = 0;
+    multi_timer_init(&sched->wheel, multi_clock_monotonic());
+
+    lua_newtable(L);
+    sched->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_newtable(L);
+    sched->waitsRef = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    luaL_getmetatable(L, "multisocket_scheduler");
+    lua_setmetatable(L, -2);
+
+    return 1; // Return [Scheduler] scheduler
+}
+
+/**
+ * Mark a coroutine as task of a scheduler
+ * The marks are kept in a table with weak keys in the registry, so finished tasks are collected as before.
+ * @param L the Lua state
+ * @param index stack index of the coroutine
+ */
+static void multi_scheduler_mark(lua_State *L, int index) {
+    index = lua_absindex(L, index);
+    if (!luaL_getsubtable(L, LUA_REGISTRYINDEX, "multisocket_tasks")) {
+        lua_createtable(L, 0, 1);
+        lua_pushstring(L, "k");
+        lua_setfield(L, -2, "__mode");
+        lua_setmetatable(L, -2);
+    }
+    lua_pushvalue(L, index);
+    lua_pushboolean(L, 1);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+}
+
+/**
+ * Is the running coroutine a task of a scheduler?
+ * Only tasks may yield what the scheduler waits for instead of a socket, like lookups of the resolver.
+ * Other coroutines are resumed by code which does not know them, so they have to block.
+ * @param L the Lua state
+ * @return 1 = task, 0 = main thread or other coroutine
+ */
+static int multi_scheduler_in_task(lua_State *L) {
+    if (!lua_isyieldable(L)) {
+        return 0;
+    }
+    int task = 0;
+    if (lua_getfield(L, LUA_REGISTRYINDEX, "multisocket_tasks") == LUA_TTABLE) {
+        lua_pushthread(L);
+        task = (lua_rawget(L, -2) != LUA_TNIL);
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+    return task;
+}
+
+/**
+ * Lua Method
+ * Create a new task, it will be started by the next step() or run()
+ * @param0 [Scheduler] scheduler
+ * @param1 [Function] function
+ * @param2... arguments passed to the function
+ * @return1 [Thread] coroutine / nil
+ * @return2 nil / [String] error
+ */
+static int multi_scheduler_spawn(lua_State *L) {
+    if (lua_gettop(L) < 2) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_scheduler")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Scheduler] scheduler");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isfunction(L, 2)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [Function] function");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiScheduler *sched = (MultiScheduler *) lua_touserdata(L, 1);
+
+    if (sched->epfd == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Scheduler is closed");
+        return 2; // Return nil, [String] error
+    }
+
+    int nargs = lua_gettop(L) - 2;
+    lua_Integer id = sched->nextId;
+    if (multi_scheduler_push(sched, id, nargs) != 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(ENOMEM));
+        return 2; // Return nil, [String] error
+    }
+    sched->nextId++;
+    sched->count++;
+
+    // Move the function and its arguments to the new coroutine
+    lua_State *co = lua_newthread(L);
+    multi_scheduler_mark(L, -1);
+    lua_insert(L, 2);
+    lua_xmove(L, co, nargs + 1);
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, sched->ref);
+    lua_pushvalue(L, 2);
+    lua_rawseti(L, -2, id);
+    lua_pop(L, 1);
+
+    return 1; // Return [Thread] coroutine
+}
+
+/**
+ * Continuation of multi_scheduler_sleep()
+ */
+static int multi_scheduler_sleep_k(lua_State *L, int status, lua_KContext ctx) {
+    (void) status;
+    (void) ctx;
+    lua_pushboolean(L, 1);
+    return 1; // Return [Boolean] success (true)
+}
+
+/**
+ * Lua Method
+ * Suspend the running task for some time, the other tasks keep running
+ * Has to be called by a task of the scheduler.
+ * @param0 [Scheduler] scheduler
+ * @param1 [Number] time (seconds)
+ * @return1 [Boolean] success / nil
+ * @return2 nil / [String] error
+ */
+static int multi_scheduler_sleep(lua_State *L) {
+    if (lua_gettop(L) != 2) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_scheduler")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Scheduler] scheduler");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isnumber(L, 2) || lua_tonumber(L, 2) < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [Number] time (seconds)");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiScheduler *sched = (MultiScheduler *) lua_touserdata(L, 1);
+
+    if (sched->epfd == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Scheduler is closed");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isyieldable(L)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Not called by a task of the scheduler");
+        return 2; // Return nil, [String] error
+    }
+
+    // The scheduler arms a timer for the task when it yields itself and the time
+    return lua_yieldk(L, 2, 0, multi_scheduler_sleep_k); // Yield [Scheduler] scheduler, [Number] time
+}
+
+/**
+ * Lua Method
+ * Create a new task which is started after some time
+ * @param0 [Scheduler] scheduler
+ * @param1 [Number] time (seconds)
+ * @param2 [Function] function
+ * @param3... arguments passed to the function
+ * @return1 [Integer] id (see cancel()) / nil
+ * @return2 nil / [String] error
+ */
+static int multi_scheduler_after(lua_State *L) {
+    if (lua_gettop(L) < 3) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_scheduler")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Scheduler] scheduler");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isnumber(L, 2) || lua_tonumber(L, 2) < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [Number] time (seconds)");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isfunction(L, 3)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #2 has to be [Function] function");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiScheduler *sched = (MultiScheduler *) lua_touserdata(L, 1);
+
+    if (sched->epfd == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Scheduler is closed");
+        return 2; // Return nil, [String] error
+    }
+
+    int nargs = lua_gettop(L) - 3;
+    lua_Integer id = sched->nextId;
+    int index = multi_timer_add(&sched->wheel, multi_clock_now() + (long) (lua_tonumber(L, 2) * 1000000000), id, NULL);
+    if (index == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(ENOMEM));
+        return 2; // Return nil, [String] error
+    }
+    sched->wheel.timers[index].nargs = nargs;
+    sched->nextId++;
+    sched->count++;
+    sched->deadlines++;
+
+    // Move the function and its arguments to the new coroutine
+    lua_State *co = lua_newthread(L);
+    multi_scheduler_mark(L, -1);
+    lua_insert(L, 3);
+    lua_xmove(L, co, nargs + 1);
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, sched->ref);
+    lua_pushvalue(L, 3);
+    lua_rawseti(L, -2, id);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, sched->waitsRef);
+    lua_pushinteger(L, index);
+    lua_rawseti(L, -2, id);
+    lua_pop(L, 2);
+
+    lua_pushinteger(L, id);
+    return 1; // Return [Integer] id
+}
+
+/**
+ * Lua Method
+ * Cancel a task created by after() which has not been started yet
+ * @param0 [Scheduler] scheduler
+ * @param1 [Integer] id
+ * @return1 [Boolean] cancelled (false = the task has been started already)
+ */
+static int multi_scheduler_cancel(lua_State *L) {
+    if (lua_gettop(L) != 2) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_scheduler")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Scheduler] scheduler");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isinteger(L, 2)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [Integer] id");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiScheduler *sched = (MultiScheduler *) lua_touserdata(L, 1);
+    lua_Integer id = lua_tointeger(L, 2);
+
+    if (sched->epfd == -1) {
+        lua_pushboolean(L, 0);
+        return 1; // Return [Boolean] cancelled (false)
+    }
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, sched->waitsRef);
+    if (lua_rawgeti(L, -1, id) != LUA_TNUMBER) {
+        lua_pushboolean(L, 0);
+        return 1; // Return [Boolean] cancelled (false)
+    }
+    multi_timer_cancel(&sched->wheel, (int) lua_tointeger(L, -1));
+    lua_pushnil(L);
+    lua_rawseti(L, -3, id);
+    sched->deadlines--;
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, sched->ref);
+    lua_pushnil(L);
+    lua_rawseti(L, -2, id);
+    sched->count--;
+
+    lua_pushboolean(L, 1);
+    return 1; // Return [Boolean] cancelled (true)
+}
+
+/**
+ * Resume all ready tasks once and wait for sockets
+ * @param L the Lua state, the scheduler has to be argument #0
+ * @param sched the scheduler
+ * @param timeout maximum time to wait for a socket in milliseconds, -1 = unlimited
+ * @return 0 = success, -1 = error (the error message is pushed onto the stack)
+ */
+static int multi_scheduler_step(lua_State *L, MultiScheduler *sched, int timeout) {
+    // The wait ends when the next timer has to be processed
+    if (sched->wheel.count > 0) {
+        int next = multi_timer_timeout(&sched->wheel, multi_clock_monotonic());
+        if (timeout == -1 || next < timeout) {
+            timeout = next;
+        }
+    }
+    if (sched->readyLen > 0) {
+        timeout = 0;
+    }
+
+    int woken = sched->readyLen;
+    if (sched->ring != NULL) {
+        if ((sched->waiting > 0 || timeout > 0 || sched->ring->queued > 0) &&
+            multi_scheduler_wait_uring(sched, (sched->waiting > 0 || timeout > 0) ? timeout : 0) != 0) {
+            lua_pushstring(L, strerror(errno));
+            return -1;
+        }
+    } else if (sched->waiting > 0 || timeout > 0) {
+        struct epoll_event events[MULTISOCKET_POLLER_EVENTS];
+        int num = epoll_wait(sched->epfd, events, MULTISOCKET_POLLER_EVENTS, timeout);
+        if (num == -1 && errno != EINTR) {
+            lua_pushstring(L, strerror(errno));
+            return -1;
+        }
+        for (int i = 0; i < num; i++) {
+            // Readers and writers of the socket are woken up on their own, the other one waits again
+            int fd = (int) events[i].data.u64;
+            MultiWatch *watch = &sched->watches[fd];
+            lua_Integer reader = (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) ? watch->reader : 0;
+            lua_Integer writer = (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) ? watch->writer : 0;
+            if ((reader != 0 && multi_scheduler_push(sched, reader, 0) != 0) ||
+                (writer != 0 && multi_scheduler_push(sched, writer, 0) != 0)) {
+                lua_pushstring(L, strerror(ENOMEM));
+                return -1;
+            }
+            watch->reader = (reader != 0) ? 0 : watch->reader;
+            watch->writer = (writer != 0) ? 0 : watch->writer;
+            sched->waiting -= (reader != 0) + (writer != 0);
+            if (watch->reader != 0 || watch->writer != 0) {
+                multi_scheduler_rearm(sched, fd);
+            }
+        }
+    }
+
+    // Sockets, timers and the resolver use the same time until the end of the step instead of reading the clock
+    multi_clock_update();
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, sched->ref);
+    int tasks = lua_gettop(L);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, sched->waitsRef);
+    int waits = tasks + 1;
+
+    // Tasks woken up by their sockets keep their deadlines no longer, before the expired timers are processed
+    multi_scheduler_disarm(L, sched, waits, woken);
+    if (multi_scheduler_expire(L, sched, waits) != 0) {
+        multi_clock_reset();
+        lua_pop(L, 2);
+        lua_pushstring(L, strerror(errno));
+        return -1;
+    }
+
+    // Tasks which become ready while resuming are resumed in the next step
+    int num = sched->readyLen;
+    for (int i = 0; i < num; i++) {
+        MultiTask task = sched->ready[i];
+
+        lua_rawgeti(L, tasks, task.id);
+        lua_State *co = lua_tothread(L, -1);
+        lua_pop(L, 1);
+        if (co == NULL) {
+            continue;
+        }
+
+        // The socket of a wait with a deadline stays on the stack until the task has been resumed
+        Multisocket *waited = NULL;
+        if (sched->deadlines > 0) {
+            if (lua_rawgeti(L, waits, task.id) == LUA_TUSERDATA) {
+                waited = (Multisocket *) lua_touserdata(L, -1);
+                lua_pushnil(L);
+                lua_rawseti(L, waits, task.id);
+                sched->deadlines--;
+            } else {
+                lua_pop(L, 1);
+            }
+        }
+
+        int status = lua_resume(co, L, task.nargs);
+        if (waited != NULL) {
+            waited->expired = 0;
+            lua_pop(L, 1);
+        }
+        if (status == LUA_YIELD) {
+            int nres = lua_gettop(co);
+            Multisocket *sock = NULL;
+            int fd = -1;
+            int events = 0;
+            double sleep = -1;
+            if (nres >= 2 && lua_type(co, 2) == LUA_TSTRING) {
+                if (multi_is_socket(co, 1)) {
+                    sock = (Multisocket *) lua_touserdata(co, 1);
+                    fd = sock->socket;
+                } else if (luaL_testudata(co, 1, "multisocket_lookup") != NULL) {
+                    // A running lookup of the resolver, its eventfd becomes readable when it has finished
+                    fd = (*(MultiLookup **) lua_touserdata(co, 1))->fd;
+                } else if (luaL_testudata(co, 1, "multisocket_crypto_job") != NULL) {
+                    // A handshake step in a crypto thread, its eventfd becomes readable when it has run
+                    fd = (*(MultiCryptoJob **) lua_touserdata(co, 1))->fd;
+                }
+                events = multi_poller_parse_events(lua_tostring(co, 2));
+            } else if (nres == 2 && lua_touserdata(co, 1) == sched && lua_type(co, 2) == LUA_TNUMBER) {
+                // The task called sleep()
+                sleep = lua_tonumber(co, 2);
+            }
+            if (sock != NULL) {
+                lua_pushvalue(co, 1);
+                lua_xmove(co, L, 1);
+            }
+            lua_settop(co, 0);
+
+            int ret;
+            int op = -1;
+            if (fd != -1 && events != 0 && sched->ring != NULL) {
+                ret = multi_scheduler_watch_uring(sched, sock, fd, events, task.id, &op);
+                sched->waiting += (ret == 0);
+            } else if (fd != -1 && events != 0) {
+                lua_Integer displaced = 0;
+                ret = multi_scheduler_watch(sched, fd, events, task.id, &displaced);
+                sched->waiting += (ret == 0);
+                if (displaced != 0) {
+                    // Another task waited for the same socket in the same direction, it retries its operation
+                    multi_scheduler_disarm_task(L, sched, waits, displaced);
+                    ret = multi_scheduler_push(sched, displaced, 0);
+                    errno = (ret == -1) ? ENOMEM : errno;
+                    sched->waiting--;
+                }
+            } else if (sleep >= 0) {
+                ret = (multi_timer_add(&sched->wheel, multi_clock_now() + (long) (sleep * 1000000000), task.id, NULL) == -1) ? -1 : 0;
+                errno = (ret == -1) ? ENOMEM : errno;
+            } else {
+                ret = multi_scheduler_push(sched, task.id, 0);
+            }
+            if (sock != NULL && ret == 0) {
+                ret = multi_scheduler_arm(L, sched, waits, sock, op, task.id);
+            } else if (sock != NULL) {
+                lua_pop(L, 1);
+            }
+            ret = (ret == 1) ? 0 : ret;
+            if (ret == 0) {
+                continue;
+            }
+            lua_pushstring(L, strerror(errno));
+        } else if (status != LUA_OK) {
+            lua_xmove(co, L, 1);
+        }
+
+        // The task has finished or failed
+        lua_pushnil(L);
+        lua_rawseti(L, tasks, task.id);
+        sched->count--;
+
+        if (status != LUA_OK) {
+            memmove(sched->ready, sched->ready + i + 1, (sched->readyLen - i - 1) * sizeof(MultiTask));
+            sched->readyLen -= i + 1;
+            multi_clock_reset();
+            // Only the error message stays on the stack
+            lua_replace(L, tasks);
+            lua_settop(L, tasks);
+            return -1;
+        }
+    }
+
+    memmove(sched->ready, sched->ready + num, (sched->readyLen - num) * sizeof(MultiTask));
+    sched->readyLen -= num;
+    multi_clock_reset();
+    lua_pop(L, 2);
+    return 0;
+}
+
+/**
+ * Lua Method
+ * Resume all ready tasks once, wait at most timeout seconds for sockets
+ * @param0 [Scheduler] scheduler
+ * @param1 nil / [Number] timeout (seconds)
+ * @return1 [Integer] numTasks / nil
+ * @return2 nil / [String] error
+ */
+static int multi_scheduler_step_lua(lua_State *L) {
+    if (lua_gettop(L) != 1 && lua_gettop(L) != 2) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_scheduler")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Scheduler] scheduler");
+        return 2; // Return nil, [String] error
+    } else if (lua_gettop(L) == 2 && !lua_isnil(L, 2) && (!lua_isnumber(L, 2) || lua_tonumber(L, 2) < 0)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [Number] timeout (seconds)");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiScheduler *sched = (MultiScheduler *) lua_touserdata(L, 1);
+
+    int timeout = -1;
+    if (lua_gettop(L) == 2 && !lua_isnil(L, 2)) {
+        timeout = (int) (lua_tonumber(L, 2) * 1000);
+    }
+
+    if (sched->epfd == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Scheduler is closed");
+        return 2; // Return nil, [String] error
+    } else if (multi_scheduler_step(L, sched, timeout) != 0) {
+        lua_pushnil(L);
+        lua_insert(L, -2);
+        return 2; // Return nil, [String] error
+    }
+
+    lua_pushinteger(L, sched->count);
+    return 1; // Return [Integer] numTasks
+}
+
+/**
+ * Lua Method
+ * Run until all tasks have finished
+ * @param0 [Scheduler] scheduler
+ * @return1 [Boolean] success / nil
+ * @return2 nil / [String] error
+ */
+static int multi_scheduler_run(lua_State *L) {
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_scheduler")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Scheduler] scheduler");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiScheduler *sched = (MultiScheduler *) lua_touserdata(L, 1);
+
+    while (sched->count > 0) {
+        if (sched->epfd == -1) {
+            lua_pushnil(L);
+            lua_pushstring(L, "Scheduler is closed");
+            return 2; // Return nil, [String] error
+        } else if (sched->readyLen == 0 && sched->waiting == 0 && sched->wheel.count == 0) {
+            lua_pushnil(L);
+            lua_pushstring(L, "All tasks are suspended outside of the scheduler");
+            return 2; // Return nil, [String] error
+        } else if (multi_scheduler_step(L, sched, -1) != 0) {
+            lua_pushnil(L);
+            lua_insert(L, -2);
+            return 2; // Return nil, [String] error
+        }
+    }
+
+    lua_pushboolean(L, 1);
+    return 1; // Return [Boolean] success (true)
+}
+
+/**
+ * Lua Method
+ * Get the number of tasks which have not finished yet
+ * @param0 [Scheduler] scheduler
+ * @return1 [Integer] numTasks
+ */
+static int multi_scheduler_count(lua_State *L) {
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_scheduler")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Scheduler] scheduler");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiScheduler *sched = (MultiScheduler *) lua_touserdata(L, 1);
+
+    lua_pushinteger(L, sched->count);
+    return 1; // Return [Integer] numTasks
+}
+
+/**
+ * Lua Method
+ * Get the backend the scheduler waits for sockets with
+ * @param0 [Scheduler] scheduler
+ * @return1 [String] backend ("epoll" / "io_uring")
+ */
+static int multi_scheduler_get_backend(lua_State *L) {
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_scheduler")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Scheduler] scheduler");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiScheduler *sched = (MultiScheduler *) lua_touserdata(L, 1);
+
+    lua_pushstring(L, (sched->ring != NULL) ? "io_uring" : "epoll");
+    return 1; // Return [String] backend
+}
+
+/**
+ * Lua Method
+ * Close the scheduler, unfinished tasks are dropped
+ * Also called by the garbage collector
+ * @param0 [Scheduler] scheduler
+ * @return1 [Boolean] success
+ */
+static int multi_scheduler_close(lua_State *L) {
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_scheduler")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Scheduler] scheduler");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiScheduler *sched = (MultiScheduler *) lua_touserdata(L, 1);
+
+    if (sched->epfd != -1) {
+        // Sockets with an armed timer can wait in another scheduler later
+        lua_rawgeti(L, LUA_REGISTRYINDEX, sched->waitsRef);
+        lua_pushnil(L);
+        while (lua_next(L, -2) != 0) {
+            if (lua_type(L, -1) == LUA_TUSERDATA) {
+                Multisocket *sock = (Multisocket *) lua_touserdata(L, -1);
+                sock->timer = 0;
+                sock->expired = 0;
+            }
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+        luaL_unref(L, LUA_REGISTRYINDEX, sched->waitsRef);
+        luaL_unref(L, LUA_REGISTRYINDEX, sched->ref);
+        multi_timer_free(&sched->wheel);
+        if (sched->ring != NULL) {
+            multi_uring_free(sched->ring);
+        } else {
+            close(sched->epfd);
+        }
+        sched->ring = NULL;
+        free(sched->ready);
+        free(sched->watches);
+        sched->epfd = -1;
+        sched->ref = LUA_NOREF;
+        sched->waitsRef = LUA_NOREF;
+        sched->deadlines = 0;
+        sched->ready = NULL;
+        sched->readyLen = 0;
+        sched->readyCap = 0;
+        sched->watches = NULL;
+        sched->watchesCap = 0;
+        sched->count = 0;
+        sched->waiting = 0;
+    }
+
+    lua_pushboolean(L, 1);
+    return 1; // Return [Boolean] success (true)
+}
@@ -0,0 +1,173 @@
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MULTISOCKET_SEARCH_X86 1
+#endif
+
+/**
+ * Delimiters of at least this length are searched with Horspool by the scalar kernel
+ */
+#define MULTISOCKET_HORSPOOL_MIN 16
+
+/**
+ * Search kernel selected by multi_search_init()
+ * 0 = scalar, 1 = SSE2, 2 = AVX2
+ */
+static int multi_search_level = 0;
+
+/**
+ * Scalar search kernel
+ * Uses memchr() for the first byte of short delimiters and Horspool for long ones
+ * @param data the data to search in
+ * @param size size of the data
+ * @param delim the delimiter
+ * @param delimSize size of the delimiter (> 0)
+ * @return offset of the delimiter, -1 = not found
+ */
+static long multi_search_scalar(const char *data, size_t size, const char *delim, size_t delimSize) {
+    if (size < delimSize) {
+        return -1;
+    }
+
+    if (delimSize < MULTISOCKET_HORSPOOL_MIN) {
+        const char *ptr = data;
+        const char *last = data + size - delimSize;
+        while (ptr <= last) {
+            ptr = memchr(ptr, delim[0], last - ptr + 1);
+            if (ptr == NULL) {
+                return -1;
+            } else if (memcmp(ptr + 1, delim + 1, delimSize - 1) == 0) {
+                return ptr - data;
+            }
+            ptr++;
+        }
+        return -1;
+    }
+
+    size_t skip[256];
+    for (int i = 0; i < 256; i++) {
+        skip[i] = delimSize;
+    }
+    for (size_t i = 0; i < delimSize - 1; i++) {
+        skip[(unsigned char) delim[i]] = delimSize - 1 - i;
+    }
+
+    const unsigned char lastChar = (unsigned char) delim[delimSize - 1];
+    size_t pos = 0;
+    while (pos <= size - delimSize) {
+        unsigned char ch = (unsigned char) data[pos + delimSize - 1];
+        if (ch == lastChar && memcmp(data + pos, delim, delimSize - 1) == 0) {
+            return pos;
+        }
+        pos += skip[ch];
+    }
+    return -1;
+}
+
+#ifdef MULTISOCKET_SEARCH_X86
+
+/**
+ * SSE2 search kernel
+ * Compares the first and the last byte of the delimiter at 16 positions at once,
+ * only positions matching both are verified with memcmp()
+ * @param data the data to search in
+ * @param size size of the data
+ * @param delim the delimiter
+ * @param delimSize size of the delimiter (> 1)
+ * @return offset of the delimiter, -1 = not found
+ */
+__attribute__((target("sse2")))
+static long multi_search_sse2(const char *data, size_t size, const char *delim, size_t delimSize) {
+    const __m128i first = _mm_set1_epi8(delim[0]);
+    const __m128i last = _mm_set1_epi8(delim[delimSize - 1]);
+
+    size_t pos = 0;
+    for (; pos + delimSize + 15 <= size; pos += 16) {
+        __m128i blockFirst = _mm_loadu_si128((const __m128i *) (data + pos));
+        __m128i blockLast = _mm_loadu_si128((const __m128i *) (data + pos + delimSize - 1));
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(blockFirst, first), _mm_cmpeq_epi8(blockLast, last)));
+        while (mask != 0) {
+            unsigned int bit = (unsigned int) __builtin_ctz(mask);
+            if (memcmp(data + pos + bit + 1, delim + 1, delimSize - 2) == 0) {
+                return (long) (pos + bit);
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    long ret = multi_search_scalar(data + pos, size - pos, delim, delimSize);
+    return (ret < 0) ? -1 : ret + (long) pos;
+}
+
+/**
+ * AVX2 search kernel, see multi_search_sse2()
+ * @param data the data to search in
+ * @param size size of the data
+ * @param delim the delimiter
+ * @param delimSize size of the delimiter (> 1)
+ * @return offset of the delimiter, -1 = not found
+ */
+__attribute__((target("avx2")))
+static long multi_search_avx2(const char *data, size_t size, const char *delim, size_t delimSize) {
+    const __m256i first = _mm256_set1_epi8(delim[0]);
+    const __m256i last = _mm256_set1_epi8(delim[delimSize - 1]);
+
+    size_t pos = 0;
+    for (; pos + delimSize + 31 <= size; pos += 32) {
+        __m256i blockFirst = _mm256_loadu_si256((const __m256i *) (data + pos));
+        __m256i blockLast = _mm256_loadu_si256((const __m256i *) (data + pos + delimSize - 1));
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(blockFirst, first), _mm256_cmpeq_epi8(blockLast, last)));
+        while (mask != 0) {
+            unsigned int bit = (unsigned int) __builtin_ctz(mask);
+            if (memcmp(data + pos + bit + 1, delim + 1, delimSize - 2) == 0) {
+                return (long) (pos + bit);
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    long ret = multi_search_sse2(data + pos, size - pos, delim, delimSize);
+    return (ret < 0) ? -1 : ret + (long) pos;
+}
+
+#endif
+
+/**
+ * Select the fastest search kernel supported by the CPU
+ */
+static void multi_search_init() {
+#ifdef MULTISOCKET_SEARCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        multi_search_level = 2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        multi_search_level = 1;
+    }
+#endif
+}
+
+/**
+ * Find the first occurrence of a delimiter in the data
+ * @param data the data to search in
+ * @param size size of the data
+ * @param delim the delimiter
+ * @param delimSize size of the delimiter (> 0)
+ * @return offset of the delimiter, -1 = not found
+ */
+static long multi_search(const char *data, size_t size, const char *delim, size_t delimSize) {
+    if (size < delimSize) {
+        return -1;
+    } else if (delimSize == 1) {
+        const char *ptr = memchr(data, delim[0], size);
+        return (ptr == NULL) ? -1 : ptr - data;
+    }
+#ifdef MULTISOCKET_SEARCH_X86
+    if (multi_search_level == 2) {
+        return multi_search_avx2(data, size, delim, delimSize);
+    } else if (multi_search_level == 1) {
+        return multi_search_sse2(data, size, delim, delimSize);
+    }
+#endif
+    return multi_search_scalar(data, size, delim, delimSize);
+}
@@ -0,0 +1,642 @@
+/**
+ * Default backlog of the listeners of a server
+ */
+#define MULTISOCKET_SERVER_BACKLOG 128
+
+int luaopen_multisocket(lua_State *L);
+
+struct MultiServer;
+
+/**
+ * A worker thread of a server
+ * Every worker has its own Lua state, listener and scheduler
+ */
+typedef struct {
+    struct MultiServer *server;
+    pthread_t thread;
+    int index;
+
+    /**
+     * Filedescriptor of the listener, -1 = not created yet
+     */
+    int listener;
+
+    /**
+     * 0 = starting, 1 = running, -1 = failed to start
+     */
+    int state;
+    char error[256];
+} MultiWorker;
+
+/**
+ * Server identifier: multisocket_server
+ * Runs a handler for every connection in several worker threads.
+ * Every worker binds its own listener with SO_REUSEPORT, the kernel spreads the connections across them.
+ */
+typedef struct MultiServer {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    MultiWorker *workers;
+    int threads;
+    int started;
+    int stopping;
+    int open;
+
+    char *address;
+    unsigned short port;
+    int backlog;
+    int ipv6;
+
+    /**
+     * Do the schedulers of the workers use io_uring instead of epoll?
+     */
+    int uring;
+
+    /**
+     * Queue length for TCP Fast Open connections of every listener, 0 = disabled
+     */
+    int fastOpen;
+
+    /**
+     * Lua source or path of the chunk which returns the handler
+     */
+    char *chunk;
+    int isFile;
+
+    /**
+     * package.path and package.cpath of the Lua state which created the server
+     */
+    char *path;
+    char *cpath;
+} MultiServer;
+
+/**
+ * Copy a string to the heap
+ * @param str the string, may be NULL
+ * @return the copy, NULL = str is NULL or out of memory
+ */
+static char *multi_server_strdup(const char *str) {
+    if (str == NULL) {
+        return NULL;
+    }
+    size_t len = strlen(str) + 1;
+    char *copy = (char *) malloc(len);
+    if (copy != NULL) {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+/**
+ * Spawn a handler task for the connection accepted by multi_server_accept()
+ * Expects the results of multi_tcp_accept() on the top of the stack and pops them
+ * @param L the Lua state of the acceptor task
+ */
+static void multi_server_spawn(lua_State *L) {
+    if (!lua_isnil(L, -2)) {
+        lua_pushcfunction(L, multi_scheduler_spawn);
+        lua_pushvalue(L, lua_upvalueindex(1));
+        lua_pushvalue(L, lua_upvalueindex(2));
+        lua_pushvalue(L, -5);
+        lua_call(L, 3, 0);
+    }
+    lua_pop(L, 2);
+}
+
+/**
+ * Continuation of multi_server_handle()
+ * A failed handler leaves its connection open, so it is closed before the error is raised again
+ */
+static int multi_server_handle_k(lua_State *L, int status, lua_KContext ctx) {
+    (void) ctx;
+    if (status != LUA_OK && status != LUA_YIELD) {
+        Multisocket *client = (Multisocket *) lua_touserdata(L, 1);
+        if (client->socket != -1) {
+            multi_tcp_release(L, client);
+        }
+        return lua_error(L);
+    }
+    return 0;
+}
+
+/**
+ * Handler task of a connection
+ * Upvalues: [Function] handler
+ * @param0 [Multisocket] client
+ */
+static int multi_server_handle(lua_State *L) {
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_pushvalue(L, 1);
+    return multi_server_handle_k(L, lua_pcallk(L, 1, 0, 0, 0, multi_server_handle_k), 0);
+}
+
+/**
+ * Continuation of multi_server_accept()
+ * ctx 0 = the results of multi_tcp_accept() are on the stack,
+ * ctx 1 = the task is started or resumed after an accept failed and it yielded to let the other tasks run
+ */
+static int multi_server_accept_k(lua_State *L, int status, lua_KContext ctx) {
+    (void) status;
+    MultiWorker *worker = (MultiWorker *) lua_touserdata(L, lua_upvalueindex(4));
+    if (ctx == 1) {
+        if (worker->server->stopping) {
+            return 0;
+        }
+    } else {
+        if (lua_isnil(L, -2) && worker->server->stopping) {
+            return 0;
+        }
+        int failed = lua_isnil(L, -2);
+        multi_server_spawn(L);
+        if (failed) {
+            return lua_yieldk(L, 0, 1, multi_server_accept_k);
+        }
+    }
+
+    while (1) {
+        lua_pushcfunction(L, multi_tcp_accept);
+        lua_pushvalue(L, lua_upvalueindex(3));
+        lua_callk(L, 1, 2, 0, multi_server_accept_k);
+        if (lua_isnil(L, -2)) {
+            return multi_server_accept_k(L, LUA_OK, 0);
+        }
+        multi_server_spawn(L);
+    }
+}
+
+/**
+ * Acceptor task of a worker
+ * Upvalues: [Scheduler] scheduler, [Function] handler, [Multisocket] listener, worker (light userdata)
+ */
+static int multi_server_accept(lua_State *L) {
+    return multi_server_accept_k(L, LUA_OK, 1);
+}
+
+/**
+ * Stop a worker during its start and report the error on the top of the stack
+ * @param L the Lua state of the worker
+ * @param worker the worker
+ */
+static void multi_server_fail(lua_State *L, MultiWorker *worker) {
+    const char *error = lua_tostring(L, -1);
+    pthread_mutex_lock(&worker->server->lock);
+    snprintf(worker->error, sizeof(worker->error), "%s", (error != NULL) ? error : "Unknown error");
+    worker->state = -1;
+    pthread_cond_broadcast(&worker->server->cond);
+    pthread_mutex_unlock(&worker->server->lock);
+}
+
+/**
+ * Main function of a worker thread
+ * @param arg the worker
+ */
+static void *multi_server_worker(void *arg) {
+    MultiWorker *worker = (MultiWorker *) arg;
+    MultiServer *server = worker->server;
+
+    lua_State *L = luaL_newstate();
+    if (L == NULL) {
+        pthread_mutex_lock(&server->lock);
+        snprintf(worker->error, sizeof(worker->error), "Unable to create Lua state");
+        worker->state = -1;
+        pthread_cond_broadcast(&server->cond);
+        pthread_mutex_unlock(&server->lock);
+        return NULL;
+    }
+    luaL_openlibs(L);
+
+    // The worker finds the same modules as the state which created the server
+    lua_getglobal(L, "package");
+    lua_pushstring(L, server->path);
+    lua_setfield(L, -2, "path");
+    lua_pushstring(L, server->cpath);
+    lua_setfield(L, -2, "cpath");
+    lua_pop(L, 1);
+    luaL_requiref(L, "multisocket", luaopen_multisocket, 0);
+    lua_pop(L, 1);
+
+    // #1 Scheduler
+    lua_pushcfunction(L, multi_scheduler_new);
+    lua_pushstring(L, server->uring ? "io_uring" : "epoll");
+    lua_call(L, 1, 2);
+    if (lua_isnil(L, 1)) {
+        multi_server_fail(L, worker);
+        lua_close(L);
+        return NULL;
+    }
+    lua_settop(L, 1);
+
+    // #2 Listener
+    lua_pushcfunction(L, server->ipv6 ? multi_tcp6 : multi_tcp4);
+    lua_call(L, 0, 2);
+    if (lua_isnil(L, 2)) {
+        multi_server_fail(L, worker);
+        lua_close(L);
+        return NULL;
+    }
+    lua_settop(L, 2);
+    Multisocket *listener = (Multisocket *) lua_touserdata(L, 2);
+
+    lua_pushcfunction(L, multi_tcp_bind);
+    lua_pushvalue(L, 2);
+    lua_pushstring(L, server->address);
+    lua_pushinteger(L, server->port);
+    lua_pushboolean(L, 1);
+    lua_call(L, 4, 2);
+    if (lua_isnil(L, 3)) {
+        multi_tcp_close_socket(listener);
+        multi_server_fail(L, worker);
+        lua_close(L);
+        return NULL;
+    }
+    lua_settop(L, 2);
+
+    // Fast Open has to be enabled before listen()
+    if (server->fastOpen > 0) {
+        setsockopt(listener->socket, IPPROTO_TCP, TCP_FASTOPEN, &server->fastOpen, sizeof(server->fastOpen));
+    }
+
+    lua_pushcfunction(L, multi_tcp_listen);
+    lua_pushvalue(L, 2);
+    lua_pushinteger(L, server->backlog);
+    lua_call(L, 2, 2);
+    if (lua_isnil(L, 3)) {
+        multi_tcp_close_socket(listener);
+        multi_server_fail(L, worker);
+        lua_close(L);
+        return NULL;
+    }
+    lua_settop(L, 2);
+
+    lua_pushcfunction(L, multi_tcp_set_blocking);
+    lua_pushvalue(L, 2);
+    lua_pushboolean(L, 0);
+    lua_call(L, 2, 0);
+
+    // #3 Handler, returned by the chunk
+    int ret = server->isFile ? luaL_loadfile(L, server->chunk) : luaL_loadbuffer(L, server->chunk, strlen(server->chunk), "=handler");
+    if (ret == LUA_OK) {
+        lua_pushinteger(L, worker->index + 1);
+        lua_pushvalue(L, 2);
+        ret = lua_pcall(L, 2, 1, 0);
+    }
+    if (ret == LUA_OK && !lua_isfunction(L, 3)) {
+        lua_pushstring(L, "The handler chunk has to return [Function] handler");
+        ret = LUA_ERRRUN;
+    }
+    if (ret != LUA_OK) {
+        multi_tcp_close_socket(listener);
+        multi_server_fail(L, worker);
+        lua_close(L);
+        return NULL;
+    }
+    lua_pushcclosure(L, multi_server_handle, 1);
+
+    // The acceptor spawns a task with the handler for every connection
+    lua_pushcfunction(L, multi_scheduler_spawn);
+    lua_pushvalue(L, 1);
+    lua_pushvalue(L, 1);
+    lua_pushvalue(L, 3);
+    lua_pushvalue(L, 2);
+    lua_pushlightuserdata(L, worker);
+    lua_pushcclosure(L, multi_server_accept, 4);
+    lua_call(L, 2, 0);
+    lua_settop(L, 1);
+
+    // Port 0 is replaced by the port of the first worker, so all workers share it
+    pthread_mutex_lock(&server->lock);
+    if (server->port == 0) {
+        struct sockaddr_in6 address;
+        socklen_t addrLen = sizeof(address);
+        if (getsockname(listener->socket, (struct sockaddr *) &address, &addrLen) == 0) {
+            server->port = ntohs(address.sin6_family == AF_INET6 ? address.sin6_port :
+                                 ((struct sockaddr_in *) &address)->sin_port);
+        }
+    }
+    worker->listener = listener->socket;
+    worker->state = 1;
+    pthread_cond_broadcast(&server->cond);
+    pthread_mutex_unlock(&server->lock);
+
+    MultiScheduler *sched = (MultiScheduler *) lua_touserdata(L, 1);
+    while (sched->count > 0) {
+        if (multi_scheduler_step(L, sched, -1) != 0) {
+            fprintf(stderr, "multisocket server worker %d: %s\n", worker->index + 1, lua_tostring(L, -1));
+            lua_settop(L, 1);
+        }
+    }
+
+    multi_tcp_close_socket(listener);
+    lua_close(L);
+    return NULL;
+}
+
+/**
+ * Stop the workers and wait for them
+ * Shutting down the listeners makes the acceptors return, the workers exit as soon as their connections are handled.
+ * @param server the server
+ */
+static void multi_server_stop(MultiServer *server) {
+    pthread_mutex_lock(&server->lock);
+    server->stopping = 1;
+    for (int i = 0; i < server->started; i++) {
+        if (server->workers[i].state == 1) {
+            shutdown(server->workers[i].listener, SHUT_RDWR);
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    for (int i = 0; i < server->started; i++) {
+        pthread_join(server->workers[i].thread, NULL);
+    }
+    server->started = 0;
+}
+
+/**
+ * Release the memory of the server, the workers have to be stopped
+ * @param server the server
+ */
+static void multi_server_free(MultiServer *server) {
+    if (!server->open) {
+        return;
+    }
+    server->open = 0;
+    pthread_cond_destroy(&server->cond);
+    pthread_mutex_destroy(&server->lock);
+    free(server->workers);
+    free(server->address);
+    free(server->chunk);
+    free(server->path);
+    free(server->cpath);
+    server->workers = NULL;
+    server->address = NULL;
+    server->chunk = NULL;
+    server->path = NULL;
+    server->cpath = NULL;
+    server->threads = 0;
+}
+
+/**
+ * Lua Function
+ * Create a server with several worker threads
+ * Every worker has its own Lua state and its own listener bound with SO_REUSEPORT.
+ * The chunk is run once in every worker with the worker index and the listener as arguments,
+ * it has to return the handler. The handler is run as task of the worker's scheduler for every connection,
+ * the connection is non-blocking, so it yields instead of blocking the worker.
+ * If the handler raises an error, the worker prints it to stderr and closes the connection.
+ * @param1 [Table] options
+ *         port = [Integer] port (0-65535, 0 = any free port)
+ *         address = [String] address (default = "*")
+ *         ipv6 = [Boolean] ipv6 (default = false)
+ *         threads = [Integer] number of worker threads (default = number of CPUs)
+ *         backlog = [Integer] backlog of every listener (default = 128)
+ *         handler = [String] Lua source of the chunk / file = [String] path of the chunk
+ *         backend = [String] backend of the schedulers ("epoll" (default) / "io_uring")
+ *         fastOpen = [Integer] queue length for TCP Fast Open connections of every listener (default = 0, disabled)
+ * @return1 [Server] server / nil
+ * @return2 nil / [String] error
+ */
+static int multi_server_new(lua_State *L) {
+    // Check if there is one parameter and if it has a valid value
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_istable(L, 1)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [Table] options");
+        return 2; // Return nil, [String] error
+    }
+
+    lua_getfield(L, 1, "port");
+    lua_getfield(L, 1, "address");
+    lua_getfield(L, 1, "ipv6");
+    lua_getfield(L, 1, "threads");
+    lua_getfield(L, 1, "backlog");
+    lua_getfield(L, 1, "handler");
+    lua_getfield(L, 1, "file");
+    lua_getfield(L, 1, "backend");
+    lua_getfield(L, 1, "fastOpen");
+    if (!lua_isinteger(L, 2) || lua_tointeger(L, 2) > 0xFFFF || lua_tointeger(L, 2) < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Option port has to be [Integer] port (0-65535)");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isnil(L, 3) && lua_type(L, 3) != LUA_TSTRING) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Option address has to be [String] address");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isnil(L, 4) && !lua_isboolean(L, 4)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Option ipv6 has to be [Boolean] ipv6");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isnil(L, 5) && (!lua_isinteger(L, 5) || lua_tointeger(L, 5) < 1 || lua_tointeger(L, 5) > 1024)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Option threads has to be [Integer] threads (1-1024)");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isnil(L, 6) && (!lua_isinteger(L, 6) || lua_tointeger(L, 6) < 0 || lua_tointeger(L, 6) > 0x7FFFFFFF)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Option backlog has to be [Integer] backlog (0-2147483647)");
+        return 2; // Return nil, [String] error
+    } else if (!(lua_type(L, 7) == LUA_TSTRING && lua_isnil(L, 8)) && !(lua_isnil(L, 7) && lua_type(L, 8) == LUA_TSTRING)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Either option handler has to be [String] source or option file has to be [String] path");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isnil(L, 9) && (lua_type(L, 9) != LUA_TSTRING ||
+               (strcmp(lua_tostring(L, 9), "epoll") != 0 && strcmp(lua_tostring(L, 9), "io_uring") != 0))) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Option backend has to be [String] backend (\"epoll\" / \"io_uring\")");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isnil(L, 10) && (!lua_isinteger(L, 10) || lua_tointeger(L, 10) < 0 || lua_tointeger(L, 10) > 0x7FFFFFFF)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Option fastOpen has to be [Integer] queue length (0-2147483647)");
+        return 2; // Return nil, [String] error
+    }
+
+    int threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (!lua_isnil(L, 5)) {
+        threads = (int) lua_tointeger(L, 5);
+    } else if (threads < 1) {
+        threads = 1;
+    }
+
+    MultiServer *server = (MultiServer *) lua_newuserdata(L, sizeof(MultiServer));
+    bzero(server, sizeof(MultiServer));
+    luaL_getmetatable(L, "multisocket_server");
+    lua_setmetatable(L, -2);
+    int index = lua_gettop(L);
+
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->cond, NULL);
+    server->open = 1;
+    server->port = (unsigned short) lua_tointeger(L, 2);
+    server->ipv6 = lua_toboolean(L, 4);
+    server->uring = !lua_isnil(L, 9) && strcmp(lua_tostring(L, 9), "io_uring") == 0;
+    server->fastOpen = (int) lua_tointeger(L, 10);
+    server->backlog = lua_isnil(L, 6) ? MULTISOCKET_SERVER_BACKLOG : (int) lua_tointeger(L, 6);
+    server->isFile = lua_isnil(L, 7);
+    server->address = multi_server_strdup(lua_isnil(L, 3) ? "*" : lua_tostring(L, 3));
+    server->chunk = multi_server_strdup(lua_tostring(L, server->isFile ? 8 : 7));
+
+    lua_getglobal(L, "package");
+    if (lua_istable(L, -1)) {
+        lua_getfield(L, -1, "path");
+        lua_getfield(L, -2, "cpath");
+        server->path = multi_server_strdup(lua_tostring(L, -2));
+        server->cpath = multi_server_strdup(lua_tostring(L, -1));
+        lua_pop(L, 2);
+    }
+    lua_pop(L, 1);
+
+    server->workers = (MultiWorker *) calloc((size_t) threads, sizeof(MultiWorker));
+    if (server->workers == NULL || server->address == NULL || server->chunk == NULL) {
+        multi_server_free(server);
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(ENOMEM));
+        return 2; // Return nil, [String] error
+    }
+    server->threads = threads;
+
+    // The workers are started one after another, so the first one can choose the port for port 0
+    for (int i = 0; i < threads; i++) {
+        MultiWorker *worker = &server->workers[i];
+        worker->server = server;
+        worker->index = i;
+        worker->listener = -1;
+
+        int ret = pthread_create(&worker->thread, NULL, multi_server_worker, worker);
+        if (ret != 0) {
+            multi_server_stop(server);
+            multi_server_free(server);
+            lua_pushnil(L);
+            lua_pushstring(L, strerror(ret));
+            return 2; // Return nil, [String] error
+        }
+
+        pthread_mutex_lock(&server->lock);
+        server->started = i + 1;
+        while (worker->state == 0) {
+            pthread_cond_wait(&server->cond, &server->lock);
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        if (worker->state == -1) {
+            lua_pushnil(L);
+            lua_pushstring(L, worker->error);
+            multi_server_stop(server);
+            multi_server_free(server);
+            return 2; // Return nil, [String] error
+        }
+    }
+
+    lua_pushvalue(L, index);
+    return 1; // Return [Server] server
+}
+
+/**
+ * Lua Method
+ * Get the port all workers listen on
+ * @param0 [Server] server
+ * @return1 [Integer] port / nil
+ * @return2 nil / [String] error
+ */
+static int multi_server_get_port(lua_State *L) {
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_server")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Server] server");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiServer *server = (MultiServer *) lua_touserdata(L, 1);
+    lua_pushinteger(L, server->port);
+    return 1; // Return [Integer] port
+}
+
+/**
+ * Lua Method
+ * Get the number of worker threads
+ * @param0 [Server] server
+ * @return1 [Integer] threads / nil
+ * @return2 nil / [String] error
+ */
+static int multi_server_get_threads(lua_State *L) {
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_server")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Server] server");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiServer *server = (MultiServer *) lua_touserdata(L, 1);
+    lua_pushinteger(L, server->started);
+    return 1; // Return [Integer] threads
+}
+
+/**
+ * Lua Method
+ * Block until all workers have exited
+ * The workers only exit if their listener fails, so the calling thread usually serves until the process ends.
+ * Use close() instead to stop the server.
+ * @param0 [Server] server
+ * @return1 [Boolean] success / nil
+ * @return2 nil / [String] error
+ */
+static int multi_server_wait(lua_State *L) {
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_server")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Server] server");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiServer *server = (MultiServer *) lua_touserdata(L, 1);
+    if (server->open) {
+        for (int i = 0; i < server->started; i++) {
+            pthread_join(server->workers[i].thread, NULL);
+        }
+        server->started = 0;
+        multi_server_free(server);
+    }
+
+    lua_pushboolean(L, 1);
+    return 1; // Return [Boolean] success (true)
+}
+
+/**
+ * Lua Method
+ * Stop accepting connections and wait until the workers have handled their open connections
+ * Also called by the garbage collector
+ * @param0 [Server] server
+ * @return1 [Boolean] success / nil
+ * @return2 nil / [String] error
+ */
+static int multi_server_close(lua_State *L) {
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_server")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Server] server");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiServer *server = (MultiServer *) lua_touserdata(L, 1);
+    if (server->open) {
+        multi_server_stop(server);
+        multi_server_free(server);
+    }
+
+    lua_pushboolean(L, 1);
+    return 1; // Return [Boolean] success (true)
+}
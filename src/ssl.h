@@ -54,23 +54,40 @@ static const char* multi_ssl_get_error(SSL* ssl, int ret) {
  * @return success, 0 = success
  */
 static int multi_ssl_close(Multisocket *sock) {
+    multi_crypto_wait(sock);
+    multi_tls_early_free(sock);
     SSL_shutdown(sock->ssl);
     SSL_free(sock->ssl);
     SSL_CTX_free(sock->ctx);
     return 0;
 }
 
+static int multi_tcp_want(Multisocket *sock, long ret, int events);
+static int multi_tcp_yield(lua_State *L, int want, lua_KContext ctx, lua_KFunction k);
+static int multi_tcp_handshake_run(lua_State *L, Multisocket *sock);
+static int multi_tcp_handshake_result(lua_State *L, Multisocket *sock, int ret, const char *message);
+
 /**
  * Lua Method
  * Encrypt the TPC connection with SSL/TLS
+ * Sockets encrypted with the same [TlsContext] share its certificates and settings,
+ * with [Table] sslParams a context is created for this socket only (see multisocket.tls.context()).
+ * Client sockets without a second argument share a default context.
+ * Clients resume the session of their last connection to the same host and port, if the server allows it.
  * @param0 [Multisocket] sock (TCP)
- * @param1 [Table] sslParams
+ * @param1 [TlsContext] context / [Table] sslParams / nil
+ * @param2 [String] serverName / nil, host name of the server for SNI and the session cache (clients only)
+ * @param3 [Boolean] earlyData / nil, if the resumed session allows it, the handshake is deferred and the first send()
+ *         goes with it as TLS 1.3 early data (0-RTT, clients only). Early data can be replayed by an attacker,
+ *         so only use it for idempotent requests. Data the server rejects is sent again after the handshake.
+ * A non-blocking socket does not wait for the peer: inside a coroutine it yields until the handshake is complete,
+ * otherwise it returns nil, "want_read" / "want_write" and handshake() continues the handshake.
  * @return1 [Boolean] success / nil
  * @return2 nil / [String] error
  */
 static int multi_tcp_encrypt(lua_State *L) {
     // Check if there are two parameters and if they have valid values
-    if (lua_gettop(L) != 1 && lua_gettop(L) != 2) {
+    if (lua_gettop(L) < 1 || lua_gettop(L) > 4) {
         lua_pushnil(L);
         lua_pushstring(L, "Wrong number of arguments");
         return 2; // Return nil, [String] error
@@ -78,9 +95,17 @@ static int multi_tcp_encrypt(lua_State *L) {
         lua_pushnil(L);
         lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (TCP)");
         return 2; // Return nil, [String] error
-    } else if (lua_gettop(L) == 2 && !lua_istable(L, 2)) {
+    } else if (!lua_isnoneornil(L, 2) && !lua_istable(L, 2) && multi_tls_context_get(L, 2) == NULL) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [TlsContext] context or [Table] sslParams");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isnoneornil(L, 3) && lua_type(L, 3) != LUA_TSTRING) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #2 has to be [String] serverName");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isnoneornil(L, 4) && !lua_isboolean(L, 4)) {
         lua_pushnil(L);
-        lua_pushstring(L, "Argument #1 has to be [Table] sslParams");
+        lua_pushstring(L, "Argument #3 has to be [Boolean] earlyData");
         return 2; // Return nil, [String] error
     }
 
@@ -91,103 +116,192 @@ static int multi_tcp_encrypt(lua_State *L) {
         lua_pushnil(L);
         lua_pushstring(L, "Socket is already encrypted");
         return 2; // Return nil, [String] error
-    }
-
-    if (sock->servers && !lua_gettop(L) == 2) {
+    } else if (sock->rbufLen > 0) {
+        // Plaintext received before the handshake must not be mixed into the encrypted stream
         lua_pushnil(L);
-        lua_pushstring(L, "Argument #1 has to be [Table] sslParams");
+        lua_pushstring(L, "Socket has unread unencrypted data");
+        return 2; // Return nil, [String] error
+    } else if (!sock->servers && !sock->clients) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Socket is not connected");
         return 2; // Return nil, [String] error
     }
 
-    const SSL_METHOD *method;
-    if (sock->servers) {
-        method = TLSv1_2_server_method();
-    } else if (sock->clients) {
-        method = TLSv1_2_client_method();
-    } else {
-        method = TLSv1_2_method();
-    }
-
-    SSL_CTX *ctx = SSL_CTX_new(method);
-    SSL_CTX_set_options(ctx, SSL_OP_SINGLE_DH_USE | SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
-    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE);
-    SSL_CTX_set_cipher_list(ctx, "HIGH:!aNULL:!kRSA:!PSK:!SRP:!MD5:!RC4");
-    SSL_CTX_set_ecdh_auto(ctx, 1);
-
-    const char* certfile = NULL;
-    const char* keyfile = NULL;
-
-    if (lua_gettop(L) == 2) {
-        lua_pushvalue(L, 2);
+    if (sock->servers && lua_isnoneornil(L, 2)) {
         lua_pushnil(L);
-        while (lua_next(L, -2)) {
-            lua_pushvalue(L, -2);
-            const char *key = lua_tostring(L, -1);
-            if (strcmp(key, "certfile") == 0) {
-                if (!lua_isstring(L, -2)) {
-                    lua_pushnil(L);
-                    lua_pushstring(L, "Field 'certfile' has to be [String] path");
-                    return 2; // Return nil, [String] err
-                }
-                certfile = lua_tostring(L, -2);
-            } else if (strcmp(key, "keyfile") == 0) {
-                if (!lua_isstring(L, -2)) {
-                    lua_pushnil(L);
-                    lua_pushstring(L, "Field 'keyfile' has to be [String] path");
-                    return 2; // Return nil, [String] err
-                }
-                keyfile = lua_tostring(L, -2);
-            }
-            lua_pop(L, 2);
-        }
-        lua_pop(L, 1);
+        lua_pushstring(L, "Argument #1 has to be [TlsContext] context or [Table] sslParams");
+        return 2; // Return nil, [String] error
     }
 
-    if (sock->servers) {
-        if (certfile == NULL || keyfile == NULL) {
+    SSL_CTX *ctx = NULL;
+    if (lua_isnoneornil(L, 2)) {
+        ctx = multi_tls_client_context();
+        if (ctx == NULL) {
             lua_pushnil(L);
-            lua_pushstring(L, "Field 'certfile' and/or 'keyfile' not found in sslParams");
+            lua_pushstring(L, "Out of memory");
             return 2; // Return nil, [String] error
         }
-
-        if (SSL_CTX_use_certificate_file(ctx, certfile, SSL_FILETYPE_PEM) != 1) {
+    } else if (lua_istable(L, 2)) {
+        const char *error = multi_tls_context_create(L, 2, &ctx);
+        if (error != NULL) {
             lua_pushnil(L);
-            lua_pushstring(L, ERR_reason_error_string(ERR_get_error()));
+            lua_pushstring(L, error);
             return 2; // Return nil, [String] error
         }
+    } else {
+        ctx = multi_tls_context_get(L, 2);
+        SSL_CTX_up_ref(ctx);
+    }
 
-        if (SSL_CTX_use_PrivateKey_file(ctx, keyfile, SSL_FILETYPE_PEM) != 1) {
-            lua_pushnil(L);
-            lua_pushstring(L, ERR_reason_error_string(ERR_get_error()));
-            return 2; // Return nil, [String] error
-        }
+    if (sock->servers && SSL_CTX_get0_certificate(ctx) == NULL) {
+        SSL_CTX_free(ctx);
+        lua_pushnil(L);
+        lua_pushstring(L, lua_istable(L, 2) ? "Field 'certfile' and/or 'keyfile' not found in sslParams" : "TLS context has no certificate");
+        return 2; // Return nil, [String] error
     }
 
     sock->ctx = ctx;
     sock->ssl = SSL_new(ctx);
     SSL_set_fd(sock->ssl, sock->socket);
     sock->enc = 1;
-
-    while (1) {
-        int ret = 0;
-        if (sock->servers) {
-            ret = SSL_accept(sock->ssl);
-        } else if (sock->clients) {
-            ret = SSL_connect(sock->ssl);
+    sock->handshake = MULTISOCKET_TLS_HANDSHAKE;
+    sock->handshakeT = multi_clock_monotonic();
+    if (sock->servers) {
+        SSL_set_accept_state(sock->ssl);
+        if (SSL_CTX_get_max_early_data(ctx) > 0) {
+            sock->handshake = MULTISOCKET_TLS_EARLY_DATA;
+        }
+    } else {
+        SSL_set_connect_state(sock->ssl);
+        multi_tls_client_setup(sock, lua_tostring(L, 3));
+        if (lua_toboolean(L, 4) && multi_tls_early_defer(sock)) {
+            lua_pushboolean(L, 1);
+            return 1; // Return [Boolean] success (true)
         }
+    }
 
-        if (ret <= 0 && ((sock->servers && SSL_get_error(sock->ssl, ret) != SSL_ERROR_WANT_READ) || (sock->clients && SSL_get_error(sock->ssl, ret) != SSL_ERROR_WANT_WRITE))) {
-            lua_pushnil(L);
-            lua_pushstring(L, multi_ssl_get_error(sock->ssl, ret));
-            sock->enc = 0;
-            return 2; // Return nil, [String] error
-        } else if (ret == 1) {
-            break;
+    lua_settop(L, 1);
+    return multi_tcp_handshake_run(L, sock);
+}
+
+/**
+ * Continuation of multi_tcp_encrypt() and multi_tcp_handshake() after the socket became ready
+ */
+static int multi_tcp_handshake_k(lua_State *L, int status, lua_KContext ctx) {
+    (void) status;
+    (void) ctx;
+    lua_settop(L, 1);
+    return multi_tcp_handshake_run(L, (Multisocket *) lua_touserdata(L, 1));
+}
+
+/**
+ * Continuation of multi_tcp_handshake_run() after a crypto thread has run the step of the handshake
+ */
+static int multi_tcp_handshake_offloaded_k(lua_State *L, int status, lua_KContext ctx) {
+    (void) status;
+    (void) ctx;
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+    MultiCryptoJob **ud = (MultiCryptoJob **) lua_touserdata(L, 2);
+    MultiCryptoJob *job = *ud;
+    multi_crypto_finish(job);
+    int ret = job->ret;
+    const char *message = job->message;
+    multi_crypto_release(ud);
+    lua_settop(L, 1);
+    return multi_tcp_handshake_result(L, sock, ret, message);
+}
+
+/**
+ * Advance the pending handshake, a non-blocking socket yields its coroutine or returns what it waits for
+ * Handshakes of contexts created with offload = true run in the crypto threads (see crypto.h).
+ */
+static int multi_tcp_handshake_run(lua_State *L, Multisocket *sock) {
+    if (multi_crypto_offloaded(L, sock)) {
+        MultiCryptoJob *job = multi_crypto_start(sock);
+        if (job != NULL) {
+            lua_settop(L, 1);
+            return multi_crypto_yield(L, job, 1, 0, multi_tcp_handshake_offloaded_k);
         }
     }
+    return multi_tcp_handshake_result(L, sock, multi_tls_handshake(sock), NULL);
+}
+
+/**
+ * Handle the result of a step of the handshake
+ * @param L the Lua state, the socket has to be argument #0
+ * @param sock the socket
+ * @param ret the result of multi_tls_handshake()
+ * @param message the error read by the crypto thread / NULL = read it from the socket
+ */
+static int multi_tcp_handshake_result(lua_State *L, Multisocket *sock, int ret, const char *message) {
+    if (ret == 1) {
+        lua_pushboolean(L, 1);
+        return 1; // Return [Boolean] success (true)
+    }
+
+    int error = SSL_get_error(sock->ssl, ret);
+    int want = multi_tcp_want(sock, ret, 0);
+    if (want && lua_isyieldable(L)) {
+        return multi_tcp_yield(L, want, 0, multi_tcp_handshake_k);
+    } else if (want) {
+        lua_pushnil(L);
+        lua_pushstring(L, multi_ssl_get_error(sock->ssl, ret));
+        return 2; // Return nil, [String] error
+    }
+
+    // The handshake has failed, or the peer did not answer in time, the connection stays unencrypted
+    int timeout = (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE);
+    lua_pushnil(L);
+    lua_pushstring(L, timeout ? "timeout" : (message != NULL) ? message : multi_ssl_get_error(sock->ssl, ret));
+    multi_tls_early_free(sock);
+    SSL_free(sock->ssl);
+    SSL_CTX_free(sock->ctx);
+    sock->ssl = NULL;
+    sock->ctx = NULL;
+    sock->enc = 0;
+    sock->handshake = 0;
+    sock->rbufPos = 0;
+    sock->rbufLen = 0;
+    multi_metrics_error(timeout ? MULTISOCKET_METRIC_TIMEOUT : MULTISOCKET_METRIC_TLS);
+    return 2; // Return nil, [String] error
+}
+
+/**
+ * Lua Method
+ * Continue the TLS handshake which encrypt() has started on a non-blocking socket
+ * The handshake advances as far as possible without blocking. Inside a coroutine the socket is yielded
+ * until the handshake is complete, outside of one "want_read" or "want_write" tells what it waits for,
+ * so the socket can be added to a poller and handshake() is called again once it is ready.
+ * @param0 [Multisocket] socket (TCP)
+ * @return1 [Boolean] success (true, also if the handshake was already complete) / nil
+ * @return2 nil / [String] error ("want_read", "want_write", "timeout" or the TLS error)
+ */
+static int multi_tcp_handshake(lua_State *L) {
+    // Check if there is one parameter and if it has a valid value
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (TCP)");
+        return 2; // Return nil, [String] error
+    }
+
+    // Cast userdata to Multisocket
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+
+    if (!sock->enc) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Socket is not encrypted");
+        return 2; // Return nil, [String] error
+    } else if (!sock->handshake || (sock->early != NULL && sock->early->data == NULL)) {
+        // A deferred handshake is done by the first send()
+        lua_pushboolean(L, 1);
+        return 1; // Return [Boolean] success (true)
+    }
 
-    lua_pushboolean(L, 1);
-    return 1; // Return [Boolean] success (true)
+    return multi_tcp_handshake_run(L, sock);
 }
 
 
@@ -15,9 +15,9 @@ static int multi_getpointer(lua_State *L) {
         lua_pushnil(L);
         lua_pushstring(L, "Wrong number of arguments");
         return 2; // Return nil, [String] error
-    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+    } else if (!multi_is_socket(L, 1)) {
         lua_pushnil(L);
-        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (TCP)");
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
         return 2; // Return nil, [String] error
     }
 
@@ -66,11 +66,13 @@ static int multi_pointer(lua_State *L) {
 /**
  * Lua Function
  * Wait until timeout or a socket status changed
+ * Uses poll(), so there is no limit on the filedescriptor numbers.
+ * Use a poller for large numbers of sockets.
  * @param1 [Table<Integer, Multisocket>] waitRead
  * @param2 [Table<Integer, Multisocket>] waitWrite
  * @param3 [Number] timeout (seconds) / nil
- * @return1 [Table<Integer, Multisocket>] readable (NOT YET IMPLEMENTED)
- * @return2 [Table<Integer, Multisocket>] writable (NOT YET IMPLEMENTED)
+ * @return1 [Table<Integer, Multisocket>] readable / nil
+ * @return2 [Table<Integer, Multisocket>] writable / [String] error
  */
 static int multi_select(lua_State *L) {
     if (lua_gettop(L) != 2 && lua_gettop(L) != 3) {
@@ -85,221 +87,361 @@ static int multi_select(lua_State *L) {
         lua_pushnil(L);
         lua_pushstring(L, "Argument #2 has to be [Table<Integer, Multisocket>] waitWrite");
         return 2; // Return nil, [String] error
-    } else if (lua_gettop(L) == 3 && !lua_isnumber(L, 3)) {
+    } else if (lua_gettop(L) == 3 && !lua_isnil(L, 3) && !lua_isnumber(L, 3)) {
         lua_pushnil(L);
         lua_pushstring(L, "Argument #3 has to be [Number] timeout (seconds)");
         return 2; // Return nil, [String] error
     }
 
-    fd_set read, write;
-    int maxfd = 0;
-    FD_ZERO(&read);
-    FD_ZERO(&write);
-
-    lua_pushvalue(L, 1);
-    lua_pushnil(L);
-    while (lua_next(L, -2)) {
-        lua_pushvalue(L, -2);
-        //const char *key = lua_tostring(L, -1);
-        Multisocket *sock = (Multisocket *) lua_touserdata(L, -2);
-        if ( sock->socket > maxfd ) {
-            maxfd = sock->socket;
-        }
-        FD_SET( sock->socket, &read );
-        lua_pop(L, 2);
-    }
-    lua_pop(L, 1);
-
-    lua_pushvalue(L, 2);
-    lua_pushnil(L);
-    while (lua_next(L, -2)) {
-        lua_pushvalue(L, -2);
-        //const char *key = lua_tostring(L, -1);
-        Multisocket *sock = (Multisocket *) lua_touserdata(L, -2);
-        if ( sock->socket > maxfd ) {
-            maxfd = sock->socket;
-        }
-        FD_SET( sock->socket, &write );
-        lua_pop(L, 2);
+    // A timeout of -1 blocks until a socket is ready
+    int timeout = -1;
+    if (lua_gettop(L) == 3 && !lua_isnil(L, 3)) {
+        timeout = (int) (lua_tonumber(L, 3) * 1000);
     }
-    lua_pop(L, 1);
 
-    struct timeval tv;
-    if ( lua_gettop(L) == 3 ) {
-        double n = lua_tonumber(L,3);
-        tv.tv_sec = (long) n;
-        tv.tv_usec = (long) (n - tv.tv_sec) * 1000000;
+    lua_settop(L, 2);
+    size_t numRead = lua_rawlen(L, 1);
+    size_t numWrite = lua_rawlen(L, 2);
+
+    // The pollfd array is garbage collected by Lua
+    struct pollfd *ufds = (struct pollfd *) lua_newuserdata(L, (numRead + numWrite + 1) * sizeof(struct pollfd));
+
+    for (size_t i = 0; i < numRead + numWrite; i++) {
+        int tbl = (i < numRead) ? 1 : 2;
+        lua_rawgeti(L, tbl, (i < numRead) ? i + 1 : i - numRead + 1);
+        if (!multi_is_socket(L, -1)) {
+            lua_pushnil(L);
+            lua_pushfstring(L, "Argument #%d has to be [Table<Integer, Multisocket>] %s", tbl, (tbl == 1) ? "waitRead" : "waitWrite");
+            return 2; // Return nil, [String] error
+        }
+        Multisocket *sock = (Multisocket *) lua_touserdata(L, -1);
+        ufds[i].fd = sock->socket;
+        ufds[i].events = (i < numRead) ? POLLIN : POLLOUT;
+        ufds[i].revents = 0;
+        // Decrypted data is not visible to poll(), but the socket is readable
+        if (i < numRead && multi_socket_pending(sock)) {
+            timeout = 0;
+        }
+        lua_pop(L, 1);
     }
 
-    int ret = select( maxfd+1, &read, &write, NULL, &tv );
-    if ( ret < 0 ) {
+    int ret = poll(ufds, numRead + numWrite, timeout);
+    if (ret < 0 && errno != EINTR) {
         lua_pushnil(L);
         lua_pushstring(L, strerror(errno));
         return 2; // Return nil, [String] error
     }
 
-    // TODO Implement readable and writable return values
     lua_newtable(L);
+    int readable = lua_gettop(L);
     lua_newtable(L);
+    int writable = lua_gettop(L);
+    lua_Integer numReadable = 0;
+    lua_Integer numWritable = 0;
+
+    for (size_t i = 0; i < numRead + numWrite; i++) {
+        if (i < numRead) {
+            lua_rawgeti(L, 1, i + 1);
+            if (ufds[i].revents != 0 || multi_socket_pending((Multisocket *) lua_touserdata(L, -1))) {
+                lua_rawseti(L, readable, ++numReadable);
+            } else {
+                lua_pop(L, 1);
+            }
+        } else if (ufds[i].revents != 0) {
+            lua_rawgeti(L, 2, i - numRead + 1);
+            lua_rawseti(L, writable, ++numWritable);
+        }
+    }
+
     return 2; // Return [Table<Integer, Multisocket>] readable, [Table<Integer, Multisocket] writable
 }
 
 /**
- * Lua Function
- * Create a socket, bind it and connect it
- * @param1 [String] address (address or domain)
- * @param2  [Integer] port (0-65535)
- * @param3 [Boolean] encrypt / nil
- * @return1 [Multisocket] client / nil
- * @return2 nil / [String] error
+ * Connect to the resolved addresses, the rest of multi_open()
+ * @param L the Lua state, the parameters of multi_open() are at stack index 1 - 6
+ * @param result the resolved addresses
+ * @param startT time when open() was called (monotonic nanoseconds)
+ * @return number of pushed values
  */
-static int multi_open(lua_State *L) {
-    // Check if there are three parameters and if they have valid values
-    if (lua_gettop(L) != 2 && lua_gettop(L) != 3) {
-        lua_pushnil(L);
-        lua_pushstring(L, "Wrong number of arguments");
-        return 2; // Return nil, [String] error
-    } else if (!lua_isstring(L, 1)) {
-        lua_pushnil(L);
-        lua_pushstring(L, "Argument #1 has to be [String] address (address or domain)");
-        return 2; // Return nil, [String] error
-    } else if (!lua_isinteger(L, 2) || lua_tointeger(L, 2) > 0xFFFF || lua_tointeger(L, 2) < 0) {
-        lua_pushnil(L);
-        lua_pushstring(L, "Argument #2 has to be [Integer] port (0-65535)");
-        return 2; // Return nil, [String] error
-    } else if (!lua_isboolean(L, 3)) {
+static int multi_open_connect(lua_State *L, MultiResolverResult *result, long startT) {
+    // Load parameters into variables
+    unsigned short port = (unsigned short) lua_tointeger(L, 2);
+    int encrypt = lua_toboolean(L, 3);
+    int fastOpen = lua_toboolean(L, 4);
+    long deadline = lua_isnoneornil(L, 5) ? -1 : startT + (long) (lua_tonumber(L, 5) * 1000000000.0);
+    int earlyData = lua_toboolean(L, 6);
+    lua_settop(L, 2);
+
+    if (result->error != 0) {
+        multi_metrics_error(MULTISOCKET_METRIC_OTHER);
+        multi_metrics_latency(MULTISOCKET_METRIC_CONNECT, startT);
         lua_pushnil(L);
-        lua_pushstring(L, "Argument #3 has to be [Boolean] encrypt");
+        lua_pushstring(L, gai_strerror(result->error));
         return 2; // Return nil, [String] error
     }
 
-    // Load parameters into variables
-    size_t addressLength = 0;
-    const char *address = lua_tolstring(L, 1, &addressLength);
-    unsigned short port = (unsigned short) lua_tointeger(L, 2);
-    char encrypt = 0;
-    if (lua_gettop(L) == 3) {
-        encrypt = (char) lua_toboolean(L, 3);
+    // Sort the addresses alternating by family, IPv6 first
+    struct sockaddr_storage addresses[MULTISOCKET_OPEN_ADDRESSES];
+    socklen_t addressLens[MULTISOCKET_OPEN_ADDRESSES];
+    int num = 0;
+    int num6 = 0;
+    int num4 = 0;
+    for (int j = 0; j < result->count; j++) {
+        num6 += (result->addresses[j].sin6_family == AF_INET6);
+        num4 += (result->addresses[j].sin6_family == AF_INET);
     }
-
-    // Init address structs for IPv6 and IPv4
-    struct sockaddr_in6 address6;
-    struct sockaddr_in address4;
-    bzero(&address6, sizeof(address6));
-    bzero(&address4, sizeof(address4));
-
-    address6.sin6_family = AF_INET6;
-    address4.sin_family = AF_INET;
-
-    struct addrinfo *result, *next;
-    struct addrinfo hint;
-    bzero(&hint, sizeof(hint));
-    hint.ai_family = AF_UNSPEC;
-
-    struct sockaddr *addr;
-    socklen_t addrLen6 = 0;
-    socklen_t addrLen4 = 0;
-    socklen_t addrLen = 0;
-
-    int ret = getaddrinfo(address, NULL, &hint, &result);
-    if (ret != 0) {
-        lua_pushnil(L);
-        lua_pushstring(L, gai_strerror(ret));
-        return 2; // Return nil, [String] error
-    } else {
-        for (next = result; next != NULL; next = next->ai_next) {
-            if (addrLen6 == 0 && next->ai_family == AF_INET6) {
-                memcpy(&address6, next->ai_addr, next->ai_addrlen);
-                addrLen6 = next->ai_addrlen;
-            } else if (addrLen4 == 0 && next->ai_family == AF_INET) {
-                memcpy(&address4, next->ai_addr, next->ai_addrlen);
-                addrLen4 = next->ai_addrlen;
+    for (int i = 0; i < num6 || i < num4; i++) {
+        for (int family = 0; family < 2; family++) {
+            int index = 0;
+            for (int j = 0; j < result->count && num < MULTISOCKET_OPEN_ADDRESSES; j++) {
+                struct sockaddr_in6 *next = &result->addresses[j];
+                if (next->sin6_family != (family == 0 ? AF_INET6 : AF_INET) || index++ != i) {
+                    continue;
+                }
+                bzero(&addresses[num], sizeof(struct sockaddr_storage));
+                if (next->sin6_family == AF_INET6) {
+                    memcpy(&addresses[num], next, sizeof(struct sockaddr_in6));
+                    addressLens[num] = sizeof(struct sockaddr_in6);
+                    ((struct sockaddr_in6 *) &addresses[num])->sin6_port = htons(port);
+                } else {
+                    memcpy(&addresses[num], next, sizeof(struct sockaddr_in));
+                    addressLens[num] = sizeof(struct sockaddr_in);
+                    ((struct sockaddr_in *) &addresses[num])->sin_port = htons(port);
+                }
+                num++;
             }
         }
     }
+    if (num == 0) {
+        multi_metrics_error(MULTISOCKET_METRIC_OTHER);
+        multi_metrics_latency(MULTISOCKET_METRIC_CONNECT, startT);
+        lua_pushnil(L);
+        lua_pushstring(L, "Unable to resolve address");
+        return 2; // Return nil, [String] error
+    }
 
-    address6.sin6_port = htons(port);
-    address4.sin_port = htons(port);
-
-    Multisocket *sock;
+    // The Multisockets of the running attempts are kept at stack index 2 + slot
+    struct pollfd fds[MULTISOCKET_OPEN_ADDRESSES];
+    Multisocket *attempts[MULTISOCKET_OPEN_ADDRESSES];
+    int running = 0;
+    int started = 0;
+    int error = ETIMEDOUT;
+    Multisocket *sock = NULL;
+    long nextStart = 0;
+    lua_checkstack(L, MULTISOCKET_OPEN_ADDRESSES + 4);
+
+    while (sock == NULL && (started < num || running > 0)) {
+        long now = multi_clock_monotonic();
+        if (deadline != -1 && now >= deadline) {
+            error = ETIMEDOUT;
+            break;
+        }
 
-    while (1) {
-        if (addrLen6 != 0) {
-            lua_pushcfunction(L, multi_tcp6);
+        // Start the next attempt if the previous one takes too long or if none is running anymore
+        if (started < num && (running == 0 || now >= nextStart)) {
+            lua_pushcfunction(L, (addresses[started].ss_family == AF_INET6) ? multi_tcp6 : multi_tcp4);
             lua_call(L, 0, 2);
-            if (lua_isnil(L, 4)) {
-                lua_pushnil(L);
-                lua_pushvalue(L, 3);
-                return 2; // Return nil, [String] error
+            lua_pop(L, 1);
+            Multisocket *attempt = (Multisocket *) lua_touserdata(L, -1);
+            if (attempt == NULL) {
+                error = errno;
+                lua_pop(L, 1);
+                started++;
+                continue;
             }
-            sock = (Multisocket *) lua_touserdata(L, 4);
-        } else if (addrLen4 != 0) {
-            lua_pushcfunction(L, multi_tcp4);
-            lua_call(L, 0, 2);
-            if (lua_isnil(L, 4)) {
-                lua_pushnil(L);
-                lua_pushvalue(L, 3);
-                return 2; // Return nil, [String] error
+            // Kernels without TCP_FASTOPEN_CONNECT just do the handshake
+            if (fastOpen) {
+                int enable = 1;
+                setsockopt(attempt->socket, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &enable, sizeof(enable));
             }
-            sock = (Multisocket *) lua_touserdata(L, 4);
-        } else {
-            lua_pushnil(L);
-            lua_pushstring(L, "Unable to resolve address");
-            return 2; // Return nil, [String] error
+            int flags = fcntl(attempt->socket, F_GETFL, 0);
+            fcntl(attempt->socket, F_SETFL, flags | O_NONBLOCK);
+            if (connect(attempt->socket, (struct sockaddr *) &addresses[started], addressLens[started]) == 0) {
+                sock = attempt;
+            } else if (errno == EINPROGRESS) {
+                attempts[running] = attempt;
+                fds[running].fd = attempt->socket;
+                fds[running].events = POLLOUT;
+                fds[running].revents = 0;
+                lua_insert(L, 3 + running);
+                running++;
+            } else {
+                error = errno;
+                multi_tcp_close_socket(attempt);
+                lua_pop(L, 1);
+            }
+            started++;
+            nextStart = now + MULTISOCKET_OPEN_DELAY;
+            continue;
         }
 
-        if (sock->ipv6) {
-            addr = (struct sockaddr *) &address6;
-            addrLen = addrLen6;
-        } else if (sock->ipv4) {
-            addr = (struct sockaddr *) &address4;
-            addrLen = addrLen4;
+        // Wait for an attempt, the start of the next one or the deadline
+        long until = (started < num) ? nextStart : deadline;
+        if (deadline != -1 && until > deadline) {
+            until = deadline;
         }
-
-        lua_pushcfunction(L, multi_tcp_bind);
-        lua_pushvalue(L, 1);
-        lua_pushstring(L, "*");
-        lua_pushinteger(L, 0);
-        lua_call(L, 3, 2);
-        if (lua_isnil(L, 3)) {
-            lua_pushnil(L);
-            lua_pushvalue(L, 2);
-            return 2; // Return nil, [String] error
+        int timeout = (until == -1) ? -1 : (int) ((until - now + 999999) / 1000000);
+        if (poll(fds, running, timeout) < 0 && errno != EINTR) {
+            error = errno;
+            break;
         }
-        if (connect(sock->socket, addr, addrLen) == -1) {
-            if (sock->ipv6 && addrLen4 != 0 && addrLen6 != 0) {
-                addrLen6 = 0;
-                lua_pop(L,4);
+
+        for (int i = running - 1; i >= 0 && sock == NULL; i--) {
+            if (fds[i].revents == 0) {
                 continue;
             }
-            lua_pushnil(L);
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                lua_pushstring(L, "timeout");
-            } else {
-                lua_pushstring(L, strerror(errno));
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
+                err = errno;
             }
-            return 2; // Return nil, [String] error
-        } else {
-            break;
+            if (err == 0) {
+                sock = attempts[i];
+                lua_pushvalue(L, 3 + i);
+                lua_remove(L, 3 + i);
+                running--;
+                memmove(&fds[i], &fds[i + 1], (running - i) * sizeof(struct pollfd));
+                memmove(&attempts[i], &attempts[i + 1], (running - i) * sizeof(Multisocket *));
+                break;
+            }
+            // A failed attempt makes room for the next one at once
+            error = err;
+            multi_tcp_close_socket(attempts[i]);
+            lua_remove(L, 3 + i);
+            running--;
+            memmove(&fds[i], &fds[i + 1], (running - i) * sizeof(struct pollfd));
+            memmove(&attempts[i], &attempts[i + 1], (running - i) * sizeof(Multisocket *));
+            nextStart = 0;
         }
     }
 
+    // Close the attempts which lost the race
+    for (int i = 0; i < running; i++) {
+        multi_tcp_close_socket(attempts[i]);
+    }
+    multi_metrics_latency(MULTISOCKET_METRIC_CONNECT, startT);
+    if (sock == NULL) {
+        multi_metrics_error((error == ETIMEDOUT) ? MULTISOCKET_METRIC_TIMEOUT : MULTISOCKET_METRIC_OTHER);
+        lua_pushnil(L);
+        lua_pushstring(L, (error == ETIMEDOUT) ? "timeout" : strerror(error));
+        return 2; // Return nil, [String] error
+    }
+    lua_insert(L, 3);
+    lua_settop(L, 3);
+
+    int flags = fcntl(sock->socket, F_GETFL, 0);
+    fcntl(sock->socket, F_SETFL, flags & ~O_NONBLOCK);
+    sock->conn = 1;
     sock->clients = 1;
+    multi_metrics_count(MULTISOCKET_METRIC_CONNECTED, 1);
 
     if (encrypt) {
         lua_pushcfunction(L, multi_tcp_encrypt);
-        lua_pushvalue(L, 4);
-        lua_call(L, 1, 2);
+        lua_pushvalue(L, 3);
+        lua_pushnil(L);
+        lua_pushvalue(L, 1);
+        lua_pushboolean(L, earlyData);
+        lua_call(L, 4, 2);
         if (lua_isnil(L, 4)) {
+            // The connection is of no use without encryption
+            lua_pushcfunction(L, multi_tcp_close);
+            lua_pushvalue(L, 3);
+            lua_call(L, 1, 0);
             lua_pushnil(L);
             lua_pushvalue(L, 5);
             return 2; // Return nil, [String] error
         }
+        lua_settop(L, 3);
     }
 
-    lua_pushvalue(L, 4);
     return 1; // Return [Multisocket] client
+}
+
+/**
+ * Lua Function
+ * Create a socket and connect it
+ * All resolved addresses are raced as described in RFC 8305 (Happy Eyeballs): the attempts alternate between
+ * IPv6 and IPv4, starting with IPv6, a new attempt starts every 250 ms or as soon as the previous one failed.
+ * The first connection which is established wins, all others are closed.
+ * The name is resolved like resolve() does, a task of a scheduler yields the lookup and "r" on a cache miss.
+ * @param1 [String] address (address or domain)
+ * @param2  [Integer] port (0-65535)
+ * @param3 [Boolean] encrypt / nil, the session of the last connection to the same host and port is resumed
+ * @param4 [Boolean] fastOpen / nil
+ *         With TCP Fast Open the first send() or the TLS handshake goes with the SYN, once the server
+ *         has handed out a cookie. connect() returns at once then, so connection errors show up on the first send()
+ *         and only the first address is used.
+ *         Only for protocols where the client speaks first, the SYN is not sent before the first write.
+ * @param5 [Number] timeout (seconds) / nil, deadline for establishing the connection (default = unlimited)
+ * @param6 [Boolean] earlyData / nil, send the first write as TLS 1.3 early data (0-RTT) when a session is resumed
+ *         Early data can be replayed by an attacker, only use it for idempotent requests.
+ * @return1 [Multisocket] client / nil
+ * @return2 nil / [String] error
+ */
+static int multi_open_k(lua_State *L, int status, lua_KContext ctx);
 
+static int multi_open(lua_State *L) {
+    // Check if there are two to six parameters and if they have valid values
+    if (lua_gettop(L) < 2 || lua_gettop(L) > 6) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isstring(L, 1)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [String] address (address or domain)");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isinteger(L, 2) || lua_tointeger(L, 2) > 0xFFFF || lua_tointeger(L, 2) < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #2 has to be [Integer] port (0-65535)");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isnoneornil(L, 3) && !lua_isboolean(L, 3)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #3 has to be [Boolean] encrypt");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isnoneornil(L, 4) && !lua_isboolean(L, 4)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #4 has to be [Boolean] fastOpen");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isnoneornil(L, 5) && (!lua_isnumber(L, 5) || lua_tonumber(L, 5) < 0)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #5 has to be [Number] timeout (seconds)");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isnoneornil(L, 6) && !lua_isboolean(L, 6)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #6 has to be [Boolean] earlyData");
+        return 2; // Return nil, [String] error
+    }
+
+    const char *address = lua_tostring(L, 1);
+    long startT = multi_clock_monotonic();
+
+    MultiResolverResult result;
+    if (!multi_resolver_get(address, AF_UNSPEC, &result)) {
+        MultiLookup *lookup = multi_resolver_start(address, AF_UNSPEC);
+        if (lookup == NULL) {
+            lua_pushnil(L);
+            lua_pushstring(L, strerror(errno));
+            return 2; // Return nil, [String] error
+        } else if (multi_scheduler_in_task(L)) {
+            lua_settop(L, 6);
+            return multi_resolver_yield(L, lookup, (lua_KContext) startT, multi_open_k);
+        }
+        multi_resolver_finish(lookup, &result);
+        multi_resolver_release(lookup);
+    }
+    return multi_open_connect(L, &result, startT);
+}
+
+/**
+ * Continuation of multi_open() after the lookup has finished
+ */
+static int multi_open_k(lua_State *L, int status, lua_KContext ctx) {
+    (void) status;
+    MultiLookup **ud = (MultiLookup **) lua_touserdata(L, 7);
+    MultiResolverResult result;
+    multi_resolver_finish(*ud, &result);
+    lua_settop(L, 6);
+    return multi_open_connect(L, &result, (long) ctx);
 }
 
 /**
@@ -314,7 +456,7 @@ static int multi_time(lua_State *L) {
         return 2; // Return nil, [String] error
     }
 
-    lua_pushnumber(L, getcurrenttime() / 1000000000.0);
+    lua_pushnumber(L, multi_clock_realtime() / 1000000000.0);
     return 1; // Return [Number] time
 }
 
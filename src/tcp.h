@@ -1,6 +1,51 @@
 
 
 
+/**
+ * Check if a failed operation on a non-blocking socket has to wait until the socket is ready
+ * If the timer of the scheduler has expired while the task waited, the operation does not wait again
+ * and fails with ETIMEDOUT instead.
+ * @param sock the socket
+ * @param ret the return value of the failed operation
+ * @param events MULTISOCKET_POLL_* to wait for, if the operation returned EAGAIN
+ * @return MULTISOCKET_POLL_READ / MULTISOCKET_POLL_WRITE, 0 = no need to wait
+ */
+static int multi_tcp_want(Multisocket *sock, long ret, int events) {
+    int want = 0;
+    if (!sock->nonblock || ret > 0) {
+        return 0;
+    } else if (sock->enc && sock->ssl != NULL) {
+        switch (SSL_get_error(sock->ssl, (int) ret)) {
+            case SSL_ERROR_WANT_READ: want = MULTISOCKET_POLL_READ; break;
+            case SSL_ERROR_WANT_WRITE: want = MULTISOCKET_POLL_WRITE; break;
+            default: return 0;
+        }
+    } else if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS)) {
+        want = events;
+    }
+    if (want && sock->expired) {
+        sock->expired = 0;
+        errno = ETIMEDOUT;
+        return 0;
+    }
+    return want;
+}
+
+/**
+ * Yield the running coroutine until the socket is ready
+ * The coroutine yields the socket and "r" or "w", the scheduler resumes it as soon as the socket is ready.
+ * Has to be used as return expression of a Lua function.
+ * @param L the Lua state, the socket has to be argument #0
+ * @param want MULTISOCKET_POLL_READ / MULTISOCKET_POLL_WRITE
+ * @param ctx the context passed to the continuation
+ * @param k the continuation
+ */
+static int multi_tcp_yield(lua_State *L, int want, lua_KContext ctx, lua_KFunction k) {
+    lua_pushvalue(L, 1);
+    lua_pushstring(L, (want == MULTISOCKET_POLL_WRITE) ? "w" : "r");
+    return lua_yieldk(L, 2, ctx, k); // Yield [Multisocket] socket, [String] events
+}
+
 /**
  * Lua Function
  * Create a new TCP/IPv6 socket
@@ -28,10 +73,24 @@ static int multi_tcp6(lua_State *L) {
     sock->socket = desc; // Set the socket filedescriptor
     sock->ssl = NULL;
     sock->ctx = NULL;
-    sock->startT = getcurrenttime(); // Set connection start time in nanoseconds
-    sock->lastT = getcurrenttime();  // Set last signal time in nanoseconds
+    sock->early = NULL;
+    sock->job = NULL;
+    sock->rbuf = NULL;
+    sock->rbufCap = 0;
+    sock->rbufPos = 0;
+    sock->rbufLen = 0;
+    sock->poller = NULL;
+    sock->pevents = 0;
+    sock->startT = multi_clock_monotonic(); // Set connection start time in nanoseconds
+    sock->lastT = sock->startT;             // Set last signal time in nanoseconds
+    sock->readT = 0;
+    sock->writeT = 0;
+    sock->handshakeT = 0;
     sock->recB = 0;  // Init received bytes
     sock->sndB = 0;  // Init sent bytes
+    sock->timeout = 0;
+    sock->idleTimeout = 0;
+    sock->timer = 0;
 
     sock->listen = 0;
     sock->conn = 0;
@@ -40,9 +99,19 @@ static int multi_tcp6(lua_State *L) {
     sock->tcp = 1;
     sock->udp = 0;
     sock->enc = 0;
+    sock->handshake = 0;
     sock->ipv6 = 1;
     sock->ipv4 = 0;
+    sock->pend = 0;
+    sock->rbufNew = 0;
+    sock->nonblock = 0;
+    sock->gro = 0;
+    sock->expired = 0;
+    sock->accepted = NULL;
+
+    multi_option_apply_defaults(sock);
 
+    multi_metrics_count(MULTISOCKET_METRIC_OPENED, 1);
     luaL_getmetatable(L, "multisocket_tcp"); // Get multisocket_tcp metatable
     lua_setmetatable(L, -2); // Set the metatable to the Multisocket
 
@@ -76,10 +145,24 @@ static int multi_tcp4(lua_State *L) {
     sock->socket = desc; // Set the socket filedescriptor
     sock->ssl = NULL;
     sock->ctx = NULL;
-    sock->startT = getcurrenttime(); // Set connection start time in nanoseconds
-    sock->lastT = getcurrenttime();  // Set last signal time in nanoseconds
+    sock->early = NULL;
+    sock->job = NULL;
+    sock->rbuf = NULL;
+    sock->rbufCap = 0;
+    sock->rbufPos = 0;
+    sock->rbufLen = 0;
+    sock->poller = NULL;
+    sock->pevents = 0;
+    sock->startT = multi_clock_monotonic(); // Set connection start time in nanoseconds
+    sock->lastT = sock->startT;             // Set last signal time in nanoseconds
+    sock->readT = 0;
+    sock->writeT = 0;
+    sock->handshakeT = 0;
     sock->recB = 0;  // Init received bytes
     sock->sndB = 0;  // Init sent bytes
+    sock->timeout = 0;
+    sock->idleTimeout = 0;
+    sock->timer = 0;
 
     sock->listen = 0;
     sock->conn = 0;
@@ -88,9 +171,19 @@ static int multi_tcp4(lua_State *L) {
     sock->tcp = 1;
     sock->udp = 0;
     sock->enc = 0;
+    sock->handshake = 0;
     sock->ipv6 = 0;
     sock->ipv4 = 1;
+    sock->pend = 0;
+    sock->rbufNew = 0;
+    sock->nonblock = 0;
+    sock->gro = 0;
+    sock->expired = 0;
+    sock->accepted = NULL;
 
+    multi_option_apply_defaults(sock);
+
+    multi_metrics_count(MULTISOCKET_METRIC_OPENED, 1);
     luaL_getmetatable(L, "multisocket_tcp"); // Get multisocket_tcp metatable
     lua_setmetatable(L, -2); // Set the metatable to the Multisocket
 
@@ -100,21 +193,22 @@ static int multi_tcp4(lua_State *L) {
 /**
  * Lua Method
  * Bind the socket to an address an a port
- * @param0 [Multisocket] socket (TCP)
+ * @param0 [Multisocket] socket
  * @param1 [String] address
  * @param2 [Integer] port (0-65535)
+ * @param3 [Boolean] reusePort (optional, several sockets share the port with SO_REUSEPORT)
  * @return1 [Boolean] success / nil
  * @return2 nil / [String] error
  */
 static int multi_tcp_bind(lua_State *L) {
-    // Check if there are three parameters and if they have valid values
-    if (lua_gettop(L) != 3) {
+    // Check if there are three or four parameters and if they have valid values
+    if (lua_gettop(L) != 3 && lua_gettop(L) != 4) {
         lua_pushnil(L);
         lua_pushstring(L, "Wrong number of arguments");
         return 2; // Return nil, [String] error
-    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+    } else if (!multi_is_socket(L, 1)) {
         lua_pushnil(L);
-        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (TCP)");
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
         return 2; // Return nil, [String] error
     } else if (!lua_isstring(L, 2)) {
         lua_pushnil(L);
@@ -124,6 +218,10 @@ static int multi_tcp_bind(lua_State *L) {
         lua_pushnil(L);
         lua_pushstring(L, "Argument #2 has to be [Integer] port (0-65535)");
         return 2; // Return nil, [String] error
+    } else if (lua_gettop(L) == 4 && !lua_isboolean(L, 4)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #3 has to be [Boolean] reusePort");
+        return 2; // Return nil, [String] error
     }
 
     // Cast userdata to Multisocket
@@ -133,6 +231,7 @@ static int multi_tcp_bind(lua_State *L) {
     size_t addressLength = 0;
     const char *address = lua_tolstring(L, 2, &addressLength);
     unsigned short port = (unsigned short) lua_tointeger(L, 3);
+    int reusePort = lua_toboolean(L, 4);
 
     // Init address structs for IPv6 and IPv4
     struct sockaddr_in6 address6;
@@ -178,16 +277,17 @@ static int multi_tcp_bind(lua_State *L) {
         addressSize = sizeof(address4);
     }
 
-    // Bind the socket to address and port
-    if (bind(sock->socket, socketAddress, addressSize) == -1) {
+    // ReuseAddr and ReusePort only have an effect if they are set before bind()
+    int enable = 1;
+    if (setsockopt(sock->socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0 ||
+        (reusePort && setsockopt(sock->socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0)) {
         lua_pushnil(L);
         lua_pushstring(L, strerror(errno));
         return 2; // Return nil, [String] error
     }
 
-    // ReusaAddr
-    int enable = 1;
-    if (setsockopt(sock->socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0) {
+    // Bind the socket to address and port
+    if (bind(sock->socket, socketAddress, addressSize) == -1) {
         lua_pushnil(L);
         lua_pushstring(L, strerror(errno));
         return 2; // Return nil, [String] error
@@ -242,6 +342,66 @@ static int multi_tcp_listen(lua_State *L) {
     return 1; // Return [Boolean] success (true)
 }
 
+/**
+ * Push a Multisocket for a connection accepted by a listener
+ * @param L the Lua state
+ * @param sock the listener, the client inherits its settings
+ * @param desc the filedescriptor of the connection
+ * @param now the current time, shared by all connections of a batch
+ * @param mt stack index of the multisocket_tcp metatable
+ * @param nonblock is the connection non-blocking?
+ * @return the client
+ */
+static Multisocket *multi_tcp_client(lua_State *L, Multisocket *sock, int desc, long now, int mt, int nonblock) {
+    // Allocate memory for Multisocket
+    Multisocket *client = (Multisocket *) lua_newuserdata(L, sizeof(Multisocket));
+    client->socket = desc; // Set the socket filedescriptor
+    client->ssl = NULL;
+    client->ctx = NULL;
+    client->early = NULL;
+    client->job = NULL;
+    client->rbuf = NULL;
+    client->rbufCap = 0;
+    client->rbufPos = 0;
+    client->rbufLen = 0;
+    client->poller = NULL;
+    client->pevents = 0;
+    client->startT = now; // Set connection start time in nanoseconds
+    client->lastT = now;  // Set last signal time in nanoseconds
+    client->readT = 0;
+    client->writeT = 0;
+    client->handshakeT = 0;
+    client->recB = 0;  // Init received bytes
+    client->sndB = 0;  // Init sent bytes
+    client->timeout = 0;
+    client->idleTimeout = sock->idleTimeout; // Connections inherit the idle timeout of the listener
+    client->timer = 0;
+
+    client->listen = 0;
+    client->conn = 1;
+    client->servers = 1;
+    client->clients = 0;
+    client->tcp = 1;
+    client->udp = 0;
+    client->enc = sock->enc;
+    client->handshake = 0;
+    client->ipv6 = sock->ipv6;
+    client->ipv4 = sock->ipv4;
+    client->pend = 0;
+    client->rbufNew = 0;
+    client->nonblock = nonblock;
+    client->gro = 0;
+    client->expired = 0;
+    client->accepted = NULL;
+
+    multi_option_apply_defaults(client);
+    multi_metrics_count(MULTISOCKET_METRIC_ACCEPTED, 1);
+
+    lua_pushvalue(L, mt);
+    lua_setmetatable(L, -2);
+    return client;
+}
+
 /**
  * Lua Method
  * Wait until a connection is ready to be accepted
@@ -249,6 +409,9 @@ static int multi_tcp_listen(lua_State *L) {
  * @return1 [Multisocket] client / nil
  * @return2 nil / [String] error
  */
+static int multi_tcp_accept_k(lua_State *L, int status, lua_KContext ctx);
+static int multi_tcp_accept_run(lua_State *L, Multisocket *sock);
+
 static int multi_tcp_accept(lua_State *L) {
     // Check if there are two parameters and if they have valid values
     if (lua_gettop(L) != 1) {
@@ -263,30 +426,60 @@ static int multi_tcp_accept(lua_State *L) {
 
     // Cast userdata to Multisocket
     Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+    sock->readT = multi_clock_monotonic();
+    return multi_metrics_finish(L, sock, MULTISOCKET_METRIC_ACCEPT, sock->readT, multi_tcp_accept_run(L, sock));
+}
 
+/**
+ * Continuation of multi_tcp_accept() after the listener became readable
+ */
+static int multi_tcp_accept_k(lua_State *L, int status, lua_KContext ctx) {
+    (void) status;
+    (void) ctx;
+    lua_settop(L, 1);
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+    return multi_metrics_finish(L, sock, MULTISOCKET_METRIC_ACCEPT, sock->readT, multi_tcp_accept_run(L, sock));
+}
+
+/**
+ * Accept a connection for multi_tcp_accept()
+ * @param L the Lua state with the validated arguments of multi_tcp_accept()
+ * @param sock the listener
+ */
+static int multi_tcp_accept_run(lua_State *L, Multisocket *sock) {
     // Init address variables
+    struct sockaddr_in6 address6;
+    struct sockaddr_in address4;
     struct sockaddr *address;
     socklen_t len;
 
     if (sock->ipv6) {
         // TCP/IPv6
-        struct sockaddr_in6 address6;
         bzero(&address6, sizeof(address6));
         len = sizeof(address6);
         address = (struct sockaddr *) &address6;
-    } else if (sock->ipv4) {
+    } else {
         // TCP/IPv4
-        struct sockaddr_in address4;
         bzero(&address4, sizeof(address4));
         len = sizeof(address4);
         address = (struct sockaddr *) &address4;
     }
 
-    // Accept a new incoming connection
-    int desc = accept(sock->socket, address, &len);
+    // Accept a new incoming connection, sockets accepted by a non-blocking listener are non-blocking too
+    // Connections accepted by the io_uring of a scheduler are taken first
+    int desc = multi_uring_accept_take(sock, sock->nonblock ? SOCK_NONBLOCK : 0);
+    if (desc == -1) {
+        desc = accept4(sock->socket, address, &len, sock->nonblock ? SOCK_NONBLOCK : 0);
+    }
     if (desc == -1) {
+        int want = multi_tcp_want(sock, -1, MULTISOCKET_POLL_READ);
+        if (want && lua_isyieldable(L)) {
+            return multi_tcp_yield(L, want, 0, multi_tcp_accept_k);
+        }
         lua_pushnil(L);
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        if (want) {
+            lua_pushstring(L, "want_read");
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ETIMEDOUT) {
             lua_pushstring(L, "timeout");
         } else if (errno == ECONNRESET) {
             lua_pushstring(L, "closed");
@@ -296,48 +489,145 @@ static int multi_tcp_accept(lua_State *L) {
         return 2; // Return nil, [String] error
     }
 
-    // Allocate memory for Multisocket
-    Multisocket *client = (Multisocket *) lua_newuserdata(L, sizeof(Multisocket));
-    client->socket = desc; // Set the socket filedescriptor
-    client->ssl = NULL;
-    client->startT = getcurrenttime(); // Set connection start time in nanoseconds
-    client->lastT = getcurrenttime();  // Set last signal time in nanoseconds
-    client->recB = 0;  // Init received bytes
-    client->sndB = 0;  // Init sent bytes
-
-    client->listen = 0;
-    client->conn = 1;
-    client->servers = 1;
-    client->clients = 0;
-    client->tcp = 1;
-    client->udp = 0;
-    client->enc = sock->enc;
-    client->ipv6 = sock->ipv6;
-    client->ipv4 = sock->ipv4;
-
     luaL_getmetatable(L, "multisocket_tcp");
-    lua_setmetatable(L, -2);
+    multi_tcp_client(L, sock, desc, multi_clock_now(), lua_gettop(L), sock->nonblock);
 
     return 1; // Return [Multisocket] client
 }
 
 /**
  * Lua Method
+ * Accept up to max pending connections at once
+ * Waits for the first connection like accept(), then takes the other ones which are already pending.
+ * The connections are accepted with accept4() and SOCK_CLOEXEC, the clock and the inherited settings
+ * of the listener are read once per batch.
  * @param0 [Multisocket] socket (TCP)
+ * @param1 [Integer] max (1-65535)
+ * @param2 [Boolean] nonblocking (optional, default = mode of the listener)
+ * @return1 [Table<Integer, Multisocket>] clients / nil
+ * @return2 nil / [String] error
+ */
+static int multi_tcp_accept_many_k(lua_State *L, int status, lua_KContext ctx);
+static int multi_tcp_accept_many_run(lua_State *L, Multisocket *sock);
+
+static int multi_tcp_accept_many(lua_State *L) {
+    // Check if there are two or three parameters and if they have valid values
+    if (lua_gettop(L) != 2 && lua_gettop(L) != 3) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (TCP)");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isinteger(L, 2) || lua_tointeger(L, 2) < 1 || lua_tointeger(L, 2) > 0xFFFF) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [Integer] max (1-65535)");
+        return 2; // Return nil, [String] error
+    } else if (lua_gettop(L) == 3 && !lua_isnil(L, 3) && !lua_isboolean(L, 3)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #2 has to be [Boolean] nonblocking");
+        return 2; // Return nil, [String] error
+    }
+
+    // Cast userdata to Multisocket
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+    sock->readT = multi_clock_monotonic();
+    return multi_metrics_finish(L, sock, MULTISOCKET_METRIC_ACCEPT, sock->readT, multi_tcp_accept_many_run(L, sock));
+}
+
+/**
+ * Continuation of multi_tcp_accept_many() after the listener became readable
+ */
+static int multi_tcp_accept_many_k(lua_State *L, int status, lua_KContext ctx) {
+    (void) status;
+    lua_settop(L, (int) ctx);
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+    return multi_metrics_finish(L, sock, MULTISOCKET_METRIC_ACCEPT, sock->readT, multi_tcp_accept_many_run(L, sock));
+}
+
+/**
+ * Accept the connections for multi_tcp_accept_many()
+ * @param L the Lua state with the validated arguments of multi_tcp_accept_many()
+ * @param sock the listener
+ */
+static int multi_tcp_accept_many_run(lua_State *L, Multisocket *sock) {
+    // Load parameters into variables
+    int max = (int) lua_tointeger(L, 2);
+    int nonblock = (lua_gettop(L) == 3 && !lua_isnil(L, 3)) ? lua_toboolean(L, 3) : sock->nonblock;
+    int flags = SOCK_CLOEXEC | (nonblock ? SOCK_NONBLOCK : 0);
+
+    // The first connection is awaited like in accept()
+    int desc = multi_uring_accept_take(sock, flags);
+    if (desc == -1) {
+        desc = accept4(sock->socket, NULL, NULL, flags);
+    }
+    if (desc == -1) {
+        int want = multi_tcp_want(sock, -1, MULTISOCKET_POLL_READ);
+        if (want && lua_isyieldable(L)) {
+            return multi_tcp_yield(L, want, lua_gettop(L), multi_tcp_accept_many_k);
+        }
+        lua_pushnil(L);
+        if (want) {
+            lua_pushstring(L, "want_read");
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ETIMEDOUT) {
+            lua_pushstring(L, "timeout");
+        } else if (errno == ECONNRESET) {
+            lua_pushstring(L, "closed");
+        } else {
+            lua_pushstring(L, strerror(errno));
+        }
+        return 2; // Return nil, [String] error
+    }
+
+    long now = multi_clock_now();
+    luaL_getmetatable(L, "multisocket_tcp");
+    int mt = lua_gettop(L);
+    lua_createtable(L, (max < 64) ? max : 64, 0);
+    multi_tcp_client(L, sock, desc, now, mt, nonblock);
+    lua_rawseti(L, -2, 1);
+
+    // The other connections are only taken if they are already pending
+    int listenFlags = 0;
+    if (!sock->nonblock && max > 1) {
+        listenFlags = fcntl(sock->socket, F_GETFL, 0);
+        fcntl(sock->socket, F_SETFL, listenFlags | O_NONBLOCK);
+    }
+    int num = 1;
+    while (num < max && ((desc = multi_uring_accept_take(sock, flags)) != -1 ||
+                         (desc = accept4(sock->socket, NULL, NULL, flags)) != -1)) {
+        multi_tcp_client(L, sock, desc, now, mt, nonblock);
+        lua_rawseti(L, -2, ++num);
+    }
+    if (!sock->nonblock && max > 1) {
+        fcntl(sock->socket, F_SETFL, listenFlags);
+    }
+
+    return 1; // Return [Table<Integer, Multisocket>] clients
+}
+
+/**
+ * Lua Method
+ * @param0 [Multisocket] socket
  * @param1 [String] address (address or domain)
  * @param2 [Integer] port (0-65535)
  * @return1 [Boolean] success / nil
  * @return2 nil / [String] error
  */
+static int multi_tcp_connect_k(lua_State *L, int status, lua_KContext ctx);
+static int multi_tcp_connect_resolved_k(lua_State *L, int status, lua_KContext ctx);
+static int multi_tcp_connect_run(lua_State *L, Multisocket *sock, MultiResolverResult *result, unsigned short port);
+static int multi_tcp_connect_done(lua_State *L, Multisocket *sock);
+
 static int multi_tcp_connect(lua_State *L) {
     // Check if there are three parameters and if they have valid values
     if (lua_gettop(L) != 3) {
         lua_pushnil(L);
         lua_pushstring(L, "Wrong number of arguments");
         return 2; // Return nil, [String] error
-    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+    } else if (!multi_is_socket(L, 1)) {
         lua_pushnil(L);
-        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (TCP)");
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
         return 2; // Return nil, [String] error
     } else if (!lua_isstring(L, 2)) {
         lua_pushnil(L);
@@ -357,53 +647,72 @@ static int multi_tcp_connect(lua_State *L) {
     const char *address = lua_tolstring(L, 2, &addressLength);
     unsigned short port = (unsigned short) lua_tointeger(L, 3);
 
-    // Init address structs for IPv6 and IPv4
-    struct sockaddr_in6 address6;
-    struct sockaddr_in address4;
-    bzero(&address6, sizeof(address6));
-    bzero(&address4, sizeof(address4));
-
-    address6.sin6_family = AF_INET6;
-    address4.sin_family = AF_INET;
+    // Host names are resolved by the resolver, a non-blocking socket waits for the lookup without blocking
+    sock->writeT = multi_clock_monotonic();
+    MultiResolverResult result;
+    int family = (sock->ipv6) ? AF_INET6 : AF_INET;
+    if (!multi_resolver_get(address, family, &result)) {
+        MultiLookup *lookup = multi_resolver_start(address, family);
+        if (lookup == NULL) {
+            lua_pushnil(L);
+            lua_pushstring(L, strerror(errno));
+            return 2; // Return nil, [String] error
+        } else if (sock->nonblock && lua_isyieldable(L)) {
+            return multi_resolver_yield(L, lookup, 0, multi_tcp_connect_resolved_k);
+        }
+        multi_resolver_finish(lookup, &result);
+        multi_resolver_release(lookup);
+    }
+    return multi_metrics_finish(L, sock, MULTISOCKET_METRIC_CONNECT, sock->writeT, multi_tcp_connect_run(L, sock, &result, port));
+}
 
-    struct addrinfo *result, *next;
-    struct addrinfo hint;
-    bzero(&hint, sizeof(hint));
-    hint.ai_family = (sock->ipv6) ? AF_INET6 : AF_INET;
+/**
+ * Continuation of multi_tcp_connect() after the lookup of the address has finished
+ */
+static int multi_tcp_connect_resolved_k(lua_State *L, int status, lua_KContext ctx) {
+    (void) status;
+    (void) ctx;
+    MultiResolverResult result;
+    multi_resolver_finish(*(MultiLookup **) lua_touserdata(L, 4), &result);
+    lua_settop(L, 3);
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+    return multi_metrics_finish(L, sock, MULTISOCKET_METRIC_CONNECT, sock->writeT,
+                                multi_tcp_connect_run(L, sock, &result, (unsigned short) lua_tointeger(L, 3)));
+}
 
-    int ret = getaddrinfo(address, NULL, &hint, &result);
-    if (ret != 0) {
+/**
+ * Connect to the first address of the lookup result
+ */
+static int multi_tcp_connect_run(lua_State *L, Multisocket *sock, MultiResolverResult *result, unsigned short port) {
+    if (result->error != 0) {
         lua_pushnil(L);
-        lua_pushstring(L, gai_strerror(ret));
+        lua_pushstring(L, gai_strerror(result->error));
+        return 2; // Return nil, [String] error
+    } else if (result->count == 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Unable to resolve address");
         return 2; // Return nil, [String] error
     }
 
-    struct sockaddr *addr;
-    socklen_t addrLen = 0;
-
-    for (next = result; next != NULL; next = next->ai_next) {
-        addrLen = next->ai_addrlen;
-        if (sock->ipv6 && next->ai_family == AF_INET6) {
-            memcpy(&address6, next->ai_addr, next->ai_addrlen);
-            break;
-        } else if (sock->ipv4 && next->ai_family == AF_INET) {
-            memcpy(&address4, next->ai_addr, next->ai_addrlen);
-            break;
-        }
-    }
-
-    address6.sin6_port = htons(port);
-    address4.sin_port = htons(port);
-
+    struct sockaddr *addr = (struct sockaddr *) &result->addresses[0];
+    socklen_t addrLen;
     if (sock->ipv6) {
-        addr = (struct sockaddr *) &address6;
-    } else if (sock->ipv4) {
-        addr = (struct sockaddr *) &address4;
+        result->addresses[0].sin6_port = htons(port);
+        addrLen = sizeof(struct sockaddr_in6);
+    } else {
+        ((struct sockaddr_in *) addr)->sin_port = htons(port);
+        addrLen = sizeof(struct sockaddr_in);
     }
 
     if (connect(sock->socket, addr, addrLen) == -1) {
+        int want = multi_tcp_want(sock, -1, MULTISOCKET_POLL_WRITE);
+        if (want && lua_isyieldable(L)) {
+            return multi_tcp_yield(L, want, 0, multi_tcp_connect_k);
+        }
         lua_pushnil(L);
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        if (want) {
+            lua_pushstring(L, "want_write");
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ETIMEDOUT) {
             lua_pushstring(L, "timeout");
         } else {
             lua_pushstring(L, strerror(errno));
@@ -413,6 +722,51 @@ static int multi_tcp_connect(lua_State *L) {
 
     sock->conn = 1;
     sock->clients = 1;
+    multi_metrics_count(MULTISOCKET_METRIC_CONNECTED, 1);
+
+    lua_pushboolean(L, 1);
+    return 1; // Return [Boolean] success (true)
+}
+
+/**
+ * Continuation of multi_tcp_connect() after the socket became writable
+ */
+static int multi_tcp_connect_k(lua_State *L, int status, lua_KContext ctx) {
+    (void) status;
+    (void) ctx;
+    lua_settop(L, 3);
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+    return multi_metrics_finish(L, sock, MULTISOCKET_METRIC_CONNECT, sock->writeT, multi_tcp_connect_done(L, sock));
+}
+
+/**
+ * Get the result of a connection attempt which was in progress
+ * @param L the Lua state
+ * @param sock the socket
+ */
+static int multi_tcp_connect_done(lua_State *L, Multisocket *sock) {
+    // The connection is still in progress, if the timer of the scheduler has expired
+    if (sock->expired) {
+        sock->expired = 0;
+        lua_pushnil(L);
+        lua_pushstring(L, "timeout");
+        return 2; // Return nil, [String] error
+    }
+
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(sock->socket, SOL_SOCKET, SO_ERROR, &error, &len) == -1) {
+        error = errno;
+    }
+    if (error != 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(error));
+        return 2; // Return nil, [String] error
+    }
+
+    sock->conn = 1;
+    sock->clients = 1;
+    multi_metrics_count(MULTISOCKET_METRIC_CONNECTED, 1);
 
     lua_pushboolean(L, 1);
     return 1; // Return [Boolean] success (true)
@@ -426,6 +780,8 @@ static int multi_tcp_connect(lua_State *L) {
  * @return2 nil / [String] error
  * @return3 nil / [String] partData
  */
+static int multi_tcp_receive_run(lua_State *L, size_t searched);
+
 static int multi_tcp_receive(lua_State *L) {
     // Check if there are two parameters and if they have valid values
     if (lua_gettop(L) != 2 && lua_gettop(L) != 1) {
@@ -445,280 +801,157 @@ static int multi_tcp_receive(lua_State *L) {
         return 3; // Return nil, [String] error, [String] partData
     }
 
+    // Check the length of the delimiter
+    if (lua_gettop(L) == 2 && !lua_isinteger(L, 2) && lua_isstring(L, 2) && (lua_rawlen(L, 2) < 1 || lua_rawlen(L, 2) > MULTISOCKET_BUFFER_SIZE)) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "Argument #1 has to be nil / [String] until (Length: 1-%i) / [Integer] numBytes (64 Bit)", MULTISOCKET_BUFFER_SIZE);
+        lua_pushstring(L, "");
+        return 3; // Return nil, [String] error, [String] partData
+    }
+
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+    sock->readT = multi_clock_monotonic();
+    return multi_metrics_finish(L, sock, MULTISOCKET_METRIC_RECEIVE, sock->readT, multi_tcp_receive_run(L, 0));
+}
+
+/**
+ * Continuation of multi_tcp_receive() after the socket became ready
+ * The number of already searched bytes is stored above the arguments
+ */
+static int multi_tcp_receive_k(lua_State *L, int status, lua_KContext ctx) {
+    (void) status;
+    size_t searched = (size_t) lua_tointeger(L, (int) ctx + 1);
+    lua_settop(L, (int) ctx);
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+    return multi_metrics_finish(L, sock, MULTISOCKET_METRIC_RECEIVE, sock->readT, multi_tcp_receive_run(L, searched));
+}
+
+/**
+ * Receive data into the read-ahead buffer until the condition of multi_tcp_receive() applies
+ * @param L the Lua state with the validated arguments of multi_tcp_receive()
+ * @param searched number of buffered bytes which do not contain the delimiter
+ */
+static int multi_tcp_receive_run(lua_State *L, size_t searched) {
     // Cast userdata to Multisocket
     Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
 
     // Init variables
     long wantedBytes = 0;
-    long wantedStringLen = 0;
+    size_t wantedStringLen = 0;
     const char *wantedString = "";
 
     // Check which argument is passed
     char mode;
     if (lua_gettop(L) == 1 || lua_isnil(L, 2)) {
         mode = 0;
-    } else if (lua_gettop(L) == 2 && lua_isinteger(L, 2)) {
+    } else if (lua_isinteger(L, 2)) {
         mode = 1;
         wantedBytes = lua_tointeger(L, 2);
-    } else if (lua_gettop(L) == 2 && lua_isstring(L, 2)) {
+    } else {
         mode = 2;
         wantedString = lua_tolstring(L, 2, &wantedStringLen);
-        if (wantedStringLen < 1 || wantedStringLen > MULTISOCKET_BUFFER_SIZE) {
-            lua_pushnil(L);
-            lua_pushfstring(L, "Argument #1 has to be nil / [String] until (Length: 1-%i) / [Integer] numBytes (64 Bit)", MULTISOCKET_BUFFER_SIZE);
-            lua_pushstring(L, "");
-            return 3; // Return nil, [String] error, [String] partData
-        }
-    } else {
-        lua_pushnil(L);
-        lua_pushstring(L, "Something went wrong");
-        lua_pushstring(L, "");
-        return 3; // Return nil, [String] error, [String] partData
     }
 
-    // Init lua string
-    luaL_Buffer str;
-    luaL_buffinit(L, &str);
-    long strLen = 0;
-
-    // Init buffer and pre-buffer
-    char pre[MULTISOCKET_BUFFER_SIZE];
-    char buffer[MULTISOCKET_BUFFER_SIZE];
-
-    // Init poll filedescriptor(s) to
-    struct pollfd ufds[1];
-    ufds[0].fd = sock->socket;
-    ufds[0].events = POLLIN | POLLOUT | POLLERR | POLLHUP;
-
-    // Receive until the condition applies
+    // Serve the request from the read-ahead buffer and refill it in large chunks
     while (1) {
-        if (mode == 0) {
-
-            long size;
-            if (sock->enc) {
-                size = SSL_read(sock->ssl, buffer, sizeof(buffer));
-            } else {
-                size = recv(sock->socket, buffer, sizeof(buffer), 0);
-            }
-            if (size < 0) {
-                lua_pushnil(L);
-                if (sock->enc) {
-                    lua_pushstring(L, multi_ssl_get_error(sock->ssl, size));
-                } else {
-                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                        lua_pushstring(L, "timeout");
-                    } else if (errno == ECONNRESET) {
-                        lua_pushstring(L, "closed");
-                    } else {
-                        lua_pushstring(L, strerror(errno));
-                    }
-                }
-                luaL_pushresult(&str);
-                return 3; // Return nil, [String] error, [String] partData
-            }
-            sock->recB += size;
-            sock->lastT = getcurrenttime();
-            strLen += size;
-            luaL_addlstring(&str, buffer, size);
-
-            if (size != sizeof(buffer)) {
-                luaL_pushresult(&str);
-                lua_pushnil(L);
-                lua_pushnil(L);
-                return 3;
-            }
-
-
-        } else if (mode == 1) {
-
-            long len = sizeof(buffer);
-            if (len > wantedBytes-strLen) {
-                len = wantedBytes-strLen;
-            }
-            long size;
-
-            if (len == 0) {
-                luaL_pushresult(&str);
-                lua_pushnil(L);
-                lua_pushnil(L);
-                return 3; // Return [String] data, nil, nil
-            }
-
-            if (sock->enc) {
-                size = SSL_read(sock->ssl, buffer, len);
-            } else {
-                size = recv(sock->socket, buffer, len, 0);
-            }
-
-            if (size < 0) {
-                lua_pushnil(L);
-                if (sock->enc) {
-                    lua_pushstring(L, multi_ssl_get_error(sock->ssl, size));
-                } else {
-                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                        lua_pushstring(L, "timeout");
-                    } else if (errno == ECONNRESET) {
-                        lua_pushstring(L, "closed");
-                    } else {
-                        lua_pushstring(L, strerror(errno));
-                    }
-                }
-                luaL_pushresult(&str);
-                return 3; // Return nil, [String] error, [String] partData
-            }
-            sock->recB += size;
-            sock->lastT = getcurrenttime();
-            strLen += size;
-            luaL_addlstring(&str, buffer, size);
-            if (strLen == wantedBytes) {
-                luaL_pushresult(&str);
+        if (mode == 0 && sock->rbufLen > 0) {
+            lua_pushlstring(L, sock->rbuf + sock->rbufPos, sock->rbufLen);
+            multi_buffer_consume(sock, sock->rbufLen);
+            multi_poller_mark(sock);
+            lua_pushnil(L);
+            lua_pushnil(L);
+            return 3; // Return [String] data, nil, nil
+        } else if (mode == 1 && sock->rbufLen >= (size_t) wantedBytes) {
+            lua_pushlstring(L, sock->rbuf + sock->rbufPos, wantedBytes);
+            multi_buffer_consume(sock, wantedBytes);
+            multi_poller_mark(sock);
+            lua_pushnil(L);
+            lua_pushnil(L);
+            return 3; // Return [String] data, nil, nil
+        } else if (mode == 2) {
+            // Only search the new data, a delimiter may start in the last bytes of the old data
+            long pos = multi_search(sock->rbuf + sock->rbufPos + searched, sock->rbufLen - searched, wantedString, wantedStringLen);
+            if (pos >= 0) {
+                pos += searched;
+                lua_pushlstring(L, sock->rbuf + sock->rbufPos, pos);
+                multi_buffer_consume(sock, pos + wantedStringLen);
+                multi_poller_mark(sock);
                 lua_pushnil(L);
                 lua_pushnil(L);
                 return 3; // Return [String] data, nil, nil
             }
-
-
-        } else if (mode == 2) {
-
-            memcpy(pre, buffer, sizeof(buffer)); // Copy buffer to pre
-
-            long size;
-            if (sock->enc) {
-                size = SSL_peek(sock->ssl, buffer, sizeof(buffer));
-            } else {
-                size = recv(sock->socket, buffer, sizeof(buffer), MSG_PEEK);
-            }
-            if (size < 0 || sock->enc && size == 0) {
-                lua_pushnil(L);
-                if (sock->enc) {
-                    lua_pushstring(L, multi_ssl_get_error(sock->ssl, (int) size));
-                } else {
-                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                        lua_pushstring(L, "timeout");
-                    } else if (errno == ECONNRESET) {
-                        lua_pushstring(L, "closed");
-                    } else {
-                        lua_pushstring(L, strerror(errno));
-                    }
-                }
-                luaL_pushresult(&str);
-                return 3; // Return nil, [String] error, [String] partData
+            if (sock->rbufLen >= (size_t) wantedStringLen) {
+                searched = sock->rbufLen - wantedStringLen + 1;
             }
+        }
 
-            char *ptr = buffer - wantedStringLen + 1;
-            while (1) {
-                ptr = memchr(ptr, wantedString[0], size);
-                if (ptr == NULL || memcmp(ptr, wantedString, wantedStringLen) == 0) {
-                    break;
-                }
-                ptr++;
-            }
-            if (ptr != NULL) {
-                strLen += ptr - buffer + wantedStringLen;
-                luaL_addlstring(&str, buffer, ptr - buffer);
-                long ret;
-                if (sock->enc) {
-                    ret = SSL_read(sock->ssl, buffer, ptr - buffer + wantedStringLen);
-                } else {
-                    ret = recv(sock->socket, buffer, ptr - buffer + wantedStringLen, 0);
-                }
-                if (ret < 0) {
-                    lua_pushnil(L);
-                    if (sock->enc) {
-                        lua_pushstring(L, multi_ssl_get_error(sock->ssl, size));
-                    } else {
-                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                            lua_pushstring(L, "timeout");
-                        } else if (errno == ECONNRESET) {
-                            lua_pushstring(L, "closed");
-                        } else {
-                            lua_pushstring(L, strerror(errno));
-                        }
-                    }
-                    luaL_pushresult(&str);
-                    return 3; // Return nil, [String] error, [String] partData
-                }
-                sock->recB += ptr - buffer + wantedStringLen;
-                sock->lastT = getcurrenttime();
-                luaL_pushresult(&str);
-                lua_pushnil(L);
-                lua_pushnil(L);
-                return 3; // Return [String] data, nil, nil
-            } else {
-                strLen += size;
-                luaL_addlstring(&str, buffer, size);
-                long ret;
-                if (sock->enc) {
-                    ret = SSL_read(sock->ssl, buffer, size);
-                } else {
-                    ret = recv(sock->socket, buffer, size, 0);
-                }
-                if (ret < 0) {
-                    lua_pushnil(L);
-                    if (sock->enc) {
-                        lua_pushstring(L, multi_ssl_get_error(sock->ssl, ret));
-                    } else {
-                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                            lua_pushstring(L, "timeout");
-                        } else if (errno == ECONNRESET) {
-                            lua_pushstring(L, "closed");
-                        } else {
-                            lua_pushstring(L, strerror(errno));
-                        }
-                    }
-                    luaL_pushresult(&str);
-                    return 3; // Return nil, [String] error, [String] partData
-                }
-                sock->recB += size;
-                sock->lastT = getcurrenttime();
-            }
+        size_t size = 0;
+        if (mode == 1) {
+            size = wantedBytes - sock->rbufLen;
         }
 
-        if (poll(ufds, 1, 0) == -1) {
+        long ret = multi_buffer_fill(sock, size);
+        int want = multi_tcp_want(sock, ret, MULTISOCKET_POLL_READ);
+        if (want && lua_isyieldable(L)) {
+            int top = lua_gettop(L);
+            lua_pushinteger(L, (lua_Integer) searched);
+            return multi_tcp_yield(L, want, top, multi_tcp_receive_k);
+        } else if (want) {
+            // Non-blocking socket outside of a coroutine, the data stays buffered for the next call
             lua_pushnil(L);
-            lua_pushstring(L, strerror(errno));
+            lua_pushstring(L, (want == MULTISOCKET_POLL_WRITE) ? "want_write" : "want_read");
+            lua_pushstring(L, "");
+            return 3; // Return nil, [String] error, [String] partData
+        } else if (ret == 0 && mode == 0) {
             lua_pushstring(L, "");
+            lua_pushnil(L);
+            lua_pushnil(L);
+            return 3; // Return [String] data, nil, nil
+        } else if (ret <= 0) {
+            lua_pushnil(L);
+            multi_buffer_error(L, sock, ret);
+            lua_pushlstring(L, (sock->rbuf != NULL) ? sock->rbuf + sock->rbufPos : "", sock->rbufLen);
+            multi_buffer_consume(sock, sock->rbufLen);
             return 3; // Return nil, [String] error, [String] partData
         }
+    }
+}
 
-        /*if ((ufds[0].revents & POLLIN) == 0) {
-            if (mode == 0) {
-                luaL_pushresult(&str);
-                if ((ufds[0].revents & POLLHUP) || (ufds[0].revents & POLLERR)) {
-                    lua_pushstring(L, "closed");
-                } else {
-                    lua_pushnil(L);
-                }
-                lua_pushnil(L);
-                return 3; // Return [String] data, [String] error, nil
-            } else {
-                lua_pushnil(L);
-                if ((ufds[0].revents & POLLHUP) || (ufds[0].revents & POLLERR)) {
-                    lua_pushstring(L, "closed");
-                } else if (ufds[0].revents & POLLOUT) {
-                    lua_pushstring(L, "want_write");
-                } else {
-                    lua_pushstring(L, "error");
-                }
-                luaL_pushresult(&str);
-                return 3; // Return nil, [String] error, [String] partData
-            }
-        }*/
+/**
+ * Get a piece of the data passed to multi_tcp_send()
+ * The string stays valid, because it is referenced by the argument or the table
+ * @param L the Lua state with the validated arguments of multi_tcp_send()
+ * @param table is the data passed as table?
+ * @param index index of the piece, starting at 0
+ * @param len the length of the piece
+ * @return the piece
+ */
+static const char *multi_tcp_send_piece(lua_State *L, int table, size_t index, size_t *len) {
+    if (!table) {
+        return lua_tolstring(L, (int) index + 2, len);
     }
+    lua_rawgeti(L, 2, (lua_Integer) index + 1);
+    const char *piece = lua_tolstring(L, -1, len);
+    lua_pop(L, 1);
+    return piece;
 }
 
 /**
  * Lua Method
  * Send data to the peer
+ * Several strings are sent with a single writev() call, without concatenating them first.
+ * On encrypted sockets small strings are packed into as few TLS records as possible.
  * @param0 [Multisocket] socket (TCP)
- * @param1 [String] data
+ * @param1... [String] data / [Table<Integer, String>] data
  * @return1 [Integer] byteNum / nil
  * @return2 nil / [String] error
  * @return3 nil / [Integer] partByteNum
  */
+static int multi_tcp_send_run(lua_State *L, long pos);
+
 static int multi_tcp_send(lua_State *L) {
-    // Check if there are two parameters and if they have valid values
-    if (lua_gettop(L) != 2) {
+    // Check if there are at least two parameters and if they have valid values
+    if (lua_gettop(L) < 2) {
         lua_pushnil(L);
         lua_pushstring(L, "Wrong number of arguments");
         lua_pushinteger(L, 0);
@@ -728,40 +961,125 @@ static int multi_tcp_send(lua_State *L) {
         lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (TCP)");
         lua_pushinteger(L, 0);
         return 3; // Return nil, [String] error, [Integer] partByteNum
-    } else if (!lua_tostring(L, 2)) {
-        lua_pushnil(L);
-        lua_pushfstring(L, "Argument #1 has to be [String] data");
-        lua_pushinteger(L, 0);
-        return 3; // Return nil, [String] error, [Integer] partByteNum
     }
 
+    if (lua_gettop(L) == 2 && lua_istable(L, 2)) {
+        size_t num = lua_rawlen(L, 2);
+        for (size_t i = 1; i <= num; i++) {
+            if (lua_rawgeti(L, 2, (lua_Integer) i) != LUA_TSTRING) {
+                lua_pushnil(L);
+                lua_pushstring(L, "Argument #1 has to be [String] data / [Table<Integer, String>] data");
+                lua_pushinteger(L, 0);
+                return 3; // Return nil, [String] error, [Integer] partByteNum
+            }
+            lua_pop(L, 1);
+        }
+    } else {
+        for (int i = 2; i <= lua_gettop(L); i++) {
+            if (!lua_tostring(L, i)) {
+                lua_pushnil(L);
+                lua_pushfstring(L, "Argument #%d has to be [String] data", i - 1);
+                lua_pushinteger(L, 0);
+                return 3; // Return nil, [String] error, [Integer] partByteNum
+            }
+        }
+    }
+
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+    sock->writeT = multi_clock_monotonic();
+    return multi_metrics_finish(L, sock, MULTISOCKET_METRIC_SEND, sock->writeT, multi_tcp_send_run(L, 0));
+}
+
+/**
+ * Continuation of multi_tcp_send() after the socket became ready
+ * The number of already sent bytes is stored above the arguments
+ */
+static int multi_tcp_send_k(lua_State *L, int status, lua_KContext ctx) {
+    (void) status;
+    long pos = (long) lua_tointeger(L, (int) ctx + 1);
+    lua_settop(L, (int) ctx);
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+    return multi_metrics_finish(L, sock, MULTISOCKET_METRIC_SEND, sock->writeT, multi_tcp_send_run(L, pos));
+}
+
+/**
+ * Send the data passed to multi_tcp_send()
+ * @param L the Lua state with the validated arguments of multi_tcp_send()
+ * @param pos number of bytes already sent
+ */
+static int multi_tcp_send_run(lua_State *L, long pos) {
     // Cast userdata to Multisocket
     Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
-    long dataSize = 0;
-    long pos = 0;
-    const char *data = lua_tolstring(L, 2, &dataSize);
+    int table = lua_istable(L, 2);
+    size_t num = table ? lua_rawlen(L, 2) : (size_t) lua_gettop(L) - 1;
+
+    // Skip the pieces which have already been sent
+    size_t piece = 0;
+    size_t offset = (size_t) pos;
+    size_t len = 0;
+    const char *data = NULL;
+    for (; piece < num; piece++) {
+        data = multi_tcp_send_piece(L, table, piece, &len);
+        if (offset < len) {
+            break;
+        }
+        offset -= len;
+    }
 
     // Init poll filedescriptor(s) to
     struct pollfd ufds[1];
     ufds[0].fd = sock->socket;
     ufds[0].events = POLLIN | POLLOUT | POLLERR | POLLHUP;
 
-    int s = MULTISOCKET_BUFFER_SIZE;
-    while (pos < dataSize) {
-        if (s > dataSize - pos) {
-            s = (int) (dataSize - pos);
-        }
-
+    while (piece < num) {
         long trans;
         if (sock->enc) {
-            trans = SSL_write(sock->ssl, data+pos, s);
+            // A retried SSL_write() gets the same bytes, because the packing only depends on pos
+            char record[MULTISOCKET_TLS_RECORD_SIZE];
+            const char *ptr = data + offset;
+            size_t size = len - offset;
+            if (size < sizeof(record)) {
+                size = 0;
+                size_t off = offset;
+                for (size_t p = piece; p < num && size < sizeof(record); p++, off = 0) {
+                    size_t l = 0;
+                    const char *d = multi_tcp_send_piece(L, table, p, &l);
+                    size_t n = (l - off < sizeof(record) - size) ? l - off : sizeof(record) - size;
+                    memcpy(record + size, d + off, n);
+                    size += n;
+                }
+                ptr = record;
+            }
+            trans = multi_tls_write(sock, ptr, (size > 0x7FFFFFFF) ? 0x7FFFFFFF : (int) size);
         } else {
-            trans = send(sock->socket, data+pos, s, 0);
+            struct iovec iov[MULTISOCKET_IOV_MAX];
+            int cnt = 0;
+            size_t off = offset;
+            for (size_t p = piece; p < num && cnt < MULTISOCKET_IOV_MAX; p++, off = 0) {
+                size_t l = 0;
+                const char *d = multi_tcp_send_piece(L, table, p, &l);
+                if (l > off) {
+                    iov[cnt].iov_base = (void *) (d + off);
+                    iov[cnt].iov_len = l - off;
+                    cnt++;
+                }
+            }
+            trans = writev(sock->socket, iov, cnt);
         }
 
-        if (trans < 0 || sock->enc && trans == 0) {
+        if (trans < 0 || (sock->enc && trans == 0)) {
+            int want = multi_tcp_want(sock, trans, MULTISOCKET_POLL_WRITE);
+            if (want && lua_isyieldable(L)) {
+                int top = lua_gettop(L);
+                lua_pushinteger(L, pos);
+                return multi_tcp_yield(L, want, top, multi_tcp_send_k);
+            }
             lua_pushnil(L);
-            if (sock->enc) {
+            if (want) {
+                lua_pushstring(L, (want == MULTISOCKET_POLL_READ) ? "want_read" : "want_write");
+            } else if (errno == ETIMEDOUT) {
+                lua_pushstring(L, "timeout");
+            } else if (sock->enc) {
                 lua_pushstring(L, multi_ssl_get_error(sock->ssl, (int) trans));
             } else {
                 if (poll(ufds, 1, 0) == -1) {
@@ -781,7 +1099,18 @@ static int multi_tcp_send(lua_State *L) {
         }
         pos += trans;
         sock->sndB += trans;
-        sock->lastT = getcurrenttime();
+        multi_metrics_count(MULTISOCKET_METRIC_SENT, trans);
+        sock->lastT = multi_clock_now();
+
+        // Advance to the first piece which has not been sent completely
+        offset += trans;
+        while (piece < num && offset >= len) {
+            offset -= len;
+            piece++;
+            if (piece < num) {
+                data = multi_tcp_send_piece(L, table, piece, &len);
+            }
+        }
     }
 
     lua_pushinteger(L, pos);
@@ -792,8 +1121,242 @@ static int multi_tcp_send(lua_State *L) {
 
 /**
  * Lua Method
- * Close the socket connection
+ * Send (a part of) a file to the peer
+ * Plain sockets use sendfile(), so the file data is never copied into user space.
+ * Encrypted sockets do the same with SSL_sendfile() if the kernel encrypts the connection (kTLS),
+ * otherwise they read the file into a buffer of MULTISOCKET_SENDFILE_BUFFER_SIZE bytes.
  * @param0 [Multisocket] socket (TCP)
+ * @param1 [File] file / [String] path
+ * @param2 [Integer] offset (optional, default = 0)
+ * @param3 [Integer] length (optional, default = until the end of the file)
+ * @return1 [Integer] byteNum / nil (smaller than length, if the file ends before)
+ * @return2 nil / [String] error
+ * @return3 nil / [Integer] partByteNum
+ */
+static int multi_tcp_send_file_run(lua_State *L, long pos);
+
+static int multi_tcp_send_file(lua_State *L) {
+    // Check if there are two to four parameters and if they have valid values
+    if (lua_gettop(L) < 2 || lua_gettop(L) > 4) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        lua_pushinteger(L, 0);
+        return 3; // Return nil, [String] error, [Integer] partByteNum
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (TCP)");
+        lua_pushinteger(L, 0);
+        return 3; // Return nil, [String] error, [Integer] partByteNum
+    } else if (lua_type(L, 2) != LUA_TSTRING && !luaL_testudata(L, 2, LUA_FILEHANDLE)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [File] file / [String] path");
+        lua_pushinteger(L, 0);
+        return 3; // Return nil, [String] error, [Integer] partByteNum
+    } else if (!lua_isnoneornil(L, 3) && (!lua_isinteger(L, 3) || lua_tointeger(L, 3) < 0)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #2 has to be [Integer] offset");
+        lua_pushinteger(L, 0);
+        return 3; // Return nil, [String] error, [Integer] partByteNum
+    } else if (!lua_isnoneornil(L, 4) && (!lua_isinteger(L, 4) || lua_tointeger(L, 4) < 0)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #3 has to be [Integer] length");
+        lua_pushinteger(L, 0);
+        return 3; // Return nil, [String] error, [Integer] partByteNum
+    }
+
+    luaL_Stream *stream = (luaL_Stream *) luaL_testudata(L, 2, LUA_FILEHANDLE);
+    if (stream != NULL && stream->closef == NULL) {
+        lua_pushnil(L);
+        lua_pushstring(L, "File is closed");
+        lua_pushinteger(L, 0);
+        return 3; // Return nil, [String] error, [Integer] partByteNum
+    } else if (stream != NULL) {
+        fflush(stream->f); // Data written through the handle has to reach the file first
+    }
+
+    lua_settop(L, 4);
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+    sock->writeT = multi_clock_monotonic();
+    return multi_metrics_finish(L, sock, MULTISOCKET_METRIC_SEND, sock->writeT, multi_tcp_send_file_run(L, 0));
+}
+
+/**
+ * Continuation of multi_tcp_send_file() after the socket became ready
+ * The number of already sent bytes is stored above the arguments
+ */
+static int multi_tcp_send_file_k(lua_State *L, int status, lua_KContext ctx) {
+    (void) status;
+    long pos = (long) lua_tointeger(L, (int) ctx + 1);
+    lua_settop(L, (int) ctx);
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+    return multi_metrics_finish(L, sock, MULTISOCKET_METRIC_SEND, sock->writeT, multi_tcp_send_file_run(L, pos));
+}
+
+/**
+ * Send the file passed to multi_tcp_send_file()
+ * A file given by its path is opened again after every yield
+ * @param L the Lua state with the validated arguments of multi_tcp_send_file()
+ * @param pos number of bytes already sent
+ */
+static int multi_tcp_send_file_run(lua_State *L, long pos) {
+    // Cast userdata to Multisocket
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+
+    int fd;
+    luaL_Stream *stream = (luaL_Stream *) luaL_testudata(L, 2, LUA_FILEHANDLE);
+    if (stream != NULL) {
+        fd = fileno(stream->f);
+    } else if ((fd = open(lua_tostring(L, 2), O_RDONLY | O_CLOEXEC)) == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        lua_pushinteger(L, pos);
+        return 3; // Return nil, [String] error, [Integer] partByteNum
+    }
+
+    off_t offset = (off_t) luaL_optinteger(L, 3, 0);
+    long length;
+    if (lua_isnil(L, 4)) {
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            int err = errno;
+            if (stream == NULL) {
+                close(fd);
+            }
+            lua_pushnil(L);
+            lua_pushstring(L, strerror(err));
+            lua_pushinteger(L, pos);
+            return 3; // Return nil, [String] error, [Integer] partByteNum
+        }
+        length = (st.st_size > offset) ? (long) (st.st_size - offset) : 0;
+    } else {
+        length = (long) lua_tointeger(L, 4);
+    }
+
+    char *buf = NULL;
+    long trans = 1;
+    int fileErr = 0;
+    int ktls = multi_tls_ktls_send(sock);
+    while (pos < length) {
+        size_t size = (size_t) (length - pos);
+        if (sock->enc && !ktls) {
+            // A retried SSL_write() gets the same bytes, because they are read from the same offset again
+            if (size > MULTISOCKET_SENDFILE_BUFFER_SIZE) {
+                size = MULTISOCKET_SENDFILE_BUFFER_SIZE;
+            }
+            if (buf == NULL && (buf = (char *) malloc(MULTISOCKET_SENDFILE_BUFFER_SIZE)) == NULL) {
+                fileErr = ENOMEM;
+                break;
+            }
+            long len = pread(fd, buf, size, offset + pos);
+            if (len < 0) {
+                fileErr = errno;
+                break;
+            } else if (len == 0) {
+                break; // End of file
+            }
+            trans = multi_tls_write(sock, buf, (int) len);
+        } else {
+            off_t off = offset + pos;
+            size = (size > 0x7FFFF000) ? 0x7FFFF000 : size;
+            trans = ktls ? multi_tls_sendfile(sock, fd, off, size) : sendfile(sock->socket, fd, &off, size);
+            if (trans == 0) {
+                break; // End of file
+            }
+        }
+        if (trans < 0 || (sock->enc && !ktls && trans == 0)) {
+            break;
+        }
+        pos += trans;
+        sock->sndB += trans;
+        multi_metrics_count(MULTISOCKET_METRIC_SENT, trans);
+        sock->lastT = multi_clock_now();
+    }
+
+    int err = errno;
+    free(buf);
+    if (stream == NULL) {
+        close(fd);
+    }
+    errno = err;
+
+    if (fileErr != 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(fileErr));
+        lua_pushinteger(L, pos);
+        return 3; // Return nil, [String] error, [Integer] partByteNum
+    } else if (trans < 0 || (sock->enc && !ktls && trans == 0)) {
+        int want = multi_tcp_want(sock, trans, MULTISOCKET_POLL_WRITE);
+        if (want && lua_isyieldable(L)) {
+            int top = lua_gettop(L);
+            lua_pushinteger(L, pos);
+            return multi_tcp_yield(L, want, top, multi_tcp_send_file_k);
+        }
+        lua_pushnil(L);
+        if (want) {
+            lua_pushstring(L, (want == MULTISOCKET_POLL_READ) ? "want_read" : "want_write");
+        } else {
+            multi_buffer_error(L, sock, trans);
+        }
+        lua_pushinteger(L, pos);
+        return 3; // Return nil, [String] error, [Integer] partByteNum
+    }
+
+    lua_pushinteger(L, pos);
+    lua_pushnil(L);
+    lua_pushnil(L);
+    return 3; // Return [Integer] byteNum, nil, nil
+}
+
+/**
+ * Close the filedescriptor of a socket and count it as closed
+ * The filedescriptor is released even if close() fails. Its number may be reused by the next socket at once,
+ * so the closed socket must not keep it.
+ * @param sock the socket
+ * @return 0 = success, -1 = error, see errno
+ */
+static int multi_tcp_close_socket(Multisocket *sock) {
+    int fd = sock->socket;
+    sock->socket = -1;
+    sock->conn = 0;
+    multi_metrics_count(MULTISOCKET_METRIC_CLOSED, 1);
+    return close(fd);
+}
+
+/**
+ * Release everything an open socket holds and close its filedescriptor
+ * @param L the Lua state
+ * @param sock the socket, must not be closed
+ * @return 0 = success, -1 = error, see errno
+ */
+static int multi_tcp_release(lua_State *L, Multisocket *sock) {
+    multi_poller_forget(L, sock);
+    multi_uring_accept_forget(sock);
+    multi_buffer_free(sock);
+
+    if (sock->enc) {
+        multi_ssl_close(sock);
+        sock->enc = 0;
+    }
+    return multi_tcp_close_socket(sock);
+}
+
+/**
+ * Lua Method
+ * __gc of TCP and UDP sockets, releases a socket which has not been closed
+ * @param0 [Multisocket] socket
+ */
+static int multi_tcp_gc(lua_State *L) {
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+    if (sock->socket != -1) {
+        multi_tcp_release(L, sock);
+    }
+    return 0;
+}
+
+/**
+ * Lua Method
+ * Close the socket connection
+ * @param0 [Multisocket] socket
  * @return1 [Boolean] success / nil
  * @return2 nil / [String] error
  */
@@ -803,21 +1366,22 @@ static int multi_tcp_close(lua_State *L) {
         lua_pushnil(L);
         lua_pushstring(L, "Wrong number of arguments");
         return 2; // Return nil, [String] error
-    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+    } else if (!multi_is_socket(L, 1)) {
         lua_pushnil(L);
-        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (TCP)");
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
         return 2; // Return nil, [String] error
     }
 
     // Cast userdata to Multisocket
     Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
-
-    if (sock->enc) {
-        multi_ssl_close(sock);
+    if (sock->socket == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Socket is closed");
+        return 2; // Return nil, [String] error
     }
 
     // Close the socket connection
-    if (close(sock->socket) == -1) {
+    if (multi_tcp_release(L, sock) == -1) {
         lua_pushnil(L);
         lua_pushstring(L, strerror(errno));
         return 2; // Return nil, [String] error
@@ -21,17 +21,16 @@ static int multi_tcp_receive_line(lua_State *L) {
         return 2; // Return nil, [String] error
     }
 
-    lua_pushcfunction(L, multi_tcp_receive);
-    lua_pushvalue(L, 1);
+    // Call receive() directly, so a non-blocking socket can yield the coroutine
     lua_pushstring(L, "\r\n");
-    lua_call(L, 2, 3);
-    return 3;
+    return multi_tcp_receive(L);
 }
 
 
 /**
  * Lua Method
- * @param0 [Multisocket] socket (TCP)
+ * A non-blocking socket uses the timeout as deadline for every wait of a scheduler task
+ * @param0 [Multisocket] socket
  * @param1 nil / [Number] timeout (seconds)
  * @return1 [Boolean] success / nil
  * @return2 nil / [String] error
@@ -42,9 +41,9 @@ static int multi_tcp_set_timeout(lua_State *L) {
         lua_pushnil(L);
         lua_pushstring(L, "Wrong number of arguments");
         return 2; // Return nil, [String] error
-    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+    } else if (!multi_is_socket(L, 1)) {
         lua_pushnil(L);
-        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (TCP)");
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
         return 2; // Return nil, [String] error
     } else if (lua_gettop(L) == 2 && (!lua_isnumber(L, 2) ||  lua_tonumber(L, 2) < 0)) {
         lua_pushnil(L);
@@ -72,11 +71,114 @@ static int multi_tcp_set_timeout(lua_State *L) {
         lua_pushstring(L, strerror(errno));
         return 2; // Return nil, [String] error
     }
+    sock->timeout = (lua_gettop(L) == 2) ? (long) (lua_tonumber(L, 2) * 1000000000) : 0;
+
+    lua_pushboolean(L, 1);
+    return 1; // Return [Boolean] success (true)
+}
+
+/**
+ * Lua Method
+ * Close the connection with "timeout", if a scheduler task waits for it and nothing has been sent or received
+ * for the given time. The timers of the scheduler fire without scanning the sockets.
+ * Connections accepted by a listener inherit its idle timeout.
+ * @param0 [Multisocket] socket
+ * @param1 nil / [Number] idle timeout (seconds, nil = unlimited)
+ * @return1 [Boolean] success / nil
+ * @return2 nil / [String] error
+ */
+static int multi_tcp_set_idle_timeout(lua_State *L) {
+    // Check if there are two parameters and if they have valid values
+    if (lua_gettop(L) != 2 && lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!multi_is_socket(L, 1)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
+        return 2; // Return nil, [String] error
+    } else if (lua_gettop(L) == 2 && !lua_isnil(L, 2) && (!lua_isnumber(L, 2) || lua_tonumber(L, 2) < 0)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [Number] idle timeout (seconds)");
+        return 2; // Return nil, [String] error
+    }
+
+    // Cast userdata to Multisocket
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+    sock->idleTimeout = lua_isnoneornil(L, 2) ? 0 : (long) (lua_tonumber(L, 2) * 1000000000);
 
     lua_pushboolean(L, 1);
     return 1; // Return [Boolean] success (true)
 }
 
+/**
+ * Lua Method
+ * Switch the socket between blocking and non-blocking mode
+ * In non-blocking mode receive, send, accept and connect yield the running coroutine
+ * instead of blocking the Lua state. Outside of a coroutine they return "want_read" or "want_write".
+ * @param0 [Multisocket] socket
+ * @param1 [Boolean] blocking
+ * @return1 [Boolean] success / nil
+ * @return2 nil / [String] error
+ */
+static int multi_tcp_set_blocking(lua_State *L) {
+    // Check if there are two parameters and if they have valid values
+    if (lua_gettop(L) != 2) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!multi_is_socket(L, 1)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isboolean(L, 2)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [Boolean] blocking");
+        return 2; // Return nil, [String] error
+    }
+
+    // Cast userdata to Multisocket
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+    int blocking = lua_toboolean(L, 2);
+
+    int flags = fcntl(sock->socket, F_GETFL, 0);
+    if (flags == -1 || fcntl(sock->socket, F_SETFL, blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK)) == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2; // Return nil, [String] error
+    }
+
+    sock->nonblock = !blocking;
+
+    lua_pushboolean(L, 1);
+    return 1; // Return [Boolean] success (true)
+}
+
+/**
+ * Lua Method
+ * Is the socket in blocking mode?
+ * @param0 [Multisocket] socket
+ * @return1 [Boolean] blocking
+ */
+static int multi_tcp_is_blocking(lua_State *L) {
+    // Check if there are two parameters and if they have valid values
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!multi_is_socket(L, 1)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
+        return 2; // Return nil, [String] error
+    }
+
+    // Cast userdata to Multisocket
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+
+    lua_pushboolean(L, !sock->nonblock);
+    return 1;
+}
+
 /**
  * Lua Method
  * Get the duration the socket is created
@@ -89,7 +191,7 @@ static int multi_get_duration(lua_State *L) {
         lua_pushnil(L);
         lua_pushstring(L, "Wrong number of arguments");
         return 2; // Return nil, [String] error
-    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+    } else if (!multi_is_socket(L, 1)) {
         lua_pushnil(L);
         lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
         return 2; // Return nil, [String] error
@@ -97,7 +199,7 @@ static int multi_get_duration(lua_State *L) {
 
     Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
 
-    lua_pushnumber(L, ((double) getcurrenttime() - sock->startT) / 1000000000);
+    lua_pushnumber(L, ((double) multi_clock_monotonic() - sock->startT) / 1000000000);
     return 1; // Return [Number] duration
 }
 
@@ -113,7 +215,7 @@ static int multi_get_starttime(lua_State *L) {
         lua_pushnil(L);
         lua_pushstring(L, "Wrong number of arguments");
         return 2; // Return nil, [String] error
-    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+    } else if (!multi_is_socket(L, 1)) {
         lua_pushnil(L);
         lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
         return 2; // Return nil, [String] error
@@ -121,7 +223,7 @@ static int multi_get_starttime(lua_State *L) {
 
     Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
 
-    lua_pushnumber(L, ((double) sock->startT) / 1000000000);
+    lua_pushnumber(L, ((double) multi_clock_to_unix(sock->startT)) / 1000000000);
     return 1; // Return [Number] startTime (UNIX)
 }
 
@@ -137,7 +239,7 @@ static int multi_get_lasttime(lua_State *L) {
         lua_pushnil(L);
         lua_pushstring(L, "Wrong number of arguments");
         return 2; // Return nil, [String] error
-    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+    } else if (!multi_is_socket(L, 1)) {
         lua_pushnil(L);
         lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
         return 2; // Return nil, [String] error
@@ -145,7 +247,7 @@ static int multi_get_lasttime(lua_State *L) {
 
     Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
 
-    lua_pushnumber(L, ((double) sock->lastT) / 1000000000);
+    lua_pushnumber(L, ((double) multi_clock_to_unix(sock->lastT)) / 1000000000);
     return 1; // Return [Number] lastSignal (UNIX)
 }
 
@@ -161,7 +263,7 @@ static int multi_get_sent(lua_State *L) {
         lua_pushnil(L);
         lua_pushstring(L, "Wrong number of arguments");
         return 2; // Return nil, [String] error
-    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+    } else if (!multi_is_socket(L, 1)) {
         lua_pushnil(L);
         lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
         return 2; // Return nil, [String] error
@@ -185,7 +287,7 @@ static int multi_get_received(lua_State *L) {
         lua_pushnil(L);
         lua_pushstring(L, "Wrong number of arguments");
         return 2; // Return nil, [String] error
-    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+    } else if (!multi_is_socket(L, 1)) {
         lua_pushnil(L);
         lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
         return 2; // Return nil, [String] error
@@ -211,7 +313,7 @@ static int multi_tcp_get_sockaddr(lua_State *L) {
         lua_pushnil(L);
         lua_pushstring(L, "Wrong number of arguments");
         return 2; // Return nil, [String] error
-    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+    } else if (!multi_is_socket(L, 1)) {
         lua_pushnil(L);
         lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
         return 2; // Return nil, [String] error
@@ -273,7 +375,7 @@ static int multi_tcp_get_sockport(lua_State *L) {
         lua_pushnil(L);
         lua_pushstring(L, "Wrong number of arguments");
         return 2; // Return nil, [String] error
-    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+    } else if (!multi_is_socket(L, 1)) {
         lua_pushnil(L);
         lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
         return 2; // Return nil, [String] error
@@ -313,7 +415,7 @@ static int multi_tcp_get_sockport(lua_State *L) {
 /**
  * Lua Method
  * Get the address and port of the socket
- * @param0 [Multisocket] socket (TCP)
+ * @param0 [Multisocket] socket
  * @return1 [String] name / nil
  * @return2 nil / [String] error
  */
@@ -323,7 +425,7 @@ static int multi_tcp_get_sockname(lua_State *L) {
         lua_pushnil(L);
         lua_pushstring(L, "Wrong number of arguments");
         return 2; // Return nil, [String] error
-    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+    } else if (!multi_is_socket(L, 1)) {
         lua_pushnil(L);
         lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
         return 2; // Return nil, [String] error
@@ -378,7 +480,7 @@ static int multi_tcp_get_peeraddr(lua_State *L) {
         lua_pushnil(L);
         lua_pushstring(L, "Wrong number of arguments");
         return 2; // Return nil, [String] error
-    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+    } else if (!multi_is_socket(L, 1)) {
         lua_pushnil(L);
         lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
         return 2; // Return nil, [String] error
@@ -440,7 +542,7 @@ static int multi_tcp_get_peerport(lua_State *L) {
         lua_pushnil(L);
         lua_pushstring(L, "Wrong number of arguments");
         return 2; // Return nil, [String] error
-    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+    } else if (!multi_is_socket(L, 1)) {
         lua_pushnil(L);
         lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
         return 2; // Return nil, [String] error
@@ -480,7 +582,7 @@ static int multi_tcp_get_peerport(lua_State *L) {
 /**
  * Lua Method
  * Get the address and port of the peer
- * @param0 [Multisocket] socket (TCP)
+ * @param0 [Multisocket] socket
  * @return1 [String] name / nil
  * @return2 nil / [String] error
  */
@@ -490,7 +592,7 @@ static int multi_tcp_get_peername(lua_State *L) {
         lua_pushnil(L);
         lua_pushstring(L, "Wrong number of arguments");
         return 2; // Return nil, [String] error
-    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+    } else if (!multi_is_socket(L, 1)) {
         lua_pushnil(L);
         lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
         return 2; // Return nil, [String] error
@@ -544,9 +646,9 @@ static int multi_is_ipv6(lua_State *L) {
         lua_pushnil(L);
         lua_pushstring(L, "Wrong number of arguments");
         return 2; // Return nil, [String] error
-    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+    } else if (!multi_is_socket(L, 1)) {
         lua_pushnil(L);
-        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (TCP)");
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
         return 2; // Return nil, [String] error
     }
 
@@ -568,9 +670,9 @@ static int multi_is_ipv4(lua_State *L) {
         lua_pushnil(L);
         lua_pushstring(L, "Wrong number of arguments");
         return 2; // Return nil, [String] error
-    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+    } else if (!multi_is_socket(L, 1)) {
         lua_pushnil(L);
-        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (TCP)");
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket");
         return 2; // Return nil, [String] error
     }
 
@@ -656,4 +758,181 @@ static int multi_tcp_is_encrypted(lua_State *L) {
     return 1;
 }
 
+/**
+ * Lua Method
+ * Has the TLS handshake resumed a previous session instead of doing a full handshake?
+ * @param0 [Multisocket] socket (TCP)
+ * @return1 [Boolean] reused
+ */
+static int multi_tcp_is_session_reused(lua_State *L) {
+    // Check if there is one parameter and if it has a valid value
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (TCP)");
+        return 2; // Return nil, [String] error
+    }
 
+    // Cast userdata to Multisocket
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+
+    lua_pushboolean(L, sock->enc && SSL_session_reused(sock->ssl));
+    return 1;
+}
+
+/**
+ * Lua Method
+ * Has the peer accepted the TLS 1.3 early data (0-RTT) of the connection?
+ * On clients with a deferred handshake this is known after the first receive().
+ * @param0 [Multisocket] socket (TCP)
+ * @return1 [Boolean] accepted
+ */
+static int multi_tcp_is_early_data_accepted(lua_State *L) {
+    // Check if there is one parameter and if it has a valid value
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (TCP)");
+        return 2; // Return nil, [String] error
+    }
+
+    // Cast userdata to Multisocket
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+
+    lua_pushboolean(L, sock->enc && !sock->handshake && SSL_get_early_data_status(sock->ssl) == SSL_EARLY_DATA_ACCEPTED);
+    return 1;
+}
+
+/**
+ * Lua Method
+ * Get the protocol which has been negotiated with ALPN
+ * @param0 [Multisocket] socket (TCP)
+ * @return1 [String] protocol / nil
+ */
+static int multi_tcp_get_alpn_protocol(lua_State *L) {
+    // Check if there is one parameter and if it has a valid value
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (TCP)");
+        return 2; // Return nil, [String] error
+    }
+
+    // Cast userdata to Multisocket
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+
+    const unsigned char *protocol = NULL;
+    unsigned int len = 0;
+    if (sock->enc) {
+        SSL_get0_alpn_selected(sock->ssl, &protocol, &len);
+    }
+    if (protocol == NULL || len == 0) {
+        lua_pushnil(L);
+    } else {
+        lua_pushlstring(L, (const char *) protocol, len);
+    }
+    return 1;
+}
+
+/**
+ * Lua Method
+ * Get the TLS protocol version of the connection
+ * @param0 [Multisocket] socket (TCP)
+ * @return1 [String] version (e.g. "TLSv1.3") / nil
+ */
+static int multi_tcp_get_tls_version(lua_State *L) {
+    // Check if there is one parameter and if it has a valid value
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (TCP)");
+        return 2; // Return nil, [String] error
+    }
+
+    // Cast userdata to Multisocket
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+
+    if (sock->enc) {
+        lua_pushstring(L, SSL_get_version(sock->ssl));
+    } else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+/**
+ * Lua Method
+ * Does the kernel encrypt and decrypt the records of the connection (kTLS)?
+ * Only if the context was created with ktls = true, the kernel has the tls module and supports the cipher.
+ * @param0 [Multisocket] socket (TCP)
+ * @return1 [Boolean] send (records are encrypted by the kernel)
+ * @return2 [Boolean] receive (records are decrypted by the kernel)
+ */
+static int multi_tcp_is_kernel_tls(lua_State *L) {
+    // Check if there is one parameter and if it has a valid value
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (TCP)");
+        return 2; // Return nil, [String] error
+    }
+
+    // Cast userdata to Multisocket
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+
+    lua_pushboolean(L, multi_tls_ktls_send(sock));
+    lua_pushboolean(L, multi_tls_ktls_recv(sock));
+    return 2;
+}
+
+/**
+ * Lua Method
+ * Did the connection use TCP Fast Open?
+ * True if the data sent with the SYN was acknowledged, so the request did not wait for the handshake.
+ * On the client side this is only known after the first send().
+ * @param0 [Multisocket] socket (TCP)
+ * @return1 [Boolean] fastOpen / nil
+ * @return2 nil / [String] error
+ */
+static int multi_tcp_is_fast_open(lua_State *L) {
+    // Check if there is one parameter and if it has a valid value
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tcp")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (TCP)");
+        return 2; // Return nil, [String] error
+    }
+
+    // Cast userdata to Multisocket
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    bzero(&info, sizeof(info));
+    if (getsockopt(sock->socket, IPPROTO_TCP, TCP_INFO, &info, &len) == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2; // Return nil, [String] error
+    }
+
+    lua_pushboolean(L, (info.tcpi_options & TCPI_OPT_SYN_DATA) != 0);
+    return 1; // Return [Boolean] fastOpen
+}
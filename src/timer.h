@@ -0,0 +1,325 @@
+/**
+ * Every level of a timer wheel has 64 slots, one bit of a bitmap each
+ */
+#define MULTISOCKET_TIMER_BITS 6
+#define MULTISOCKET_TIMER_SLOTS (1 << MULTISOCKET_TIMER_BITS)
+#define MULTISOCKET_TIMER_MASK (MULTISOCKET_TIMER_SLOTS - 1)
+
+/**
+ * A timer of a timer wheel
+ * Timers are kept in an array and linked by index, so the array can grow without breaking the lists.
+ */
+typedef struct {
+    /**
+     * Expiration time in ticks
+     */
+    long expires;
+
+    /**
+     * Id of the task which is resumed when the timer expires
+     */
+    lua_Integer id;
+
+    /**
+     * The socket the task waits for, NULL = the task sleeps
+     */
+    Multisocket *sock;
+
+    /**
+     * io_uring operation of the waiting task, -1 = none
+     */
+    int slot;
+
+    /**
+     * Number of values on the coroutine stack of a task which has not been started yet
+     */
+    int nargs;
+
+    /**
+     * List of the slot the timer is in, -1 = not in a slot (free or expired)
+     */
+    int bucket;
+    int prev;
+    int next;
+} MultiTimer;
+
+/**
+ * Hierarchical timer wheel
+ * Level 0 has one slot per tick, every slot of level n covers a whole turn of level n - 1.
+ * Timers are moved down a level when their slot comes up (cascade), so insert, cancel and expire are O(1).
+ */
+typedef struct {
+    /**
+     * The tick which has been processed last
+     */
+    long now;
+
+    /**
+     * First timer of every slot, -1 = empty
+     */
+    int heads[MULTISOCKET_TIMER_LEVELS * MULTISOCKET_TIMER_SLOTS];
+
+    /**
+     * Bitmaps of the non-empty slots of every level
+     */
+    uint64_t used[MULTISOCKET_TIMER_LEVELS];
+
+    MultiTimer *timers;
+    int cap;
+
+    /**
+     * First unused timer, -1 = none
+     */
+    int free;
+
+    /**
+     * First expired timer, they are linked by next
+     */
+    int expired;
+
+    /**
+     * Number of timers in the wheel
+     */
+    int count;
+} MultiTimerWheel;
+
+/**
+ * Convert a time in nanoseconds into ticks, rounded up so a timer never fires early
+ */
+static long multi_timer_ticks(long time) {
+    return (time + MULTISOCKET_TIMER_TICK - 1) / MULTISOCKET_TIMER_TICK;
+}
+
+/**
+ * Initialize an empty timer wheel
+ * @param wheel the wheel
+ * @param now the current time in nanoseconds
+ */
+static void multi_timer_init(MultiTimerWheel *wheel, long now) {
+    bzero(wheel, sizeof(MultiTimerWheel));
+    wheel->now = now / MULTISOCKET_TIMER_TICK;
+    wheel->free = -1;
+    wheel->expired = -1;
+    for (int i = 0; i < MULTISOCKET_TIMER_LEVELS * MULTISOCKET_TIMER_SLOTS; i++) {
+        wheel->heads[i] = -1;
+    }
+}
+
+/**
+ * Free the memory of a timer wheel
+ * @param wheel the wheel
+ */
+static void multi_timer_free(MultiTimerWheel *wheel) {
+    free(wheel->timers);
+    wheel->timers = NULL;
+    wheel->cap = 0;
+    wheel->free = -1;
+    wheel->expired = -1;
+    wheel->count = 0;
+}
+
+/**
+ * Put a timer into the slot of its expiration time
+ * Timers beyond the range of the wheel wait in the last slot of the highest level and are put back later.
+ * @param wheel the wheel
+ * @param index index of the timer
+ */
+static void multi_timer_link(MultiTimerWheel *wheel, int index) {
+    MultiTimer *timer = &wheel->timers[index];
+    long expires = (timer->expires > wheel->now) ? timer->expires : wheel->now + 1;
+    long delta = expires - wheel->now;
+
+    int level = 0;
+    while (level < MULTISOCKET_TIMER_LEVELS - 1 && delta >= (1L << (MULTISOCKET_TIMER_BITS * (level + 1)))) {
+        level++;
+    }
+    long max = (1L << (MULTISOCKET_TIMER_BITS * MULTISOCKET_TIMER_LEVELS)) - 1;
+    if (delta > max) {
+        expires = wheel->now + max;
+    }
+
+    int slot = (int) ((expires >> (MULTISOCKET_TIMER_BITS * level)) & MULTISOCKET_TIMER_MASK);
+    int bucket = level * MULTISOCKET_TIMER_SLOTS + slot;
+    timer->bucket = bucket;
+    timer->prev = -1;
+    timer->next = wheel->heads[bucket];
+    if (timer->next != -1) {
+        wheel->timers[timer->next].prev = index;
+    }
+    wheel->heads[bucket] = index;
+    wheel->used[level] |= 1UL << slot;
+}
+
+/**
+ * Remove a timer from its slot
+ * @param wheel the wheel
+ * @param index index of the timer
+ */
+static void multi_timer_unlink(MultiTimerWheel *wheel, int index) {
+    MultiTimer *timer = &wheel->timers[index];
+    if (timer->prev != -1) {
+        wheel->timers[timer->prev].next = timer->next;
+    } else {
+        wheel->heads[timer->bucket] = timer->next;
+        if (timer->next == -1) {
+            wheel->used[timer->bucket / MULTISOCKET_TIMER_SLOTS] &= ~(1UL << (timer->bucket % MULTISOCKET_TIMER_SLOTS));
+        }
+    }
+    if (timer->next != -1) {
+        wheel->timers[timer->next].prev = timer->prev;
+    }
+    timer->bucket = -1;
+}
+
+/**
+ * Add a timer
+ * @param wheel the wheel
+ * @param expires expiration time in nanoseconds
+ * @param id id of the task
+ * @param sock the socket the task waits for, NULL = none
+ * @return index of the timer, -1 = out of memory
+ */
+static int multi_timer_add(MultiTimerWheel *wheel, long expires, lua_Integer id, Multisocket *sock) {
+    if (wheel->free == -1) {
+        int cap = (wheel->cap == 0) ? 64 : wheel->cap * 2;
+        MultiTimer *timers = realloc(wheel->timers, cap * sizeof(MultiTimer));
+        if (timers == NULL) {
+            return -1;
+        }
+        for (int i = wheel->cap; i < cap; i++) {
+            timers[i].bucket = -1;
+            timers[i].next = (i + 1 < cap) ? i + 1 : -1;
+        }
+        wheel->free = wheel->cap;
+        wheel->timers = timers;
+        wheel->cap = cap;
+    }
+
+    int index = wheel->free;
+    MultiTimer *timer = &wheel->timers[index];
+    wheel->free = timer->next;
+    timer->expires = multi_timer_ticks(expires);
+    timer->id = id;
+    timer->sock = sock;
+    timer->slot = -1;
+    timer->nargs = 0;
+    multi_timer_link(wheel, index);
+    wheel->count++;
+    return index;
+}
+
+/**
+ * Cancel a timer which has not expired yet, or release an expired timer
+ * @param wheel the wheel
+ * @param index index of the timer
+ */
+static void multi_timer_cancel(MultiTimerWheel *wheel, int index) {
+    if (wheel->timers[index].bucket != -1) {
+        multi_timer_unlink(wheel, index);
+        wheel->count--;
+    }
+    wheel->timers[index].next = wheel->free;
+    wheel->free = index;
+}
+
+/**
+ * Get the next tick after the current one at which a slot has to be processed
+ * @param wheel the wheel
+ * @return the tick, -1 = the wheel is empty
+ */
+static long multi_timer_next_tick(MultiTimerWheel *wheel) {
+    long next = -1;
+    for (int level = 0; level < MULTISOCKET_TIMER_LEVELS; level++) {
+        if (wheel->used[level] == 0) {
+            continue;
+        }
+        // Position of the slot of the next turn of this level
+        int shift = MULTISOCKET_TIMER_BITS * level;
+        long base = (wheel->now >> shift) + 1;
+        int rot = (int) (base & MULTISOCKET_TIMER_MASK);
+        uint64_t used = wheel->used[level];
+        uint64_t rotated = (rot == 0) ? used : (used >> rot) | (used << (MULTISOCKET_TIMER_SLOTS - rot));
+        long tick = (base + __builtin_ctzll(rotated)) << shift;
+        if (next == -1 || tick < next) {
+            next = tick;
+        }
+    }
+    return next;
+}
+
+/**
+ * Get the time until the next timer has to be processed
+ * @param wheel the wheel
+ * @param now the current time in nanoseconds
+ * @return time in milliseconds, -1 = the wheel is empty
+ */
+static int multi_timer_timeout(MultiTimerWheel *wheel, long now) {
+    long tick = multi_timer_next_tick(wheel);
+    if (tick == -1) {
+        return -1;
+    }
+    long ms = (tick * MULTISOCKET_TIMER_TICK - now + 999999) / 1000000;
+    return (ms < 0) ? 0 : (ms > 0x7FFFFFFF) ? 0x7FFFFFFF : (int) ms;
+}
+
+/**
+ * Move all timers of a slot to the expired list or to the slots of a lower level
+ * @param wheel the wheel
+ * @param bucket the slot
+ */
+static void multi_timer_cascade(MultiTimerWheel *wheel, int bucket) {
+    int index = wheel->heads[bucket];
+    wheel->heads[bucket] = -1;
+    wheel->used[bucket / MULTISOCKET_TIMER_SLOTS] &= ~(1UL << (bucket % MULTISOCKET_TIMER_SLOTS));
+    while (index != -1) {
+        MultiTimer *timer = &wheel->timers[index];
+        int next = timer->next;
+        if (timer->expires <= wheel->now) {
+            timer->bucket = -1;
+            timer->next = wheel->expired;
+            wheel->expired = index;
+            wheel->count--;
+        } else {
+            multi_timer_link(wheel, index);
+        }
+        index = next;
+    }
+}
+
+/**
+ * Advance the wheel to the current time, expired timers are collected in the expired list
+ * Slots without timers are skipped, so the cost does not depend on the time that has passed.
+ * @param wheel the wheel
+ * @param now the current time in nanoseconds
+ */
+static void multi_timer_advance(MultiTimerWheel *wheel, long now) {
+    long target = now / MULTISOCKET_TIMER_TICK;
+    while (wheel->now < target) {
+        long tick = multi_timer_next_tick(wheel);
+        if (tick == -1 || tick > target) {
+            wheel->now = target;
+            break;
+        }
+        wheel->now = tick;
+        for (int level = MULTISOCKET_TIMER_LEVELS - 1; level > 0; level--) {
+            int shift = MULTISOCKET_TIMER_BITS * level;
+            if ((tick & ((1L << shift) - 1)) == 0) {
+                multi_timer_cascade(wheel, level * MULTISOCKET_TIMER_SLOTS + (int) ((tick >> shift) & MULTISOCKET_TIMER_MASK));
+            }
+        }
+        multi_timer_cascade(wheel, (int) (tick & MULTISOCKET_TIMER_MASK));
+    }
+}
+
+/**
+ * Take a timer from the expired list, it has to be released with multi_timer_cancel()
+ * @param wheel the wheel
+ * @return index of the timer, -1 = no expired timer
+ */
+static int multi_timer_pop(MultiTimerWheel *wheel) {
+    int index = wheel->expired;
+    if (index != -1) {
+        wheel->expired = wheel->timers[index].next;
+    }
+    return index;
+}
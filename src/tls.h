@@ -0,0 +1,904 @@
+/**
+ * TLS context identifier: multisocket_tls_context
+ * Certificates, keys, CA store, ciphers and protocol versions, loaded once and shared by any number of sockets.
+ * The SSL_CTX is reference counted by OpenSSL and every encrypted socket holds a reference,
+ * so the context may be collected or closed while sockets which use it are still open.
+ */
+typedef struct {
+    /**
+     * The shared context, NULL = closed
+     */
+    SSL_CTX *ctx;
+} MultiTlsContext;
+
+/**
+ * Sessions of the client sockets of a context, keyed by host:port, so reconnects resume the session
+ * The cache is direct-mapped: a host whose slot is taken replaces the older session.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    char *keys[MULTISOCKET_TLS_SESSIONS];
+    SSL_SESSION *sessions[MULTISOCKET_TLS_SESSIONS];
+} MultiTlsSessions;
+
+/**
+ * A key for session tickets, the name tells the server which key encrypted a ticket
+ */
+typedef struct {
+    unsigned char name[16];
+    unsigned char aes[32];
+    unsigned char hmac[32];
+} MultiTlsTicketKey;
+
+/**
+ * Ticket keys of all server contexts of the process, so every worker of a server can resume the sessions of the others
+ * New tickets are encrypted with the current key, tickets of the previous key are still accepted and renewed.
+ */
+static struct {
+    pthread_mutex_t lock;
+    MultiTlsTicketKey keys[2];
+
+    /**
+     * Time of the last rotation in nanoseconds (CLOCK_MONOTONIC), 0 = no keys yet
+     */
+    long rotated;
+} multi_tls_tickets = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+/**
+ * States of a pending TLS handshake (Multisocket.handshake)
+ * A server whose context accepts early data reads it first, then the handshake is completed.
+ */
+#define MULTISOCKET_TLS_HANDSHAKE 1
+#define MULTISOCKET_TLS_EARLY_DATA 2
+
+/**
+ * ALPN protocols of a context in wire format (length-prefixed names)
+ */
+typedef struct {
+    unsigned int len;
+    unsigned char data[];
+} MultiTlsAlpn;
+
+/**
+ * Early data of a client connection whose handshake is deferred to the first send()
+ * The data is kept until the server has accepted it, a server which rejects it gets it again after the handshake.
+ */
+typedef struct MultiTlsEarly {
+    /**
+     * The data sent as early data, NULL = nothing sent yet
+     */
+    char *data;
+    size_t len;
+
+    /**
+     * Number of bytes sent again after the server rejected the early data
+     */
+    size_t pos;
+} MultiTlsEarly;
+
+/**
+ * Indexes of the ex_data of OpenSSL: the sessions and ALPN protocols of a context, whether its handshakes
+ * run in the crypto threads (non-NULL), the session key of a client connection
+ */
+static int multi_tls_ctx_index = -1;
+static int multi_tls_alpn_index = -1;
+static int multi_tls_offload_index = -1;
+static int multi_tls_ssl_index = -1;
+static pthread_once_t multi_tls_index_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Context of client sockets which are encrypted without a context, created on first use
+ */
+static SSL_CTX *multi_tls_client = NULL;
+static pthread_once_t multi_tls_client_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Get the protocol version of a name
+ * @param name the name, e.g. "TLSv1.2"
+ * @return the version, -1 = unknown
+ */
+static int multi_tls_version(const char *name) {
+    if (strcmp(name, "TLSv1") == 0) {
+        return TLS1_VERSION;
+    } else if (strcmp(name, "TLSv1.1") == 0) {
+        return TLS1_1_VERSION;
+    } else if (strcmp(name, "TLSv1.2") == 0) {
+        return TLS1_2_VERSION;
+    } else if (strcmp(name, "TLSv1.3") == 0) {
+        return TLS1_3_VERSION;
+    }
+    return -1;
+}
+
+/**
+ * Get the message of the last OpenSSL error, which may come from the system (e.g. a missing file)
+ * @return the error message
+ */
+static const char *multi_tls_error() {
+    int err = errno;
+    const char *error = ERR_reason_error_string(ERR_get_error());
+    ERR_clear_error();
+    return (error != NULL) ? error : (err != 0) ? strerror(err) : "Unknown TLS error";
+}
+
+/**
+ * Free the client sessions of a context, called by OpenSSL when the context is freed
+ */
+static void multi_tls_sessions_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int index, long argl, void *argp) {
+    (void) parent;
+    (void) ad;
+    (void) index;
+    (void) argl;
+    (void) argp;
+    MultiTlsSessions *sessions = (MultiTlsSessions *) ptr;
+    if (sessions == NULL) {
+        return;
+    }
+    for (int i = 0; i < MULTISOCKET_TLS_SESSIONS; i++) {
+        free(sessions->keys[i]);
+        if (sessions->sessions[i] != NULL) {
+            SSL_SESSION_free(sessions->sessions[i]);
+        }
+    }
+    pthread_mutex_destroy(&sessions->lock);
+    free(sessions);
+}
+
+/**
+ * Free a buffer of a context or a connection, called by OpenSSL when the object is freed
+ */
+static void multi_tls_data_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int index, long argl, void *argp) {
+    (void) parent;
+    (void) ad;
+    (void) index;
+    (void) argl;
+    (void) argp;
+    free(ptr);
+}
+
+/**
+ * Register the ex_data indexes
+ */
+static void multi_tls_index_init() {
+    multi_tls_ctx_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, multi_tls_sessions_free);
+    multi_tls_alpn_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, multi_tls_data_free);
+    multi_tls_offload_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+    multi_tls_ssl_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, multi_tls_data_free);
+}
+
+/**
+ * Get the slot of a session key
+ */
+static int multi_tls_session_slot(const char *key) {
+    unsigned int hash = 2166136261u;
+    for (; *key != '\0'; key++) {
+        hash = (hash ^ (unsigned char) *key) * 16777619u;
+    }
+    return (int) (hash % MULTISOCKET_TLS_SESSIONS);
+}
+
+/**
+ * Get the cached session of a host
+ * A TLS 1.3 session is taken out of the cache, its tickets should only be used once (RFC 8446, C.4),
+ * the resumed connection receives a new one.
+ * @param ctx the context
+ * @param key host:port
+ * @return the session, it has to be released with SSL_SESSION_free(), NULL = none
+ */
+static SSL_SESSION *multi_tls_session_get(SSL_CTX *ctx, const char *key) {
+    MultiTlsSessions *sessions = (MultiTlsSessions *) SSL_CTX_get_ex_data(ctx, multi_tls_ctx_index);
+    if (sessions == NULL) {
+        return NULL;
+    }
+    int slot = multi_tls_session_slot(key);
+    SSL_SESSION *session = NULL;
+    pthread_mutex_lock(&sessions->lock);
+    if (sessions->keys[slot] != NULL && strcmp(sessions->keys[slot], key) == 0 &&
+        SSL_SESSION_is_resumable(sessions->sessions[slot])) {
+        session = sessions->sessions[slot];
+        if (SSL_SESSION_get_protocol_version(session) >= TLS1_3_VERSION) {
+            free(sessions->keys[slot]);
+            sessions->keys[slot] = NULL;
+            sessions->sessions[slot] = NULL;
+        } else {
+            SSL_SESSION_up_ref(session);
+        }
+    }
+    pthread_mutex_unlock(&sessions->lock);
+    return session;
+}
+
+/**
+ * Store a new session of a client connection, called by OpenSSL after the handshake or when a ticket arrives
+ * @param ssl the connection
+ * @param session the session
+ * @return 1 = the session is kept, 0 = it is not
+ */
+static int multi_tls_session_new(SSL *ssl, SSL_SESSION *session) {
+    const char *key = (const char *) SSL_get_ex_data(ssl, multi_tls_ssl_index);
+    MultiTlsSessions *sessions = (MultiTlsSessions *) SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), multi_tls_ctx_index);
+    if (SSL_is_server(ssl) || key == NULL || sessions == NULL) {
+        return 0;
+    }
+    char *copy = strdup(key);
+    if (copy == NULL) {
+        return 0;
+    }
+    int slot = multi_tls_session_slot(key);
+    pthread_mutex_lock(&sessions->lock);
+    free(sessions->keys[slot]);
+    if (sessions->sessions[slot] != NULL) {
+        SSL_SESSION_free(sessions->sessions[slot]);
+    }
+    sessions->keys[slot] = copy;
+    sessions->sessions[slot] = session;
+    pthread_mutex_unlock(&sessions->lock);
+    return 1;
+}
+
+/**
+ * Fill a ticket key with random bytes
+ * @return 1 = success, 0 = no randomness
+ */
+static int multi_tls_ticket_generate(MultiTlsTicketKey *key) {
+    return RAND_bytes(key->name, sizeof(key->name)) == 1 && RAND_bytes(key->aes, sizeof(key->aes)) == 1 &&
+           RAND_bytes(key->hmac, sizeof(key->hmac)) == 1;
+}
+
+/**
+ * Encrypt a new session ticket or find the key of a received one, called by OpenSSL
+ * The keys are rotated every MULTISOCKET_TLS_TICKET_LIFETIME seconds.
+ * TLS 1.3 tickets are always renewed, because clients use every ticket only once.
+ * @return 1 = success, 2 = the ticket is valid but has to be renewed, 0 = unknown key, -1 = error
+ */
+static int multi_tls_ticket_key(SSL *ssl, unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *cipher, EVP_MAC_CTX *hmac, int enc) {
+    long now = multi_clock_monotonic();
+    MultiTlsTicketKey key;
+    int ret = 0;
+
+    pthread_mutex_lock(&multi_tls_tickets.lock);
+    if (multi_tls_tickets.rotated == 0 || now - multi_tls_tickets.rotated >= MULTISOCKET_TLS_TICKET_LIFETIME * 1000000000L) {
+        MultiTlsTicketKey next;
+        if (multi_tls_ticket_generate(&next)) {
+            multi_tls_tickets.keys[1] = (multi_tls_tickets.rotated == 0) ? next : multi_tls_tickets.keys[0];
+            multi_tls_tickets.keys[0] = next;
+            multi_tls_tickets.rotated = now;
+        }
+    }
+    if (multi_tls_tickets.rotated == 0) {
+        ret = -1;
+    } else if (enc) {
+        key = multi_tls_tickets.keys[0];
+        ret = 1;
+    } else {
+        for (int i = 0; i < 2; i++) {
+            if (memcmp(name, multi_tls_tickets.keys[i].name, sizeof(key.name)) == 0) {
+                key = multi_tls_tickets.keys[i];
+                ret = (i == 0 && SSL_version(ssl) < TLS1_3_VERSION) ? 1 : 2;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&multi_tls_tickets.lock);
+    if (ret <= 0) {
+        return ret;
+    }
+
+    if (enc) {
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1 ||
+            EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), NULL, key.aes, iv) != 1) {
+            return -1;
+        }
+        memcpy(name, key.name, sizeof(key.name));
+    } else if (EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), NULL, key.aes, iv) != 1) {
+        return -1;
+    }
+
+    // The MAC context comes with HMAC fetched already, it only needs the key and the digest
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac, sizeof(key.hmac)),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0),
+        OSSL_PARAM_construct_end()
+    };
+    return (EVP_MAC_CTX_set_params(hmac, params) == 1) ? ret : -1;
+}
+
+/**
+ * Create a context with the default settings
+ * @return the context, NULL = out of memory
+ */
+static SSL_CTX *multi_tls_context_alloc() {
+    SSL_CTX *ctx = SSL_CTX_new(TLS_method());
+    if (ctx == NULL) {
+        return NULL;
+    }
+    SSL_CTX_set_options(ctx, SSL_OP_SINGLE_DH_USE | SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    SSL_CTX_set_cipher_list(ctx, MULTISOCKET_TLS_CIPHERS);
+    SSL_CTX_set_min_proto_version(ctx, MULTISOCKET_TLS_MIN_VERSION);
+    SSL_CTX_set_max_proto_version(ctx, MULTISOCKET_TLS_MAX_VERSION);
+    SSL_CTX_set_ecdh_auto(ctx, 1);
+
+    // Sessions: tickets and a cache on servers, a cache keyed by host:port on clients
+    pthread_once(&multi_tls_index_once, multi_tls_index_init);
+    MultiTlsSessions *sessions = (MultiTlsSessions *) calloc(1, sizeof(MultiTlsSessions));
+    if (sessions == NULL) {
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    pthread_mutex_init(&sessions->lock, NULL);
+    SSL_CTX_set_ex_data(ctx, multi_tls_ctx_index, sessions);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_BOTH);
+    SSL_CTX_sess_set_new_cb(ctx, multi_tls_session_new);
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char *) "multisocket", 11);
+    SSL_CTX_set_timeout(ctx, MULTISOCKET_TLS_TICKET_LIFETIME);
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, multi_tls_ticket_key);
+    return ctx;
+}
+
+/**
+ * Create the context of client sockets which are encrypted without a context
+ */
+static void multi_tls_client_init() {
+    multi_tls_client = multi_tls_context_alloc();
+}
+
+/**
+ * Get a reference to the context of client sockets which are encrypted without a context
+ * @return the context, it has to be released with SSL_CTX_free(), NULL = out of memory
+ */
+static SSL_CTX *multi_tls_client_context() {
+    pthread_once(&multi_tls_client_once, multi_tls_client_init);
+    if (multi_tls_client != NULL) {
+        SSL_CTX_up_ref(multi_tls_client);
+    }
+    return multi_tls_client;
+}
+
+/**
+ * Set the session id context to the digest of the certificate
+ * Contexts with the same certificate, e.g. the ones of all workers of a server, resume each other's sessions.
+ * @param ctx the context with a certificate
+ * @return 1 = success, 0 = error
+ */
+static int multi_tls_context_id(SSL_CTX *ctx) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    if (X509_digest(SSL_CTX_get0_certificate(ctx), EVP_sha256(), digest, &len) != 1) {
+        return 0;
+    }
+    return SSL_CTX_set_session_id_context(ctx, digest, (len > SSL_MAX_SID_CTX_LENGTH) ? SSL_MAX_SID_CTX_LENGTH : len);
+}
+
+/**
+ * Select the ALPN protocol of a server connection, the first protocol of the server which the client offers
+ * Without a common protocol the connection continues without ALPN.
+ */
+static int multi_tls_alpn_select(SSL *ssl, const unsigned char **out, unsigned char *outlen, const unsigned char *in, unsigned int inlen, void *arg) {
+    (void) arg;
+    MultiTlsAlpn *alpn = (MultiTlsAlpn *) SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), multi_tls_alpn_index);
+    if (alpn == NULL || SSL_select_next_proto((unsigned char **) out, outlen, alpn->data, alpn->len, in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    return SSL_TLSEXT_ERR_OK;
+}
+
+/**
+ * Convert a list of protocol names into the wire format of ALPN
+ * @param L the Lua state
+ * @param index stack index of the list
+ * @return the protocols, NULL = the list is invalid or out of memory
+ */
+static MultiTlsAlpn *multi_tls_alpn_create(lua_State *L, int index) {
+    size_t len = 0;
+    size_t num = lua_rawlen(L, index);
+    for (size_t i = 1; i <= num; i++) {
+        lua_rawgeti(L, index, (lua_Integer) i);
+        size_t l = 0;
+        if (lua_type(L, -1) != LUA_TSTRING || (lua_tolstring(L, -1, &l), l == 0 || l > 255)) {
+            lua_pop(L, 1);
+            return NULL;
+        }
+        len += l + 1;
+        lua_pop(L, 1);
+    }
+    if (len == 0 || len > 0xFFFF) {
+        return NULL;
+    }
+
+    MultiTlsAlpn *alpn = (MultiTlsAlpn *) malloc(sizeof(MultiTlsAlpn) + len);
+    if (alpn == NULL) {
+        return NULL;
+    }
+    alpn->len = 0;
+    for (size_t i = 1; i <= num; i++) {
+        lua_rawgeti(L, index, (lua_Integer) i);
+        size_t l = 0;
+        const char *name = lua_tolstring(L, -1, &l);
+        alpn->data[alpn->len++] = (unsigned char) l;
+        memcpy(alpn->data + alpn->len, name, l);
+        alpn->len += l;
+        lua_pop(L, 1);
+    }
+    return alpn;
+}
+
+/**
+ * Set the ALPN protocols of a context, offered by clients and selected by servers
+ * @param L the Lua state
+ * @param ctx the context
+ * @param index stack index of the list of protocol names
+ * @return 1 = success, 0 = the list is invalid
+ */
+static int multi_tls_context_alpn(lua_State *L, SSL_CTX *ctx, int index) {
+    MultiTlsAlpn *alpn = multi_tls_alpn_create(L, index);
+    if (alpn == NULL) {
+        return 0;
+    } else if (SSL_CTX_set_alpn_protos(ctx, alpn->data, alpn->len) != 0) {
+        free(alpn);
+        return 0;
+    }
+    SSL_CTX_set_ex_data(ctx, multi_tls_alpn_index, alpn);
+    SSL_CTX_set_alpn_select_cb(ctx, multi_tls_alpn_select, NULL);
+    return 1;
+}
+
+/**
+ * Create a context from a table of options, see multi_tls_context_new()
+ * @param L the Lua state
+ * @param index stack index of the table
+ * @param result set to the context, it has to be released with SSL_CTX_free()
+ * @return error message, NULL = success
+ */
+static const char *multi_tls_context_create(lua_State *L, int index, SSL_CTX **result) {
+    int top = lua_gettop(L);
+    lua_getfield(L, index, "certfile");
+    lua_getfield(L, index, "keyfile");
+    lua_getfield(L, index, "cafile");
+    lua_getfield(L, index, "capath");
+    lua_getfield(L, index, "verify");
+    lua_getfield(L, index, "ciphers");
+    lua_getfield(L, index, "minVersion");
+    lua_getfield(L, index, "maxVersion");
+    lua_getfield(L, index, "ciphersuites");
+    lua_getfield(L, index, "alpn");
+    lua_getfield(L, index, "earlyData");
+    lua_getfield(L, index, "ktls");
+    lua_getfield(L, index, "offload");
+
+    const char *certfile = lua_tostring(L, top + 1);
+    const char *keyfile = lua_tostring(L, top + 2);
+    const char *cafile = lua_tostring(L, top + 3);
+    const char *capath = lua_tostring(L, top + 4);
+    const char *ciphers = lua_tostring(L, top + 6);
+    const char *ciphersuites = lua_tostring(L, top + 9);
+    int minVersion = lua_isstring(L, top + 7) ? multi_tls_version(lua_tostring(L, top + 7)) : MULTISOCKET_TLS_MIN_VERSION;
+    int maxVersion = lua_isstring(L, top + 8) ? multi_tls_version(lua_tostring(L, top + 8)) : MULTISOCKET_TLS_MAX_VERSION;
+
+    const char *error = NULL;
+    if (!lua_isnil(L, top + 1) && !lua_isstring(L, top + 1)) {
+        error = "Field 'certfile' has to be [String] path";
+    } else if (!lua_isnil(L, top + 2) && !lua_isstring(L, top + 2)) {
+        error = "Field 'keyfile' has to be [String] path";
+    } else if (!lua_isnil(L, top + 3) && !lua_isstring(L, top + 3)) {
+        error = "Field 'cafile' has to be [String] path";
+    } else if (!lua_isnil(L, top + 4) && !lua_isstring(L, top + 4)) {
+        error = "Field 'capath' has to be [String] path";
+    } else if (!lua_isnil(L, top + 5) && !lua_isboolean(L, top + 5)) {
+        error = "Field 'verify' has to be [Boolean] verify";
+    } else if (!lua_isnil(L, top + 6) && !lua_isstring(L, top + 6)) {
+        error = "Field 'ciphers' has to be [String] cipher list";
+    } else if ((!lua_isnil(L, top + 7) && !lua_isstring(L, top + 7)) || minVersion == -1) {
+        error = "Field 'minVersion' has to be [String] version (TLSv1, TLSv1.1, TLSv1.2, TLSv1.3)";
+    } else if ((!lua_isnil(L, top + 8) && !lua_isstring(L, top + 8)) || maxVersion == -1 || maxVersion < minVersion) {
+        error = "Field 'maxVersion' has to be [String] version (TLSv1, TLSv1.1, TLSv1.2, TLSv1.3), not below minVersion";
+    } else if (!lua_isnil(L, top + 9) && !lua_isstring(L, top + 9)) {
+        error = "Field 'ciphersuites' has to be [String] TLS 1.3 cipher suites";
+    } else if (!lua_isnil(L, top + 10) && !lua_istable(L, top + 10)) {
+        error = "Field 'alpn' has to be [Table<Integer, String>] protocols";
+    } else if (!lua_isnil(L, top + 11) && (!lua_isinteger(L, top + 11) || lua_tointeger(L, top + 11) < 0 ||
+                                           lua_tointeger(L, top + 11) > 0x7FFFFFFF)) {
+        error = "Field 'earlyData' has to be [Integer] maximum size (0-2147483647)";
+    } else if (!lua_isnil(L, top + 12) && !lua_isboolean(L, top + 12)) {
+        error = "Field 'ktls' has to be [Boolean] kernel TLS";
+    } else if (!lua_isnil(L, top + 13) && !lua_isboolean(L, top + 13)) {
+        error = "Field 'offload' has to be [Boolean] run handshakes in the crypto threads";
+    } else if (keyfile != NULL && certfile == NULL) {
+        error = "Field 'keyfile' requires field 'certfile'";
+    }
+    if (error != NULL) {
+        lua_settop(L, top);
+        return error;
+    }
+
+    SSL_CTX *ctx = multi_tls_context_alloc();
+    if (ctx == NULL) {
+        lua_settop(L, top);
+        return "Out of memory";
+    }
+    SSL_CTX_set_min_proto_version(ctx, minVersion);
+    SSL_CTX_set_max_proto_version(ctx, maxVersion);
+    ERR_clear_error();
+    errno = 0;
+
+    if (ciphers != NULL && SSL_CTX_set_cipher_list(ctx, ciphers) != 1) {
+        error = "Field 'ciphers' contains no usable cipher";
+    } else if (ciphersuites != NULL && SSL_CTX_set_ciphersuites(ctx, ciphersuites) != 1) {
+        error = "Field 'ciphersuites' contains no usable cipher suite";
+    } else if (!lua_isnil(L, top + 10) && !multi_tls_context_alpn(L, ctx, top + 10)) {
+        error = "Field 'alpn' has to be [Table<Integer, String>] protocols (1-255 bytes each)";
+    } else if (certfile != NULL && SSL_CTX_use_certificate_chain_file(ctx, certfile) != 1) {
+        error = multi_tls_error();
+    } else if (certfile != NULL && SSL_CTX_use_PrivateKey_file(ctx, (keyfile != NULL) ? keyfile : certfile, SSL_FILETYPE_PEM) != 1) {
+        error = multi_tls_error();
+    } else if (certfile != NULL && SSL_CTX_check_private_key(ctx) != 1) {
+        error = multi_tls_error();
+    } else if (certfile != NULL && !multi_tls_context_id(ctx)) {
+        error = multi_tls_error();
+    } else if ((cafile != NULL || capath != NULL) && SSL_CTX_load_verify_locations(ctx, cafile, capath) != 1) {
+        error = multi_tls_error();
+    } else if (lua_toboolean(L, top + 5)) {
+        // Without a CA store of its own the context trusts the CAs of the system
+        if (cafile == NULL && capath == NULL && SSL_CTX_set_default_verify_paths(ctx) != 1) {
+            error = multi_tls_error();
+        }
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NULL);
+    }
+    if (error == NULL && lua_isinteger(L, top + 11)) {
+        // OpenSSL hands out stateful tickets then (anti-replay): each is valid once, at the context which issued it
+        SSL_CTX_set_max_early_data(ctx, (uint32_t) lua_tointeger(L, top + 11));
+        SSL_CTX_set_recv_max_early_data(ctx, (uint32_t) lua_tointeger(L, top + 11));
+    }
+#ifdef SSL_OP_ENABLE_KTLS
+    if (lua_toboolean(L, top + 12)) {
+        // OpenSSL falls back to encrypting in user space, if the kernel or the cipher does not support it
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    }
+#endif
+    if (lua_toboolean(L, top + 13)) {
+        SSL_CTX_set_ex_data(ctx, multi_tls_offload_index, ctx);
+    }
+    lua_settop(L, top);
+
+    if (error != NULL) {
+        SSL_CTX_free(ctx);
+        return error;
+    }
+    *result = ctx;
+    return NULL;
+}
+
+/**
+ * Lua Function
+ * Create a TLS context, which is shared by all sockets encrypted with it
+ * @param1 [Table] options
+ *         certfile = [String] path of the PEM certificate chain (required for servers)
+ *         keyfile = [String] path of the PEM private key (optional, default = certfile)
+ *         cafile = [String] path of a PEM file with trusted CAs (optional)
+ *         capath = [String] path of a directory with trusted CAs (optional)
+ *         verify = [Boolean] verify the certificate of the peer (optional, default = false)
+ *         ciphers = [String] OpenSSL cipher list (optional)
+ *         ciphersuites = [String] OpenSSL list of TLS 1.3 cipher suites (optional)
+ *         minVersion = [String] lowest protocol version, "TLSv1" - "TLSv1.3" (optional, default = "TLSv1.2")
+ *         maxVersion = [String] highest protocol version, "TLSv1" - "TLSv1.3" (optional, default = "TLSv1.3")
+ *         alpn = [Table<Integer, String>] ALPN protocols, offered by clients, servers select the first one the client offers
+ *         earlyData = [Integer] maximum number of bytes of TLS 1.3 early data (0-RTT) a server accepts
+ *                     (optional, default = 0, only for idempotent requests, early data can be replayed)
+ *         ktls = [Boolean] hand the keys to the kernel after the handshake (kTLS), so sendFile() and relay()
+ *                do not copy the data through user space (optional, default = false)
+ *         offload = [Boolean] run the handshakes of non-blocking sockets in scheduler tasks on the crypto threads,
+ *                   so the key exchange does not delay the other tasks (optional, default = false)
+ * @return1 [TlsContext] context / nil
+ * @return2 nil / [String] error
+ */
+static int multi_tls_context_new(lua_State *L) {
+    // Check if there is one parameter and if it has a valid value
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_istable(L, 1)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [Table] options");
+        return 2; // Return nil, [String] error
+    }
+
+    SSL_CTX *ctx = NULL;
+    const char *error = multi_tls_context_create(L, 1, &ctx);
+    if (error != NULL) {
+        lua_pushnil(L);
+        lua_pushstring(L, error);
+        return 2; // Return nil, [String] error
+    }
+
+    MultiTlsContext *context = (MultiTlsContext *) lua_newuserdata(L, sizeof(MultiTlsContext));
+    context->ctx = ctx;
+    luaL_setmetatable(L, "multisocket_tls_context");
+    return 1; // Return [TlsContext] context
+}
+
+/**
+ * Get the context of a TLS context object
+ * @param L the Lua state
+ * @param index stack index of the value
+ * @return the context, NULL = the value is no TLS context or it is closed
+ */
+static SSL_CTX *multi_tls_context_get(lua_State *L, int index) {
+    MultiTlsContext *context = (MultiTlsContext *) luaL_testudata(L, index, "multisocket_tls_context");
+    return (context != NULL) ? context->ctx : NULL;
+}
+
+/**
+ * Lua Method
+ * Release the context, sockets which are already encrypted with it keep working
+ * @param0 [TlsContext] context
+ * @return1 [Boolean] success (true) / nil
+ * @return2 nil / [String] error
+ */
+static int multi_tls_context_close(lua_State *L) {
+    // Check if there is one parameter and if it has a valid value
+    if (lua_gettop(L) != 1) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_tls_context")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [TlsContext] context");
+        return 2; // Return nil, [String] error
+    }
+
+    MultiTlsContext *context = (MultiTlsContext *) lua_touserdata(L, 1);
+    if (context->ctx != NULL) {
+        SSL_CTX_free(context->ctx);
+        context->ctx = NULL;
+    }
+    lua_pushboolean(L, 1);
+    return 1; // Return [Boolean] success (true)
+}
+
+/**
+ * Prepare a client connection: set the server name and resume the cached session of host:port
+ * @param sock the client socket, sock->ssl has been created
+ * @param name the server name, NULL = use the address of the peer
+ */
+static void multi_tls_client_setup(Multisocket *sock, const char *name) {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    char host[INET6_ADDRSTRLEN];
+    unsigned short port;
+    if (getpeername(sock->socket, (struct sockaddr *) &addr, &len) != 0) {
+        return;
+    } else if (addr.ss_family == AF_INET6) {
+        inet_ntop(AF_INET6, &((struct sockaddr_in6 *) &addr)->sin6_addr, host, sizeof(host));
+        port = ntohs(((struct sockaddr_in6 *) &addr)->sin6_port);
+    } else {
+        inet_ntop(AF_INET, &((struct sockaddr_in *) &addr)->sin_addr, host, sizeof(host));
+        port = ntohs(((struct sockaddr_in *) &addr)->sin_port);
+    }
+
+    // Server Name Indication is only sent for host names, not for addresses (RFC 6066)
+    unsigned char buf[sizeof(struct in6_addr)];
+    if (name != NULL && inet_pton(AF_INET, name, buf) != 1 && inet_pton(AF_INET6, name, buf) != 1) {
+        SSL_set_tlsext_host_name(sock->ssl, name);
+    }
+
+    size_t size = strlen((name != NULL) ? name : host) + 8;
+    char *key = (char *) malloc(size);
+    if (key == NULL) {
+        return;
+    }
+    snprintf(key, size, "%s:%d", (name != NULL) ? name : host, port);
+    SSL_set_ex_data(sock->ssl, multi_tls_ssl_index, key);
+
+    SSL_SESSION *session = multi_tls_session_get(sock->ctx, key);
+    if (session != NULL) {
+        SSL_set_session(sock->ssl, session);
+        SSL_SESSION_free(session);
+    }
+}
+
+/**
+ * Free the early data of a connection
+ * @param sock the socket
+ */
+static void multi_tls_early_free(Multisocket *sock) {
+    if (sock->early != NULL) {
+        free(sock->early->data);
+        free(sock->early);
+        sock->early = NULL;
+    }
+}
+
+/**
+ * Defer the handshake of a client connection to the first send(), which then goes as early data (0-RTT)
+ * Only possible if the session which is resumed allows early data.
+ * @param sock the client socket, sock->ssl has been set up by multi_tls_client_setup()
+ * @return 1 = deferred, 0 = the handshake has to be done now
+ */
+static int multi_tls_early_defer(Multisocket *sock) {
+    SSL_SESSION *session = SSL_get_session(sock->ssl);
+    if (session == NULL || SSL_SESSION_get_max_early_data(session) == 0) {
+        return 0;
+    }
+    sock->early = (MultiTlsEarly *) calloc(1, sizeof(MultiTlsEarly));
+    return sock->early != NULL;
+}
+
+/**
+ * Send early data again which the server has rejected
+ * @param sock the client socket, the handshake is complete
+ * @return 1 = done, <= 0 = failed or has to wait (see SSL_get_error())
+ */
+static int multi_tls_early_resend(Multisocket *sock) {
+    MultiTlsEarly *early = sock->early;
+    if (early->data != NULL && SSL_get_early_data_status(sock->ssl) != SSL_EARLY_DATA_ACCEPTED) {
+        while (early->pos < early->len) {
+            int ret = SSL_write(sock->ssl, early->data + early->pos, (int) (early->len - early->pos));
+            if (ret <= 0) {
+                return ret;
+            }
+            early->pos += ret;
+        }
+    }
+    multi_tls_early_free(sock);
+    return 1;
+}
+
+static int multi_buffer_reserve(Multisocket *sock, size_t size);
+
+/**
+ * Read the early data of a server connection into the read-ahead buffer, receive() returns it like other data
+ * @param sock the server socket
+ * @return 1 = all early data has been read (or there was none), <= 0 = failed or has to wait (see SSL_get_error())
+ */
+static int multi_tls_early_accept(Multisocket *sock) {
+    while (1) {
+        if (multi_buffer_reserve(sock, MULTISOCKET_READ_BUFFER_SIZE) != 0) {
+            errno = ENOMEM;
+            return -1;
+        }
+        char *end = sock->rbuf + sock->rbufPos + sock->rbufLen;
+        size_t space = sock->rbufCap - sock->rbufPos - sock->rbufLen;
+        size_t read = 0;
+        int ret = SSL_read_early_data(sock->ssl, end, space, &read);
+        if (read > 0) {
+            sock->rbufLen += read;
+            sock->rbufNew = 1;
+            sock->recB += (long) read;
+            multi_metrics_count(MULTISOCKET_METRIC_RECEIVED, (long) read);
+            sock->lastT = multi_clock_now();
+        }
+        if (ret == SSL_READ_EARLY_DATA_FINISH) {
+            return 1;
+        } else if (ret == SSL_READ_EARLY_DATA_ERROR) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * Advance the pending TLS handshake of a connection as far as possible
+ * On a non-blocking socket it returns as soon as OpenSSL has to wait for the peer,
+ * SSL_get_error() tells whether it waits for the socket to become readable or writable.
+ * @param sock the socket, sock->handshake is the state of the handshake
+ * @return 1 = complete, <= 0 = failed or has to wait (see SSL_get_error())
+ */
+static int multi_tls_handshake(Multisocket *sock) {
+    int ret;
+    if (sock->handshake == MULTISOCKET_TLS_EARLY_DATA) {
+        ret = multi_tls_early_accept(sock);
+        if (ret != 1) {
+            return ret;
+        }
+        sock->handshake = MULTISOCKET_TLS_HANDSHAKE;
+    }
+    // A completed handshake returns 1 again, so a client can retry to send rejected early data
+    ret = SSL_do_handshake(sock->ssl);
+    if (ret == 1 && sock->early != NULL) {
+        ret = multi_tls_early_resend(sock);
+    }
+    if (ret == 1) {
+        sock->handshake = 0;
+        multi_metrics_latency(MULTISOCKET_METRIC_HANDSHAKE, sock->handshakeT);
+        multi_metrics_count(MULTISOCKET_METRIC_HANDSHAKES, 1);
+        multi_metrics_count(MULTISOCKET_METRIC_RESUMED, SSL_session_reused(sock->ssl));
+    }
+    return ret;
+}
+
+/**
+ * Write to an encrypted connection, SSL_write() for connections with a pending handshake
+ * The first write of a deferred handshake is sent as early data, as much as the session allows,
+ * the following ones wait until the handshake is complete.
+ * @param sock the socket
+ * @param buf the data
+ * @param len the length of the data
+ * @return number of bytes written, <= 0 = failed or has to wait (see SSL_get_error())
+ */
+static int multi_tls_write(Multisocket *sock, const void *buf, int len) {
+    MultiTlsEarly *early = sock->early;
+    if (early != NULL && early->data == NULL) {
+        size_t max = SSL_SESSION_get_max_early_data(SSL_get_session(sock->ssl));
+        size_t size = ((size_t) len < max) ? (size_t) len : max;
+        size_t written = 0;
+        char *data = (char *) malloc(size);
+        if (data == NULL) {
+            errno = ENOMEM;
+            return -1;
+        } else if (SSL_write_early_data(sock->ssl, buf, size, &written) != 1) {
+            free(data);
+            return -1;
+        }
+        memcpy(data, buf, written);
+        early->data = data;
+        early->len = written;
+        return (int) written;
+    } else if (sock->handshake) {
+        int ret = multi_tls_handshake(sock);
+        if (ret != 1) {
+            return ret;
+        }
+    }
+    return SSL_write(sock->ssl, buf, len);
+}
+
+/**
+ * Read from an encrypted connection, SSL_read() for connections with a pending handshake
+ * @param sock the socket
+ * @param buf the buffer
+ * @param len the size of the buffer
+ * @return number of bytes read, <= 0 = failed, closed or has to wait (see SSL_get_error())
+ */
+static int multi_tls_read(Multisocket *sock, void *buf, int len) {
+    if (sock->handshake) {
+        int ret = multi_tls_handshake(sock);
+        if (ret != 1) {
+            return ret;
+        }
+    }
+    return SSL_read(sock->ssl, buf, len);
+}
+
+/**
+ * Does the kernel encrypt the records sent on the connection (kTLS)?
+ * @param sock the socket
+ * @return 1 = kernel TLS, 0 = OpenSSL encrypts in user space
+ */
+static int multi_tls_ktls_send(Multisocket *sock) {
+#ifdef SSL_OP_ENABLE_KTLS
+    return sock->enc && !sock->handshake && BIO_get_ktls_send(SSL_get_wbio(sock->ssl));
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Does the kernel decrypt the records received on the connection (kTLS)?
+ * @param sock the socket
+ * @return 1 = kernel TLS, 0 = OpenSSL decrypts in user space
+ */
+static int multi_tls_ktls_recv(Multisocket *sock) {
+#ifdef SSL_OP_ENABLE_KTLS
+    return sock->enc && !sock->handshake && BIO_get_ktls_recv(SSL_get_rbio(sock->ssl));
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Send a part of a file on a connection with kernel TLS, the kernel encrypts the pages of the file
+ * Only for sockets for which multi_tls_ktls_send() is true.
+ * @param sock the socket
+ * @param fd the file
+ * @param offset offset in the file
+ * @param size number of bytes
+ * @return number of bytes sent, 0 = end of file, < 0 = failed or has to wait (see SSL_get_error())
+ */
+static long multi_tls_sendfile(Multisocket *sock, int fd, off_t offset, size_t size) {
+#ifdef SSL_OP_ENABLE_KTLS
+    return (long) SSL_sendfile(sock->ssl, fd, offset, size, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
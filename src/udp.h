@@ -0,0 +1,815 @@
+/**
+ * Maximum number of datagrams passed to one recvmmsg() or sendmmsg() call (UIO_MAXIOV)
+ */
+#define MULTISOCKET_UDP_BATCH 1024
+
+/**
+ * Default maximum size of a received datagram
+ * With UDP_GRO one message can carry up to 64 KiB of coalesced datagrams.
+ */
+#define MULTISOCKET_UDP_DATAGRAM_SIZE 2048
+#define MULTISOCKET_UDP_GRO_SIZE 65535
+
+/**
+ * Maximum memory receiveMany() uses for the messages of one recvmmsg() call
+ */
+#define MULTISOCKET_UDP_RECEIVE_BUFFER (4 * 1024 * 1024)
+
+/**
+ * Maximum payload and maximum number of segments of one UDP_SEGMENT send
+ */
+#define MULTISOCKET_UDP_GSO_SIZE 65507
+#define MULTISOCKET_UDP_GSO_SEGMENTS 64
+
+
+/**
+ * Create a new UDP socket
+ * @param L the Lua state
+ * @param ipv6 1 = IPv6, 0 = IPv4
+ * @return number of Lua return values
+ */
+static int multi_udp_new(lua_State *L, int ipv6) {
+    // Init socket filedescriptor
+    int desc = 0;
+    if ((desc = socket(ipv6 ? AF_INET6 : AF_INET, SOCK_DGRAM, 0)) == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2; // Return nil, [String] error
+    }
+
+    // Allocate memory for Multisocket
+    Multisocket *sock = (Multisocket *) lua_newuserdata(L, sizeof(Multisocket));
+    sock->socket = desc; // Set the socket filedescriptor
+    sock->ssl = NULL;
+    sock->ctx = NULL;
+    sock->early = NULL;
+    sock->job = NULL;
+    sock->rbuf = NULL;
+    sock->rbufCap = 0;
+    sock->rbufPos = 0;
+    sock->rbufLen = 0;
+    sock->poller = NULL;
+    sock->pevents = 0;
+    sock->startT = multi_clock_monotonic(); // Set connection start time in nanoseconds
+    sock->lastT = sock->startT;             // Set last signal time in nanoseconds
+    sock->readT = 0;
+    sock->writeT = 0;
+    sock->handshakeT = 0;
+    sock->recB = 0;  // Init received bytes
+    sock->sndB = 0;  // Init sent bytes
+    sock->timeout = 0;
+    sock->idleTimeout = 0;
+    sock->timer = 0;
+
+    sock->listen = 0;
+    sock->conn = 0;
+    sock->servers = 0;
+    sock->clients = 0;
+    sock->tcp = 0;
+    sock->udp = 1;
+    sock->enc = 0;
+    sock->handshake = 0;
+    sock->ipv6 = (unsigned char) (ipv6 != 0);
+    sock->ipv4 = (unsigned char) (ipv6 == 0);
+    sock->pend = 0;
+    sock->rbufNew = 0;
+    sock->nonblock = 0;
+    sock->gro = 0;
+    sock->expired = 0;
+    sock->accepted = NULL;
+
+    multi_metrics_count(MULTISOCKET_METRIC_OPENED, 1);
+    luaL_getmetatable(L, "multisocket_udp"); // Get multisocket_udp metatable
+    lua_setmetatable(L, -2); // Set the metatable to the Multisocket
+
+    return 1; // Return [Multisocket] socket
+}
+
+/**
+ * Lua Function
+ * Create a new UDP/IPv6 socket
+ * @return1 [Multisocket] socket / nil
+ * @return2 nil / [String] error
+ */
+static int multi_udp6(lua_State *L) {
+    // Check if there are any parameters
+    if (lua_gettop(L) != 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    }
+
+    return multi_udp_new(L, 1);
+}
+
+/**
+ * Lua Function
+ * Create a new UDP/IPv4 socket
+ * @return1 [Multisocket] socket / nil
+ * @return2 nil / [String] error
+ */
+static int multi_udp4(lua_State *L) {
+    // Check if there are any parameters
+    if (lua_gettop(L) != 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    }
+
+    return multi_udp_new(L, 0);
+}
+
+/**
+ * Read the destination of a datagram from the Lua stack
+ * Only numeric addresses are accepted, so sending never blocks on name resolution.
+ * @param L the Lua state
+ * @param sock the socket
+ * @param index stack index of the address, the port follows it
+ * @param address the destination, unchanged if there is no address on the stack
+ * @param len size of the destination, 0 = use the address the socket is connected to
+ * @return NULL = success, otherwise the error
+ */
+static const char *multi_udp_destination(lua_State *L, Multisocket *sock, int index,
+                                         struct sockaddr_storage *address, socklen_t *len) {
+    if (lua_isnoneornil(L, index) && lua_isnoneornil(L, index + 1)) {
+        return NULL;
+    } else if (lua_type(L, index) != LUA_TSTRING) {
+        return "has to be [String] address";
+    } else if (!lua_isinteger(L, index + 1) || lua_tointeger(L, index + 1) > 0xFFFF || lua_tointeger(L, index + 1) < 0) {
+        return "has to be [Integer] port (0-65535)";
+    }
+
+    const char *string = lua_tostring(L, index);
+    unsigned short port = (unsigned short) lua_tointeger(L, index + 1);
+    bzero(address, sizeof(struct sockaddr_storage));
+    if (sock->ipv6) {
+        struct sockaddr_in6 *address6 = (struct sockaddr_in6 *) address;
+        address6->sin6_family = AF_INET6;
+        address6->sin6_port = htons(port);
+        if (inet_pton(AF_INET6, string, &address6->sin6_addr) != 1) {
+            return "has to be a numeric IPv6 address";
+        }
+        *len = sizeof(struct sockaddr_in6);
+    } else {
+        struct sockaddr_in *address4 = (struct sockaddr_in *) address;
+        address4->sin_family = AF_INET;
+        address4->sin_port = htons(port);
+        if (inet_pton(AF_INET, string, &address4->sin_addr) != 1) {
+            return "has to be a numeric IPv4 address";
+        }
+        *len = sizeof(struct sockaddr_in);
+    }
+    return NULL;
+}
+
+/**
+ * Push the address and the port of the sender of a datagram
+ * @param L the Lua state
+ * @param address the sender
+ */
+static void multi_udp_push_sender(lua_State *L, const struct sockaddr_storage *address) {
+    char string[INET6_ADDRSTRLEN];
+    if (address->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *address6 = (const struct sockaddr_in6 *) address;
+        inet_ntop(AF_INET6, &address6->sin6_addr, string, sizeof(string));
+        lua_pushstring(L, string);
+        lua_pushinteger(L, ntohs(address6->sin6_port));
+    } else if (address->ss_family == AF_INET) {
+        const struct sockaddr_in *address4 = (const struct sockaddr_in *) address;
+        inet_ntop(AF_INET, &address4->sin_addr, string, sizeof(string));
+        lua_pushstring(L, string);
+        lua_pushinteger(L, ntohs(address4->sin_port));
+    } else {
+        lua_pushnil(L);
+        lua_pushnil(L);
+    }
+}
+
+/**
+ * Push the error of a failed datagram call, or yield if a non-blocking socket is not ready
+ * Has to be used as return expression of a Lua function.
+ * @param L the Lua state, the socket has to be argument #0
+ * @param sock the socket
+ * @param events MULTISOCKET_POLL_READ / MULTISOCKET_POLL_WRITE
+ * @param ctx the context passed to the continuation, the stack is cut to it before the error is pushed
+ * @param k the continuation
+ * @param done number of datagrams or bytes already sent, -1 = do not return a count
+ */
+static int multi_udp_error(lua_State *L, Multisocket *sock, int events, lua_KContext ctx, lua_KFunction k, long done) {
+    int want = multi_tcp_want(sock, -1, events);
+    if (want && lua_isyieldable(L)) {
+        if (done >= 0) {
+            lua_pushinteger(L, done);
+        }
+        return multi_tcp_yield(L, want, ctx, k);
+    }
+    int error = errno;
+    lua_settop(L, (int) ctx);
+    lua_pushnil(L);
+    if (want) {
+        lua_pushstring(L, (want == MULTISOCKET_POLL_WRITE) ? "want_write" : "want_read");
+    } else if (error == EAGAIN || error == EWOULDBLOCK || error == ETIMEDOUT) {
+        lua_pushstring(L, "timeout");
+    } else {
+        lua_pushstring(L, strerror(error));
+    }
+    if (done >= 0) {
+        lua_pushinteger(L, done);
+        return 3; // Return nil, [String] error, [Integer] sent
+    }
+    return 2; // Return nil, [String] error
+}
+
+/**
+ * Lua Method
+ * Send one datagram
+ * @param0 [Multisocket] socket (UDP)
+ * @param1 [String] data
+ * @param2 [String] address (optional if the socket is connected, numeric)
+ * @param3 [Integer] port (optional if the socket is connected)
+ * @return1 [Integer] sent bytes / nil
+ * @return2 nil / [String] error
+ */
+static int multi_udp_send_k(lua_State *L, int status, lua_KContext ctx);
+
+static int multi_udp_send(lua_State *L) {
+    // Check if there are two or four parameters and if they have valid values
+    if (lua_gettop(L) != 2 && lua_gettop(L) != 4) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_udp")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (UDP)");
+        return 2; // Return nil, [String] error
+    } else if (lua_type(L, 2) != LUA_TSTRING) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [String] data");
+        return 2; // Return nil, [String] error
+    }
+
+    // Cast userdata to Multisocket
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+
+    struct sockaddr_storage address;
+    socklen_t addressLen = 0;
+    const char *error = multi_udp_destination(L, sock, 3, &address, &addressLen);
+    if (error != NULL) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "Argument #2/#3 %s", error);
+        return 2; // Return nil, [String] error
+    }
+
+    size_t len = 0;
+    const char *data = lua_tolstring(L, 2, &len);
+    ssize_t ret = sendto(sock->socket, data, len, 0, (addressLen != 0) ? (struct sockaddr *) &address : NULL, addressLen);
+    if (ret == -1) {
+        return multi_udp_error(L, sock, MULTISOCKET_POLL_WRITE, lua_gettop(L), multi_udp_send_k, -1);
+    }
+
+    sock->sndB += ret;
+    multi_metrics_count(MULTISOCKET_METRIC_SENT, ret);
+    sock->lastT = multi_clock_now();
+
+    lua_pushinteger(L, ret);
+    return 1; // Return [Integer] sent bytes
+}
+
+/**
+ * Continuation of multi_udp_send() after the socket became writable
+ */
+static int multi_udp_send_k(lua_State *L, int status, lua_KContext ctx) {
+    (void) status;
+    lua_settop(L, (int) ctx);
+    return multi_udp_send(L);
+}
+
+/**
+ * Lua Method
+ * Receive one datagram
+ * Datagrams longer than maxSize are truncated. With GRO enabled a datagram can contain
+ * several coalesced datagrams, use receiveMany() to get them split.
+ * @param0 [Multisocket] socket (UDP)
+ * @param1 [Integer] maxSize (optional, 1-65535, default = 2048 / 65535 with GRO)
+ * @return1 [String] data / nil
+ * @return2 [String] address / [String] error
+ * @return3 [Integer] port / nil
+ */
+static int multi_udp_receive_k(lua_State *L, int status, lua_KContext ctx);
+
+static int multi_udp_receive(lua_State *L) {
+    // Check if there are one or two parameters and if they have valid values
+    if (lua_gettop(L) != 1 && lua_gettop(L) != 2) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_udp")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (UDP)");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isnoneornil(L, 2) && (!lua_isinteger(L, 2) || lua_tointeger(L, 2) < 1 || lua_tointeger(L, 2) > 0xFFFF)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [Integer] maxSize (1-65535)");
+        return 2; // Return nil, [String] error
+    }
+
+    // Cast userdata to Multisocket
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+    size_t size = !lua_isnoneornil(L, 2) ? (size_t) lua_tointeger(L, 2) :
+                  sock->gro ? MULTISOCKET_UDP_GRO_SIZE : MULTISOCKET_UDP_DATAGRAM_SIZE;
+
+    // The read-ahead buffer is not used otherwise by UDP sockets
+    if (multi_buffer_reserve(sock, size) != 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(ENOMEM));
+        return 2; // Return nil, [String] error
+    }
+    char *buffer = sock->rbuf + sock->rbufPos;
+
+    struct sockaddr_storage address;
+    socklen_t addressLen = sizeof(address);
+    bzero(&address, sizeof(address));
+    ssize_t ret = recvfrom(sock->socket, buffer, size, 0, (struct sockaddr *) &address, &addressLen);
+    if (ret == -1) {
+        return multi_udp_error(L, sock, MULTISOCKET_POLL_READ, lua_gettop(L), multi_udp_receive_k, -1);
+    }
+
+    sock->recB += ret;
+    multi_metrics_count(MULTISOCKET_METRIC_RECEIVED, ret);
+    sock->lastT = multi_clock_now();
+
+    lua_pushlstring(L, buffer, (size_t) ret);
+    multi_udp_push_sender(L, &address);
+    return 3; // Return [String] data, [String] address, [Integer] port
+}
+
+/**
+ * Continuation of multi_udp_receive() after the socket became readable
+ */
+static int multi_udp_receive_k(lua_State *L, int status, lua_KContext ctx) {
+    (void) status;
+    lua_settop(L, (int) ctx);
+    return multi_udp_receive(L);
+}
+
+/**
+ * Lua Method
+ * Receive as many datagrams as are ready with a single recvmmsg() call
+ * Blocks until at least one datagram arrived. With GRO enabled every message can contain
+ * several coalesced datagrams, they are split again, so the table can hold more than max datagrams.
+ * Datagrams longer than maxSize are truncated.
+ * @param0 [Multisocket] socket (UDP)
+ * @param1 [Integer] max (1-1024, number of messages)
+ * @param2 [Integer] maxSize (optional, 1-65535, default = 2048 / 65535 with GRO)
+ * @return1 [Table<Integer, Table>] datagrams ({data = [String], address = [String], port = [Integer]}) / nil
+ * @return2 nil / [String] error
+ */
+static int multi_udp_receive_many_k(lua_State *L, int status, lua_KContext ctx);
+
+static int multi_udp_receive_many(lua_State *L) {
+    // Check if there are two or three parameters and if they have valid values
+    if (lua_gettop(L) != 2 && lua_gettop(L) != 3) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_udp")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (UDP)");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isinteger(L, 2) || lua_tointeger(L, 2) < 1 || lua_tointeger(L, 2) > MULTISOCKET_UDP_BATCH) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "Argument #1 has to be [Integer] max (1-%d)", MULTISOCKET_UDP_BATCH);
+        return 2; // Return nil, [String] error
+    } else if (!lua_isnoneornil(L, 3) && (!lua_isinteger(L, 3) || lua_tointeger(L, 3) < 1 || lua_tointeger(L, 3) > 0xFFFF)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #2 has to be [Integer] maxSize (1-65535)");
+        return 2; // Return nil, [String] error
+    }
+
+    // Cast userdata to Multisocket
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+
+    // Load parameters into variables
+    size_t size = !lua_isnoneornil(L, 3) ? (size_t) lua_tointeger(L, 3) :
+                  sock->gro ? MULTISOCKET_UDP_GRO_SIZE : MULTISOCKET_UDP_DATAGRAM_SIZE;
+    int max = (int) lua_tointeger(L, 2);
+    if ((size_t) max * size > MULTISOCKET_UDP_RECEIVE_BUFFER) {
+        max = (int) (MULTISOCKET_UDP_RECEIVE_BUFFER / size);
+        max = (max < 1) ? 1 : max;
+    }
+
+    // The headers, the senders, the control messages and the data of all messages share the read-ahead buffer
+    size_t control = CMSG_SPACE(sizeof(int));
+    size_t each = sizeof(struct mmsghdr) + sizeof(struct iovec) + sizeof(struct sockaddr_storage) + control;
+    if (multi_buffer_reserve(sock, (size_t) max * (each + size)) != 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(ENOMEM));
+        return 2; // Return nil, [String] error
+    }
+    struct mmsghdr *msgs = (struct mmsghdr *) (sock->rbuf + sock->rbufPos);
+    struct iovec *iov = (struct iovec *) (msgs + max);
+    struct sockaddr_storage *addresses = (struct sockaddr_storage *) (iov + max);
+    char *controls = (char *) (addresses + max);
+    char *data = controls + (size_t) max * control;
+
+    for (int i = 0; i < max; i++) {
+        iov[i].iov_base = data + (size_t) i * size;
+        iov[i].iov_len = size;
+        bzero(&msgs[i].msg_hdr, sizeof(struct msghdr));
+        msgs[i].msg_hdr.msg_name = &addresses[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = sock->gro ? controls + (size_t) i * control : NULL;
+        msgs[i].msg_hdr.msg_controllen = sock->gro ? control : 0;
+    }
+
+    // MSG_WAITFORONE only waits for the first datagram, the others are taken if they are already queued
+    int num = recvmmsg(sock->socket, msgs, (unsigned int) max, MSG_WAITFORONE, NULL);
+    if (num == -1) {
+        return multi_udp_error(L, sock, MULTISOCKET_POLL_READ, lua_gettop(L), multi_udp_receive_many_k, -1);
+    }
+
+    lua_createtable(L, num, 0);
+    int count = 0;
+    for (int i = 0; i < num; i++) {
+        size_t len = msgs[i].msg_len;
+        size_t segment = len;
+        if (sock->gro) {
+            for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+                if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                    int gso = 0;
+                    memcpy(&gso, CMSG_DATA(cmsg), sizeof(gso));
+                    segment = (gso > 0) ? (size_t) gso : len;
+                }
+            }
+        }
+        sock->recB += len;
+        multi_metrics_count(MULTISOCKET_METRIC_RECEIVED, len);
+
+        // A message without data is still a datagram
+        size_t offset = 0;
+        do {
+            size_t part = (len - offset < segment) ? len - offset : segment;
+            lua_createtable(L, 0, 3);
+            lua_pushlstring(L, (char *) iov[i].iov_base + offset, part);
+            lua_setfield(L, -2, "data");
+            multi_udp_push_sender(L, &addresses[i]);
+            lua_setfield(L, -3, "port");
+            lua_setfield(L, -2, "address");
+            lua_rawseti(L, -2, ++count);
+            offset += part;
+        } while (offset < len);
+    }
+    sock->lastT = multi_clock_now();
+
+    return 1; // Return [Table<Integer, Table>] datagrams
+}
+
+/**
+ * Continuation of multi_udp_receive_many() after the socket became readable
+ */
+static int multi_udp_receive_many_k(lua_State *L, int status, lua_KContext ctx) {
+    (void) status;
+    lua_settop(L, (int) ctx);
+    return multi_udp_receive_many(L);
+}
+
+/**
+ * Lua Method
+ * Send many datagrams with as few sendmmsg() calls as possible
+ * Every datagram is either a [String] sent to the default destination, or a table like the ones
+ * returned by receiveMany() with its own address and port.
+ * @param0 [Multisocket] socket (UDP)
+ * @param1 [Table<Integer, String / Table>] datagrams ({data = [String], address = [String], port = [Integer]})
+ * @param2 [String] address (optional, numeric, default destination)
+ * @param3 [Integer] port (optional, default destination)
+ * @return1 [Integer] number of sent datagrams / nil
+ * @return2 nil / [String] error
+ * @return3 nil / [Integer] number of sent datagrams
+ */
+static int multi_udp_send_many_run(lua_State *L, long sent);
+
+static int multi_udp_send_many(lua_State *L) {
+    // Check if there are two or four parameters and if they have valid values
+    if (lua_gettop(L) != 2 && lua_gettop(L) != 4) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_udp")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (UDP)");
+        return 2; // Return nil, [String] error
+    } else if (!lua_istable(L, 2)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [Table] datagrams");
+        return 2; // Return nil, [String] error
+    }
+
+    return multi_udp_send_many_run(L, 0);
+}
+
+/**
+ * Continuation of multi_udp_send_many() after the socket became writable
+ * The number of already sent datagrams is stored above the arguments
+ */
+static int multi_udp_send_many_k(lua_State *L, int status, lua_KContext ctx) {
+    (void) status;
+    long sent = (long) lua_tointeger(L, (int) ctx + 1);
+    lua_settop(L, (int) ctx);
+    return multi_udp_send_many_run(L, sent);
+}
+
+/**
+ * Send the datagrams of multi_udp_send_many() starting at the given index
+ * @param L the Lua state with the validated arguments of multi_udp_send_many()
+ * @param sent number of datagrams already sent
+ */
+static int multi_udp_send_many_run(lua_State *L, long sent) {
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+    int top = lua_gettop(L);
+    long count = (long) lua_rawlen(L, 2);
+
+    struct sockaddr_storage fallback;
+    socklen_t fallbackLen = 0;
+    const char *error = multi_udp_destination(L, sock, 3, &fallback, &fallbackLen);
+    if (error != NULL) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "Argument #2/#3 %s", error);
+        lua_pushinteger(L, sent);
+        return 3; // Return nil, [String] error, [Integer] sent
+    }
+
+    while (sent < count) {
+        int batch = (count - sent < MULTISOCKET_UDP_BATCH) ? (int) (count - sent) : MULTISOCKET_UDP_BATCH;
+        if (multi_buffer_reserve(sock, (size_t) batch * (sizeof(struct mmsghdr) + sizeof(struct iovec) + sizeof(struct sockaddr_storage))) != 0) {
+            lua_pushnil(L);
+            lua_pushstring(L, strerror(ENOMEM));
+            lua_pushinteger(L, sent);
+            return 3; // Return nil, [String] error, [Integer] sent
+        }
+        struct mmsghdr *msgs = (struct mmsghdr *) (sock->rbuf + sock->rbufPos);
+        struct iovec *iov = (struct iovec *) (msgs + batch);
+        struct sockaddr_storage *addresses = (struct sockaddr_storage *) (iov + batch);
+
+        // The strings stay referenced by the datagrams table while they are sent
+        for (int i = 0; i < batch; i++) {
+            socklen_t addressLen = fallbackLen;
+            if (fallbackLen != 0) {
+                memcpy(&addresses[i], &fallback, sizeof(fallback));
+            }
+            lua_rawgeti(L, 2, sent + i + 1);
+            if (lua_istable(L, -1)) {
+                lua_getfield(L, -1, "data");
+                lua_getfield(L, -2, "address");
+                lua_getfield(L, -3, "port");
+                error = multi_udp_destination(L, sock, -2, &addresses[i], &addressLen);
+                lua_pop(L, 2);
+            } else {
+                error = NULL;
+            }
+            if (lua_type(L, -1) != LUA_TSTRING || error != NULL) {
+                lua_settop(L, top);
+                lua_pushnil(L);
+                lua_pushfstring(L, "Datagram #%d %s", (int) (sent + i + 1), (error != NULL) ? error : "has to be [String] data");
+                lua_pushinteger(L, sent);
+                return 3; // Return nil, [String] error, [Integer] sent
+            }
+            size_t len = 0;
+            iov[i].iov_base = (void *) lua_tolstring(L, -1, &len);
+            iov[i].iov_len = len;
+            lua_settop(L, top);
+
+            bzero(&msgs[i].msg_hdr, sizeof(struct msghdr));
+            msgs[i].msg_hdr.msg_name = (addressLen != 0) ? &addresses[i] : NULL;
+            msgs[i].msg_hdr.msg_namelen = addressLen;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int num = sendmmsg(sock->socket, msgs, (unsigned int) batch, 0);
+        if (num == -1) {
+            return multi_udp_error(L, sock, MULTISOCKET_POLL_WRITE, top, multi_udp_send_many_k, sent);
+        }
+        for (int i = 0; i < num; i++) {
+            sock->sndB += msgs[i].msg_len;
+            multi_metrics_count(MULTISOCKET_METRIC_SENT, msgs[i].msg_len);
+        }
+        sent += num;
+        sock->lastT = multi_clock_now();
+    }
+
+    lua_pushinteger(L, sent);
+    return 1; // Return [Integer] sent
+}
+
+/**
+ * Send one datagram of every segment with UDP_SEGMENT
+ * @param sock the socket
+ * @param data the segments
+ * @param len size of the segments
+ * @param segment size of every segment but the last one
+ * @param address the destination, NULL = use the address the socket is connected to
+ * @param addressLen size of the destination
+ * @return number of sent bytes, -1 = error (see errno)
+ */
+static ssize_t multi_udp_send_gso(Multisocket *sock, const char *data, size_t len, size_t segment,
+                                  struct sockaddr_storage *address, socklen_t addressLen) {
+    struct iovec iov;
+    iov.iov_base = (void *) data;
+    iov.iov_len = len;
+
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    bzero(control, sizeof(control));
+
+    struct msghdr msg;
+    bzero(&msg, sizeof(msg));
+    msg.msg_name = address;
+    msg.msg_namelen = addressLen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    // A single segment does not need segmentation offload
+    if (len > segment) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t size = (uint16_t) segment;
+        memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+    }
+    return sendmsg(sock->socket, &msg, 0);
+}
+
+/**
+ * Send one datagram of every segment with sendmmsg(), for kernels and devices without UDP_SEGMENT
+ * @return number of sent bytes, -1 = error (see errno)
+ */
+static ssize_t multi_udp_send_split(Multisocket *sock, const char *data, size_t len, size_t segment,
+                                    struct sockaddr_storage *address, socklen_t addressLen) {
+    struct mmsghdr msgs[MULTISOCKET_UDP_GSO_SEGMENTS];
+    struct iovec iov[MULTISOCKET_UDP_GSO_SEGMENTS];
+    int num = 0;
+    for (size_t offset = 0; offset < len && num < MULTISOCKET_UDP_GSO_SEGMENTS; offset += segment, num++) {
+        iov[num].iov_base = (void *) (data + offset);
+        iov[num].iov_len = (len - offset < segment) ? len - offset : segment;
+        bzero(&msgs[num].msg_hdr, sizeof(struct msghdr));
+        msgs[num].msg_hdr.msg_name = address;
+        msgs[num].msg_hdr.msg_namelen = addressLen;
+        msgs[num].msg_hdr.msg_iov = &iov[num];
+        msgs[num].msg_hdr.msg_iovlen = 1;
+    }
+
+    int ret = sendmmsg(sock->socket, msgs, (unsigned int) num, 0);
+    if (ret <= 0) {
+        return ret;
+    }
+    ssize_t sent = 0;
+    for (int i = 0; i < ret; i++) {
+        sent += msgs[i].msg_len;
+    }
+    return sent;
+}
+
+/**
+ * Lua Method
+ * Send a large buffer as datagrams of segmentSize bytes each (the last one can be shorter)
+ * Uses UDP generic segmentation offload (UDP_SEGMENT), so up to 64 datagrams take a single trip
+ * through the network stack. Falls back to sendmmsg() where UDP_SEGMENT is not supported.
+ * @param0 [Multisocket] socket (UDP)
+ * @param1 [String] data
+ * @param2 [Integer] segmentSize (1-65507)
+ * @param3 [String] address (optional if the socket is connected, numeric)
+ * @param4 [Integer] port (optional if the socket is connected)
+ * @return1 [Integer] sent bytes / nil
+ * @return2 nil / [String] error
+ * @return3 nil / [Integer] sent bytes
+ */
+static int multi_udp_send_segments_run(lua_State *L, long sent);
+
+static int multi_udp_send_segments(lua_State *L) {
+    // Check if there are three or five parameters and if they have valid values
+    if (lua_gettop(L) != 3 && lua_gettop(L) != 5) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_udp")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (UDP)");
+        return 2; // Return nil, [String] error
+    } else if (lua_type(L, 2) != LUA_TSTRING) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [String] data");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isinteger(L, 3) || lua_tointeger(L, 3) < 1 || lua_tointeger(L, 3) > MULTISOCKET_UDP_GSO_SIZE) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "Argument #2 has to be [Integer] segmentSize (1-%d)", MULTISOCKET_UDP_GSO_SIZE);
+        return 2; // Return nil, [String] error
+    }
+
+    return multi_udp_send_segments_run(L, 0);
+}
+
+/**
+ * Continuation of multi_udp_send_segments() after the socket became writable
+ * The number of already sent bytes is stored above the arguments
+ */
+static int multi_udp_send_segments_k(lua_State *L, int status, lua_KContext ctx) {
+    (void) status;
+    long sent = (long) lua_tointeger(L, (int) ctx + 1);
+    lua_settop(L, (int) ctx);
+    return multi_udp_send_segments_run(L, sent);
+}
+
+/**
+ * Send the segments of multi_udp_send_segments() starting at the given offset
+ * @param L the Lua state with the validated arguments of multi_udp_send_segments()
+ * @param sent number of bytes already sent
+ */
+static int multi_udp_send_segments_run(lua_State *L, long sent) {
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+    size_t len = 0;
+    const char *data = lua_tolstring(L, 2, &len);
+    size_t segment = (size_t) lua_tointeger(L, 3);
+
+    struct sockaddr_storage address;
+    socklen_t addressLen = 0;
+    const char *error = multi_udp_destination(L, sock, 4, &address, &addressLen);
+    if (error != NULL) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "Argument #3/#4 %s", error);
+        lua_pushinteger(L, sent);
+        return 3; // Return nil, [String] error, [Integer] sent
+    }
+
+    // Every call carries at most 64 segments and 64 KiB
+    size_t segments = MULTISOCKET_UDP_GSO_SIZE / segment;
+    segments = (segments > MULTISOCKET_UDP_GSO_SEGMENTS) ? MULTISOCKET_UDP_GSO_SEGMENTS : (segments < 1) ? 1 : segments;
+    int gso = 1;
+
+    // Empty data is sent as one empty datagram
+    do {
+        size_t chunk = (len - sent < segments * segment) ? len - sent : segments * segment;
+        ssize_t ret = -1;
+        if (gso) {
+            ret = multi_udp_send_gso(sock, data + sent, chunk, segment, (addressLen != 0) ? &address : NULL, addressLen);
+        }
+        if (ret == -1 && (!gso || errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP)) {
+            // EIO: the device has no checksum offload, the segments are sent one by one
+            gso = 0;
+            ret = multi_udp_send_split(sock, data + sent, chunk, segment, (addressLen != 0) ? &address : NULL, addressLen);
+        }
+        if (ret == -1) {
+            return multi_udp_error(L, sock, MULTISOCKET_POLL_WRITE, lua_gettop(L), multi_udp_send_segments_k, sent);
+        }
+        sock->sndB += ret;
+        multi_metrics_count(MULTISOCKET_METRIC_SENT, ret);
+        sock->lastT = multi_clock_now();
+        sent += ret;
+    } while ((size_t) sent < len);
+
+    lua_pushinteger(L, sent);
+    return 1; // Return [Integer] sent bytes
+}
+
+/**
+ * Lua Method
+ * Let the kernel coalesce received datagrams of the same flow (UDP_GRO)
+ * receiveMany() splits them again, so the datagrams stay the same, but far fewer messages are needed.
+ * @param0 [Multisocket] socket (UDP)
+ * @param1 [Boolean] enabled
+ * @return1 [Boolean] success / nil
+ * @return2 nil / [String] error
+ */
+static int multi_udp_set_gro(lua_State *L) {
+    // Check if there are two parameters and if they have valid values
+    if (lua_gettop(L) != 2) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Wrong number of arguments");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isuserdata(L, 1) || !luaL_checkudata(L, 1, "multisocket_udp")) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #0 has to be [Multisocket] socket (UDP)");
+        return 2; // Return nil, [String] error
+    } else if (!lua_isboolean(L, 2)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Argument #1 has to be [Boolean] enabled");
+        return 2; // Return nil, [String] error
+    }
+
+    // Cast userdata to Multisocket
+    Multisocket *sock = (Multisocket *) lua_touserdata(L, 1);
+
+    int enabled = lua_toboolean(L, 2);
+    if (setsockopt(sock->socket, SOL_UDP, UDP_GRO, &enabled, sizeof(enabled)) == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2; // Return nil, [String] error
+    }
+    sock->gro = (unsigned char) enabled;
+
+    lua_pushboolean(L, 1);
+    return 1; // Return [Boolean] success (true)
+}
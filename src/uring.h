@@ -0,0 +1,445 @@
+/**
+ * Number of submission queue entries of an io_uring
+ */
+#define MULTISOCKET_URING_ENTRIES 256
+
+/**
+ * Number and size of the buffers provided to the kernel for receives
+ * A receive only takes a buffer as soon as data arrives, so waiting connections do not pin one each.
+ */
+#define MULTISOCKET_URING_BUFFERS 256
+#define MULTISOCKET_URING_BUFFER_SIZE 8192
+
+/**
+ * Operations of the scheduler submitted to an io_uring
+ */
+#define MULTISOCKET_URING_POLL 1
+#define MULTISOCKET_URING_RECV 2
+
+struct MultiUring;
+
+/**
+ * Connections accepted by a multishot accept of a listener, which have not been taken by accept() yet
+ */
+typedef struct MultiUringAccept {
+    struct MultiUring *ring;
+    struct MultiUringAccept *next;
+
+    /**
+     * The listener, NULL = it has been closed
+     */
+    Multisocket *sock;
+
+    /**
+     * Is the multishot accept still armed?
+     */
+    int armed;
+
+    /**
+     * Flags the connections were accepted with
+     */
+    int flags;
+
+    /**
+     * Accepted filedescriptors
+     */
+    int *fds;
+    int fdsLen;
+    int fdsCap;
+
+    /**
+     * Ids of the tasks waiting for a connection
+     */
+    lua_Integer *waiters;
+    int waitersLen;
+    int waitersCap;
+} MultiUringAccept;
+
+/**
+ * A pending operation of a task
+ */
+typedef struct {
+    lua_Integer id;
+    Multisocket *sock;
+    int type;
+
+    /**
+     * Index of the next free slot, if the slot is free
+     */
+    int next;
+} MultiUringOp;
+
+/**
+ * An io_uring with its mapped rings and provided buffers
+ */
+typedef struct MultiUring {
+    int fd;
+
+    void *sqPtr;
+    size_t sqSize;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned sqEntries;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+
+    void *cqPtr;
+    size_t cqSize;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    struct io_uring_cqe *cqes;
+
+    /**
+     * Number of entries which have been queued but not submitted yet
+     */
+    unsigned queued;
+
+    /**
+     * Ring of provided buffers, NULL if the kernel does not support it
+     */
+    struct io_uring_buf_ring *bufRing;
+    size_t bufRingSize;
+    char *bufs;
+    unsigned short bufTail;
+
+    /**
+     * Slots of the pending operations, user_data of their entries is the slot index shifted by one
+     */
+    MultiUringOp *ops;
+    int opsCap;
+    int opsFree;
+
+    /**
+     * Accept queues of the listeners, user_data of their entries is the pointer with the lowest bit set
+     */
+    MultiUringAccept *accepts;
+} MultiUring;
+
+/**
+ * Give a buffer back to the kernel
+ * @param ring the io_uring
+ * @param bid id of the buffer
+ */
+static void multi_uring_recycle(MultiUring *ring, unsigned short bid) {
+    struct io_uring_buf *buf = &ring->bufRing->bufs[ring->bufTail & (MULTISOCKET_URING_BUFFERS - 1)];
+    buf->addr = (unsigned long) (ring->bufs + (size_t) bid * MULTISOCKET_URING_BUFFER_SIZE);
+    buf->len = MULTISOCKET_URING_BUFFER_SIZE;
+    buf->bid = bid;
+    ring->bufTail++;
+    __atomic_store_n(&ring->bufRing->tail, ring->bufTail, __ATOMIC_RELEASE);
+}
+
+/**
+ * Release an io_uring and everything it has mapped
+ * The accept queues lose their listeners, queued connections are closed.
+ * @param ring the io_uring
+ */
+static void multi_uring_free(MultiUring *ring) {
+    if (ring->fd != -1) {
+        close(ring->fd);
+    }
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqesSize);
+    }
+    if (ring->cqPtr != NULL && ring->cqPtr != MAP_FAILED && ring->cqPtr != ring->sqPtr) {
+        munmap(ring->cqPtr, ring->cqSize);
+    }
+    if (ring->sqPtr != NULL && ring->sqPtr != MAP_FAILED) {
+        munmap(ring->sqPtr, ring->sqSize);
+    }
+    if (ring->bufRing != NULL) {
+        munmap(ring->bufRing, ring->bufRingSize);
+    }
+    free(ring->bufs);
+    free(ring->ops);
+
+    MultiUringAccept *acc = ring->accepts;
+    while (acc != NULL) {
+        MultiUringAccept *next = acc->next;
+        if (acc->sock != NULL) {
+            acc->sock->accepted = NULL;
+        }
+        for (int i = 0; i < acc->fdsLen; i++) {
+            close(acc->fds[i]);
+        }
+        free(acc->fds);
+        free(acc->waiters);
+        free(acc);
+        acc = next;
+    }
+    free(ring);
+}
+
+/**
+ * Create an io_uring with a ring of provided buffers
+ * @return the io_uring, NULL = error (see errno)
+ */
+static MultiUring *multi_uring_new() {
+    MultiUring *ring = (MultiUring *) calloc(1, sizeof(MultiUring));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->opsFree = -1;
+
+    struct io_uring_params params;
+    bzero(&params, sizeof(params));
+    ring->fd = (int) syscall(__NR_io_uring_setup, MULTISOCKET_URING_ENTRIES, &params);
+    if (ring->fd == -1) {
+        int err = errno;
+        multi_uring_free(ring);
+        errno = err;
+        return NULL;
+    }
+    fcntl(ring->fd, F_SETFD, FD_CLOEXEC);
+
+    ring->sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sqSize = (ring->cqSize > ring->sqSize) ? ring->cqSize : ring->sqSize;
+    }
+    ring->sqPtr = mmap(NULL, ring->sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sqPtr == MAP_FAILED) {
+        int err = errno;
+        multi_uring_free(ring);
+        errno = err;
+        return NULL;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cqPtr = ring->sqPtr;
+    } else {
+        ring->cqPtr = mmap(NULL, ring->cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    }
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->cqPtr == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        int err = errno;
+        multi_uring_free(ring);
+        errno = err;
+        return NULL;
+    }
+
+    char *sq = (char *) ring->sqPtr;
+    ring->sqHead = (unsigned *) (sq + params.sq_off.head);
+    ring->sqTail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sqMask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned *) (sq + params.sq_off.array);
+    ring->sqEntries = params.sq_entries;
+
+    char *cq = (char *) ring->cqPtr;
+    ring->cqHead = (unsigned *) (cq + params.cq_off.head);
+    ring->cqTail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cqMask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    // Provided buffers need Linux 5.19, without them receives wait for readiness with a poll
+    ring->bufRingSize = MULTISOCKET_URING_BUFFERS * sizeof(struct io_uring_buf);
+    void *bufRing = mmap(NULL, ring->bufRingSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    ring->bufs = (char *) malloc((size_t) MULTISOCKET_URING_BUFFERS * MULTISOCKET_URING_BUFFER_SIZE);
+    if (bufRing != MAP_FAILED && ring->bufs != NULL) {
+        struct io_uring_buf_reg reg;
+        bzero(&reg, sizeof(reg));
+        reg.ring_addr = (unsigned long) bufRing;
+        reg.ring_entries = MULTISOCKET_URING_BUFFERS;
+        reg.bgid = 0;
+        if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == 0) {
+            ring->bufRing = (struct io_uring_buf_ring *) bufRing;
+            for (unsigned short bid = 0; bid < MULTISOCKET_URING_BUFFERS; bid++) {
+                multi_uring_recycle(ring, bid);
+            }
+        }
+    }
+    if (ring->bufRing == NULL) {
+        if (bufRing != MAP_FAILED) {
+            munmap(bufRing, ring->bufRingSize);
+        }
+        free(ring->bufs);
+        ring->bufs = NULL;
+    }
+
+    return ring;
+}
+
+/**
+ * Submit the queued entries and wait for completions
+ * @param ring the io_uring
+ * @param timeout maximum time to wait for a completion in milliseconds, -1 = unlimited, 0 = do not wait
+ * @return 0 = success, -1 = error (see errno)
+ */
+static int multi_uring_enter(MultiUring *ring, int timeout) {
+    unsigned flags = (timeout != 0) ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    void *argp = NULL;
+    size_t argSize = 0;
+    if (timeout > 0) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (long long) (timeout % 1000) * 1000000;
+        bzero(&arg, sizeof(arg));
+        arg.ts = (unsigned long) &ts;
+        argp = &arg;
+        argSize = sizeof(arg);
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+
+    long ret = syscall(__NR_io_uring_enter, ring->fd, ring->queued, (timeout != 0) ? 1 : 0, flags, argp, argSize);
+    if (ret == -1) {
+        // A timeout or a signal only end the wait, the entries have been submitted
+        if (errno == ETIME || errno == EINTR) {
+            ring->queued = 0;
+            return 0;
+        }
+        return -1;
+    }
+    ring->queued -= ((unsigned) ret < ring->queued) ? (unsigned) ret : ring->queued;
+    return 0;
+}
+
+/**
+ * Get the next free submission queue entry
+ * Submits the queued entries first if the queue is full
+ * @param ring the io_uring
+ * @return the entry, NULL = error (see errno)
+ */
+static struct io_uring_sqe *multi_uring_sqe(MultiUring *ring) {
+    unsigned tail = *ring->sqTail;
+    if (tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) >= ring->sqEntries) {
+        if (multi_uring_enter(ring, 0) != 0) {
+            return NULL;
+        }
+        if (tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) >= ring->sqEntries) {
+            errno = EBUSY;
+            return NULL;
+        }
+    }
+    unsigned index = tail & *ring->sqMask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    bzero(sqe, sizeof(struct io_uring_sqe));
+    ring->sqArray[index] = index;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+    return sqe;
+}
+
+/**
+ * Take a slot for a pending operation
+ * @param ring the io_uring
+ * @return index of the slot, -1 = out of memory
+ */
+static int multi_uring_op(MultiUring *ring, lua_Integer id, Multisocket *sock, int type) {
+    if (ring->opsFree == -1) {
+        int cap = (ring->opsCap == 0) ? 64 : ring->opsCap * 2;
+        MultiUringOp *ops = realloc(ring->ops, cap * sizeof(MultiUringOp));
+        if (ops == NULL) {
+            return -1;
+        }
+        for (int i = ring->opsCap; i < cap; i++) {
+            ops[i].next = (i + 1 < cap) ? i + 1 : -1;
+        }
+        ring->ops = ops;
+        ring->opsFree = ring->opsCap;
+        ring->opsCap = cap;
+    }
+    int slot = ring->opsFree;
+    ring->opsFree = ring->ops[slot].next;
+    ring->ops[slot].id = id;
+    ring->ops[slot].sock = sock;
+    ring->ops[slot].type = type;
+    return slot;
+}
+
+/**
+ * Detach an accept queue from its listener and cancel its multishot accept
+ * The cancellation is submitted at once, the io_uring might not be waited on anymore.
+ * @param acc the accept queue
+ */
+static void multi_uring_accept_detach(MultiUringAccept *acc) {
+    acc->sock->accepted = NULL;
+    acc->sock = NULL;
+    if (acc->armed) {
+        struct io_uring_sqe *sqe = multi_uring_sqe(acc->ring);
+        if (sqe != NULL) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = (unsigned long) acc | 1;
+            multi_uring_enter(acc->ring, 0);
+        }
+    }
+}
+
+/**
+ * Get the accept queue of a listener, create it if necessary
+ * A listener used by another io_uring before moves its queued connections to the new queue.
+ * @param ring the io_uring
+ * @param sock the listener
+ * @return the accept queue, NULL = out of memory
+ */
+static MultiUringAccept *multi_uring_accept_queue(MultiUring *ring, Multisocket *sock) {
+    MultiUringAccept *old = sock->accepted;
+    if (old != NULL && old->ring == ring) {
+        return old;
+    }
+    MultiUringAccept *acc = (MultiUringAccept *) calloc(1, sizeof(MultiUringAccept));
+    if (acc == NULL) {
+        return NULL;
+    }
+    if (old != NULL) {
+        acc->fds = old->fds;
+        acc->fdsLen = old->fdsLen;
+        acc->fdsCap = old->fdsCap;
+        acc->flags = old->flags;
+        old->fds = NULL;
+        old->fdsLen = 0;
+        old->fdsCap = 0;
+        multi_uring_accept_detach(old);
+    }
+    acc->ring = ring;
+    acc->sock = sock;
+    acc->next = ring->accepts;
+    ring->accepts = acc;
+    sock->accepted = acc;
+    return acc;
+}
+
+/**
+ * Take a connection accepted by the multishot accept of a listener
+ * @param sock the listener
+ * @param flags SOCK_NONBLOCK / SOCK_CLOEXEC the connection should have
+ * @return the filedescriptor, -1 = no connection is queued
+ */
+static int multi_uring_accept_take(Multisocket *sock, int flags) {
+    MultiUringAccept *acc = sock->accepted;
+    if (acc == NULL || acc->fdsLen == 0) {
+        return -1;
+    }
+    int desc = acc->fds[0];
+    acc->fdsLen--;
+    memmove(acc->fds, acc->fds + 1, acc->fdsLen * sizeof(int));
+    if ((flags & SOCK_NONBLOCK) != (acc->flags & SOCK_NONBLOCK)) {
+        int fl = fcntl(desc, F_GETFL, 0);
+        fcntl(desc, F_SETFL, (flags & SOCK_NONBLOCK) ? fl | O_NONBLOCK : fl & ~O_NONBLOCK);
+    }
+    if (!(flags & SOCK_CLOEXEC)) {
+        fcntl(desc, F_SETFD, 0);
+    }
+    return desc;
+}
+
+/**
+ * Forget the accept queue of a closed listener
+ * Queued connections are closed and the multishot accept is cancelled
+ * @param sock the listener
+ */
+static void multi_uring_accept_forget(Multisocket *sock) {
+    MultiUringAccept *acc = sock->accepted;
+    if (acc == NULL) {
+        return;
+    }
+    for (int i = 0; i < acc->fdsLen; i++) {
+        close(acc->fds[i]);
+    }
+    acc->fdsLen = 0;
+    multi_uring_accept_detach(acc);
+}
@@ -0,0 +1,108 @@
+#!/usr/bin/lua5.3
+
+--[[
+Throughput of the scheduler backends
+Every connection sends a message and waits for the echo, so each round trip is one receive per side.
+The blocking variant runs the same round trips one connection after another without a scheduler.
+
+lua5.3 test/benchBackend.lua [connections] [rounds] [size]
+]]
+
+local multisocket = require("multisocket")
+
+local connections = tonumber(arg[1]) or 64
+local rounds = tonumber(arg[2]) or 1000
+local size = tonumber(arg[3]) or 64
+local message = string.rep("x", size - 1) .. "\n"
+
+local function listen()
+    local listener = assert(multisocket.tcp4())
+    assert(listener:bind("127.0.0.1", 0))
+    assert(listener:listen(connections))
+    return listener
+end
+
+local function blocking()
+    local listener = listen()
+    local conns = {}
+    for i = 1, connections do
+        local client = assert(multisocket.open("127.0.0.1", listener:getSocketPort(), false))
+        conns[i] = {client, assert(listener:accept())}
+    end
+    local start = multisocket.time()
+    for _, pair in ipairs(conns) do
+        local client, server = pair[1], pair[2]
+        for _ = 1, rounds do
+            client:send(message)
+            server:send(server:receive("\n"), "\n")
+            client:receive("\n")
+        end
+    end
+    local time = multisocket.time() - start
+    for _, pair in ipairs(conns) do
+        pair[1]:close()
+        pair[2]:close()
+    end
+    listener:close()
+    return time
+end
+
+local function scheduled(backend)
+    local scheduler, err = multisocket.scheduler(backend)
+    if not scheduler then
+        return nil, err
+    end
+    local listener = listen()
+    listener:setBlocking(false)
+    local port = listener:getSocketPort()
+
+    scheduler:spawn(function()
+        for _ = 1, connections do
+            local server = assert(listener:accept())
+            scheduler:spawn(function()
+                while true do
+                    local data = server:receive("\n")
+                    if not data then
+                        break
+                    end
+                    server:send(data, "\n")
+                end
+                server:close()
+            end)
+        end
+    end)
+
+    local start = multisocket.time()
+    for _ = 1, connections do
+        scheduler:spawn(function()
+            local client = assert(multisocket.tcp4())
+            client:setBlocking(false)
+            assert(client:connect("127.0.0.1", port))
+            for _ = 1, rounds do
+                client:send(message)
+                assert(client:receive("\n"))
+            end
+            client:close()
+        end)
+    end
+    assert(scheduler:run())
+    local time = multisocket.time() - start
+    listener:close()
+    scheduler:close()
+    return time
+end
+
+local total = connections * rounds
+local function report(name, time, err)
+    if not time then
+        print(string.format("%-10s unavailable: %s", name, err))
+    else
+        print(string.format("%-10s %8.3f s %10.0f round trips/s %8.2f MiB/s", name, time, total / time,
+                total * size * 2 / time / 1048576))
+    end
+end
+
+print(string.format("%d connections, %d round trips each, %d bytes per message", connections, rounds, size))
+report("blocking", blocking())
+report("epoll", scheduled("epoll"))
+report("io_uring", scheduled("io_uring"))
@@ -0,0 +1,98 @@
+/**
+ * Microbenchmark for the timestamp of the last connection signal
+ * Runs the receive loop of multi_tcp_receive() (one recv() per chunk, then lastT is updated)
+ * with the old CLOCK_REALTIME call, with the coarse monotonic clock and with the time cached by the scheduler step.
+ *
+ * gcc -O2 -o benchClock test/benchClock.c && ./benchClock
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "../src/clock.h"
+
+#define BENCH_CALLS 10000000
+#define BENCH_CHUNKS 500000
+#define BENCH_ROUNDS 5
+#define BENCH_CHUNK_SIZE 64
+
+/**
+ * The clock of the old getcurrenttime()
+ */
+static long clock_old() {
+    struct timespec tv;
+    clock_gettime(CLOCK_REALTIME, &tv);
+    return tv.tv_sec * 1000000000 + tv.tv_nsec;
+}
+
+static long (*clocks[])() = {clock_old, multi_clock_monotonic, multi_clock_now, multi_clock_now};
+static const char *names[] = {"realtime (old)", "monotonic", "coarse", "cached"};
+
+static double bench_calls(int index) {
+    volatile long sink = 0;
+    double start = multi_clock_monotonic();
+    for (int i = 0; i < BENCH_CALLS; i++) {
+        sink += clocks[index]();
+    }
+    return (multi_clock_monotonic() - start) / BENCH_CALLS;
+}
+
+static volatile long lastT = 0;
+
+static double bench_receive(int index, int fds[2]) {
+    char chunk[BENCH_CHUNK_SIZE];
+    memset(chunk, 'x', sizeof(chunk));
+    double start = multi_clock_monotonic();
+    for (int i = 0; i < BENCH_CHUNKS; i++) {
+        send(fds[0], chunk, sizeof(chunk), 0);
+        if (recv(fds[1], chunk, sizeof(chunk), 0) > 0 && index >= 0) {
+            lastT = clocks[index]();
+        }
+    }
+    return (multi_clock_monotonic() - start) / BENCH_CHUNKS;
+}
+
+/**
+ * Select the clock, "cached" reads the time stored by the scheduler step, the others read a clock on every call
+ */
+static void bench_select(int index) {
+    if (index == 3) {
+        multi_clock_update();
+    } else {
+        multi_clock_reset();
+    }
+}
+
+int main() {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+        perror("socketpair");
+        return 1;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        bench_select(i);
+        printf("%-15s %6.1f ns/call\n", names[i], bench_calls(i));
+    }
+
+    // The syscalls dominate the loop, so the rounds are interleaved and the fastest one counts
+    double loops[5] = {1e9, 1e9, 1e9, 1e9, 1e9};
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        for (int i = -1; i < 4; i++) {
+            bench_select(i);
+            double loop = bench_receive(i, fds);
+            if (loop < loops[i + 1]) {
+                loops[i + 1] = loop;
+            }
+        }
+    }
+    printf("\nreceive loop, %d byte chunks\n", BENCH_CHUNK_SIZE);
+    printf("%-15s %8.1f ns/chunk\n", "no timestamp", loops[0]);
+    for (int i = 0; i < 4; i++) {
+        printf("%-15s %8.1f ns/chunk %+6.1f ns/chunk\n", names[i], loops[i + 1], loops[i + 1] - loops[0]);
+    }
+    return 0;
+}
@@ -0,0 +1,110 @@
+/**
+ * Microbenchmark for the delimiter search of receive("until")
+ * Compares the search kernels in src/search.h with the memchr/memcmp loop
+ * which was used by multi_tcp_receive() before.
+ *
+ * gcc -O2 -o benchSearch test/benchSearch.c && ./benchSearch
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/search.h"
+
+#define BENCH_SIZE (1 << 20)
+#define BENCH_ROUNDS 200
+
+/**
+ * The search loop of the old multi_tcp_receive(), with the out-of-bounds start fixed
+ */
+static long search_old(const char *data, size_t size, const char *delim, size_t delimSize) {
+    const char *ptr = data;
+    const char *end = data + size;
+    while (ptr < end) {
+        ptr = memchr(ptr, delim[0], end - ptr);
+        if (ptr == NULL || (ptr + delimSize <= end && memcmp(ptr, delim, delimSize) == 0)) {
+            break;
+        }
+        ptr++;
+    }
+    return (ptr == NULL || ptr >= end || ptr + delimSize > end) ? -1 : ptr - data;
+}
+
+static double now() {
+    struct timespec tv;
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return tv.tv_sec + tv.tv_nsec / 1e9;
+}
+
+static int maxLevel = 0;
+
+static void bench(const char *name, const char *data, size_t size, const char *delim) {
+    size_t delimSize = strlen(delim);
+    long expected = search_old(data, size, delim, delimSize);
+
+    const char *names[] = {"old loop", "scalar", "sse2", "avx2"};
+    for (int kernel = 0; kernel < 4; kernel++) {
+        if (kernel - 1 > maxLevel) {
+            continue; // Not supported by this CPU
+        }
+        multi_search_level = (kernel == 0) ? 0 : kernel - 1;
+
+        long found = 0;
+        double start = now();
+        for (int i = 0; i < BENCH_ROUNDS; i++) {
+            found = (kernel == 0) ? search_old(data, size, delim, delimSize) : multi_search(data, size, delim, delimSize);
+        }
+        double time = now() - start;
+
+        printf("%-10s %-8s %8.2f GB/s %s\n", name, names[kernel],
+               (double) size * BENCH_ROUNDS / time / 1e9, (found == expected) ? "" : "MISMATCH");
+    }
+}
+
+int main() {
+    multi_search_init();
+    maxLevel = multi_search_level;
+
+    char *data = malloc(BENCH_SIZE);
+    const char *header = "Accept-Encoding: gzip, deflate, br\r\nCookie: session=0123456789abcdef; lang=en\r\n";
+    size_t headerSize = strlen(header);
+    for (size_t i = 0; i < BENCH_SIZE; i++) {
+        data[i] = header[i % headerSize];
+    }
+
+    const char *boundary = "\r\n------WebKitFormBoundary7MA4YWxkTrZu0gW";
+    memcpy(data + BENCH_SIZE - 4, "\r\n\r\n", 4);
+    bench("crlfcrlf", data, BENCH_SIZE, "\r\n\r\n");
+
+    memcpy(data + BENCH_SIZE - strlen(boundary), boundary, strlen(boundary));
+    bench("boundary", data, BENCH_SIZE, boundary);
+
+    // Random data and delimiters, every kernel has to agree with the old loop
+    srand(1);
+    int errors = 0;
+    for (int i = 0; i < 100000; i++) {
+        char hay[300];
+        char delim[40];
+        size_t size = (size_t) (rand() % 300);
+        size_t delimSize = (size_t) (rand() % 39) + 1;
+        for (size_t j = 0; j < size; j++) {
+            hay[j] = "ab\r\n"[rand() % 4];
+        }
+        for (size_t j = 0; j < delimSize; j++) {
+            delim[j] = "ab\r\n"[rand() % 4];
+        }
+        long expected = search_old(hay, size, delim, delimSize);
+        for (int level = 0; level <= maxLevel; level++) {
+            multi_search_level = level;
+            if (multi_search(hay, size, delim, delimSize) != expected) {
+                errors++;
+            }
+        }
+    }
+    printf("random check: %d errors\n", errors);
+
+    free(data);
+    return errors != 0;
+}
@@ -0,0 +1,71 @@
+#!/usr/bin/lua5.3
+
+--[[
+listener:acceptMany(max)
+Takes at most max pending connections with one call, the next call the rest. A non-blocking listener
+yields in a scheduler task until the first connection arrives and returns "want_read" outside of a task.
+
+lua5.3 test/testAccept.lua
+]]
+
+local multisocket = require("multisocket")
+
+local listener = assert(multisocket.tcp4())
+assert(listener:bind("127.0.0.1", 0))
+assert(listener:listen(16))
+local port = listener:getSocketPort()
+
+assert(listener:acceptMany(0) == nil, "max 0 accepted")
+
+-- Pending connections are taken in batches of at most max
+local clients = {}
+for i = 1, 10 do
+    clients[i] = assert(multisocket.tcp4())
+    assert(clients[i]:connect("127.0.0.1", port))
+    assert(clients[i]:send(i .. "\n"))
+end
+local first = assert(listener:acceptMany(4))
+assert(#first == 4, "first batch: " .. #first)
+local rest = assert(listener:acceptMany(100, true))
+assert(#rest == 6, "second batch: " .. #rest)
+
+local seen = {}
+for _, batch in ipairs({first, rest}) do
+    for _, sock in ipairs(batch) do
+        assert(sock:isBlocking() == (batch == first), "mode of the accepted connection")
+        sock:setBlocking(true)
+        local id = tonumber(sock:receive("\n"))
+        assert(id and not seen[id], "connection accepted twice or not at all")
+        seen[id] = true
+        sock:close()
+    end
+end
+for _, client in ipairs(clients) do
+    client:close()
+end
+
+-- Non-blocking listener
+listener:setBlocking(false)
+local ok, err = listener:acceptMany(8)
+assert(ok == nil and err == "want_read", "acceptMany() without pending connections: " .. tostring(err))
+
+local sched = assert(multisocket.scheduler())
+local accepted
+sched:spawn(function()
+    accepted = assert(listener:acceptMany(8))
+    for _, sock in ipairs(accepted) do
+        sock:close()
+    end
+end)
+sched:spawn(function()
+    local sock = assert(multisocket.tcp4())
+    sock:setBlocking(false)
+    assert(sock:connect("127.0.0.1", port))
+    sock:close()
+end)
+assert(sched:run())
+sched:close()
+assert(#accepted >= 1, "task got no connection")
+
+listener:close()
+print("ok")
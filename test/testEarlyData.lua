@@ -0,0 +1,51 @@
+#!/usr/bin/lua5.3
+
+--[[
+TLS 1.3 with ALPN and early data (0-RTT)
+The first connection does a full handshake and negotiates the protocol, the following ones resume the session
+and send their first line as early data, which the server accepts and answers like any other line.
+Uses the certificate created by make test.
+
+lua5.3 test/testEarlyData.lua
+]]
+
+local multisocket = require("multisocket")
+
+-- The certificate of make test (cert/new-fake-certificate.sh)
+local certfile, keyfile = "cert/cert.pem", "cert/privkey.pem"
+assert(io.open(certfile), "No certificate, run make test or cert/new-fake-certificate.sh in cert/")
+
+-- Tickets for early data are only valid at the context which issued them, so there is one worker
+local server = assert(multisocket.server({port = 0, address = "127.0.0.1", threads = 1, handler = [[
+local multisocket = require("multisocket")
+local ctx = assert(multisocket.tls.context({certfile = "]] .. certfile .. [[", keyfile = "]] .. keyfile .. [[",
+    alpn = {"h2", "http/1.1"}, earlyData = 16384}))
+
+return function(client)
+    if client:encrypt(ctx) then
+        local line = client:receive("\n")
+        client:send(table.concat({client:isSessionReused() and "resumed" or "full",
+            client:isEarlyDataAccepted() and "early" or "-", tostring(client:getAlpnProtocol()),
+            tostring(client:getTlsVersion()), tostring(line)}, " ") .. "\n")
+    end
+    client:close()
+end
+]]}))
+local port = server:getSocketPort()
+
+local ctx = assert(multisocket.tls.context({alpn = {"http/1.1"}}))
+for i = 1, 4 do
+    local sock = assert(multisocket.tcp4())
+    assert(sock:connect("127.0.0.1", port))
+    assert(sock:encrypt(ctx, "localhost", true))
+    assert(sock:send("hello " .. i .. "\n"))
+    local answer = assert(sock:receive("\n"))
+    local expected = ((i == 1) and "full -" or "resumed early") .. " http/1.1 TLSv1.3 hello " .. i
+    assert(answer == expected, "connection " .. i .. ": " .. answer)
+    assert(sock:isEarlyDataAccepted() == (i > 1), "connection " .. i .. ": client does not agree")
+    assert(sock:getAlpnProtocol() == "http/1.1")
+    sock:close()
+end
+
+server:close()
+print("ok")
@@ -0,0 +1,63 @@
+#!/usr/bin/lua5.3
+
+--[[
+TCP Fast Open
+The first connection gets a cookie from the listener unless the kernel still has one, the following ones
+send their request with the SYN, so both sides report isFastOpen(). The requests arrive either way,
+also with a server worker.
+Without Fast Open for clients and servers in net.ipv4.tcp_fastopen only the requests are checked.
+
+lua5.3 test/testFastOpen.lua
+]]
+
+local multisocket = require("multisocket")
+
+local file = io.open("/proc/sys/net/ipv4/tcp_fastopen")
+local mode = file and tonumber(file:read("l")) or 0
+if file then
+    file:close()
+end
+local enabled = (mode & 3) == 3
+
+local listener = assert(multisocket.tcp4())
+assert(listener:bind("127.0.0.1", 0))
+assert(listener:setOption("fastOpen", 16))
+assert(listener:listen(16))
+local port = listener:getSocketPort()
+
+for i = 1, 3 do
+    local client = assert(multisocket.open("127.0.0.1", port, false, true))
+    assert(client:send("hello " .. i .. "\n"))
+    local accepted = assert(listener:accept())
+    assert(accepted:receive("\n") == "hello " .. i)
+    assert(accepted:send("answer " .. i .. "\n"))
+    assert(client:receive("\n") == "answer " .. i)
+    -- The kernel keeps the cookie of an address, so the first connection may already use it
+    assert(client:isFastOpen() == accepted:isFastOpen(), "connection " .. i .. ": client and server do not agree")
+    if enabled and i > 1 then
+        assert(client:isFastOpen(), "connection " .. i .. ": Fast Open not used")
+    elseif not enabled then
+        assert(not client:isFastOpen(), "connection " .. i .. ": Fast Open used although it is disabled")
+    end
+    client:close()
+    accepted:close()
+end
+listener:close()
+
+-- The listeners of a server worker
+local server = assert(multisocket.server({port = 0, address = "127.0.0.1", threads = 1, fastOpen = 16, handler = [[
+return function(client)
+    client:send(tostring(client:isFastOpen()) .. " " .. client:receive("\n") .. "\n")
+    client:close()
+end
+]]}))
+for i = 1, 3 do
+    local client = assert(multisocket.open("127.0.0.1", server:getSocketPort(), false, true))
+    assert(client:send("hello\n"))
+    local answer = assert(client:receive("\n"))
+    assert(answer == "true hello" or (answer == "false hello" and not (enabled and i > 1)), "connection " .. i .. ": " .. answer)
+    client:close()
+end
+server:close()
+
+print(enabled and "ok" or "ok, no Fast Open")
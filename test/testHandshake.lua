@@ -0,0 +1,78 @@
+#!/usr/bin/lua5.3
+
+--[[
+Non-blocking TLS handshakes outside of a coroutine
+encrypt() of a non-blocking socket returns "want_read" instead of waiting for the server (unless it has already answered),
+a poller reports the socket once the server has answered and handshake() continues from there.
+Several handshakes are in flight at once.
+Uses the certificate created by make test.
+
+lua5.3 test/testHandshake.lua
+]]
+
+local multisocket = require("multisocket")
+
+-- The certificate of make test (cert/new-fake-certificate.sh)
+local certfile, keyfile = "cert/cert.pem", "cert/privkey.pem"
+assert(io.open(certfile), "No certificate, run make test or cert/new-fake-certificate.sh in cert/")
+
+local server = assert(multisocket.server({port = 0, address = "127.0.0.1", threads = 1, handler = [[
+local multisocket = require("multisocket")
+local ctx = assert(multisocket.tls.context({certfile = "]] .. certfile .. [[", keyfile = "]] .. keyfile .. [["}))
+
+return function(client)
+    if client:encrypt(ctx) then
+        client:send(client:receive("\n") .. "\n")
+    end
+    client:close()
+end
+]]}))
+local port = server:getSocketPort()
+
+local ctx = assert(multisocket.tls.context({}))
+local poller = assert(multisocket.poller())
+local pending, done = {}, {}
+for i = 1, 8 do
+    local sock = assert(multisocket.tcp4())
+    assert(sock:connect("127.0.0.1", port))
+    sock:setBlocking(false)
+    local ok, err = sock:encrypt(ctx, "localhost")
+    if ok then
+        -- The server was fast enough to answer before encrypt() gave up
+        done[#done + 1] = sock
+    else
+        assert(err == "want_read", "handshake did not wait for the server: " .. tostring(err))
+        assert(poller:add(sock, "r"))
+        pending[sock] = i
+    end
+end
+
+while next(pending) do
+    local readable, writable = assert(poller:wait(5))
+    assert(#readable + #writable > 0, "handshakes stalled")
+    for _, list in ipairs({readable, writable}) do
+        for _, sock in ipairs(list) do
+            local ok, err = sock:handshake()
+            if ok then
+                poller:remove(sock)
+                done[#done + 1] = sock
+                pending[sock] = nil
+            else
+                assert(err == "want_read" or err == "want_write", "handshake failed: " .. tostring(err))
+                assert(poller:modify(sock, (err == "want_read") and "r" or "w"))
+            end
+        end
+    end
+end
+
+for _, sock in ipairs(done) do
+    sock:setBlocking(true)
+    assert(sock:send("hello\n"))
+    assert(sock:receive("\n") == "hello")
+    sock:close()
+end
+assert(#done == 8)
+
+poller:close()
+server:close()
+print("ok")
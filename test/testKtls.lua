@@ -0,0 +1,73 @@
+#!/usr/bin/lua5.3
+
+--[[
+sendFile() over TLS with kernel TLS enabled
+With the tls module of the kernel the file is encrypted by the kernel, without it OpenSSL encrypts it
+in user space. Either way the client has to receive the whole file, with TLS 1.2 and TLS 1.3.
+Uses the certificate created by make test.
+
+lua5.3 test/testKtls.lua
+]]
+
+local multisocket = require("multisocket")
+
+-- The certificate of make test (cert/new-fake-certificate.sh)
+local certfile, keyfile = "cert/cert.pem", "cert/privkey.pem"
+assert(io.open(certfile), "No certificate, run make test or cert/new-fake-certificate.sh in cert/")
+
+-- A file which is not a multiple of the record size
+local block = {}
+for i = 0, 255 do
+    block[#block + 1] = string.char(i)
+end
+local content = string.rep(table.concat(block), 12000) .. "end"
+local path = os.tmpname()
+local file = assert(io.open(path, "wb"))
+file:write(content)
+file:close()
+
+for _, version in ipairs({"TLSv1.2", "TLSv1.3"}) do
+    local serverCtx = assert(multisocket.tls.context({certfile = certfile, keyfile = keyfile,
+        ktls = true, maxVersion = version}))
+    local clientCtx = assert(multisocket.tls.context({ktls = true}))
+    local sched = assert(multisocket.scheduler())
+    local listener = assert(multisocket.tcp4())
+    assert(listener:bind("127.0.0.1", 0))
+    assert(listener:listen(1))
+    listener:setBlocking(false)
+
+    local sent, received, kernel
+    sched:spawn(function()
+        local sock = assert(listener:accept())
+        assert(sock:encrypt(serverCtx))
+        kernel = sock:isKernelTls()
+        sent = assert(sock:sendFile(path))
+        sock:close()
+    end)
+    sched:spawn(function()
+        local sock = assert(multisocket.tcp4())
+        sock:setBlocking(false)
+        assert(sock:connect("127.0.0.1", listener:getSocketPort()))
+        assert(sock:encrypt(clientCtx, "localhost"))
+        local parts = {}
+        while true do
+            local data, err, part = sock:receive(65536)
+            parts[#parts + 1] = data or part
+            if not data then
+                assert(err == "closed", version .. ": " .. tostring(err))
+                break
+            end
+        end
+        received = table.concat(parts)
+        sock:close()
+    end)
+
+    assert(sched:run())
+    assert(sent == #content, version .. ": sendFile() returned " .. tostring(sent))
+    assert(received == content, version .. ": received " .. #received .. " bytes, corrupted or incomplete")
+    print(version .. ": ok" .. (kernel and ", kernel TLS" or ", no kernel TLS"))
+    listener:close()
+    sched:close()
+end
+
+os.remove(path)
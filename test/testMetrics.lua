@@ -0,0 +1,52 @@
+#!/usr/bin/lua5.3
+
+--[[
+Connection metrics of open() and of a server
+open() counts its connection and the connect latency, failed attempts and the listeners of the server workers
+are counted as closed, as are sockets released by the garbage collector,
+so the gauge of open connections is back at its start value after server:close().
+
+lua5.3 test/testMetrics.lua
+]]
+
+local multisocket = require("multisocket")
+
+local before = multisocket.getMetrics()
+
+local server = assert(multisocket.server({port = 0, address = "127.0.0.1", threads = 2, handler = [[
+return function(client)
+    client:send(client:receive("\n") .. "\n")
+    client:close()
+end
+]]}))
+
+local sock = assert(multisocket.open("127.0.0.1", server:getSocketPort(), false))
+local metrics = multisocket.getMetrics()
+assert(metrics.connections.connected == before.connections.connected + 1, "open() not counted as connected")
+assert(metrics.latency.connect.count == before.latency.connect.count + 1, "connect latency of open() not measured")
+assert(sock:send("hello\n"))
+assert(sock:receive("\n") == "hello")
+sock:close()
+
+-- A socket dropped without close() is released by the garbage collector
+local dropped = assert(multisocket.open("127.0.0.1", server:getSocketPort(), false))
+assert(dropped:send("bye\n"))
+assert(dropped:receive("\n") == "bye")
+dropped = nil
+collectgarbage()
+collectgarbage()
+
+-- Nobody listens on the port of a closed listener
+local unused = assert(multisocket.tcp4())
+assert(unused:bind("127.0.0.1", 0))
+local port = unused:getSocketPort()
+unused:close()
+assert(multisocket.open("127.0.0.1", port, false) == nil, "connected to a closed port")
+metrics = multisocket.getMetrics()
+assert(metrics.errors.other == before.errors.other + 1, "failed open() not counted as error")
+
+server:close()
+metrics = multisocket.getMetrics()
+assert(metrics.connections.open == before.connections.open,
+    "open connections: " .. metrics.connections.open .. ", before: " .. before.connections.open)
+print("ok")
@@ -0,0 +1,78 @@
+#!/usr/bin/lua5.3
+
+--[[
+TLS handshakes in the crypto threads
+Many scheduler tasks of a context with offload = true do their handshakes at once, every one of them has to succeed.
+A task which is dropped while a step of its handshake is queued must neither crash nor leave the step in the queue,
+even when its socket is dropped with it.
+Uses the certificate created by make test.
+
+lua5.3 test/testOffload.lua
+]]
+
+local multisocket = require("multisocket")
+
+-- The certificate of make test (cert/new-fake-certificate.sh)
+local certfile, keyfile = "cert/cert.pem", "cert/privkey.pem"
+assert(io.open(certfile), "No certificate, run make test or cert/new-fake-certificate.sh in cert/")
+
+local serverCtx = assert(multisocket.tls.context({certfile = certfile, keyfile = keyfile, offload = true}))
+local clientCtx = assert(multisocket.tls.context({offload = true}))
+local listener = assert(multisocket.tcp4())
+assert(listener:bind("127.0.0.1", 0))
+assert(listener:listen(128))
+listener:setBlocking(false)
+local port = listener:getSocketPort()
+
+local before = multisocket.getMetrics()
+local count, served, answered = 64, 0, 0
+local sched = assert(multisocket.scheduler())
+sched:spawn(function()
+    for _ = 1, count do
+        local client = assert(listener:accept())
+        sched:spawn(function()
+            assert(client:encrypt(serverCtx))
+            assert(client:send(client:receive("\n") .. "\n"))
+            served = served + 1
+            client:close()
+        end)
+    end
+end)
+for i = 1, count do
+    sched:spawn(function()
+        local sock = assert(multisocket.tcp4())
+        sock:setBlocking(false)
+        assert(sock:connect("127.0.0.1", port))
+        assert(sock:encrypt(clientCtx, "localhost"))
+        assert(sock:send("hello " .. i .. "\n"))
+        assert(sock:receive("\n") == "hello " .. i)
+        answered = answered + 1
+        sock:close()
+    end)
+end
+assert(sched:run())
+sched:close()
+assert(served == count and answered == count, "handshakes: " .. served .. " served, " .. answered .. " answered")
+local metrics = multisocket.getMetrics()
+assert(metrics.tls.offloaded > before.tls.offloaded, "no handshake step ran in the crypto threads")
+assert(metrics.tls.queued == 0, "steps left in the queue: " .. metrics.tls.queued)
+
+-- The server waits for the client hello, so the first step is queued and the task yields
+listener:setBlocking(true)
+local peer = assert(multisocket.tcp4())
+assert(peer:connect("127.0.0.1", port))
+local task = coroutine.create(function()
+    local sock = assert(listener:accept())
+    sock:setBlocking(false)
+    return sock:encrypt(serverCtx)
+end)
+assert(coroutine.resume(task))
+assert(coroutine.status(task) == "suspended", "handshake did not yield")
+task = nil
+collectgarbage()
+collectgarbage()
+assert(multisocket.getMetrics().tls.queued == 0, "dropped step left in the queue")
+peer:close()
+
+listener:close()
+print("ok")
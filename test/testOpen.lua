@@ -0,0 +1,44 @@
+#!/usr/bin/lua5.3
+
+--[[
+multisocket.open() against a server which does not speak TLS
+The handshake fails, the connection must be closed.
+
+lua5.3 test/testOpen.lua
+]]
+
+local multisocket = require("multisocket")
+
+-- Sockets can not be opened through /proc, but only missing descriptors fail with ENOENT
+local function openFds()
+    local count = 0
+    for fd = 0, 1023 do
+        local file, _, code = io.open("/proc/self/fd/" .. fd)
+        if file then
+            file:close()
+        end
+        if file or code ~= 2 then
+            count = count + 1
+        end
+    end
+    return count
+end
+
+local server = assert(multisocket.server({port = 0, address = "127.0.0.1", threads = 1, handler = [[
+return function(client)
+    client:send("HTTP/1.0 400 Bad Request\r\n\r\n")
+    client:close()
+end
+]]}))
+local port = server:getSocketPort()
+
+local before = openFds()
+for _ = 1, 8 do
+    local sock, err = multisocket.open("127.0.0.1", port, true)
+    assert(sock == nil and err, "handshake with a plain server succeeded")
+end
+collectgarbage()
+assert(openFds() == before, "failed handshakes leak connections")
+
+server:close()
+print("ok")
@@ -0,0 +1,60 @@
+#!/usr/bin/lua5.3
+
+--[[
+Socket options
+setOption() and getOption() of TCP and UDP sockets, and the defaults of setDefaultOption(),
+which new sockets, open() and accepted connections take until the default is removed again.
+
+lua5.3 test/testOptions.lua
+]]
+
+local multisocket = require("multisocket")
+
+local sock = assert(multisocket.tcp4())
+assert(sock:setOption("noDelay", true))
+assert(sock:getOption("noDelay") == true)
+assert(sock:setOption("noDelay", false))
+assert(sock:getOption("noDelay") == false)
+assert(sock:setOption("keepIdle", 30))
+assert(sock:getOption("keepIdle") == 30)
+assert(sock:setOption("sendBuffer", 65536))
+assert(sock:getOption("sendBuffer") >= 65536, "sendBuffer not set")
+assert(sock:setOption("noDelay", 1) == nil, "integer accepted for a boolean option")
+assert(sock:setOption("keepIdle", -1) == nil, "negative value accepted")
+local ok, err = sock:setOption("unknown", true)
+assert(ok == nil and err == "Unknown option unknown")
+sock:close()
+
+-- UDP sockets only know the options of the socket level
+local udp = assert(multisocket.udp4())
+assert(udp:setOption("receiveBuffer", 65536))
+assert(udp:getOption("receiveBuffer") >= 65536, "receiveBuffer not set")
+assert(udp:setOption("noDelay", true) == nil, "TCP option accepted by a UDP socket")
+udp:close()
+
+-- Defaults
+assert(multisocket.getDefaultOption("noDelay") == nil)
+assert(multisocket.setDefaultOption("noDelay", true))
+assert(multisocket.setDefaultOption("keepAlive", true))
+assert(multisocket.getDefaultOption("noDelay") == true)
+
+local listener = assert(multisocket.tcp4())
+assert(listener:bind("127.0.0.1", 0))
+assert(listener:listen(4))
+local client = assert(multisocket.open("127.0.0.1", listener:getSocketPort(), false))
+local accepted = assert(listener:accept())
+for _, s in ipairs({listener, client, accepted}) do
+    assert(s:getOption("noDelay") == true and s:getOption("keepAlive") == true, "default not applied")
+end
+client:close()
+accepted:close()
+
+assert(multisocket.setDefaultOption("noDelay", nil))
+assert(multisocket.setDefaultOption("keepAlive", nil))
+assert(multisocket.getDefaultOption("noDelay") == nil)
+sock = assert(multisocket.tcp4())
+assert(sock:getOption("noDelay") == false, "removed default still applied")
+sock:close()
+listener:close()
+
+print("ok")
@@ -0,0 +1,58 @@
+#!/usr/bin/lua5.3
+
+--[[
+Readiness of buffered data in the poller and in select()
+A partial line stays in the read-ahead buffer after receive("\n") has asked for more,
+it must not make the socket readable again until the rest of the line arrives.
+
+lua5.3 test/testPoller.lua
+]]
+
+local multisocket = require("multisocket")
+
+local listener = assert(multisocket.tcp4())
+assert(listener:bind("127.0.0.1", 0))
+assert(listener:listen(1))
+local client = assert(multisocket.open("127.0.0.1", listener:getSocketPort(), false))
+local server = assert(listener:accept())
+server:setBlocking(false)
+
+local poller = assert(multisocket.poller())
+assert(poller:add(server, "r"))
+
+-- Nothing received yet
+local readable = assert(poller:wait(0.05))
+assert(#readable == 0, "idle socket reported readable")
+
+-- Two lines and the start of a third in one segment
+assert(client:send("one\ntwo\nthr"))
+readable = assert(poller:wait(1))
+assert(#readable == 1 and readable[1] == server, "socket with data not reported")
+assert(server:receive("\n") == "one")
+
+-- The second line is buffered, the socket is ready without new data
+readable = assert(poller:wait(1))
+assert(#readable == 1, "buffered line not reported")
+assert(server:receive("\n") == "two")
+local data, err = server:receive("\n")
+assert(data == nil and err == "want_read", "partial line returned: " .. tostring(data) .. " " .. tostring(err))
+
+-- Only the partial line is left, so the poller and select() have to wait for the peer
+local start = multisocket.time()
+readable = assert(poller:wait(0.2))
+assert(#readable == 0, "partial line reported readable")
+assert(multisocket.time() - start >= 0.15, "poller did not block")
+readable = assert(multisocket.select({server}, {}, 0.1))
+assert(#readable == 0, "select() reported a partial line readable")
+
+-- The rest of the line makes it readable again
+assert(client:send("ee\n"))
+readable = assert(poller:wait(1))
+assert(#readable == 1, "completed line not reported")
+assert(server:receive("\n") == "three")
+
+poller:close()
+client:close()
+server:close()
+listener:close()
+print("ok")
@@ -0,0 +1,56 @@
+#!/usr/bin/lua5.3
+
+--[[
+Reuse of pooled connections and sockets closed by their user
+A connection given back is handed out again, a closed socket is rejected by put(),
+and an idle socket closed behind the back of the pool must neither be handed out nor close the connection
+which got its filedescriptor number.
+
+lua5.3 test/testPool.lua
+]]
+
+local multisocket = require("multisocket")
+
+local listener = assert(multisocket.tcp4())
+assert(listener:bind("127.0.0.1", 0))
+assert(listener:listen(8))
+local port = listener:getSocketPort()
+local pool = assert(multisocket.pool())
+
+-- Reuse
+local a = assert(pool:get("127.0.0.1", port))
+local peerA = assert(listener:accept())
+assert(pool:put(a) == true, "connection not pooled")
+assert(pool:get("127.0.0.1", port) == a, "idle connection not reused")
+local stats = pool:getStatistics()
+assert(stats.hits == 1 and stats.misses == 1, "hits " .. stats.hits .. ", misses " .. stats.misses)
+
+-- A closed socket can not be given back
+a:close()
+local pooled, err = pool:put(a)
+assert(pooled == nil and err == "Socket is closed", "closed socket accepted: " .. tostring(err))
+peerA:close()
+
+-- The filedescriptor of an idle socket closed by its user is reused by the next connection
+local b = assert(pool:get("127.0.0.1", port))
+local peerB = assert(listener:accept())
+assert(pool:put(b) == true)
+b:close()
+peerB:close()
+local c = assert(multisocket.open("127.0.0.1", port, false))
+local peerC = assert(listener:accept())
+
+local d = assert(pool:get("127.0.0.1", port))
+assert(d ~= b, "closed socket handed out again")
+local peerD = assert(listener:accept())
+
+-- The connection which got the filedescriptor still works
+assert(c:send("hello\n"))
+assert(peerC:receive("\n") == "hello", "connection closed by the pool")
+
+for _, sock in ipairs({c, d, peerC, peerD}) do
+    sock:close()
+end
+pool:close()
+listener:close()
+print("ok")
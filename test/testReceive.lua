@@ -0,0 +1,48 @@
+#!/usr/bin/lua5.3
+
+--[[
+receive(numBytes) with large lengths
+The read-ahead buffer grows with the data which arrives, so a length of several megabytes is received completely,
+and a length the peer never sends does not allocate memory for it, the data arrived so far is returned on close.
+
+lua5.3 test/testReceive.lua
+]]
+
+local multisocket = require("multisocket")
+
+local block = {}
+for i = 0, 255 do
+    block[#block + 1] = string.char(i)
+end
+local content = string.rep(table.concat(block), 12000) .. "end"
+
+local server = assert(multisocket.server({port = 0, address = "127.0.0.1", threads = 1, handler = [[
+return function(client)
+    local size = tonumber(client:receive("\n"))
+    local block = {}
+    for i = 0, 255 do
+        block[#block + 1] = string.char(i)
+    end
+    client:send((string.rep(table.concat(block), 12000) .. "end"):sub(1, size))
+    client:close()
+end
+]]}))
+local port = server:getSocketPort()
+
+local sock = assert(multisocket.open("127.0.0.1", port, false))
+assert(sock:send(#content .. "\n"))
+local data, err = sock:receive(#content)
+assert(data == content, "received " .. tostring(data and #data) .. " bytes: " .. tostring(err))
+sock:close()
+
+-- A length far beyond the data of the peer
+sock = assert(multisocket.open("127.0.0.1", port, false))
+assert(sock:send("5\n"))
+local part
+data, err, part = sock:receive(1 << 40)
+assert(data == nil and err == "closed", "receive() of a huge length: " .. tostring(err))
+assert(part == content:sub(1, 5))
+sock:close()
+
+server:close()
+print("ok")
@@ -0,0 +1,106 @@
+#!/usr/bin/lua5.3
+
+--[[
+Relay in both directions at once
+A server worker relays between the client and an upstream connection, both peers are tasks of this script.
+The client and the upstream send 8 MiB to each other at the same time, the upstream reads slowly,
+so the pipe of a -> b fills up while b -> a keeps the socket of b busy.
+Every byte has to arrive in order and relay() has to report both totals.
+
+lua5.3 test/testRelay.lua
+]]
+
+local multisocket = require("multisocket")
+
+local size = 8 * 1024 * 1024
+local chunk = 64 * 1024
+
+local function pattern(seed)
+    local block = {}
+    for i = 0, 255 do
+        block[#block + 1] = string.char((i * 7 + seed) % 256)
+    end
+    return string.rep(table.concat(block), chunk // 256)
+end
+
+local up = pattern(1)
+local down = pattern(2)
+
+local upstream = assert(multisocket.tcp4())
+assert(upstream:bind("127.0.0.1", 0))
+assert(upstream:listen(1))
+upstream:setBlocking(false)
+
+local server = assert(multisocket.server({port = 0, address = "127.0.0.1", threads = 1, handler = [[
+local multisocket = require("multisocket")
+local port = ]] .. upstream:getSocketPort() .. [[
+
+return function(client)
+    local target = assert(multisocket.open("127.0.0.1", port, false))
+    local ab, ba = multisocket.relay(client, target, {timeout = 5})
+    client:close()
+    target:close()
+    -- The totals are reported on a second connection to the upstream listener
+    local report = assert(multisocket.open("127.0.0.1", port, false))
+    report:send(tostring(ab) .. " " .. tostring(ba) .. "\n")
+    report:close()
+end
+]]}))
+
+local sched = assert(multisocket.scheduler())
+local received = {}
+
+-- Receive the whole stream in chunks and compare it with the pattern of the sender
+local function sink(sock, expected, name, delay)
+    local total = 0
+    while total < size do
+        local data, err = sock:receive(chunk)
+        assert(data, name .. ": " .. tostring(err) .. " after " .. total .. " bytes")
+        assert(data == expected, name .. ": corrupted data after " .. total .. " bytes")
+        total = total + #data
+        if delay then
+            sched:sleep(delay)
+        end
+    end
+    received[name] = total
+end
+
+-- Send the whole stream in a task of its own while the caller receives, then close the socket
+local function peer(sock, data, expected, name, delay)
+    sock:setTimeout(10)
+    local sent = false
+    sched:spawn(function()
+        for _ = 1, size // chunk do
+            assert(sock:send(data))
+        end
+        sent = true
+    end)
+    sink(sock, expected, name, delay)
+    while not sent do
+        sched:sleep(0.01)
+    end
+    sock:close()
+end
+
+local report
+sched:spawn(function()
+    local target = assert(upstream:accept())
+    peer(target, down, up, "a -> b", 0.001)
+    local conn = assert(upstream:accept())
+    report = conn:receive("\n")
+    conn:close()
+end)
+
+sched:spawn(function()
+    local client = assert(multisocket.tcp4())
+    client:setBlocking(false)
+    assert(client:connect("127.0.0.1", server:getSocketPort()))
+    peer(client, up, down, "b -> a")
+end)
+
+assert(sched:run())
+assert(received["a -> b"] == size, "a -> b incomplete")
+assert(received["b -> a"] == size, "b -> a incomplete")
+assert(report == size .. " " .. size, "relay() returned " .. tostring(report))
+server:close()
+print("ok")
@@ -0,0 +1,65 @@
+#!/usr/bin/lua5.3
+
+--[[
+Resolver cache and lookups of open() in a coroutine
+The second lookup of a name is a cache hit, clearResolverCache() drops it again.
+open() of a name which is not cached yields its task, the scheduler keeps running the other tasks meanwhile.
+Other coroutines wait for the lookup.
+
+lua5.3 test/testResolver.lua
+]]
+
+local multisocket = require("multisocket")
+
+multisocket.clearResolverCache()
+local before = multisocket.getResolverStatistics()
+assert(before.entries == 0, "cache not cleared")
+
+-- Numeric addresses are neither cached nor looked up
+assert(multisocket.resolve("127.0.0.1")[1] == "127.0.0.1")
+
+local first = assert(multisocket.resolve("localhost", 4))
+local second = assert(multisocket.resolve("localhost", 4))
+assert(first[1] == second[1], "cached answer differs")
+local stats = multisocket.getResolverStatistics()
+assert(stats.misses == before.misses + 1, "first lookup was no miss")
+assert(stats.hits == before.hits + 1, "second lookup was no hit")
+assert(stats.entries == 1, "answer not cached")
+
+multisocket.clearResolverCache()
+assert(multisocket.getResolverStatistics().entries == 0, "cache not cleared")
+
+local listener = assert(multisocket.tcp4())
+assert(listener:bind("127.0.0.1", 0))
+assert(listener:listen(1))
+
+local sched = assert(multisocket.scheduler())
+local client, yielded
+sched:spawn(function()
+    client = assert(multisocket.open("localhost", listener:getSocketPort(), false))
+end)
+sched:spawn(function()
+    yielded = (client == nil)
+end)
+assert(sched:run())
+assert(client, "open() failed")
+assert(yielded, "open() did not yield for the lookup")
+assert(multisocket.getResolverStatistics().misses == stats.misses + 1, "open() did not use the resolver")
+
+client:close()
+
+-- Coroutines which are no tasks wait for the lookup instead of yielding it to their caller
+multisocket.clearResolverCache()
+client = coroutine.wrap(function()
+    return multisocket.open("localhost", listener:getSocketPort(), false)
+end)()
+assert(getmetatable(client) == getmetatable(listener), "open() in a coroutine returned " .. tostring(client))
+client:close()
+multisocket.clearResolverCache()
+local addresses = coroutine.wrap(function()
+    return multisocket.resolve("localhost", 4)
+end)()
+assert(type(addresses) == "table" and addresses[1] == first[1], "resolve() in a coroutine returned " .. tostring(addresses))
+
+listener:close()
+print("ok")
@@ -0,0 +1,78 @@
+#!/usr/bin/lua5.3
+
+--[[
+A reader and a writer task waiting for the same socket
+The writer fills the socket until it blocks while the reader waits for a line from the peer,
+both of them have to be woken up on their own, and the deadline of the reader must not end the wait of the writer.
+Runs with every available backend.
+
+lua5.3 test/testScheduler.lua
+]]
+
+local multisocket = require("multisocket")
+
+local size = 4 * 1024 * 1024
+
+local function run(backend)
+    local sched = multisocket.scheduler(backend)
+    if not sched then
+        print(backend .. ": not available")
+        return
+    end
+
+    local listener = assert(multisocket.tcp4())
+    assert(listener:bind("127.0.0.1", 0))
+    assert(listener:listen(1))
+    listener:setBlocking(false)
+
+    local line, written, drained, timedOut
+
+    sched:spawn(function()
+        local sock = assert(listener:accept())
+
+        -- The writer blocks first, as the peer does not read yet
+        sched:spawn(function()
+            assert(sock:send(string.rep("x", size)))
+            written = true
+        end)
+
+        -- A read with a deadline gives up while the writer keeps waiting
+        sched:sleep(0.01)
+        sock:setTimeout(0.05)
+        local data, err = sock:receive("\n")
+        timedOut = (data == nil and err == "timeout")
+        sock:setTimeout(0)
+
+        line = assert(sock:receive("\n"))
+        while not written do
+            sched:sleep(0.01)
+        end
+        sock:close()
+    end)
+
+    sched:spawn(function()
+        local peer = assert(multisocket.tcp4())
+        peer:setBlocking(false)
+        assert(peer:connect("127.0.0.1", listener:getSocketPort()))
+        sched:sleep(0.1)
+        assert(peer:send("hello\n"))
+        local total = 0
+        while total < size do
+            total = total + #assert(peer:receive(64 * 1024))
+        end
+        drained = total
+        peer:close()
+    end)
+
+    assert(sched:run())
+    assert(line == "hello", backend .. ": reader got " .. tostring(line))
+    assert(written, backend .. ": writer did not finish")
+    assert(drained == size, backend .. ": peer received " .. tostring(drained))
+    assert(timedOut, backend .. ": deadline did not expire")
+    sched:close()
+    listener:close()
+    print(backend .. ": ok")
+end
+
+run("epoll")
+run("io_uring")
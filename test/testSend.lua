@@ -0,0 +1,78 @@
+#!/usr/bin/lua5.3
+
+--[[
+send() of several strings or a table of strings
+The pieces arrive in order and complete, also when there are more of them than one writev() takes
+and when a non-blocking send() has to wait for the peer in between. Over TLS small pieces are packed
+into records, large ones are sent as they are.
+Uses the certificate created by make test.
+
+lua5.3 test/testSend.lua
+]]
+
+local multisocket = require("multisocket")
+
+-- The certificate of make test (cert/new-fake-certificate.sh)
+local certfile, keyfile = "cert/cert.pem", "cert/privkey.pem"
+assert(io.open(certfile), "No certificate, run make test or cert/new-fake-certificate.sh in cert/")
+
+local listener = assert(multisocket.tcp4())
+assert(listener:bind("127.0.0.1", 0))
+assert(listener:listen(8))
+local port = listener:getSocketPort()
+
+-- Blocking sockets
+local client = assert(multisocket.tcp4())
+assert(client:connect("127.0.0.1", port))
+local peer = assert(listener:accept())
+assert(client:send("a", "b", "c") == 3)
+assert(client:send({"de", "", "fg"}) == 4)
+assert(client:send("h", 1) == 2)
+local ok, err, part = client:send({"x", {}})
+assert(ok == nil and err and part == 0, "table with a non-string piece accepted")
+assert(peer:receive(9) == "abcdefgh1")
+
+-- More pieces than one writev() call takes
+local pieces = {}
+for i = 1, 1000 do
+    pieces[i] = "piece " .. i .. ";"
+end
+local expected = table.concat(pieces)
+assert(client:send(pieces) == #expected)
+assert(peer:receive(#expected) == expected)
+client:close()
+peer:close()
+
+-- Non-blocking sockets over TLS, the large piece does not fit into the socket buffers
+local serverCtx = assert(multisocket.tls.context({certfile = certfile, keyfile = keyfile}))
+local clientCtx = assert(multisocket.tls.context({}))
+table.insert(pieces, 500, string.rep("large", 400000))
+expected = table.concat(pieces) .. table.concat(pieces, "", 1, 200)
+listener:setBlocking(false)
+local sched = assert(multisocket.scheduler())
+local sent, received
+sched:spawn(function()
+    local sock = assert(listener:accept())
+    assert(sock:encrypt(serverCtx))
+    received = assert(sock:receive(#expected))
+    assert(sock:send("done\n"))
+    sock:close()
+end)
+sched:spawn(function()
+    local sock = assert(multisocket.tcp4())
+    sock:setBlocking(false)
+    assert(sock:connect("127.0.0.1", port))
+    assert(sock:encrypt(clientCtx, "localhost"))
+    sent = assert(sock:send(pieces))
+    sent = sent + assert(sock:send(table.unpack(pieces, 1, 200)))
+    -- Closing with unread session tickets would reset the connection
+    assert(sock:receive("\n") == "done")
+    sock:close()
+end)
+assert(sched:run())
+sched:close()
+assert(sent == #expected, "send() returned " .. tostring(sent))
+assert(received == expected, "corrupted or incomplete data")
+
+listener:close()
+print("ok")
@@ -0,0 +1,45 @@
+#!/usr/bin/lua5.3
+
+--[[
+Handlers of multisocket.server() which raise errors
+The worker closes the connection of a failed handler, so the client sees "closed" at once, and keeps serving
+the following connections however many handlers have failed. The errors are printed to stderr.
+
+lua5.3 test/testServer.lua
+]]
+
+local multisocket = require("multisocket")
+
+local before = multisocket.getMetrics()
+
+local server = assert(multisocket.server({port = 0, address = "127.0.0.1", threads = 1, handler = [[
+return function(client)
+    local line = client:receive("\n")
+    if line ~= "echo" then
+        error("handler failed on purpose")
+    end
+    client:send(line .. "\n")
+    client:close()
+end
+]]}))
+local port = server:getSocketPort()
+
+for i = 1, 50 do
+    local sock = assert(multisocket.open("127.0.0.1", port, false))
+    sock:setTimeout(5)
+    assert(sock:send("fail\n"))
+    local data, err = sock:receive("\n")
+    assert(data == nil and err == "closed", "connection " .. i .. " of a failed handler: " .. tostring(err))
+    sock:close()
+end
+
+local sock = assert(multisocket.open("127.0.0.1", port, false))
+assert(sock:send("echo\n"))
+assert(sock:receive("\n") == "echo", "worker stopped serving after the failed handlers")
+sock:close()
+
+server:close()
+local metrics = multisocket.getMetrics()
+assert(metrics.connections.open == before.connections.open,
+    "open connections: " .. metrics.connections.open .. ", before: " .. before.connections.open)
+print("ok")
@@ -0,0 +1,66 @@
+#!/usr/bin/lua5.3
+
+--[[
+Timers of the scheduler
+Sleeping tasks wake up in the order of their deadlines, cancelled tasks never start,
+and the idle timeout and the timeout of a socket end a wait with "timeout" once they expire.
+
+lua5.3 test/testTimers.lua
+]]
+
+local multisocket = require("multisocket")
+
+local sched = assert(multisocket.scheduler())
+local order = {}
+
+for _, delay in ipairs({0.15, 0.05, 0.1}) do
+    sched:spawn(function()
+        sched:sleep(delay)
+        order[#order + 1] = delay
+    end)
+end
+local started = false
+local id = assert(sched:after(0.02, function()
+    started = true
+end))
+assert(sched:cancel(id) == true, "pending task not cancelled")
+
+local listener = assert(multisocket.tcp4())
+assert(listener:bind("127.0.0.1", 0))
+assert(listener:listen(2))
+listener:setBlocking(false)
+listener:setIdleTimeout(0.1)
+local client = assert(multisocket.tcp4())
+client:setBlocking(false)
+
+local idleErr, idleTime, timeoutErr, timeoutTime
+sched:spawn(function()
+    local sock = assert(listener:accept())
+
+    -- The idle timeout is inherited from the listener
+    local start = multisocket.time()
+    local data, err = sock:receive("\n")
+    idleErr, idleTime = err, multisocket.time() - start
+
+    -- A shorter timeout ends the wait first
+    sock:setIdleTimeout(0)
+    sock:setTimeout(0.05)
+    start = multisocket.time()
+    data, err = sock:receive("\n")
+    timeoutErr, timeoutTime = err, multisocket.time() - start
+    sock:close()
+end)
+sched:spawn(function()
+    assert(client:connect("127.0.0.1", listener:getSocketPort()))
+end)
+
+assert(sched:run())
+assert(#order == 3 and order[1] == 0.05 and order[2] == 0.1 and order[3] == 0.15, "tasks woke up out of order")
+assert(not started, "cancelled task started")
+assert(idleErr == "timeout" and idleTime >= 0.09 and idleTime < 1, "idle timeout: " .. tostring(idleErr) .. " after " .. idleTime)
+assert(timeoutErr == "timeout" and timeoutTime >= 0.04 and timeoutTime < 1, "timeout: " .. tostring(timeoutErr) .. " after " .. timeoutTime)
+
+client:close()
+listener:close()
+sched:close()
+print("ok")
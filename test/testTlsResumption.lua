@@ -0,0 +1,47 @@
+#!/usr/bin/lua5.3
+
+--[[
+Resumption of TLS sessions with TLS 1.2 and TLS 1.3
+Two server workers have a context of their own, but share the ticket keys of the process,
+so every connection after the first one resumes its session, whichever worker accepts it.
+Uses the certificate created by make test.
+
+lua5.3 test/testTlsResumption.lua
+]]
+
+local multisocket = require("multisocket")
+
+-- The certificate of make test (cert/new-fake-certificate.sh)
+local certfile, keyfile = "cert/cert.pem", "cert/privkey.pem"
+assert(io.open(certfile), "No certificate, run make test or cert/new-fake-certificate.sh in cert/")
+
+local server = assert(multisocket.server({port = 0, address = "127.0.0.1", threads = 2, handler = [[
+local multisocket = require("multisocket")
+local ctx = assert(multisocket.tls.context({certfile = "]] .. certfile .. [[", keyfile = "]] .. keyfile .. [["}))
+
+return function(client)
+    if client:encrypt(ctx) then
+        client:send(client:isSessionReused() and "resumed\n" or "full\n")
+    end
+    client:close()
+end
+]]}))
+local port = server:getSocketPort()
+
+for _, version in ipairs({"TLSv1.2", "TLSv1.3"}) do
+    local ctx = assert(multisocket.tls.context({maxVersion = version}))
+    for i = 1, 6 do
+        local sock = assert(multisocket.tcp4())
+        assert(sock:connect("127.0.0.1", port))
+        assert(sock:encrypt(ctx, "localhost"))
+        -- TLS 1.3 tickets arrive after the handshake, the client stores them while it reads
+        local handshake = assert(sock:receive("\n"))
+        local expected = (i == 1) and "full" or "resumed"
+        assert(handshake == expected, version .. " connection " .. i .. ": " .. handshake)
+        assert(sock:isSessionReused() == (i > 1), version .. " connection " .. i .. ": client does not agree")
+        sock:close()
+    end
+end
+
+server:close()
+print("ok")
@@ -0,0 +1,117 @@
+#!/usr/bin/lua5.3
+
+--[[
+UDP sockets
+Datagrams keep their boundaries, receiveMany(max) takes at most max of them per call, sendMany() sends more datagrams
+than one sendmmsg() takes to several destinations, and the segments of sendSegments() arrive as datagrams of their own,
+also when the receiver lets the kernel coalesce them with GRO. Non-blocking sockets yield in scheduler tasks.
+
+lua5.3 test/testUdp.lua
+]]
+
+local multisocket = require("multisocket")
+
+local function receiver()
+    local sock = assert(multisocket.udp4())
+    assert(sock:bind("127.0.0.1", 0))
+    sock:setTimeout(5)
+    return sock, sock:getSocketPort()
+end
+
+local sender = assert(multisocket.udp4())
+assert(sender:bind("127.0.0.1", 0))
+local senderPort = sender:getSocketPort()
+
+-- Datagram boundaries
+local sock, port = receiver()
+assert(sender:send("hello", "127.0.0.1", port) == 5)
+assert(sender:send("", "127.0.0.1", port) == 0)
+assert(sender:send("world", "127.0.0.1", port) == 5)
+local data, address, from = sock:receive()
+assert(data == "hello" and address == "127.0.0.1" and from == senderPort)
+assert(sock:receive() == "")
+assert(sock:receive(3) == "wor", "long datagram not truncated")
+sock:close()
+
+-- More datagrams than one sendmmsg() takes, to several receivers
+local receivers = {}
+for i = 1, 4 do
+    local s, p = receiver()
+    -- The default buffer holds about 256 small datagrams, the kernel doubles the value and caps it at rmem_max
+    assert(s:setOption("receiveBuffer", 1 << 20))
+    receivers[i] = {sock = s, port = p}
+end
+local datagrams = {}
+for i = 1, 1100 do
+    datagrams[i] = {data = "datagram " .. i, address = "127.0.0.1", port = receivers[(i - 1) % 4 + 1].port}
+end
+assert(sender:sendMany(datagrams) == 1100)
+
+-- One receiver has more datagrams than one receiveMany() takes
+for i, r in ipairs(receivers) do
+    local expected = i
+    local batches = 0
+    while expected <= 1100 do
+        local batch = assert(r.sock:receiveMany(100))
+        assert(#batch <= 100, "more datagrams than max")
+        for _, datagram in ipairs(batch) do
+            assert(datagram.data == "datagram " .. expected, "expected datagram " .. expected .. ", got " .. datagram.data)
+            assert(datagram.address == "127.0.0.1" and datagram.port == senderPort)
+            expected = expected + 4
+        end
+        batches = batches + 1
+    end
+    assert(batches >= 3, "275 datagrams in " .. batches .. " batches")
+    r.sock:close()
+end
+
+-- Segments, with and without GRO at the receiver
+for _, gro in ipairs({false, true}) do
+    sock, port = receiver()
+    assert(sock:setGro(gro))
+    local segments = {}
+    for i = 1, 10 do
+        segments[i] = string.rep(string.char(64 + i), 1000)
+    end
+    segments[11] = "last"
+    local payload = table.concat(segments)
+    assert(sender:sendSegments(payload, 1000, "127.0.0.1", port) == #payload)
+    local received = {}
+    while #received < #segments do
+        for _, datagram in ipairs(assert(sock:receiveMany(16))) do
+            received[#received + 1] = datagram.data
+        end
+    end
+    assert(#received == #segments, "GRO " .. tostring(gro) .. ": " .. #received .. " datagrams")
+    for i = 1, #segments do
+        assert(received[i] == segments[i], "GRO " .. tostring(gro) .. ": segment " .. i .. " differs")
+    end
+    sock:close()
+end
+
+-- Non-blocking sockets
+sock, port = receiver()
+sock:setBlocking(false)
+local ok, err = sock:receive()
+assert(ok == nil and err == "want_read", "receive() without a datagram: " .. tostring(err))
+
+local sched = assert(multisocket.scheduler())
+local single, batch
+sched:spawn(function()
+    single = assert(sock:receive())
+    batch = assert(sock:receiveMany(8))
+end)
+sched:spawn(function()
+    sched:sleep(0.05)
+    assert(sender:send("first", "127.0.0.1", port))
+    sched:sleep(0.05)
+    assert(sender:sendMany({"second", "third"}, "127.0.0.1", port) == 2)
+end)
+assert(sched:run())
+sched:close()
+assert(single == "first")
+assert(#batch >= 1 and batch[1].data == "second")
+sock:close()
+
+sender:close()
+print("ok")